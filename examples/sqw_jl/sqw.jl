@@ -111,6 +111,14 @@ function TakinSqw(h::Float64, k::Float64, l::Float64, E::Float64)::Float64
 end
 
 
+#
+# called for a whole batch of Monte-Carlo points (optional)
+#
+function TakinSqwBatch(h::Array{Float64}, k::Array{Float64}, l::Array{Float64}, E::Array{Float64})::Array{Float64}
+	return map(TakinSqw, h, k, l, E)
+end
+
+
 
 # -----------------------------------------------------------------------------
 # test
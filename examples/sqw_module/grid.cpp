@@ -16,12 +16,47 @@
 #include "tlibs/file/prop.h"
 
 #include <boost/dll/alias.hpp>
-#include <QFile>
 
 
 using t_real = typename SqwMod::t_real;
 
 
+// ----------------------------------------------------------------------------
+// mapped files
+
+GridMappedFile::GridMappedFile(const std::string& strFile) : file(strFile.c_str())
+{
+	if(!file.exists())
+	{
+		tl::log_err("File \"", strFile, "\" does not exist.");
+		return;
+	}
+
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		tl::log_err("File \"", strFile, "\" cannot be opened.");
+		return;
+	}
+
+	// map the whole file for the lifetime of the object
+	iSize = std::size_t(file.size());
+	pMem = file.map(0, file.size());
+	if(!pMem)
+	{
+		tl::log_err("File \"", strFile, "\" cannot be mapped.");
+		iSize = 0;
+	}
+}
+
+
+GridMappedFile::~GridMappedFile()
+{
+	if(pMem)
+		file.unmap(const_cast<unsigned char*>(pMem));
+	file.close();
+}
+
+
 // ----------------------------------------------------------------------------
 // constructors
 
@@ -51,7 +86,10 @@ SqwMod::SqwMod(const std::string& strCfgFile) : SqwMod()
 		m_lmax = prop.QueryAndParse<t_real>("dims/lmax");
 		m_lstep = prop.QueryAndParse<t_real>("dims/lstep");
 
-		SqwBase::m_bOk = 1;
+		m_pIdx = std::make_shared<GridMappedFile>(m_strIndexFile);
+		m_pDat = std::make_shared<GridMappedFile>(m_strDataFile);
+
+		SqwBase::m_bOk = (m_pIdx->pMem && m_pDat->pMem);
 	}
 	else
 	{
@@ -104,75 +142,49 @@ std::tuple<std::vector<t_real>, std::vector<t_real>>
 	};
 
 
-	// ------------------------------------------------------------------------
-	// the index file holds the offsets into the data file
-	std::size_t idx_file_offs = hkl_to_idx(dh, dk, dl);
-
-	QFile fileIdx(m_strIndexFile.c_str());
-	if(!fileIdx.exists())
-	{
-		tl::log_err("Index file \"", m_strIndexFile, "\" does not exist.");
+	if(!m_pIdx || !m_pIdx->pMem || !m_pDat || !m_pDat->pMem)
 		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
-	}
 
-	if(!fileIdx.open(QIODevice::ReadOnly))
-	{
-		tl::log_err("Index file \"", m_strIndexFile, "\" cannot be opened.");
-		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
-	}
 
-	const void *pMemIdx = fileIdx.map(idx_file_offs*sizeof(std::size_t), sizeof(std::size_t));
-	if(!pMemIdx)
+	// ------------------------------------------------------------------------
+	// the index file holds the offsets into the data file
+	std::size_t idx_file_offs = hkl_to_idx(dh, dk, dl);
+	if((idx_file_offs+1)*sizeof(std::size_t) > m_pIdx->iSize)
 	{
-		tl::log_err("Index file \"", m_strIndexFile, "\" cannot be mapped.");
+		tl::log_err("Index ", idx_file_offs, " is out of the index file's range.");
 		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
 	}
 
-	std::size_t dat_file_offs = *((std::size_t*)pMemIdx);
-	fileIdx.unmap((unsigned char*)pMemIdx);
-	fileIdx.close();
+	std::size_t dat_file_offs = *((const std::size_t*)m_pIdx->pMem + idx_file_offs);
 	// ------------------------------------------------------------------------
 
 
 	// ------------------------------------------------------------------------
 	// the data file holds the energies and spectral weights of the dispersion branches
 
-	QFile fileDat(m_strDataFile.c_str());
-	if(!fileDat.exists())
-	{
-		tl::log_err("Data file \"", m_strDataFile, "\" does not exist.");
-		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
-	}
-
-	if(!fileDat.open(QIODevice::ReadOnly))
-	{
-		tl::log_err("Data file \"", m_strDataFile, "\" cannot be opened.");
-		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
-	}
-
-	const void *pMemDat = fileDat.map(dat_file_offs, sizeof(std::size_t));
-	if(!pMemDat)
+	if(dat_file_offs + sizeof(unsigned int) > m_pDat->iSize)
 	{
-		tl::log_err("Data file \"", m_strDataFile, "\" cannot be mapped (1).");
+		tl::log_err("Offset ", dat_file_offs, " is out of the data file's range.");
 		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
 	}
 
 	// number of dispersion branches and weights
-	unsigned int iNumBranches = *((unsigned int*)pMemDat);
-	fileDat.unmap((unsigned char*)pMemDat);
+	unsigned int iNumBranches = *((const unsigned int*)(m_pDat->pMem + dat_file_offs));
 
-
-	// map actual (E, w) data
-	const t_real *pBranches = (t_real*)fileDat.map(dat_file_offs+sizeof(iNumBranches),
-		iNumBranches*sizeof(t_real)*2);
-	if(!pMemDat)
+	if(dat_file_offs + sizeof(iNumBranches) + iNumBranches*sizeof(t_real)*2 > m_pDat->iSize)
 	{
-		tl::log_err("Data file \"", m_strDataFile, "\" cannot be mapped (2).");
+		tl::log_err("Branches at offset ", dat_file_offs, " are out of the data file's range.");
 		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
 	}
 
+	// actual (E, w) data
+	const t_real *pBranches = (const t_real*)(m_pDat->pMem + dat_file_offs + sizeof(iNumBranches));
+
 
 	std::vector<t_real> vecE, vecw;
+	vecE.reserve(iNumBranches);
+	vecw.reserve(iNumBranches);
+
 	for(unsigned int iBranch=0; iBranch<iNumBranches; ++iBranch)
 	{
 		if(!tl::float_equal(pBranches[iBranch*2 + 1], t_real(0)))
@@ -181,9 +193,6 @@ std::tuple<std::vector<t_real>, std::vector<t_real>>
 			vecw.push_back(pBranches[iBranch*2 + 1]);	// weight
 		}
 	}
-
-	fileDat.unmap((unsigned char*)pBranches);
-	fileDat.close();
 	// ------------------------------------------------------------------------
 
 
@@ -283,6 +292,11 @@ SqwBase* SqwMod::shallow_copy() const
 	pMod->m_lmax = this->m_lmax;
 	pMod->m_lstep = this->m_lstep;
 
+	// the read-only mappings can be shared between threads
+	pMod->m_pIdx = this->m_pIdx;
+	pMod->m_pDat = this->m_pDat;
+	pMod->m_bOk = this->m_bOk;
+
 	return pMod;
 }
 
@@ -11,6 +11,26 @@
 #include "tools/monteconvo/sqwbase.h"
 #include "tlibs/math/linalg.h"
 
+#include <memory>
+#include <QFile>
+
+
+/**
+ * read-only view of a memory-mapped file
+ */
+struct GridMappedFile
+{
+	QFile file;
+	const unsigned char *pMem = nullptr;
+	std::size_t iSize = 0;
+
+	GridMappedFile(const std::string& strFile);
+	~GridMappedFile();
+
+	GridMappedFile(const GridMappedFile&) = delete;
+	const GridMappedFile& operator=(const GridMappedFile&) = delete;
+};
+
 
 class SqwMod : public SqwBase
 {
@@ -43,6 +63,9 @@ class SqwMod : public SqwBase
 		t_real m_kmin=0., m_kmax=0., m_kstep=0.;
 		t_real m_lmin=0., m_lmax=0., m_lstep=0.;
 
+		// files, mapped once and shared between shallow copies
+		std::shared_ptr<GridMappedFile> m_pIdx, m_pDat;
+
 
 	public:
 		SqwMod();
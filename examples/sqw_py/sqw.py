@@ -131,6 +131,14 @@ def TakinSqw(h, k, l, E):
 	except ZeroDivisionError:
 		return 0.
 
+
+#
+# S(Q,E) function for a whole batch of Monte-Carlo points (optional),
+# called with numpy arrays, returns an array of the same length
+#
+def TakinSqwBatch(h, k, l, E):
+	return np.array([TakinSqw(*hklE) for hklE in zip(h, k, l, E)])
+
 # -----------------------------------------------------------------------------
 
 
@@ -10,6 +10,7 @@
 #include "tlibs/file/file.h"
 #include "tlibs/string/string.h"
 #include <thread>
+#include <algorithm>
 
 
 // -----------------------------------------------------------------------------
@@ -52,6 +53,34 @@ unsigned int get_max_threads()
 	return std::min(iMaxThreads, g_iMaxThreads);
 }
 
+// number of worker processes for process-isolated S(q,w) models, 0: same as threads
+unsigned int g_iMaxProcesses = 0;
+
+unsigned int get_max_processes()
+{
+	if(g_iMaxProcesses == 0)
+		return std::max(get_max_threads(), 1u);
+	return g_iMaxProcesses;
+}
+
+/**
+ * parses a thread or process count given by the user, only accepts integers >= 1
+ */
+bool str_to_count(const std::string& str, unsigned int& iCount)
+{
+	// digits only, at most 9 of them to stay in range
+	if(str.length() == 0 || str.length() > 9 ||
+		str.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+
+	const unsigned int iVal = tl::str_to_var<unsigned int>(str);
+	if(iVal < 1)
+		return false;
+
+	iCount = iVal;
+	return true;
+}
+
 // -----------------------------------------------------------------------------
 
 
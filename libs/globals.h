@@ -23,6 +23,7 @@ extern t_real_glob g_dEps;
 extern t_real_glob g_dEpsGfx;
 
 extern unsigned int g_iMaxThreads;
+extern unsigned int g_iMaxProcesses;
 
 extern std::size_t GFX_NUM_POINTS;
 extern std::size_t g_iMaxNN;
@@ -54,5 +55,7 @@ extern void clear_global_paths();
 extern std::string find_file_in_global_paths(const std::string& strFile, bool bAlsoTryFileOnly=true);
 
 extern unsigned int get_max_threads();
+extern unsigned int get_max_processes();
+extern bool str_to_count(const std::string& str, unsigned int& iCount);
 
 #endif
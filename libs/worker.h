@@ -0,0 +1,188 @@
+/**
+ * background worker which only calculates the latest of the submitted jobs
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __TAKIN_WORKER_H__
+#define __TAKIN_WORKER_H__
+
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#include "tlibs/log/log.h"
+
+
+/**
+ * runs one job at a time in its own thread:
+ * a newly submitted job replaces a still pending one and cancels the running one,
+ * so only the latest request is calculated and published;
+ * the results are immutable and are handed over as shared pointers
+ */
+template<class t_res>
+class CoalescingWorker
+{
+	public:
+		using t_resptr = std::shared_ptr<const t_res>;
+
+		// the job gets a cancellation flag to poll and returns nullptr when cancelled
+		using t_job = std::function<t_resptr(const std::atomic<bool>& bCancel)>;
+
+		// called from the worker thread when the result of the given job is ready
+		using t_notify = std::function<void(std::size_t iJob)>;
+
+	protected:
+		std::mutex m_mtx;
+		std::condition_variable m_cond;
+		bool m_bStop = 0;
+
+		t_job m_jobPending;
+		std::size_t m_iJobPending = 0;
+		std::size_t m_iJobLatest = 0;
+		std::shared_ptr<std::atomic<bool>> m_pCancelRunning;
+
+		t_resptr m_pResult;
+		std::size_t m_iJobResult = 0;
+
+		t_notify m_funcNotify;
+		std::thread m_thread;
+
+	protected:
+		void Run()
+		{
+			while(1)
+			{
+				t_job job;
+				std::size_t iJob = 0;
+				std::shared_ptr<std::atomic<bool>> pCancel;
+
+				{
+					std::unique_lock<std::mutex> lock(m_mtx);
+					m_cond.wait(lock, [this]() -> bool { return m_bStop || bool(m_jobPending); });
+					if(m_bStop)
+						break;
+
+					job = std::move(m_jobPending);
+					m_jobPending = nullptr;
+					iJob = m_iJobPending;
+
+					pCancel = std::make_shared<std::atomic<bool>>(false);
+					m_pCancelRunning = pCancel;
+				}
+
+				t_resptr pRes;
+				try
+				{
+					pRes = job(*pCancel);
+				}
+				catch(const std::exception& ex)
+				{
+					tl::log_err(ex.what());
+				}
+
+				bool bPublish = 0;
+				{
+					std::lock_guard<std::mutex> lock(m_mtx);
+					if(m_pCancelRunning == pCancel)
+						m_pCancelRunning.reset();
+
+					// drop superseded results
+					if(pRes && !pCancel->load() && iJob == m_iJobLatest)
+					{
+						m_pResult = pRes;
+						m_iJobResult = iJob;
+						bPublish = 1;
+					}
+				}
+
+				if(bPublish && m_funcNotify)
+					m_funcNotify(iJob);
+			}
+		}
+
+	public:
+		CoalescingWorker(t_notify funcNotify)
+			: m_funcNotify(funcNotify), m_thread([this]() { this->Run(); })
+		{}
+
+		~CoalescingWorker() { Stop(); }
+
+		CoalescingWorker(const CoalescingWorker&) = delete;
+		const CoalescingWorker& operator=(const CoalescingWorker&) = delete;
+
+		/**
+		 * submits a new job, superseding all earlier ones
+		 * @return job number
+		 */
+		std::size_t Submit(t_job job)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+
+			m_jobPending = std::move(job);
+			m_iJobPending = m_iJobLatest = m_iJobLatest + 1;
+			if(m_pCancelRunning)
+				m_pCancelRunning->store(true);
+
+			m_cond.notify_one();
+			return m_iJobPending;
+		}
+
+		/**
+		 * drops the pending job and cancels the running one
+		 */
+		void Cancel()
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+
+			m_jobPending = nullptr;
+			++m_iJobLatest;
+			if(m_pCancelRunning)
+				m_pCancelRunning->store(true);
+		}
+
+		/**
+		 * gets the result of the given job if it is still the latest one
+		 */
+		t_resptr TakeResult(std::size_t iJob)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if(iJob != m_iJobResult || iJob != m_iJobLatest)
+				return nullptr;
+
+			t_resptr pRes = std::move(m_pResult);
+			m_pResult.reset();
+			return pRes;
+		}
+
+		/**
+		 * is a job pending or running?
+		 */
+		bool IsBusy()
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			return bool(m_jobPending) || bool(m_pCancelRunning);
+		}
+
+		void Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_bStop = 1;
+				m_jobPending = nullptr;
+				if(m_pCancelRunning)
+					m_pCancelRunning->store(true);
+			}
+
+			m_cond.notify_all();
+			if(m_thread.joinable())
+				m_thread.join();
+		}
+};
+
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * parallel chi^2 function for convolution fitting
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __CONVOFIT_CHI2_H__
+#define __CONVOFIT_CHI2_H__
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <cmath>
+
+#include <Minuit2/FCNBase.h>
+
+#include "tlibs/log/log.h"
+#include "tlibs/math/math.h"
+#include "model.h"
+
+
+/**
+ * chi^2 of all points of all scan groups;
+ * the points of a scan group are evaluated concurrently, each worker thread
+ * uses its own copy of the model, and the sum is formed in point order
+ */
+template<class t_real = t_real_mod>
+class Chi2FunctionParallel : public minuit::FCNBase
+{
+protected:
+	SqwFuncModel *m_pMod = nullptr;
+
+	// default data set (used if the model has no scan groups)
+	std::size_t m_iLen = 0;
+	const t_real *m_pX = nullptr, *m_pY = nullptr, *m_pDY = nullptr;
+
+	t_real m_dSigma = 1.;
+	bool m_bDebug = 0;
+	unsigned int m_iNumThreads = 1;
+
+protected:
+	static t_real chi2_pt(t_real dY, t_real dYMod, t_real dDY)
+	{
+		t_real d = dY - dYMod;
+		if(!tl::float_equal<t_real>(dDY, 0.))
+			d /= dDY;
+		return d*d;
+	}
+
+	/**
+	 * evaluates all points of one scan group
+	 */
+	void EvalSet(const SqwFuncModel& modSet, std::size_t iLen,
+		const t_real *pX, const t_real *pY, const t_real *pDY,
+		std::vector<t_real>& vecChi2) const
+	{
+		vecChi2.resize(iLen);
+		std::atomic<std::size_t> iNextPt(0);
+
+		const std::size_t iNumThreads = std::max<std::size_t>(1,
+			std::min<std::size_t>(m_iNumThreads, iLen));
+
+		auto worker = [&modSet, &iNextPt, &vecChi2, iLen, pX, pY, pDY, iNumThreads]() -> void
+		{
+			// thread-local model copy, the parallelism is over the points
+			std::unique_ptr<SqwFuncModel> pMod(modSet.copy());
+			if(iNumThreads > 1)
+				pMod->SetUseThreads(0);
+
+			// idle workers take the next open point
+			for(std::size_t iPt = iNextPt++; iPt < iLen; iPt = iNextPt++)
+			{
+				const t_real dYMod = t_real((*pMod)(tl::t_real_min(pX[iPt])));
+				vecChi2[iPt] = chi2_pt(pY[iPt], dYMod, pDY[iPt]);
+			}
+		};
+
+		std::vector<std::future<void>> vecFut;
+		vecFut.reserve(iNumThreads);
+		for(std::size_t iThread=1; iThread<iNumThreads; ++iThread)
+			vecFut.emplace_back(std::async(std::launch::async, worker));
+		worker();
+
+		for(std::future<void>& fut : vecFut)
+			fut.get();
+	}
+
+public:
+	Chi2FunctionParallel(SqwFuncModel *pMod, std::size_t iLen,
+		const t_real *pX, const t_real *pY, const t_real *pDY)
+		: m_pMod(pMod), m_iLen(iLen), m_pX(pX), m_pY(pY), m_pDY(pDY)
+	{}
+
+	virtual ~Chi2FunctionParallel() = default;
+
+	void SetSigma(t_real dSig) { m_dSigma = dSig; }
+	t_real GetSigma() const { return m_dSigma; }
+	void SetDebug(bool b) { m_bDebug = b; }
+	void SetNumThreads(unsigned int iNum) { m_iNumThreads = iNum; }
+
+	virtual double Up() const override { return double(m_dSigma*m_dSigma); }
+
+	virtual double operator()(const std::vector<double>& vecParams) const override
+	{
+		m_pMod->SetParams(std::vector<tl::t_real_min>(vecParams.begin(), vecParams.end()));
+
+		// workers of a scan group share the group's parameters
+		const std::size_t iNumSets = m_pMod->GetParamSetCount();
+		t_real dChi2 = 0.;
+
+		for(std::size_t iSet=0; iSet<iNumSets; ++iSet)
+		{
+			std::size_t iLen = m_iLen;
+			const t_real *pX = m_pX, *pY = m_pY, *pDY = m_pDY;
+
+			if(iNumSets > 1)
+			{
+				m_pMod->SetParamSet(iSet);
+				iLen = m_pMod->GetExpLen();
+				pX = m_pMod->GetExpX();
+				pY = m_pMod->GetExpY();
+				pDY = m_pMod->GetExpDY();
+			}
+
+			std::vector<t_real> vecChi2;
+			EvalSet(*m_pMod, iLen, pX, pY, pDY, vecChi2);
+
+			// deterministic order of summation
+			for(t_real dChi2Pt : vecChi2)
+				dChi2 += dChi2Pt;
+		}
+
+		if(m_bDebug)
+			tl::log_debug("Chi2 = ", dChi2);
+		return double(dChi2);
+	}
+};
+
+
+#endif
@@ -14,6 +14,7 @@
 #include <iostream>
 #include <fstream>
 #include <locale>
+#include <mutex>
 
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
@@ -22,8 +23,11 @@ namespace fs = boost::filesystem;
 #include "convofit_import.h"
 #include "scan.h"
 #include "model.h"
+#include "chi2.h"
 #include "../monteconvo/sqwfactory.h"
+#include "../monteconvo/reso_cache.h"
 #include "../res/defs.h"
+#include "libs/globals.h"
 
 
 //using t_real = tl::t_real_min;
@@ -104,28 +108,36 @@ unsigned int g_iPlotSkipEnd = 0;
 // ----------------------------------------------------------------------------
 
 
+/**
+ * resolves a file name relative to the directory of the job file;
+ * the process-wide working directory is not changed, as jobs run concurrently
+ */
+static std::string get_job_path(const fs::path& pathJobDir, const std::string& strFile)
+{
+	if(strFile == "")
+		return strFile;
+
+	fs::path pathFile(strFile);
+	if(pathFile.is_absolute())
+		return strFile;
+	return (pathJobDir / pathFile).string();
+}
+
+
 bool Convofit::run_job(const std::string& _strJob)
 {
+	m_vecOutFiles.clear();
+
 	// --------------------------------------------------------------------
-	// set working directory for job
-	bool bChangedCWD = 0;
-	fs::path pathProg = fs::system_complete(_strJob).remove_filename();
-	if(pathProg.filename().string() == ".")		// remove "./"
-		pathProg.remove_filename();
-	fs::path pathCWD = fs::system_complete(fs::current_path());
-	if(pathProg != pathCWD)
-	{
-		fs::current_path(pathProg);
-		bChangedCWD = 1;
-		tl::log_debug("Working directory: ", pathProg.string(), ".");
-	}
+	// directory of the job, relative paths are resolved against it
+	fs::path pathJobDir = fs::system_complete(_strJob).remove_filename();
+	if(pathJobDir.filename().string() == ".")		// remove "./"
+		pathJobDir.remove_filename();
+	tl::log_debug("Job directory: ", pathJobDir.string(), ".");
 	// --------------------------------------------------------------------
 
 
-	std::string strJob = _strJob;
-
-	if(bChangedCWD)
-		strJob = fs::path(strJob).filename().string();
+	std::string strJob = fs::system_complete(_strJob).string();
 
 
 	// if a monteconvo file is given, convert it to a convofit job file
@@ -141,8 +153,7 @@ bool Convofit::run_job(const std::string& _strJob)
 	}
 
 
-	const unsigned iSeed = tl::get_rand_seed();
-	tl::init_rand_seed(iSeed);
+	unsigned iSeed = tl::get_rand_seed();
 
 	// Parameters
 	tl::Prop<std::string> prop;
@@ -178,6 +189,8 @@ bool Convofit::run_job(const std::string& _strJob)
 	bool bUseFirstAndLastScanPt = prop.Query<bool>("input/use_first_last_pt", 0);
 	unsigned iScanAxis = prop.Query<unsigned>("input/scan_axis", 0);
 
+	strSqwFile = get_job_path(pathJobDir, strSqwFile);
+
 
 	if(g_strSetParams != "")
 	{
@@ -202,7 +215,8 @@ bool Convofit::run_job(const std::string& _strJob)
 	{
 		std::vector<std::string> vecScFiles;
 		tl::get_tokens<std::string, std::string>(strScFile, ";", vecScFiles);
-		std::for_each(vecScFiles.begin(), vecScFiles.end(), [](std::string& str){ tl::trim(str); });
+		std::for_each(vecScFiles.begin(), vecScFiles.end(), [&pathJobDir](std::string& str)
+			{ tl::trim(str); str = get_job_path(pathJobDir, str); });
 		vecvecScFiles.emplace_back(std::move(vecScFiles));
 	}
 
@@ -216,7 +230,8 @@ bool Convofit::run_job(const std::string& _strJob)
 
 		std::vector<std::string> vecSecScFiles;
 		tl::get_tokens<std::string, std::string>(strSecScFile, ";", vecSecScFiles);
-		std::for_each(vecSecScFiles.begin(), vecSecScFiles.end(), [](std::string& str){ tl::trim(str); });
+		std::for_each(vecSecScFiles.begin(), vecSecScFiles.end(), [&pathJobDir](std::string& str)
+			{ tl::trim(str); str = get_job_path(pathJobDir, str); });
 		vecvecScFiles.emplace_back(std::move(vecSecScFiles));
 	}
 	// --------------------------------------------------------------------
@@ -224,7 +239,7 @@ bool Convofit::run_job(const std::string& _strJob)
 
 	// --------------------------------------------------------------------
 	//primary resolution file
-	std::vector<std::string> vecResFiles({strResFile});
+	std::vector<std::string> vecResFiles({get_job_path(pathJobDir, strResFile)});
 
 	// get secondary resolution files for multi-function fitting
 	for(std::size_t iSecFile=1; 1; ++iSecFile)
@@ -234,7 +249,7 @@ bool Convofit::run_job(const std::string& _strJob)
 		if(strSecResFile == "")
 			break;
 		tl::trim(strSecResFile);
-		vecResFiles.emplace_back(std::move(strSecResFile));
+		vecResFiles.emplace_back(get_job_path(pathJobDir, strSecResFile));
 	}
 
 	if(vecResFiles.size()!=1 && vecResFiles.size()!=vecvecScFiles.size())
@@ -249,6 +264,25 @@ bool Convofit::run_job(const std::string& _strJob)
 	unsigned iNumNeutrons = prop.Query<unsigned>("montecarlo/neutrons", 1000);
 	unsigned iNumSample = prop.Query<unsigned>("montecarlo/sample_positions", 1);
 	bool bRecycleMC = prop.Query<bool>("montecarlo/recycle_neutrons", 1);
+	bool bAdaptiveMC = prop.Query<bool>("montecarlo/adaptive", 0);
+	t_real dAdaptiveErr = prop.Query<t_real>("montecarlo/adaptive_error", 0.01);
+	bool bImportanceMC = prop.Query<bool>("montecarlo/importance", 0);
+	t_real dImportanceWidth = prop.Query<t_real>("montecarlo/importance_width", 0.1);
+	bool bAnalyticE = prop.Query<bool>("montecarlo/analytic_E", 0);
+	std::string strSampling = prop.Query<std::string>("montecarlo/sampling", "pseudo");
+	unsigned iCubMaxLevel = prop.Query<unsigned>("montecarlo/cubature_max_level", 5);
+	t_real dCubTol = prop.Query<t_real>("montecarlo/cubature_tolerance", 1e-3);
+
+	if(bImportanceMC && !(dImportanceWidth > t_real(0)))
+	{
+		tl::log_err("Invalid importance sampling width: ", dImportanceWidth, ", it has to be positive.");
+		return 0;
+	}
+
+	// a fixed seed makes the fit reproducible, independently of the number of threads
+	iSeed = prop.Query<unsigned>("montecarlo/seed", iSeed);
+	tl::init_rand_seed(iSeed);
+	tl::log_info("Random seed: ", iSeed, ".");
 
 	if(g_iNumNeutrons > 0)
 		iNumNeutrons = g_iNumNeutrons;
@@ -261,6 +295,11 @@ bool Convofit::run_job(const std::string& _strJob)
 	int iResFocAnaV = prop.Query<int>("resolution/focus_ana_v", -1);
 	int iResFocAnaH = prop.Query<int>("resolution/focus_ana_h", -1);
 
+	// interpolate the resolution matrices in a cache, optionally kept in a directory between runs
+	bool bResoCache = prop.Query<bool>("resolution/cache", 0);
+	std::string strResoCacheDir = get_job_path(pathJobDir, prop.Query<std::string>("resolution/cache_dir", ""));
+	t_real dResoCacheTol = prop.Query<t_real>("resolution/cache_tolerance", 1e-3);
+
 	std::string strMinimiser = prop.Query<std::string>("fitter/minimiser");
 	int iStrat = prop.Query<int>("fitter/strategy", 0);
 	t_real dSigma = prop.Query<t_real>("fitter/sigma", 1.);
@@ -271,9 +310,9 @@ bool Convofit::run_job(const std::string& _strJob)
 	unsigned int iMaxFuncCalls = prop.Query<unsigned>("fitter/max_funccalls", 0);
 	t_real dTolerance = prop.Query<t_real>("fitter/tolerance", 0.5);
 
-	std::string strScOutFile = prop.Query<std::string>("output/scan_file");
-	std::string strModOutFile = prop.Query<std::string>("output/model_file");
-	std::string strLogOutFile = prop.Query<std::string>("output/log_file");
+	std::string strScOutFile = get_job_path(pathJobDir, prop.Query<std::string>("output/scan_file"));
+	std::string strModOutFile = get_job_path(pathJobDir, prop.Query<std::string>("output/model_file"));
+	std::string strLogOutFile = get_job_path(pathJobDir, prop.Query<std::string>("output/log_file"));
 	bool bPlot = prop.Query<bool>("output/plot", 0);
 	bool bPlotIntermediate = prop.Query<bool>("output/plot_intermediate", 0);
 
@@ -324,7 +363,7 @@ bool Convofit::run_job(const std::string& _strJob)
 	// parameter using either strModInFile if it is defined or strModOutFile if
 	// reuse_values_from_model_file is set to 1
 	bool bUseValuesFromModel = prop.Query<bool>("fit_parameters/reuse_values_from_model_file", 0);
-	std::string strModInFile = prop.Query<std::string>("input/model_file");
+	std::string strModInFile = get_job_path(pathJobDir, prop.Query<std::string>("input/model_file"));
 	if(g_bUseValuesFromModel || strModInFile != "")
 		bUseValuesFromModel = 1;
 
@@ -455,6 +494,17 @@ bool Convofit::run_job(const std::string& _strJob)
 	// --------------------------------------------------------------------
 	// resolution files
 	std::vector<TASReso> vecResos;
+
+	std::shared_ptr<ResoCache> pResoCache;
+	if(bResoCache)
+	{
+		if(iNumSample > 1)
+			tl::log_warn("The resolution cache is only used for one sample position.");
+
+		// concurrent jobs share the cache
+		pResoCache = ResoCache::GetShared(strResoCacheDir, dResoCacheTol);
+	}
+
 	for(const std::string& strCurResFile : vecResFiles)
 	{
 		TASReso reso;
@@ -491,7 +541,26 @@ bool Convofit::run_job(const std::string& _strJob)
 			reso.SetOptimalFocus(ResoFocus(ifocMode));
 		}
 
+		if(strSampling == "pseudo")
+			reso.SetSampling(McNeutronSampling::PSEUDO);
+		else if(strSampling == "sobol")
+			reso.SetSampling(McNeutronSampling::SOBOL);
+		else if(strSampling == "cubature")
+		{
+			// quasi-random neutrons are the fallback if the cubature does not converge
+			reso.SetSampling(McNeutronSampling::SOBOL);
+			reso.SetCubature(1, iCubMaxLevel, dCubTol);
+		}
+		else
+		{
+			tl::log_err("Invalid sampling selected: \"", strSampling, "\".");
+			return 0;
+		}
+
+		reso.SetImportance(bImportanceMC, dImportanceWidth);
+		reso.SetAnalyticE(bAnalyticE);
 		reso.SetRandomSamplePos(iNumSample);
+		reso.SetResoCache(pResoCache);
 		vecResos.emplace_back(std::move(reso));
 	}
 
@@ -517,14 +586,25 @@ bool Convofit::run_job(const std::string& _strJob)
 		tl::log_err("S(q,w) model cannot be initialised.");
 		return 0;
 	}
+
+	// the energy integration is only faster than mc for models with a closed form
+	if(bAnalyticE && !pSqw->HasGaussEBatch())
+	{
+		tl::log_warn("S(q,w) model has no analytical energy integration, sampling the energy instead.");
+		for(TASReso& reso : vecResos)
+			reso.SetAnalyticE(0);
+	}
 	SqwFuncModel mod(pSqw, vecResos);
 
 
 	std::vector<t_real> vecModTmpX, vecModTmpY;
+	std::mutex mtxSlot;	// scan points are evaluated concurrently
 	// slots
 	mod.AddFuncResultSlot(
-	[this, &pltMeas, &vecModTmpX, &vecModTmpY, bPlotIntermediate](t_real h, t_real k, t_real l, t_real E, t_real S)
+	[this, &pltMeas, &vecModTmpX, &vecModTmpY, &mtxSlot, bPlotIntermediate](t_real h, t_real k, t_real l, t_real E, t_real S)
 	{
+		std::lock_guard<std::mutex> lock(mtxSlot);
+
 		if(g_bVerbose)
 			tl::log_info("Q = (", h, ", ", k, ", ", l, ") rlu, E = ", E, " meV -> S = ", S);
 
@@ -543,7 +623,7 @@ bool Convofit::run_job(const std::string& _strJob)
 		}
 	});
 	mod.AddParamsChangedSlot(
-	[&vecModTmpX, &vecModTmpY, bPlotIntermediate, iSeed, bRecycleMC](const std::string& strDescr)
+	[&vecModTmpX, &vecModTmpY, bPlotIntermediate](const std::string& strDescr)
 	{
 		tl::log_info("Changed model parameters: ", strDescr);
 
@@ -552,13 +632,6 @@ bool Convofit::run_job(const std::string& _strJob)
 			vecModTmpX.clear();
 			vecModTmpY.clear();
 		}
-
-		// do we use the same MC neutrons again?
-		if(bRecycleMC)
-		{
-			tl::init_rand_seed(iSeed);
-			tl::log_debug("Resetting random seed to ", iSeed, ".");
-		}
 	});
 
 
@@ -568,8 +641,14 @@ bool Convofit::run_job(const std::string& _strJob)
 
 	tl::log_info("Number of neutrons: ", iNumNeutrons, ".");
 	mod.SetNumNeutrons(iNumNeutrons);
-	// execution has to be in a determined order to recycle the same neutrons
-	mod.SetUseThreads(!bRecycleMC);
+	// the neutrons come from random streams keyed by seed and scan point,
+	// so they are reproducible independently of the order of execution;
+	// a job restricted to a single thread must not start a neutron thread pool
+	mod.SetUseThreads(m_budget.iNumThreads != 1);
+	// resolution and recycled neutrons only need to be calculated once per scan point
+	mod.SetCacheNeutrons(bRecycleMC);
+	mod.SetRandSeed(iSeed);
+	mod.SetAdaptive(bAdaptiveMC, dAdaptiveErr);
 
 	if(bTempOverride)
 	{
@@ -636,11 +715,15 @@ bool Convofit::run_job(const std::string& _strJob)
 	}
 
 	//tl::Chi2Function<t_real_sc> chi2fkt(&mod, vecSc[0].vecX.size(), vecSc[0].vecX.data(), vecSc[0].vecCts.data(), vecSc[0].vecCtsErr.data());
-	tl::Chi2Function_mult<t_real_sc, std::vector> chi2fkt;
+	//tl::Chi2Function_mult<t_real_sc, std::vector> chi2fkt;
 	// the vecSc[0] data sets are the default data set (will not be used if scan groups are defined)
-	chi2fkt.AddFunc(&mod, vecSc[0].vecX.size(), vecSc[0].vecX.data(), vecSc[0].vecCts.data(), vecSc[0].vecCtsErr.data());
+	Chi2FunctionParallel<t_real_sc> chi2fkt(&mod, vecSc[0].vecX.size(), vecSc[0].vecX.data(), vecSc[0].vecCts.data(), vecSc[0].vecCtsErr.data());
 	chi2fkt.SetDebug(1);
 	chi2fkt.SetSigma(dSigma);
+	// the job's share of the threads goes to the scan points
+	const unsigned int iNumThreads = m_budget.iNumThreads ? m_budget.iNumThreads : get_max_threads();
+	chi2fkt.SetNumThreads(iNumThreads);
+	tl::log_info("Number of threads: ", iNumThreads, ".");
 
 
 	minuit::MnUserParameters params = mod.GetMinuitParams();
@@ -712,8 +795,10 @@ bool Convofit::run_job(const std::string& _strJob)
 			strCurScOutFile += tl::var_to_str(iSc);
 		}
 		mod.SetParamSet(iSc);
-		mod.Save(strCurModOutFile.c_str(), iPlotPoints, iPlotPointsSkipBegin, iPlotPointsSkipEnd);
-		save_file(strCurScOutFile.c_str(), sc);
+		if(mod.Save(strCurModOutFile.c_str(), iPlotPoints, iPlotPointsSkipBegin, iPlotPointsSkipEnd))
+			m_vecOutFiles.push_back(strCurModOutFile);
+		if(save_file(strCurScOutFile.c_str(), sc))
+			m_vecOutFiles.push_back(strCurScOutFile);
 	}
 	// --------------------------------------------------------------------
 
@@ -743,11 +828,21 @@ bool Convofit::run_job(const std::string& _strJob)
 	// --------------------------------------------------------------------
 
 
+	if(pResoCache)
+	{
+		tl::log_info("Resolution cache: ", pResoCache->GetNumInterpolated(), " interpolated, ",
+			pResoCache->GetNumExact(), " calculated.");
+		pResoCache->Save();
+	}
+
+
 	// remove thread-local loggers
 	if(!!ofstrLog)
 	{
 		for(tl::Log* plog : { &tl::log_info, &tl::log_warn, &tl::log_err, &tl::log_crit, &tl::log_debug })
 			plog->RemoveOstr(ofstrLog.get());
+		ofstrLog.reset();
+		m_vecOutFiles.push_back(strLogOutFile);
 	}
 
 
@@ -24,6 +24,9 @@ static inline void set_tasreso_params_from_scan(TASReso& reso, const Scan& sc)
 		tl::make_vec({sc.plane.vec2[0], sc.plane.vec2[1], sc.plane.vec2[2]}));
 	reso.SetKiFix(sc.bKiFixed);
 	reso.SetKFix(sc.dKFix);
+
+	// the per-point copies of the resolution object share the cache hash
+	reso.UpdateParamHash();
 }
 
 static inline void set_model_params_from_scan(SqwFuncModel& mod, const Scan& sc)
@@ -55,6 +58,15 @@ extern unsigned int g_iPlotSkipEnd;
 // --------------------------------------------------------------------
 
 
+/**
+ * resources available to a single job, 0: no limit
+ */
+struct ConvofitBudget
+{
+	unsigned int iNumThreads = 0;	// threads for the scan points of the job
+};
+
+
 class Convofit
 {
 	public:
@@ -72,12 +84,22 @@ class Convofit
 		t_sigDeinitPlotter m_sigDeinitPlotter;
 		t_sigPlot m_sigPlot;
 
+		ConvofitBudget m_budget;
+
+		// files written by the last job
+		std::vector<std::string> m_vecOutFiles;
+
 	public:
 		Convofit(bool bUseDefaultPlotter=1);
 		~Convofit();
 
 		bool run_job(const std::string& _strJob);
 
+		void SetBudget(const ConvofitBudget& budget) { m_budget = budget; }
+		const ConvofitBudget& GetBudget() const { return m_budget; }
+
+		const std::vector<std::string>& GetOutFiles() const { return m_vecOutFiles; }
+
 		void addsig_initplotter(const typename t_sigInitPlotter::slot_type& conn)
 		{ m_sigInitPlotter.connect(conn); }
 		void addsig_deinitplotter(const typename t_sigDeinitPlotter::slot_type& conn)
@@ -0,0 +1,370 @@
+/**
+ * distributed convolution fitting: coordinator and workers
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * protocol (text lines):
+ *   worker -> coordinator: HELLO <token> <name>
+ *   coordinator -> worker: JOB <id>, <job file>   or   QUIT
+ *   worker -> coordinator: ALIVE (repeatedly while the job is running),
+ *     RESULT <id> <ok> <number of files>, then for each file: FILE <file name>
+ *
+ * the result files are not transferred, the workers write them to the
+ * output paths of the job on the shared file system
+ */
+
+#include "convofit_dist.h"
+#include "tlibs/log/log.h"
+#include "tlibs/string/string.h"
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+namespace asio = boost::asio;
+namespace sys = boost::system;
+namespace fs = boost::filesystem;
+using asio::ip::tcp;
+
+
+// ----------------------------------------------------------------------------
+// coordinator
+
+enum class DistJobState { QUEUED, RUNNING, OK, FAILED };
+
+struct DistJobs
+{
+	std::vector<std::string> vecFiles;
+	std::vector<DistJobState> vecStates;
+	std::vector<unsigned int> vecTries;
+
+	std::deque<std::size_t> queue;
+	std::size_t iFinished = 0;
+
+	std::mutex mtx;
+	std::condition_variable cond;
+
+	bool AllFinished() const { return iFinished == vecFiles.size(); }
+};
+
+
+/**
+ * compares the tokens without leaking the position of the first difference
+ */
+static bool token_equals(const std::string& str0, const std::string& str1)
+{
+	if(str0.length() != str1.length())
+		return false;
+
+	unsigned char cDiff = 0;
+	for(std::size_t i=0; i<str0.length(); ++i)
+		cDiff |= (unsigned char)(str0[i] ^ str1[i]);
+	return cDiff == 0;
+}
+
+
+/**
+ * receives the result of a job, false if the connection was lost or timed out
+ */
+static bool recv_result(tcp::iostream& stream, std::size_t iJob, bool& bOk, const ConvofitDistOpts& opts)
+{
+	std::string strCmd;
+
+	// the worker reports regularly while the job is running
+	while(1)
+	{
+		stream.expires_after(std::chrono::milliseconds(opts.iTimeoutMs));
+		if(!(stream >> strCmd))
+			return false;
+		if(strCmd != "ALIVE")
+			break;
+	}
+
+	std::size_t iId = 0, iNumFiles = 0;
+	if(strCmd != "RESULT" || !(stream >> iId >> bOk >> iNumFiles) || iId != iJob)
+		return false;
+
+	for(std::size_t iFile=0; iFile<iNumFiles; ++iFile)
+	{
+		std::string strFile;
+		if(!(stream >> strCmd) || strCmd != "FILE")
+			return false;
+		stream.ignore(1);	// ' '
+		if(!std::getline(stream, strFile))
+			return false;
+
+		if(fs::exists(strFile))
+			tl::log_debug("Result file \"", strFile, "\".");
+		else
+			tl::log_warn("Result file \"", strFile, "\" is not visible to the coordinator.");
+	}
+
+	return true;
+}
+
+
+/**
+ * serves one connected worker until there are no more jobs or the worker is lost
+ */
+static void serve_worker(std::shared_ptr<tcp::iostream> pStream, DistJobs& jobs, const ConvofitDistOpts& opts)
+{
+	tcp::iostream& stream = *pStream;
+
+	std::string strCmd, strToken, strName;
+	stream.expires_after(std::chrono::milliseconds(opts.iTimeoutMs));
+	if(!(stream >> strCmd >> strToken) || strCmd != "HELLO" || !std::getline(stream, strName))
+	{
+		tl::log_err("Invalid worker greeting.");
+		return;
+	}
+	if(!token_equals(strToken, opts.strToken))
+	{
+		tl::log_err("Rejected worker with an invalid token.");
+		return;
+	}
+	tl::trim(strName);
+	tl::log_info("Worker \"", strName, "\" connected.");
+
+	while(1)
+	{
+		std::size_t iJob = 0;
+		{
+			std::unique_lock<std::mutex> lock(jobs.mtx);
+
+			// jobs of lost workers can be re-queued as long as some are running
+			jobs.cond.wait(lock, [&jobs]() -> bool
+				{ return !jobs.queue.empty() || jobs.AllFinished(); });
+
+			if(jobs.queue.empty())
+			{
+				stream.expires_after(std::chrono::milliseconds(opts.iTimeoutMs));
+				stream << "QUIT\n" << std::flush;
+				tl::log_info("Worker \"", strName, "\" finished.");
+				return;
+			}
+
+			iJob = jobs.queue.front();
+			jobs.queue.pop_front();
+			jobs.vecStates[iJob] = DistJobState::RUNNING;
+			++jobs.vecTries[iJob];
+		}
+
+		tl::log_info("Sending job ", iJob+1, " (\"", jobs.vecFiles[iJob], "\") to worker \"", strName, "\".");
+		stream.expires_after(std::chrono::milliseconds(opts.iTimeoutMs));
+		stream << "JOB " << iJob << "\n" << jobs.vecFiles[iJob] << "\n" << std::flush;
+
+		bool bOk = 0;
+		const bool bConnected = stream && recv_result(stream, iJob, bOk, opts);
+
+		std::lock_guard<std::mutex> lock(jobs.mtx);
+		if(bConnected)
+		{
+			jobs.vecStates[iJob] = bOk ? DistJobState::OK : DistJobState::FAILED;
+			++jobs.iFinished;
+			if(!bOk)
+				tl::log_err("Job ", iJob+1, " (", jobs.vecFiles[iJob], ") failed or fit invalid!");
+		}
+		else
+		{
+			tl::log_err("Lost worker \"", strName, "\" while running job ", iJob+1, ".");
+
+			if(jobs.vecTries[iJob] <= opts.iMaxRetries)
+			{
+				jobs.vecStates[iJob] = DistJobState::QUEUED;
+				jobs.queue.push_back(iJob);
+			}
+			else
+			{
+				tl::log_err("Giving up on job ", iJob+1, " (", jobs.vecFiles[iJob], ") after ",
+					jobs.vecTries[iJob], " tries.");
+				jobs.vecStates[iJob] = DistJobState::FAILED;
+				++jobs.iFinished;
+			}
+		}
+		jobs.cond.notify_all();
+
+		if(!bConnected)
+			return;
+	}
+}
+
+
+std::size_t run_coordinator(const std::vector<std::string>& vecJobs,
+	unsigned short iPort, const ConvofitDistOpts& opts)
+{
+	if(opts.strToken == "")
+	{
+		tl::log_err("The coordinator needs a token which the workers have to present.");
+		return vecJobs.size();
+	}
+
+	DistJobs jobs;
+	for(const std::string& strJob : vecJobs)
+	{
+		// the workers can run in other directories
+		jobs.vecFiles.push_back(fs::system_complete(strJob).string());
+		jobs.queue.push_back(jobs.vecFiles.size()-1);
+	}
+	jobs.vecStates.resize(jobs.vecFiles.size(), DistJobState::QUEUED);
+	jobs.vecTries.resize(jobs.vecFiles.size(), 0);
+
+	asio::io_service ioSrv;
+	tcp::acceptor acceptor(ioSrv);
+	try
+	{
+		const tcp::endpoint endpoint(asio::ip::address::from_string(opts.strBind), iPort);
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(tcp::acceptor::reuse_address(true));
+		acceptor.bind(endpoint);
+		acceptor.listen();
+		acceptor.non_blocking(true);
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_err("Cannot listen on ", opts.strBind, ":", iPort, ": ", ex.what());
+		return vecJobs.size();
+	}
+	tl::log_info("Coordinator listening on ", opts.strBind, ":", iPort, " for ", jobs.vecFiles.size(), " job(s).");
+
+	std::vector<std::thread> vecThreads;
+	while(1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobs.mtx);
+			if(jobs.AllFinished())
+				break;
+		}
+
+		std::shared_ptr<tcp::iostream> pStream = std::make_shared<tcp::iostream>();
+		sys::error_code err;
+		acceptor.accept(*pStream->rdbuf(), err);
+
+		if(err == asio::error::would_block || err == asio::error::try_again)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		else if(err)
+		{
+			tl::log_err("Cannot accept worker connection: ", err.message(), ".");
+			continue;
+		}
+
+		// notice workers on crashed nodes
+		pStream->rdbuf()->set_option(asio::socket_base::keep_alive(true));
+		vecThreads.emplace_back(serve_worker, pStream, std::ref(jobs), std::cref(opts));
+	}
+
+	// release the idle workers, busy ones send their results or time out
+	jobs.cond.notify_all();
+	for(std::thread& th : vecThreads)
+		th.join();
+
+	std::size_t iNumFailed = std::count(jobs.vecStates.begin(), jobs.vecStates.end(), DistJobState::FAILED);
+	tl::log_info("All jobs finished, ", iNumFailed, " failed.");
+	return iNumFailed;
+}
+
+// ----------------------------------------------------------------------------
+
+
+
+// ----------------------------------------------------------------------------
+// worker
+
+bool run_worker(const std::string& strHost, const std::string& strPort,
+	const t_convofit_dist_job& funcJob, const ConvofitDistOpts& opts)
+{
+	// the coordinator may not yet be running
+	tcp::iostream stream;
+	for(unsigned int iTry=0; iTry<=opts.iConnectRetries; ++iTry)
+	{
+		stream.clear();
+		stream.connect(strHost, strPort);
+		if(stream)
+			break;
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	if(!stream)
+	{
+		tl::log_err("Cannot connect to coordinator ", strHost, ":", strPort, ".");
+		return false;
+	}
+
+	const std::string strName = asio::ip::host_name();
+	stream << "HELLO " << opts.strToken << " " << strName << "\n" << std::flush;
+	tl::log_info("Connected to coordinator ", strHost, ":", strPort, ".");
+
+	while(1)
+	{
+		std::string strCmd;
+		if(!(stream >> strCmd))
+		{
+			tl::log_err("Lost connection to coordinator.");
+			return false;
+		}
+
+		if(strCmd == "QUIT")
+			break;
+		if(strCmd != "JOB")
+		{
+			tl::log_err("Invalid coordinator command \"", strCmd, "\".");
+			return false;
+		}
+
+		std::size_t iJob = 0;
+		std::string strJob;
+		stream >> iJob;
+		stream.ignore(1);	// '\n'
+		std::getline(stream, strJob);
+		tl::log_info("Executing job file ", iJob+1, ": \"", strJob, "\".");
+
+		// tell the coordinator that the worker is still alive while the job runs
+		bool bJobDone = 0;
+		std::mutex mtxDone;
+		std::condition_variable condDone;
+		std::thread thHeartbeat([&]()
+		{
+			std::unique_lock<std::mutex> lock(mtxDone);
+			while(!condDone.wait_for(lock, std::chrono::milliseconds(opts.iHeartbeatMs),
+				[&bJobDone]() -> bool { return bJobDone; }))
+				stream << "ALIVE\n" << std::flush;
+		});
+
+		std::vector<std::string> vecFiles;
+		bool bOk = 0;
+		try
+		{
+			bOk = funcJob(strJob, vecFiles);
+		}
+		catch(const std::exception& ex)
+		{
+			tl::log_err("Job ", iJob+1, " failed: ", ex.what());
+			bOk = 0;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtxDone);
+			bJobDone = 1;
+		}
+		condDone.notify_all();
+		thHeartbeat.join();
+
+		stream << "RESULT " << iJob << " " << bOk << " " << vecFiles.size() << "\n";
+		for(const std::string& strFile : vecFiles)
+			stream << "FILE " << strFile << "\n";
+		stream << std::flush;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
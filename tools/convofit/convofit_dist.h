@@ -0,0 +1,58 @@
+/**
+ * distributed convolution fitting: coordinator and workers
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __TAKIN_CONVOFIT_DIST_H__
+#define __TAKIN_CONVOFIT_DIST_H__
+
+#include <string>
+#include <vector>
+#include <functional>
+
+
+/**
+ * connection settings of coordinator and workers
+ */
+struct ConvofitDistOpts
+{
+	// address the coordinator listens on, only local workers by default
+	std::string strBind = "127.0.0.1";
+
+	// shared secret which the workers have to present
+	std::string strToken;
+
+	unsigned int iMaxRetries = 2;		// re-queueing of jobs of lost workers
+	unsigned int iConnectRetries = 10;	// worker connection attempts, one per second
+
+	// a worker which is silent for longer than this is considered lost
+	unsigned int iTimeoutMs = 60000;
+	// interval in which a busy worker reports that it is still alive
+	unsigned int iHeartbeatMs = 10000;
+};
+
+
+/**
+ * runs a job file and returns the names of the written output files
+ */
+using t_convofit_dist_job = std::function<bool(const std::string& strJob, std::vector<std::string>& vecOutFiles)>;
+
+
+/**
+ * coordinator: listens on a tcp port and hands out the job files to the connected workers;
+ * the jobs of lost workers are re-queued up to iMaxRetries times,
+ * the workers write the results to the job's output paths on the shared file system;
+ * returns the number of failed jobs
+ */
+extern std::size_t run_coordinator(const std::vector<std::string>& vecJobs,
+	unsigned short iPort, const ConvofitDistOpts& opts);
+
+/**
+ * worker: connects to a coordinator and runs the jobs it receives, one at a time
+ */
+extern bool run_worker(const std::string& strHost, const std::string& strPort,
+	const t_convofit_dist_job& funcJob, const ConvofitDistOpts& opts);
+
+
+#endif
@@ -102,6 +102,22 @@ std::string convert_monteconvo(
 		propMC.Query<std::string>("taz/monteconvo/sample_step_count", "1");
 	mapJob["montecarlo/recycle_neutrons"] =
 		propMC.Query<std::string>("taz/convofit/recycle_neutrons", "1");
+	mapJob["montecarlo/adaptive"] =
+		propMC.Query<std::string>("taz/monteconvo/adaptive", "0");
+	mapJob["montecarlo/adaptive_error"] =
+		tl::var_to_str(propMC.Query<t_real>("taz/monteconvo/adaptive_error", 1.) / t_real(100.));
+	mapJob["montecarlo/importance"] =
+		propMC.Query<std::string>("taz/monteconvo/importance", "0");
+	mapJob["montecarlo/analytic_E"] =
+		propMC.Query<std::string>("taz/monteconvo/analytic_E", "0");
+	mapJob["resolution/cache"] =
+		propMC.Query<std::string>("taz/monteconvo/reso_cache", "0");
+	switch(propMC.Query<int>("taz/monteconvo/sampling", 0))
+	{
+		case 1: mapJob["montecarlo/sampling"] = "sobol"; break;
+		case 2: mapJob["montecarlo/sampling"] = "cubature"; break;
+		default: mapJob["montecarlo/sampling"] = "pseudo"; break;
+	}
 
 	// fitting
 	std::string strMin = "simplex";
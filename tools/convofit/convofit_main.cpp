@@ -9,8 +9,12 @@
 #include <boost/asio/signal_set.hpp>
 #include <boost/scope_exit.hpp>
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
 
 #include "convofit.h"
+#include "convofit_dist.h"
 #include "libs/version.h"
 #include "libs/globals.h"
 #include "tlibs/time/stopwatch.h"
@@ -86,6 +90,10 @@ int main(int argc, char** argv)
 		// --------------------------------------------------------------------
 		// get job files and program options
 		std::vector<std::string> vecJobs;
+		unsigned short iCoordPort = 0;
+		std::string strCoordinator;
+		ConvofitDistOpts distopts;
+		std::string strMaxThreads, strMaxProcesses;
 
 		// normal args
 		opts::options_description args("convofit options (overriding job file settings)");
@@ -131,8 +139,32 @@ int main(int argc, char** argv)
 			"skip plot points in the end of the range")));
 		args.add(boost::shared_ptr<opts::option_description>(
 			new opts::option_description("max-threads",
-			opts::value<decltype(g_iMaxThreads)>(&g_iMaxThreads),
+			opts::value<decltype(strMaxThreads)>(&strMaxThreads),
 			"maximum number of threads")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("max-processes",
+			opts::value<decltype(strMaxProcesses)>(&strMaxProcesses),
+			"number of worker processes for python and julia models")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("coordinator",
+			opts::value<decltype(iCoordPort)>(&iCoordPort),
+			"distribute the job files to workers connecting to this port")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("worker",
+			opts::value<decltype(strCoordinator)>(&strCoordinator),
+			"run the jobs of the coordinator at host:port")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("max-retries",
+			opts::value<decltype(distopts.iMaxRetries)>(&distopts.iMaxRetries),
+			"number of times a job of a lost worker is re-queued")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("bind",
+			opts::value<decltype(distopts.strBind)>(&distopts.strBind),
+			"address the coordinator listens on (default: 127.0.0.1)")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("token",
+			opts::value<decltype(distopts.strToken)>(&distopts.strToken),
+			"shared secret of coordinator and workers (default: $CONVOFIT_TOKEN)")));
 
 
 		// positional args
@@ -157,34 +189,113 @@ int main(int argc, char** argv)
 				log->SetShowThread(1);
 		}
 
-		if(argc <= 1)
+		auto print_usage = [&args, argv]()
 		{
 			std::ostringstream ostrHelp;
 			ostrHelp << "Usage: " << argv[0] << " [options] <job-file 1> <job-file 2> ...\n";
+			ostrHelp << "       " << argv[0] << " --coordinator <port> [options] <job-file 1> <job-file 2> ...\n";
+			ostrHelp << "       " << argv[0] << " --worker <host>:<port> [options]\n";
 			ostrHelp << args;
 			tl::log_info(ostrHelp.str());
+		};
+
+		if(argc <= 1)
+		{
+			print_usage();
+			return -1;
+		}
+
+		// thread and process counts have to be positive integers
+		if(strMaxThreads != "" && !str_to_count(strMaxThreads, g_iMaxThreads))
+		{
+			tl::log_err("Invalid number of threads: \"", strMaxThreads, "\", need an integer >= 1.");
+			print_usage();
+			return -1;
+		}
+		if(strMaxProcesses != "" && !str_to_count(strMaxProcesses, g_iMaxProcesses))
+		{
+			tl::log_err("Invalid number of processes: \"", strMaxProcesses, "\", need an integer >= 1.");
+			print_usage();
+			return -1;
+		}
+
+		// the token can be kept out of the process list
+		if(distopts.strToken == "")
+		{
+			if(const char* pcToken = std::getenv("CONVOFIT_TOKEN"))
+				distopts.strToken = pcToken;
+		}
+		if((strCoordinator != "" || iCoordPort) && (distopts.strToken == "" ||
+			std::any_of(distopts.strToken.begin(), distopts.strToken.end(),
+				[](char c) -> bool { return std::isspace((unsigned char)c); })))
+		{
+			tl::log_err("Coordinator and workers need a shared token without spaces, use --token or $CONVOFIT_TOKEN.");
 			return -1;
 		}
 
+		// worker mode, the jobs come from the coordinator
+		if(strCoordinator != "")
+		{
+			std::pair<std::string, std::string> pairHost =
+				tl::split_first<std::string>(strCoordinator, ":", 1);
+			if(pairHost.first == "" || pairHost.second == "")
+			{
+				tl::log_err("Invalid coordinator address \"", strCoordinator, "\", use host:port.");
+				return -1;
+			}
+
+			auto funcJob = [](const std::string& strJob, std::vector<std::string>& vecOutFiles) -> bool
+			{
+				Convofit convo(0);
+				const bool bOk = convo.run_job(strJob);
+				vecOutFiles = convo.GetOutFiles();
+				return bOk;
+			};
+
+			return run_worker(pairHost.first, pairHost.second, funcJob, distopts) ? 0 : -1;
+		}
+
 		if(vecJobs.size() == 0)
 		{
 			tl::log_err("No job files given.");
 			return -1;
 		}
+
+		// coordinator mode, the workers run the jobs
+		if(iCoordPort)
+		{
+			tl::Stopwatch<t_real> watch;
+			watch.start();
+			std::size_t iNumFailed = run_coordinator(vecJobs, iCoordPort, distopts);
+			watch.stop();
+
+			tl::log_info("Execution time: ", tl::get_duration_str_secs<t_real>(watch.GetDur()));
+			return iNumFailed ? -1 : 0;
+		}
 		// --------------------------------------------------------------------
 
 
+		// split the threads between the jobs and the scan points of each job
 		unsigned int iNumThreads = get_max_threads();
-		tl::ThreadPool<bool()> tp(iNumThreads);
+		unsigned int iNumJobThreads = std::max<unsigned int>(1,
+			std::min<unsigned int>(iNumThreads, vecJobs.size()));
+
+		ConvofitBudget budget;
+		budget.iNumThreads = std::max<unsigned int>(1, iNumThreads / iNumJobThreads);
+		tl::log_debug("Running ", iNumJobThreads, " job(s) concurrently with ",
+			budget.iNumThreads, " thread(s) each.");
+
+		tl::ThreadPool<bool()> tp(iNumJobThreads);
 
 		for(std::size_t iJob=0; iJob<vecJobs.size(); ++iJob)
 		{
 			const std::string& strJob = vecJobs[iJob];
-			tp.AddTask([iJob, strJob]() -> bool
+			tp.AddTask([iJob, strJob, budget]() -> bool
 			{
 				tl::log_info("Executing job file ", iJob+1, ": \"", strJob, "\".");
 
 				Convofit convo;
+				convo.SetBudget(budget);
 				return convo.run_job(strJob);
 				//if(argc > 2) tl::log_info("================================================================================");
 			});
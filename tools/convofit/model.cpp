@@ -15,6 +15,10 @@
 #include "tlibs/helper/array.h"
 #include "../res/defs.h"
 #include "../res/helper.h"
+#include "../monteconvo/convo_cubature.h"
+#include "../monteconvo/convo_adaptive.h"
+#include "../monteconvo/convo_importance.h"
+#include "../monteconvo/convo_analytic.h"
 #include "convofit.h"
 
 using t_real = t_real_mod;
@@ -22,14 +26,23 @@ using t_real = t_real_mod;
 
 
 SqwFuncModel::SqwFuncModel(std::shared_ptr<SqwBase> pSqw, const TASReso& reso)
-	: m_pSqw(pSqw)/*, m_reso(reso)*/, m_vecResos({reso})
+	: m_pSqw(pSqw)/*, m_reso(reso)*/, m_vecResos({reso}),
+	m_pCache(std::make_shared<SqwFuncModelCache>())
 {}
 
 SqwFuncModel::SqwFuncModel(std::shared_ptr<SqwBase> pSqw, const std::vector<TASReso>& vecResos)
-	: m_pSqw(pSqw), m_vecResos(vecResos)
+	: m_pSqw(pSqw), m_vecResos(vecResos),
+	m_pCache(std::make_shared<SqwFuncModelCache>())
 {}
 
 
+void SqwFuncModel::ClearCache()
+{
+	std::lock_guard<std::mutex> lock(m_pCache->mtx);
+	m_pCache->map.clear();
+}
+
+
 TASReso* SqwFuncModel::GetTASReso()
 {
 	//TASReso reso = m_reso;
@@ -48,12 +61,18 @@ const TASReso* SqwFuncModel::GetTASReso() const
 }
 
 
-bool SqwFuncModel::SetTASPos(t_real dPrincipalX, TASReso& reso) const
+ublas::vector<t_real> SqwFuncModel::GetScanPos(t_real dPrincipalX) const
 {
 	const t_real xrange = t_real(m_dPrincipalAxisMax - m_dPrincipalAxisMin);
 	const t_real xscale = (t_real(dPrincipalX) - t_real(m_dPrincipalAxisMin)) / xrange;
 
-	const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + xscale*m_vecScanDir;
+	return m_vecScanOrigin + xscale*m_vecScanDir;
+}
+
+
+bool SqwFuncModel::SetTASPos(t_real dPrincipalX, TASReso& reso) const
+{
+	const ublas::vector<t_real> vecScanPos = GetScanPos(dPrincipalX);
 	//tl::log_debug("Scan pos: ", vecScanPos, "(origin: ", m_vecScanOrigin, ", dir: ", m_vecScanDir, "), run param: ", dPrincipalX);
 
 	if(!reso.SetHKLE(vecScanPos[0], vecScanPos[1], vecScanPos[2], vecScanPos[3]))
@@ -69,37 +88,234 @@ bool SqwFuncModel::SetTASPos(t_real dPrincipalX, TASReso& reso) const
 }
 
 
-tl::t_real_min SqwFuncModel::operator()(tl::t_real_min x_principal) const
+/**
+ * random stream of a scan point
+ */
+McRandStream SqwFuncModel::GetRandStream(const ublas::vector<t_real>& vecScanPos) const
 {
-	TASReso/*&*/ reso = *GetTASReso();
-	if(!SetTASPos(t_real_mod(x_principal), reso))
-		return 0.;
+	return McRandStream(m_iRandSeed).Sub(m_iCurParamSet)
+		.SubReal(vecScanPos[0]).SubReal(vecScanPos[1])
+		.SubReal(vecScanPos[2]).SubReal(vecScanPos[3]);
+}
 
-	const t_real xrange = t_real(m_dPrincipalAxisMax - m_dPrincipalAxisMin);
-	const t_real xscale = (t_real(x_principal) - t_real(m_dPrincipalAxisMin)) / xrange;
 
-	const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + t_real(xscale)*m_vecScanDir;
-	std::vector<ublas::vector<t_real_reso>> vecNeutrons;
-	Ellipsoid4d<t_real_reso> elli;
-	if(m_bUseThreads)
-		elli = reso.GenerateMC(m_iNumNeutrons, vecNeutrons);
+/**
+ * generates the mc neutrons of a scan point, with the energy widths for Q-only neutrons
+ */
+void SqwFuncModel::GenerateNeutrons(TASReso& reso, std::size_t iNum,
+	McNeutrons<t_real_reso>& neutrons, std::vector<t_real_reso>& vecSigE) const
+{
+	if(reso.UseAnalyticE())
+		reso.GenerateMC_Q(iNum, neutrons, vecSigE);
+	else if(m_bUseThreads)
+		reso.GenerateMC(iNum, neutrons);
 	else
-		elli = reso.GenerateMC_deferred(m_iNumNeutrons, vecNeutrons);
+		reso.GenerateMC_deferred(iNum, neutrons);
+}
+
+
+SqwFuncModelCache::t_key SqwFuncModel::GetCacheKey(const ublas::vector<t_real>& vecScanPos) const
+{
+	return SqwFuncModelCache::t_key{{ t_real(m_iCurParamSet),
+		vecScanPos[0], vecScanPos[1], vecScanPos[2], vecScanPos[3] }};
+}
+
+
+/**
+ * gets the resolution (and the neutrons) of a scan point from the cache,
+ * calculates them if not yet available; bStore=false does not keep new entries,
+ * e.g. for the plot points, which are only evaluated once
+ */
+std::shared_ptr<const SqwFuncModelCacheEntry>
+SqwFuncModel::GetCacheEntry(const ublas::vector<t_real>& vecScanPos, bool bStore) const
+{
+	const SqwFuncModelCache::t_key key = GetCacheKey(vecScanPos);
+
+	{
+		std::lock_guard<std::mutex> lock(m_pCache->mtx);
+		auto iter = m_pCache->map.find(key);
+		if(iter != m_pCache->map.end())
+			return iter->second;
+	}
+
+	std::shared_ptr<SqwFuncModelCacheEntry> pEntry = std::make_shared<SqwFuncModelCacheEntry>();
+
+	std::shared_ptr<TASReso> pReso = std::make_shared<TASReso>(*GetTASReso());
+	pReso->SetRandStream(GetRandStream(vecScanPos));
+	if(pReso->SetHKLE(vecScanPos[0], vecScanPos[1], vecScanPos[2], vecScanPos[3]))
+	{
+		// with cubature, mc neutrons are only needed if it does not converge,
+		// in adaptive mode the number of neutrons is only known after the first evaluation
+		if(m_bCacheNeutrons && !pReso->UseCubature() && !m_bAdaptive)
+		{
+			std::shared_ptr<McNeutrons<t_real_reso>> pNeutrons = std::make_shared<McNeutrons<t_real_reso>>();
+			GenerateNeutrons(*pReso, m_iNumNeutrons, *pNeutrons, pEntry->vecSigE);
+			pEntry->pNeutrons = pNeutrons;
+			pEntry->iNumNeutrons = m_iNumNeutrons;
+		}
+
+		pEntry->pReso = pReso;
+	}
+	else
+	{
+		std::ostringstream ostrErr;
+		ostrErr << "Invalid crystal position: ("
+			<< vecScanPos[0] << " " << vecScanPos[1] << " " << vecScanPos[2]
+			<< ") rlu, " << vecScanPos[3] << " meV.";
+		tl::log_err(ostrErr.str());
+	}
+
+	if(!bStore)
+		return pEntry;
+
+	std::lock_guard<std::mutex> lock(m_pCache->mtx);
+	// another thread could have been faster
+	return m_pCache->map.emplace(key, pEntry).first->second;
+}
+
+
+/**
+ * adaptive mode: draws neutrons for the scan point until the requested error is reached
+ * and keeps the result in a new cache entry; if neutrons are recycled, the entry
+ * also gets that number of neutrons, which are re-used in all further evaluations
+ */
+std::shared_ptr<const SqwFuncModelCacheEntry>
+SqwFuncModel::GetAdaptiveCacheEntry(const ublas::vector<t_real>& vecScanPos,
+	const std::shared_ptr<const SqwFuncModelCacheEntry>& pEntry, bool bStore) const
+{
+	const TASReso& reso = *pEntry->pReso;
+
+	ConvoAdaptiveOpts<t_real_reso> opts;
+	opts.dRelErr = m_dAdaptiveErr;
+	opts.iMaxNeutrons = m_iNumNeutrons;
+	opts.bUseThreads = m_bUseThreads;
+
+	ConvoAdaptiveResult<t_real_reso> res;
+	convo_mc_adaptive<t_real_reso>(reso, *m_pSqw, GetRandStream(vecScanPos).Sub(m_iRandGen), opts, res);
+	if(!res.bConverged)
+		tl::log_debug("Adaptive convolution did not reach the requested error, S = ", res.dS, " +- ", res.dSErr, ".");
+
+	std::shared_ptr<SqwFuncModelCacheEntry> pNewEntry = std::make_shared<SqwFuncModelCacheEntry>(*pEntry);
+	pNewEntry->bAdaptive = 1;
+	pNewEntry->bAdaptiveConverged = res.bConverged;
+	pNewEntry->dAdaptiveS = res.dS;
+	pNewEntry->dAdaptiveSErr = res.dSErr;
+	pNewEntry->iNumNeutrons = res.iNumNeutrons;
+
+	if(m_bCacheNeutrons && res.iNumNeutrons)
+	{
+		TASReso resoGen = reso;
+		resoGen.SetRandStream(GetRandStream(vecScanPos));
+
+		std::shared_ptr<McNeutrons<t_real_reso>> pNeutrons = std::make_shared<McNeutrons<t_real_reso>>();
+		GenerateNeutrons(resoGen, res.iNumNeutrons, *pNeutrons, pNewEntry->vecSigE);
+		pNewEntry->pNeutrons = pNeutrons;
+	}
+
+	if(!bStore)
+		return pNewEntry;
+
+	std::lock_guard<std::mutex> lock(m_pCache->mtx);
+	std::shared_ptr<const SqwFuncModelCacheEntry>& pStored = m_pCache->map[GetCacheKey(vecScanPos)];
+	// another thread could have been faster
+	if(!pStored || !pStored->pNeutrons)
+		pStored = pNewEntry;
+	return pStored;
+}
+
+
+tl::t_real_min SqwFuncModel::operator()(tl::t_real_min x_principal) const
+{
+	return Eval(x_principal, true);
+}
+
+
+/**
+ * model value at the principal axis position,
+ * bStoreCache=false evaluates points outside the fitted scan without growing the cache
+ */
+tl::t_real_min SqwFuncModel::Eval(tl::t_real_min x_principal, bool bStoreCache) const
+{
+	const ublas::vector<t_real> vecScanPos = GetScanPos(t_real(x_principal));
+
+	std::shared_ptr<const SqwFuncModelCacheEntry> pEntry = GetCacheEntry(vecScanPos, bStoreCache);
+	if(!pEntry->pReso)
+		return 0.;
+	const TASReso& reso = *pEntry->pReso;
 
 	t_real dS = 0.;
 	t_real dhklE_mean[4] = {0., 0., 0., 0.};
 
-	for(const ublas::vector<t_real_reso>& vecHKLE : vecNeutrons)
+	// the mc sums below run over the neutrons of all sample positions
+	if(reso.UseCubature() && convo_cubature<t_real>(reso, *m_pSqw, dS, dhklE_mean))
 	{
-		dS += t_real((*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]));
-
-		for(int i=0; i<4; ++i)
-			dhklE_mean[i] += t_real(vecHKLE[i]);
+		dS *= t_real(reso.GetNumSamplePos());
 	}
+	else
+	{
+		// adaptive mode: find the number of neutrons which the scan point needs
+		if(m_bAdaptive && !pEntry->pNeutrons)
+			pEntry = GetAdaptiveCacheEntry(vecScanPos, pEntry, bStoreCache);
 
-	dS /= t_real(m_iNumNeutrons);
-	for(int i=0; i<4; ++i)
-		dhklE_mean[i] /= t_real(m_iNumNeutrons);
+		if(m_bAdaptive && !pEntry->pNeutrons)
+		{
+			// neutrons are not recycled, use the mean of the adaptive run
+			dS = t_real(pEntry->dAdaptiveS) * t_real(reso.GetNumSamplePos());
+		}
+		else
+		{
+			// use the cached neutrons (in adaptive mode: their converged number) or generate new ones
+			std::size_t iNumNeutrons = m_iNumNeutrons;
+			McNeutrons<t_real_reso> neutronsNew;
+			std::vector<t_real_reso> vecSigENew;
+			const McNeutrons<t_real_reso>* pNeutrons = pEntry->pNeutrons.get();
+			const std::vector<t_real_reso>* pSigE = &pEntry->vecSigE;
+			if(pNeutrons)
+			{
+				iNumNeutrons = pEntry->iNumNeutrons;
+			}
+			else
+			{
+				// new neutrons for every generation of parameters
+				TASReso resoGen = reso;
+				resoGen.SetRandStream(GetRandStream(vecScanPos).Sub(m_iRandGen));
+				GenerateNeutrons(resoGen, m_iNumNeutrons, neutronsNew, vecSigENew);
+				pNeutrons = &neutronsNew;
+				pSigE = &vecSigENew;
+			}
+
+			// the dispersion depends on the fit parameters, so the energies are re-drawn
+			// for every evaluation, starting from the (possibly cached) nominal neutrons
+			if(reso.UseImportance() && !reso.UseAnalyticE())
+			{
+				if(pNeutrons != &neutronsNew)
+					neutronsNew = *pNeutrons;
+				convo_importance<t_real>(reso, *m_pSqw, GetRandStream(vecScanPos).Sub(m_iRandGen).Sub(3), neutronsNew);
+				pNeutrons = &neutronsNew;
+			}
+			const McNeutrons<t_real_reso>& neutrons = *pNeutrons;
+
+			std::vector<t_real_reso> vecS(neutrons.size());
+			if(reso.UseAnalyticE())
+				sqw_gauss_E_neutrons<t_real>(*m_pSqw, neutrons, *pSigE, vecS);
+			else
+				m_pSqw->sqw_batch(neutrons.h.data(), neutrons.k.data(),
+					neutrons.l.data(), neutrons.E.data(), vecS.data(), neutrons.size());
+
+			for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+			{
+				const t_real dW = neutrons.HasWeights() ? t_real(neutrons.w[iNeutr]) : t_real(1);
+				dS += dW*t_real(vecS[iNeutr]);
+
+				dhklE_mean[0] += dW*t_real(neutrons.h[iNeutr]); dhklE_mean[1] += dW*t_real(neutrons.k[iNeutr]);
+				dhklE_mean[2] += dW*t_real(neutrons.l[iNeutr]); dhklE_mean[3] += dW*t_real(neutrons.E[iNeutr]);
+			}
+
+			dS /= t_real(iNumNeutrons);
+			for(int i=0; i<4; ++i)
+				dhklE_mean[i] /= t_real(iNumNeutrons);
+		}
+	}
 
 	if(reso.GetResoParams().flags & CALC_R0)
 		dS *= reso.GetResoResults().dR0;
@@ -128,6 +344,12 @@ SqwFuncModel* SqwFuncModel::copy() const
 	pMod->m_dPrincipalAxisMax = this->m_dPrincipalAxisMax;
 	pMod->m_iNumNeutrons = this->m_iNumNeutrons;
 	pMod->m_bUseThreads = this->m_bUseThreads;
+	pMod->m_pCache = this->m_pCache;
+	pMod->m_bCacheNeutrons = this->m_bCacheNeutrons;
+	pMod->m_iRandSeed = this->m_iRandSeed;
+	pMod->m_iRandGen = this->m_iRandGen;
+	pMod->m_bAdaptive = this->m_bAdaptive;
+	pMod->m_dAdaptiveErr = this->m_dAdaptiveErr;
 	pMod->m_dScale = this->m_dScale;
 	pMod->m_dSlope = this->m_dSlope;
 	pMod->m_dOffs = this->m_dOffs;
@@ -231,6 +453,10 @@ bool SqwFuncModel::SetParams(const std::vector<tl::t_real_min>& vecParams)
 	for(std::size_t iParam=3; iParam<vecParams.size(); ++iParam)
 		m_vecModelParams[iParam-3] = t_real(vecParams[iParam]);
 
+	// fresh neutrons for the new parameters if they are not recycled
+	if(!m_bCacheNeutrons)
+		++m_iRandGen;
+
 	//tl::log_debug("Params:");
 	//for(t_real d : vecParams)
 	//	tl::log_debug(d);
@@ -336,6 +562,47 @@ minuit::MnUserParameters SqwFuncModel::GetMinuitParams() const
 }
 
 
+/**
+ * writes the achieved error and the number of neutrons of the adaptively convolved scan points
+ * of the current scan group; the errors belong to the parameters of the run which determined
+ * the number of neutrons, with recycled neutrons this was the first evaluation of the point
+ */
+void SqwFuncModel::SaveAdaptiveResults(std::ostream& ostr) const
+{
+	std::size_t iNumPts = 0, iNumUnconverged = 0;
+
+	ostr << "## Adaptive convolution of the scan points: (1) h (rlu), (2) k (rlu), (3) l (rlu), (4) E (meV)";
+	ostr << ", (5) S, (6) S error, (7) neutrons per sample position, (8) converged\n";
+
+	std::lock_guard<std::mutex> lock(m_pCache->mtx);
+	for(const auto& pair : m_pCache->map)
+	{
+		const SqwFuncModelCache::t_key& key = pair.first;
+		const SqwFuncModelCacheEntry& entry = *pair.second;
+		if(key[0] != t_real(m_iCurParamSet) || !entry.bAdaptive)
+			continue;
+
+		ostr << "# adaptive: ";
+		for(int i=1; i<5; ++i)
+			ostr << std::left << std::setw(NUM_PREC*2) << key[i] << " ";
+		ostr << std::left << std::setw(NUM_PREC*2) << entry.dAdaptiveS << " "
+			<< std::left << std::setw(NUM_PREC*2) << entry.dAdaptiveSErr << " "
+			<< std::left << std::setw(NUM_PREC) << entry.iNumNeutrons << " "
+			<< entry.bAdaptiveConverged << "\n";
+
+		++iNumPts;
+		if(!entry.bAdaptiveConverged)
+			++iNumUnconverged;
+	}
+
+	if(iNumUnconverged)
+		tl::log_info("Adaptive convolution: ", iNumUnconverged, " of ", iNumPts,
+			" scan points did not reach the requested error of ", m_dAdaptiveErr, ".");
+	else
+		tl::log_info("Adaptive convolution: all ", iNumPts, " scan points reached the requested error.");
+}
+
+
 bool SqwFuncModel::Save(const char *pcFile, std::size_t iNum, std::size_t iSkipBegin, std::size_t iSkipEnd) const
 {
 	if(iSkipBegin + iSkipEnd >= iNum)
@@ -377,7 +644,8 @@ bool SqwFuncModel::Save(const char *pcFile, std::size_t iNum, std::size_t iSkipB
 		for(std::size_t i=iSkipBegin; i<iNum-iSkipEnd; ++i)
 		{
 			t_real dX = tl::lerp(t_real(m_dPrincipalAxisMin), t_real(m_dPrincipalAxisMax), t_real(i)/t_real(iNum-1));
-			t_real dY = (*this)(dX);
+			// the plot points are not part of the fit, so they are not cached
+			t_real dY = t_real(Eval(dX, false));
 
 			ofstr << std::left << std::setw(NUM_PREC*2) << dX << " "
 				<< std::left << std::setw(NUM_PREC*2) << dY << " ";
@@ -415,6 +683,9 @@ bool SqwFuncModel::Save(const char *pcFile, std::size_t iNum, std::size_t iSkipB
 				<< dSig*tl::get_FWHM2SIGMA<t_real>() << " +- "
 				<< dDSig*tl::get_FWHM2SIGMA<t_real>() << "\n";
 		}
+
+		if(m_bAdaptive)
+			SaveAdaptiveResults(ofstr);
 	}
 	catch(const std::exception& ex)
 	{
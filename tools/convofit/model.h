@@ -11,6 +11,10 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <array>
+#include <map>
+#include <mutex>
+#include <cstdint>
 
 #include "tlibs/fit/minuit.h"
 #include <Minuit2/FunctionMinimum.h>
@@ -32,6 +36,40 @@ namespace sig = boost::signals2;
 using t_real_mod = t_real_reso;
 
 
+/**
+ * resolution and mc neutrons of a scan point, which do not depend on the S(q,w) parameters
+ */
+struct SqwFuncModelCacheEntry
+{
+	// nullptr if the position cannot be reached
+	std::shared_ptr<const TASReso> pReso;
+
+	// nullptr if neutrons are not recycled
+	std::shared_ptr<const McNeutrons<t_real_reso>> pNeutrons;
+	// number of neutrons per sample position in pNeutrons
+	std::size_t iNumNeutrons = 0;
+
+	// energy widths of the sample positions for Q-only neutrons
+	std::vector<t_real_reso> vecSigE;
+
+	// adaptive mode: result of the run which determined the number of neutrons
+	bool bAdaptive = 0;
+	bool bAdaptiveConverged = 0;
+	t_real_reso dAdaptiveS = 0., dAdaptiveSErr = 0.;
+};
+
+/**
+ * cache shared between model copies, key: [param set, h, k, l, E]
+ */
+struct SqwFuncModelCache
+{
+	using t_key = std::array<t_real_mod, 5>;
+
+	std::mutex mtx;
+	std::map<t_key, std::shared_ptr<const SqwFuncModelCacheEntry>> map;
+};
+
+
 class SqwFuncModel : public tl::MinuitMultiFuncModel<t_real_mod>
 {
 protected:
@@ -41,6 +79,19 @@ protected:
 	unsigned int m_iNumNeutrons = 1000;
 	bool m_bUseThreads = 1;
 
+	// resolution and neutrons of already calculated scan points
+	std::shared_ptr<SqwFuncModelCache> m_pCache;
+	bool m_bCacheNeutrons = 1;
+
+	// random streams are keyed by (seed, param set, h, k, l, E, generation);
+	// the generation is only advanced if neutrons are not recycled
+	std::uint64_t m_iRandSeed = 0;
+	std::uint64_t m_iRandGen = 0;
+
+	// adaptive number of neutrons per point, m_iNumNeutrons is the upper limit
+	bool m_bAdaptive = 0;
+	t_real_reso m_dAdaptiveErr = 0.01;
+
 	ublas::vector<t_real_mod> m_vecScanOrigin;	// hklE
 	ublas::vector<t_real_mod> m_vecScanDir;		// hklE
 	t_real_mod m_dPrincipalAxisMin, m_dPrincipalAxisMax;
@@ -85,7 +136,17 @@ protected:
 protected:
 	void SetModelParams();
 
+	ublas::vector<t_real_mod> GetScanPos(t_real_mod dX) const;
 	bool SetTASPos(t_real_mod dX, TASReso& reso) const;
+	SqwFuncModelCache::t_key GetCacheKey(const ublas::vector<t_real_mod>& vecScanPos) const;
+	std::shared_ptr<const SqwFuncModelCacheEntry> GetCacheEntry(const ublas::vector<t_real_mod>& vecScanPos,
+		bool bStore=true) const;
+	std::shared_ptr<const SqwFuncModelCacheEntry> GetAdaptiveCacheEntry(const ublas::vector<t_real_mod>& vecScanPos,
+		const std::shared_ptr<const SqwFuncModelCacheEntry>& pEntry, bool bStore=true) const;
+	void GenerateNeutrons(TASReso& reso, std::size_t iNum,
+		McNeutrons<t_real_reso>& neutrons, std::vector<t_real_reso>& vecSigE) const;
+	void SaveAdaptiveResults(std::ostream& ostr) const;
+	tl::t_real_min Eval(tl::t_real_min x, bool bStoreCache) const;
 	TASReso* GetTASReso();
 	const TASReso* GetTASReso() const;
 
@@ -122,11 +183,20 @@ public:
 	void SetOtherParamNames(std::string strTemp, std::string strField);
 	void SetOtherParams(t_real_mod dTemperature, t_real_mod dField);
 
-	void SetReso(const TASReso& reso) { /*m_reso = reso;*/ m_vecResos = {reso}; }
-	void SetResos(const std::vector<TASReso>& vecResos) { m_vecResos = vecResos; }
-	void SetNumNeutrons(unsigned int iNum) { m_iNumNeutrons = iNum; }
+	void SetReso(const TASReso& reso) { /*m_reso = reso;*/ m_vecResos = {reso}; ClearCache(); }
+	void SetResos(const std::vector<TASReso>& vecResos) { m_vecResos = vecResos; ClearCache(); }
+	void SetNumNeutrons(unsigned int iNum) { m_iNumNeutrons = iNum; ClearCache(); }
 	void SetUseThreads(bool b) { m_bUseThreads = b; }
 
+	// re-use the same neutrons for a scan point in all iterations?
+	void SetCacheNeutrons(bool b) { m_bCacheNeutrons = b; ClearCache(); }
+	void ClearCache();
+
+	void SetRandSeed(std::uint64_t iSeed) { m_iRandSeed = iSeed; m_iRandGen = 0; ClearCache(); }
+	McRandStream GetRandStream(const ublas::vector<t_real_mod>& vecScanPos) const;
+
+	void SetAdaptive(bool b, t_real_reso dRelErr) { m_bAdaptive = b; m_dAdaptiveErr = dRelErr; ClearCache(); }
+
 	void SetScanOrigin(t_real_mod h, t_real_mod k, t_real_mod l, t_real_mod E)
 	{ m_vecScanOrigin = tl::make_vec({h,k,l,E}); }
 	void SetScanDir(t_real_mod h, t_real_mod k, t_real_mod l, t_real_mod E)
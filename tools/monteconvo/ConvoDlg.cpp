@@ -43,7 +43,7 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 		spinStopH, spinStopK, spinStopL, spinStopE,
 		spinStopH2, spinStopK2, spinStopL2, spinStopE2,
 		spinKfix,
-		spinTolerance
+		spinTolerance, spinAdaptiveErr
 	};
 
 	m_vecSpinNames = {
@@ -51,7 +51,7 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 		"monteconvo/h_to", "monteconvo/k_to", "monteconvo/l_to", "monteconvo/E_to",
 		"monteconvo/h_to_2", "monteconvo/k_to_2", "monteconvo/l_to_2", "monteconvo/E_to_2",
 		"monteconvo/kfix",
-		"convofit/tolerance"
+		"convofit/tolerance", "monteconvo/adaptive_error"
 	};
 
 	m_vecIntSpinBoxes = { spinNeutrons, spinSampleSteps, spinStepCnt,
@@ -73,17 +73,21 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 	m_vecTextNames = { "convofit/sqw_params" };
 
 	m_vecComboBoxes = { comboAlgo, comboFixedK, comboFocMono, comboFocAna,
-		comboFitter, comboAxis, comboAxis2,
+		comboFitter, comboAxis, comboAxis2, comboSampling,
 	};
 	m_vecComboNames = { "monteconvo/algo", "monteconvo/fixedk", "monteconvo/mono_foc",
 		"monteconvo/ana_foc", "convofit/minimiser", "convofit/scanaxis", "convofit/scanaxis2",
+		"monteconvo/sampling",
 	};
 
 	m_vecCheckBoxes = { checkScan, check2dMap,
-		checkRnd, checkNorm, checkFlip
+		checkRnd, checkNorm, checkFlip, checkAdaptive, checkImportance, checkAnalyticE,
+		checkResoCache
 	};
 	m_vecCheckNames = { "monteconvo/has_scanfile", "monteconvo/scan_2d",
-		"convofit/recycle_neutrons", "convofit/normalise", "convofit/flip_coords"
+		"convofit/recycle_neutrons", "convofit/normalise", "convofit/flip_coords",
+		"monteconvo/adaptive", "monteconvo/importance", "monteconvo/analytic_E",
+		"monteconvo/reso_cache"
 	};
 	// -------------------------------------------------------------------------
 
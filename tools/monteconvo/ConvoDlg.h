@@ -32,6 +32,7 @@
 #include "dialogs/FavDlg.h"
 #include "SqwParamDlg.h"
 #include "TASReso.h"
+#include "reso_cache.h"
 
 
 #define CONVO_MAX_CURVES		32
@@ -51,6 +52,8 @@ protected:
 
 	bool m_bAllowSqwReinit = 1;
 	std::shared_ptr<SqwBase> m_pSqw;
+	// resolution matrices of the earlier convolutions
+	std::shared_ptr<ResoCache> m_pResoCache = std::make_shared<ResoCache>();
 	std::vector<t_real_reso> m_vecQ, m_vecS, m_vecScaledS;
 	std::vector<std::vector<t_real_reso>> m_vecvecQ, m_vecvecE, m_vecvecW;
 	std::unique_ptr<QwtPlotWrapper> m_plotwrap, m_plotwrap2d;
@@ -6,6 +6,10 @@
  */
 
 #include "ConvoDlg.h"
+#include "convo_cubature.h"
+#include "convo_adaptive.h"
+#include "convo_importance.h"
+#include "convo_analytic.h"
 #include "tlibs/time/stopwatch.h"
 #include "tlibs/helper/thread.h"
 #include "tlibs/math/stat.h"
@@ -124,6 +128,12 @@ void ConvoDlg::Start1D()
 
 		const unsigned int iNumNeutrons = spinNeutrons->value();
 		const unsigned int iNumSampleSteps = spinSampleSteps->value();
+
+		// adaptive number of neutrons per point, the neutron count is the upper limit
+		const bool bAdaptive = checkAdaptive->isChecked();
+		ConvoAdaptiveOpts<t_real> optsAdaptive;
+		optsAdaptive.dRelErr = spinAdaptiveErr->value() / t_real(100.);
+		optsAdaptive.iMaxNeutrons = iNumNeutrons;
 		const unsigned int iNumSteps = spinStepCnt->value();
 
 		bool bScanAxisFound = 0;
@@ -202,9 +212,17 @@ void ConvoDlg::Start1D()
 		}
 
 		reso.SetAlgo(ResoAlgo(comboAlgo->currentIndex()+1));
+		// the cubature falls back to quasi-random neutrons
+		const int iSampling = comboSampling->currentIndex();
+		reso.SetSampling(iSampling == 2 ? McNeutronSampling::SOBOL : McNeutronSampling(iSampling));
+		reso.SetCubature(iSampling == 2);
+		reso.SetImportance(checkImportance->isChecked());
+		reso.SetAnalyticE(checkAnalyticE->isChecked());
 		reso.SetKiFix(comboFixedK->currentIndex()==0);
 		reso.SetKFix(spinKfix->value());
 		reso.SetOptimalFocus(GetFocus());
+		if(checkResoCache->isChecked())
+			reso.SetResoCache(m_pResoCache);
 
 
 		if(m_pSqw == nullptr || !m_pSqw->IsOk())
@@ -214,13 +232,22 @@ void ConvoDlg::Start1D()
 			return;
 		}
 
+		// the energy integration is only faster than mc for models with a closed form
+		if(reso.UseAnalyticE() && !m_pSqw->HasGaussEBatch())
+		{
+			tl::log_warn("S(q,w) model has no analytical energy integration, sampling the energy instead.");
+			reso.SetAnalyticE(0);
+		}
+
 
 
 		std::ostringstream ostrOut;
 		ostrOut << "#\n";
-		ostrOut << "# Format: h k l E S\n";
-		ostrOut << "# MC Neutrons: " << iNumNeutrons << "\n";
+		ostrOut << "# Format: h k l E S" << (bAdaptive ? " S_err neutrons" : "") << "\n";
+		ostrOut << "# MC Neutrons: " << iNumNeutrons << (bAdaptive ? " (maximum)" : "") << "\n";
 		ostrOut << "# MC Sample Steps: " << iNumSampleSteps << "\n";
+		if(bAdaptive)
+			ostrOut << "# MC Relative Error: " << optsAdaptive.dRelErr << "\n";
 		ostrOut << "#\n";
 
 		QMetaObject::invokeMethod(editStartTime, "setText",
@@ -243,8 +270,15 @@ void ConvoDlg::Start1D()
 		unsigned int iNumThreads = bForceDeferred ? 0 : get_max_threads();
 		tl::log_debug("Calculating using ", iNumThreads, " threads.");
 
+		// each scan point has its own random stream
+		const unsigned iSeed = tl::get_rand_seed();
+		tl::log_debug("Random seed: ", iSeed, ".");
+
+		// success, S, error of S, number of neutrons
+		using t_taskres = std::tuple<bool, t_real, t_real, std::size_t>;
+
 		void (*pThStartFunc)() = []{ tl::init_rand(); };
-		tl::ThreadPool<std::pair<bool, t_real>()> tp(iNumThreads, pThStartFunc);
+		tl::ThreadPool<t_taskres()> tp(iNumThreads, pThStartFunc);
 		auto& lstFuts = tp.GetFutures();
 
 		for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
@@ -255,13 +289,14 @@ void ConvoDlg::Start1D()
 			t_real dCurE = vecE[iStep];
 
 			tp.AddTask(
-			[&reso, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps, this]()
-				-> std::pair<bool, t_real>
+			[&reso, &optsAdaptive, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps,
+				bAdaptive, iSeed, iStep, this]() -> t_taskres
 			{
-				if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+				if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
 
-				t_real dS = 0.;
+				t_real dS = 0., dSErr = 0.;
 				t_real dhklE_mean[4] = {0., 0., 0., 0.};
+				std::size_t iNumNeutrUsed = 0;
 
 				if(iNumNeutrons == 0)
 				{	// if no neutrons are given, just plot the unconvoluted S(q,w)
@@ -271,7 +306,8 @@ void ConvoDlg::Start1D()
 				{	// convolution
 					TASReso localreso = reso;
 					localreso.SetRandomSamplePos(iNumSampleSteps);
-					std::vector<ublas::vector<t_real>> vecNeutrons;
+					localreso.SetRandStream(McRandStream(iSeed).Sub(iStep));
+					McNeutrons<t_real> neutrons;
 
 					try
 					{
@@ -288,32 +324,75 @@ void ConvoDlg::Start1D()
 					{
 						//QMessageBox::critical(this, "Error", ex.what());
 						tl::log_err(ex.what());
-						return std::pair<bool, t_real>(false, 0.);
+						return t_taskres(false, 0., 0., 0);
 					}
 
-					Ellipsoid4d<t_real> elli =
-						localreso.GenerateMC_deferred(iNumNeutrons, vecNeutrons);
+					// mc neutrons if the cubature is disabled or does not converge
+					const bool bCubature = localreso.UseCubature() &&
+						convo_cubature<t_real>(localreso, *m_pSqw, dS, dhklE_mean);
 
-					for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
+					if(!bCubature && bAdaptive)
 					{
-						if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+						ConvoAdaptiveResult<t_real> resAdaptive;
+						if(!convo_mc_adaptive<t_real>(localreso, *m_pSqw,
+							McRandStream(iSeed).Sub(iStep).Sub(2), optsAdaptive, resAdaptive, &m_atStop))
+							return t_taskres(false, 0., 0., 0);
+
+						dS = resAdaptive.dS;
+						dSErr = resAdaptive.dSErr;
+						iNumNeutrUsed = resAdaptive.iNumNeutrons;
+						for(int i=0; i<4; ++i)
+							dhklE_mean[i] = resAdaptive.dhklE_mean[i];
+					}
+					else if(!bCubature)
+					{
+						std::vector<t_real> vecS;
+						if(localreso.UseAnalyticE())
+						{
+							convo_analytic_E<t_real>(localreso, *m_pSqw, iNumNeutrons, neutrons, vecS);
+						}
+						else
+						{
+							localreso.GenerateMC_deferred(iNumNeutrons, neutrons);
+							if(localreso.UseImportance())
+								convo_importance<t_real>(localreso, *m_pSqw, McRandStream(iSeed).Sub(iStep).Sub(3), neutrons);
+
+							if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
+
+							vecS.resize(neutrons.size());
+							m_pSqw->sqw_batch(neutrons.h.data(), neutrons.k.data(),
+								neutrons.l.data(), neutrons.E.data(), vecS.data(), neutrons.size());
+						}
 
-						dS += (*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
+						if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
 
+						for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+						{
+							const t_real dW = neutrons.HasWeights() ? neutrons.w[iNeutr] : t_real(1);
+							dS += dW*vecS[iNeutr];
+
+							dhklE_mean[0] += dW*neutrons.h[iNeutr]; dhklE_mean[1] += dW*neutrons.k[iNeutr];
+							dhklE_mean[2] += dW*neutrons.l[iNeutr]; dhklE_mean[3] += dW*neutrons.E[iNeutr];
+						}
+
+						dS /= t_real(iNumNeutrons*iNumSampleSteps);
 						for(int i=0; i<4; ++i)
-							dhklE_mean[i] += vecHKLE[i];
+							dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
+						iNumNeutrUsed = iNumNeutrons;
 					}
 
-					dS /= t_real(iNumNeutrons*iNumSampleSteps);
-					for(int i=0; i<4; ++i)
-						dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
-
 					if(localreso.GetResoParams().flags & CALC_R0)
+					{
 						dS *= localreso.GetResoResults().dR0;
+						dSErr *= localreso.GetResoResults().dR0;
+					}
 					if(localreso.GetResoParams().flags & CALC_RESVOL)
+					{
 						dS /= localreso.GetResoResults().dResVol * tl::get_pi<t_real>() * t_real(3.);
+						dSErr /= localreso.GetResoResults().dResVol * tl::get_pi<t_real>() * t_real(3.);
+					}
 				}
-				return std::pair<bool, t_real>(true, dS);
+				return t_taskres(true, dS, dSErr, iNumNeutrUsed);
 			});
 		}
 
@@ -321,6 +400,7 @@ void ConvoDlg::Start1D()
 
 		auto iterTask = tp.GetTasks().begin();
 		unsigned int iStep = 0;
+		std::size_t iNumNeutrUsedTotal = 0;
 		for(auto &fut : lstFuts)
 		{
 			if(m_atStop.load()) break;
@@ -332,9 +412,10 @@ void ConvoDlg::Start1D()
 				++iterTask;
 			}
 
-			std::pair<bool, t_real> pairS = fut.get();
-			if(!pairS.first) break;
-			t_real dS = pairS.second;
+			t_taskres resS = fut.get();
+			if(!std::get<0>(resS)) break;
+			t_real dS = std::get<1>(resS);
+			iNumNeutrUsedTotal += std::get<3>(resS);
 			if(tl::is_nan_or_inf(dS))
 			{
 				dS = t_real(0);
@@ -346,7 +427,13 @@ void ConvoDlg::Start1D()
 				<< std::left << std::setw(g_iPrec*2) << vecK[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecL[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecE[iStep] << " "
-				<< std::left << std::setw(g_iPrec*2) << dS << "\n";
+				<< std::left << std::setw(g_iPrec*2) << dS;
+			if(bAdaptive)
+			{
+				ostrOut << " " << std::left << std::setw(g_iPrec*2) << std::get<2>(resS)
+					<< " " << std::left << std::setw(g_iPrec*2) << std::get<3>(resS);
+			}
+			ostrOut << "\n";
 
 			const t_real dXVal = (*pVecScanX)[iStep];
 			t_real dYVal = dScale*(dS + dSlope*dXVal) + dOffs;
@@ -411,7 +498,11 @@ void ConvoDlg::Start1D()
 			if(bLiveResults || bIsLastStep)
 			{
 				if(bIsLastStep)
+				{
+					if(bAdaptive)
+						tl::log_info("Used ", iNumNeutrUsedTotal, " neutrons per sample position in total.");
 					ostrOut << "# ------------------------- EOF -------------------------\n";
+				}
 
 				QMetaObject::invokeMethod(textResult, "setPlainText", connty,
 					Q_ARG(const QString&, QString(ostrOut.str().c_str())));
@@ -531,6 +622,12 @@ void ConvoDlg::Start2D()
 		const unsigned int iNumNeutrons = spinNeutrons->value();
 		const unsigned int iNumSampleSteps = spinSampleSteps->value();
 
+		// adaptive number of neutrons per point, the neutron count is the upper limit
+		const bool bAdaptive = checkAdaptive->isChecked();
+		ConvoAdaptiveOpts<t_real> optsAdaptive;
+		optsAdaptive.dRelErr = spinAdaptiveErr->value() / t_real(100.);
+		optsAdaptive.iMaxNeutrons = iNumNeutrons;
+
 		const unsigned int iNumSteps = std::sqrt(spinStepCnt->value());
 		const t_real dStartHKL[] =
 		{
@@ -657,9 +754,17 @@ void ConvoDlg::Start2D()
 
 
 		reso.SetAlgo(ResoAlgo(comboAlgo->currentIndex()+1));
+		// the cubature falls back to quasi-random neutrons
+		const int iSampling = comboSampling->currentIndex();
+		reso.SetSampling(iSampling == 2 ? McNeutronSampling::SOBOL : McNeutronSampling(iSampling));
+		reso.SetCubature(iSampling == 2);
+		reso.SetImportance(checkImportance->isChecked());
+		reso.SetAnalyticE(checkAnalyticE->isChecked());
 		reso.SetKiFix(comboFixedK->currentIndex()==0);
 		reso.SetKFix(spinKfix->value());
 		reso.SetOptimalFocus(GetFocus());
+		if(checkResoCache->isChecked())
+			reso.SetResoCache(m_pResoCache);
 
 		if(m_pSqw == nullptr || !m_pSqw->IsOk())
 		{
@@ -668,12 +773,21 @@ void ConvoDlg::Start2D()
 			return;
 		}
 
+		// the energy integration is only faster than mc for models with a closed form
+		if(reso.UseAnalyticE() && !m_pSqw->HasGaussEBatch())
+		{
+			tl::log_warn("S(q,w) model has no analytical energy integration, sampling the energy instead.");
+			reso.SetAnalyticE(0);
+		}
+
 
 		std::ostringstream ostrOut;
 		ostrOut << "#\n";
-		ostrOut << "# Format: h k l E S\n";
-		ostrOut << "# MC Neutrons: " << iNumNeutrons << "\n";
+		ostrOut << "# Format: h k l E S" << (bAdaptive ? " S_err neutrons" : "") << "\n";
+		ostrOut << "# MC Neutrons: " << iNumNeutrons << (bAdaptive ? " (maximum)" : "") << "\n";
 		ostrOut << "# MC Sample Steps: " << iNumSampleSteps << "\n";
+		if(bAdaptive)
+			ostrOut << "# MC Relative Error: " << optsAdaptive.dRelErr << "\n";
 		ostrOut << "#\n";
 
 		QMetaObject::invokeMethod(editStartTime2d, "setText",
@@ -712,8 +826,15 @@ void ConvoDlg::Start2D()
 		unsigned int iNumThreads = bForceDeferred ? 0 : get_max_threads();
 		tl::log_debug("Calculating using ", iNumThreads, " threads.");
 
+		// each scan point has its own random stream
+		const unsigned iSeed = tl::get_rand_seed();
+		tl::log_debug("Random seed: ", iSeed, ".");
+
+		// success, S, error of S, number of neutrons
+		using t_taskres = std::tuple<bool, t_real, t_real, std::size_t>;
+
 		void (*pThStartFunc)() = []{ tl::init_rand(); };
-		tl::ThreadPool<std::pair<bool, t_real>()> tp(iNumThreads, pThStartFunc);
+		tl::ThreadPool<t_taskres()> tp(iNumThreads, pThStartFunc);
 		auto& lstFuts = tp.GetFutures();
 
 		for(unsigned int iStep=0; iStep<iNumSteps*iNumSteps; ++iStep)
@@ -724,13 +845,14 @@ void ConvoDlg::Start2D()
 			t_real dCurE = vecE[iStep];
 
 			tp.AddTask(
-			[&reso, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps, this]()
-				-> std::pair<bool, t_real>
+			[&reso, &optsAdaptive, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps,
+				bAdaptive, iSeed, iStep, this]() -> t_taskres
 			{
-				if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+				if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
 
-				t_real dS = 0.;
+				t_real dS = 0., dSErr = 0.;
 				t_real dhklE_mean[4] = {0., 0., 0., 0.};
+				std::size_t iNumNeutrUsed = 0;
 
 				if(iNumNeutrons == 0)
 				{	// if no neutrons are given, just plot the unconvoluted S(q,w)
@@ -740,7 +862,8 @@ void ConvoDlg::Start2D()
 				{	// convolution
 					TASReso localreso = reso;
 					localreso.SetRandomSamplePos(iNumSampleSteps);
-					std::vector<ublas::vector<t_real>> vecNeutrons;
+					localreso.SetRandStream(McRandStream(iSeed).Sub(iStep));
+					McNeutrons<t_real> neutrons;
 
 					try
 					{
@@ -757,32 +880,75 @@ void ConvoDlg::Start2D()
 					{
 						//QMessageBox::critical(this, "Error", ex.what());
 						tl::log_err(ex.what());
-						return std::pair<bool, t_real>(false, 0.);
+						return t_taskres(false, 0., 0., 0);
 					}
 
-					Ellipsoid4d<t_real> elli =
-						localreso.GenerateMC_deferred(iNumNeutrons, vecNeutrons);
+					// mc neutrons if the cubature is disabled or does not converge
+					const bool bCubature = localreso.UseCubature() &&
+						convo_cubature<t_real>(localreso, *m_pSqw, dS, dhklE_mean);
 
-					for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
+					if(!bCubature && bAdaptive)
 					{
-						if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+						ConvoAdaptiveResult<t_real> resAdaptive;
+						if(!convo_mc_adaptive<t_real>(localreso, *m_pSqw,
+							McRandStream(iSeed).Sub(iStep).Sub(2), optsAdaptive, resAdaptive, &m_atStop))
+							return t_taskres(false, 0., 0., 0);
+
+						dS = resAdaptive.dS;
+						dSErr = resAdaptive.dSErr;
+						iNumNeutrUsed = resAdaptive.iNumNeutrons;
+						for(int i=0; i<4; ++i)
+							dhklE_mean[i] = resAdaptive.dhklE_mean[i];
+					}
+					else if(!bCubature)
+					{
+						std::vector<t_real> vecS;
+						if(localreso.UseAnalyticE())
+						{
+							convo_analytic_E<t_real>(localreso, *m_pSqw, iNumNeutrons, neutrons, vecS);
+						}
+						else
+						{
+							localreso.GenerateMC_deferred(iNumNeutrons, neutrons);
+							if(localreso.UseImportance())
+								convo_importance<t_real>(localreso, *m_pSqw, McRandStream(iSeed).Sub(iStep).Sub(3), neutrons);
+
+							if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
+
+							vecS.resize(neutrons.size());
+							m_pSqw->sqw_batch(neutrons.h.data(), neutrons.k.data(),
+								neutrons.l.data(), neutrons.E.data(), vecS.data(), neutrons.size());
+						}
 
-						dS += (*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
+						if(m_atStop.load()) return t_taskres(false, 0., 0., 0);
 
+						for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+						{
+							const t_real dW = neutrons.HasWeights() ? neutrons.w[iNeutr] : t_real(1);
+							dS += dW*vecS[iNeutr];
+
+							dhklE_mean[0] += dW*neutrons.h[iNeutr]; dhklE_mean[1] += dW*neutrons.k[iNeutr];
+							dhklE_mean[2] += dW*neutrons.l[iNeutr]; dhklE_mean[3] += dW*neutrons.E[iNeutr];
+						}
+
+						dS /= t_real(iNumNeutrons*iNumSampleSteps);
 						for(int i=0; i<4; ++i)
-							dhklE_mean[i] += vecHKLE[i];
+							dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
+						iNumNeutrUsed = iNumNeutrons;
 					}
 
-					dS /= t_real(iNumNeutrons*iNumSampleSteps);
-					for(int i=0; i<4; ++i)
-						dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
-
 					if(localreso.GetResoParams().flags & CALC_R0)
+					{
 						dS *= localreso.GetResoResults().dR0;
+						dSErr *= localreso.GetResoResults().dR0;
+					}
 					if(localreso.GetResoParams().flags & CALC_RESVOL)
+					{
 						dS /= localreso.GetResoResults().dResVol * tl::get_pi<t_real>() * t_real(3.);
+						dSErr /= localreso.GetResoResults().dResVol * tl::get_pi<t_real>() * t_real(3.);
+					}
 				}
-				return std::pair<bool, t_real>(true, dS);
+				return t_taskres(true, dS, dSErr, iNumNeutrUsed);
 			});
 		}
 
@@ -790,6 +956,7 @@ void ConvoDlg::Start2D()
 
 		auto iterTask = tp.GetTasks().begin();
 		unsigned int iStep = 0;
+		std::size_t iNumNeutrUsedTotal = 0;
 		for(auto &fut : lstFuts)
 		{
 			if(m_atStop.load()) break;
@@ -801,9 +968,10 @@ void ConvoDlg::Start2D()
 				++iterTask;
 			}
 
-			std::pair<bool, t_real> pairS = fut.get();
-			if(!pairS.first) break;
-			t_real dS = pairS.second;
+			t_taskres resS = fut.get();
+			if(!std::get<0>(resS)) break;
+			t_real dS = std::get<1>(resS);
+			iNumNeutrUsedTotal += std::get<3>(resS);
 			if(tl::is_nan_or_inf(dS))
 			{
 				dS = t_real(0);
@@ -815,7 +983,13 @@ void ConvoDlg::Start2D()
 				<< std::left << std::setw(g_iPrec*2) << vecK[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecL[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecE[iStep] << " "
-				<< std::left << std::setw(g_iPrec*2) << dS << "\n";
+				<< std::left << std::setw(g_iPrec*2) << dS;
+			if(bAdaptive)
+			{
+				ostrOut << " " << std::left << std::setw(g_iPrec*2) << std::get<2>(resS)
+					<< " " << std::left << std::setw(g_iPrec*2) << std::get<3>(resS);
+			}
+			ostrOut << "\n";
 
 			m_plotwrap2d->GetRaster()->SetPixel(iStep%iNumSteps, iStep/iNumSteps, t_real_qwt(dS));
 
@@ -832,7 +1006,11 @@ void ConvoDlg::Start2D()
 			if(bLiveResults || bIsLastStep)
 			{
 				if(bIsLastStep)
+				{
+					if(bAdaptive)
+						tl::log_info("Used ", iNumNeutrUsedTotal, " neutrons per sample position in total.");
 					ostrOut << "# ------------------------- EOF -------------------------\n";
+				}
 				QMetaObject::invokeMethod(textResult, "setPlainText", connty,
 					Q_ARG(const QString&, QString(ostrOut.str().c_str())));
 			}
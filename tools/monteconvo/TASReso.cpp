@@ -6,6 +6,7 @@
  */
 
 #include "TASReso.h"
+#include "reso_cache.h"
 #include "tlibs/phys/lattice.h"
 #include "tlibs/math/rand.h"
 #include "tlibs/file/prop.h"
@@ -53,6 +54,17 @@ const TASReso& TASReso::operator=(const TASReso& res)
 	this->m_res = res.m_res;
 	this->m_bKiFix = res.m_bKiFix;
 	this->m_dKFix = res.m_dKFix;
+	this->m_rng = res.m_rng;
+	this->m_bUseRng = res.m_bUseRng;
+	this->m_bCubature = res.m_bCubature;
+	this->m_iCubMaxLevel = res.m_iCubMaxLevel;
+	this->m_dCubTol = res.m_dCubTol;
+	this->m_bImportance = res.m_bImportance;
+	this->m_dImpWidth = res.m_dImpWidth;
+	this->m_bAnalyticE = res.m_bAnalyticE;
+	this->m_pCache = res.m_pCache;
+	this->m_iParamHash = res.m_iParamHash;
+	this->m_bParamHashValid = res.m_bParamHashValid;
 	//this->m_bEnableThreads = res.m_bEnableThreads;
 
 	return *this;
@@ -281,6 +293,8 @@ bool TASReso::LoadRes(const char* pcXmlFile)
 	m_tofreso.Q = m_reso.Q = xml.Query<t_real>((strXmlRoot + "reso/Q").c_str(), 0.) / angs;
 
 	m_dKFix = m_bKiFix ? m_reso.ki*angs : m_reso.kf*angs;
+	m_bParamHashValid = 0;
+	UpdateParamHash();
 	return true;
 }
 
@@ -331,37 +345,37 @@ bool TASReso::SetLattice(t_real a, t_real b, t_real c,
 	return true;
 }
 
-bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
-{
-	static const t_real s_dPlaneDistTolerance = std::cbrt(tl::get_epsilon<t_real>());
-
-	ResoResults& resores = m_res[0];
-
-	//std::cout << "UB = " << m_opts.matUB << std::endl;
-	//std::cout << h << " " << k << " " << l << ", " << E << std::endl;
-	if(m_opts.matUB.size1() < 3 || m_opts.matUB.size2() < 3)
-	{
-		const char* pcErr = "Invalid UB matrix.";
-		tl::log_err(pcErr);
-		resores.strErr = pcErr;
-		resores.bOk = false;
-		return false;
-	}
 
-	t_vec vecHKLE;
-	if(m_opts.matUB.size1() == 3)
-		vecHKLE = tl::make_vec({h, k, l});
-	else
-		vecHKLE = tl::make_vec({h, k, l, E});
+/**
+ * sets the mirror curvatures according to the selected focus mode
+ */
+void TASReso::ApplyFocus(EckParams& reso) const
+{
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_FLAT)) != 0)	// flat mono
+		reso.bMonoIsCurvedH = reso.bMonoIsCurvedV = 0;
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_H)) != 0)	// optimally curved mono (h)
+		reso.bMonoIsCurvedH = reso.bMonoIsOptimallyCurvedH = 1;
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_V)) != 0)	// optimally curved mono (v)
+		reso.bMonoIsCurvedV = reso.bMonoIsOptimallyCurvedV = 1;
+
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_FLAT)) != 0)	// flat ana
+		reso.bAnaIsCurvedH = reso.bAnaIsCurvedV = 0;
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_H)) != 0)		// optimally curved ana (h)
+		reso.bAnaIsCurvedH = reso.bAnaIsOptimallyCurvedH = 1;
+	if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_V)) != 0)		// optimally curved ana (v)
+		reso.bAnaIsCurvedV = reso.bAnaIsOptimallyCurvedV = 1;
+}
 
-	t_vec vecQ = ublas::prod(m_opts.matUB, vecHKLE);
-	if(vecQ.size() > 3)
-		vecQ.resize(3, true);
 
-	m_tofreso.Q = m_reso.Q = ublas::norm_2(vecQ) / angs;
-	m_tofreso.E = m_reso.E = E * meV;
+/**
+ * sets the angles of the scattering triangle at |Q| and E
+ */
+void TASReso::SetScatteringTriangle(t_real dQ, t_real dE)
+{
+	m_tofreso.Q = m_reso.Q = dQ / angs;
+	m_tofreso.E = m_reso.E = dE * meV;
 
-	//tl::log_info("kfix = ", m_dKFix, ", E = ", E, ", Q = ", vecQ);
+	//tl::log_info("kfix = ", m_dKFix, ", E = ", dE, ", Q = ", dQ);
 	wavenumber kother = tl::get_other_k(m_reso.E, m_dKFix/angs, m_bKiFix);
 	//tl::log_info("kother = ", t_real(kother*angs));
 	if(m_bKiFix)
@@ -385,6 +399,163 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 
 	m_tofreso.angle_ki_Q = m_reso.angle_ki_Q = tl::get_angle_ki_Q(m_reso.ki, m_reso.kf, m_reso.Q, /*m_reso.dsample_sense>=0.*/1);
 	m_tofreso.angle_kf_Q = m_reso.angle_kf_Q = tl::get_angle_kf_Q(m_reso.ki, m_reso.kf, m_reso.Q, /*m_reso.dsample_sense>=0.*/1);
+}
+
+
+/**
+ * calculates the resolution at the current scattering triangle and sample position
+ */
+bool TASReso::CalcReso(ResoResults& res)
+{
+	if(m_algo == ResoAlgo::CN)
+	{
+		//tl::log_info("Algorithm: Cooper-Nathans (TAS)");
+		res = calc_cn(m_reso);
+	}
+	else if(m_algo == ResoAlgo::POP)
+	{
+		//tl::log_info("Algorithm: Popovici (TAS)");
+		res = calc_pop(m_reso);
+	}
+	else if(m_algo == ResoAlgo::ECK)
+	{
+		//tl::log_info("Algorithm: Eckold-Sobolev (TAS)");
+		res = calc_eck(m_reso);
+	}
+	else if(m_algo == ResoAlgo::VIOL)
+	{
+		//tl::log_info("Algorithm: Violini (TOF)");
+		m_reso.flags &= ~CALC_R0;
+		res = calc_viol(m_tofreso);
+	}
+	else
+	{
+		const char* pcErr = "Unknown algorithm selected.";
+		tl::log_err(pcErr);
+		res.strErr = pcErr;
+		res.bOk = false;
+		return false;
+	}
+
+	return true;
+}
+
+
+void TASReso::UpdateParamHash()
+{
+	if(!m_pCache || m_bParamHashValid)
+		return;
+
+	m_iParamHash = CalcParamHash();
+	m_bParamHashValid = 1;
+}
+
+
+/**
+ * hash of all instrument parameters which enter the resolution at a given |Q| and E
+ */
+std::uint64_t TASReso::CalcParamHash() const
+{
+	ResoParamHash hash;
+
+	// the focus is applied to the parameters in SetHKLE, hash the focused mirror curvatures
+	EckParams resoFoc = m_reso;
+	ApplyFocus(resoFoc);
+
+	hash.AddInt(int(m_algo));
+	hash.AddInt(unsigned(m_foc));
+	hash.AddInt(m_bKiFix);
+	hash.AddReal(m_dKFix);
+
+	// tas
+	for(const auto& q : { m_reso.mono_d, m_reso.ana_d })
+		hash.AddQuantity(q);
+	for(const auto& q : { m_reso.mono_mosaic, m_reso.ana_mosaic, m_reso.sample_mosaic,
+		m_reso.mono_mosaic_v, m_reso.ana_mosaic_v,
+		m_reso.coll_h_pre_mono, m_reso.coll_h_pre_sample, m_reso.coll_h_post_sample, m_reso.coll_h_post_ana,
+		m_reso.coll_v_pre_mono, m_reso.coll_v_pre_sample, m_reso.coll_v_post_sample, m_reso.coll_v_post_ana,
+		m_reso.guide_div_h, m_reso.guide_div_v })
+		hash.AddQuantity(q);
+	for(int i=0; i<3; ++i)
+	{
+		hash.AddQuantity(m_reso.sample_lattice[i]);
+		hash.AddQuantity(m_reso.sample_angles[i]);
+	}
+	for(const auto& q : { m_reso.mono_w, m_reso.mono_h, m_reso.mono_thick, m_reso.mono_curvh, m_reso.mono_curvv,
+		m_reso.ana_w, m_reso.ana_h, m_reso.ana_thick, m_reso.ana_curvh, m_reso.ana_curvv,
+		m_reso.sample_w_q, m_reso.sample_w_perpq, m_reso.sample_h,
+		m_reso.src_w, m_reso.src_h, m_reso.det_w, m_reso.det_h,
+		m_reso.dist_mono_sample, m_reso.dist_sample_ana, m_reso.dist_ana_det, m_reso.dist_src_mono,
+		m_reso.pos_x, m_reso.pos_y, m_reso.pos_z })
+		hash.AddQuantity(q);
+	for(t_real d : { m_reso.dmono_sense, m_reso.dana_sense, m_reso.dsample_sense,
+		m_reso.dmono_refl, m_reso.dana_effic })
+		hash.AddReal(d);
+	for(bool b : { resoFoc.bMonoIsCurvedH, resoFoc.bMonoIsCurvedV,
+		resoFoc.bMonoIsOptimallyCurvedH, resoFoc.bMonoIsOptimallyCurvedV,
+		resoFoc.bAnaIsCurvedH, resoFoc.bAnaIsCurvedV,
+		resoFoc.bAnaIsOptimallyCurvedH, resoFoc.bAnaIsOptimallyCurvedV,
+		m_reso.bSampleCub, m_reso.bSrcRect, m_reso.bDetRect, m_reso.bGuide })
+		hash.AddInt(b);
+	for(unsigned int i : { m_reso.mono_numtiles_v, m_reso.mono_numtiles_h,
+		m_reso.ana_numtiles_v, m_reso.ana_numtiles_h })
+		hash.AddInt(i);
+	hash.AddInt(std::int64_t(m_reso.flags));
+
+	// the reflectivity curves are sampled, they have no other identity
+	for(const auto& pCurve : { m_reso.mono_refl_curve, m_reso.ana_effic_curve })
+	{
+		const bool bCurve = pCurve && *pCurve;
+		hash.AddInt(bCurve);
+		if(!bCurve)
+			continue;
+		for(t_real dK=0.5; dK<=10.; dK+=0.25)
+			hash.AddReal((*pCurve)(dK));
+	}
+
+	// tof
+	for(const auto& q : { m_tofreso.len_pulse_mono, m_tofreso.len_mono_sample, m_tofreso.len_sample_det,
+		m_tofreso.sig_len_pulse_mono, m_tofreso.sig_len_mono_sample, m_tofreso.sig_len_sample_det })
+		hash.AddQuantity(q);
+	for(const auto& q : { m_tofreso.sig_pulse, m_tofreso.sig_mono, m_tofreso.sig_det })
+		hash.AddQuantity(q);
+	for(const auto& q : { m_tofreso.angle_outplane_i, m_tofreso.angle_outplane_f, m_tofreso.twotheta_i,
+		m_tofreso.sig_twotheta_f, m_tofreso.sig_outplane_f, m_tofreso.sig_twotheta_i, m_tofreso.sig_outplane_i })
+		hash.AddQuantity(q);
+	hash.AddInt(int(m_tofreso.det_shape));
+
+	return hash.GetHash();
+}
+
+
+bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
+{
+	static const t_real s_dPlaneDistTolerance = std::cbrt(tl::get_epsilon<t_real>());
+
+	ResoResults& resores = m_res[0];
+
+	//std::cout << "UB = " << m_opts.matUB << std::endl;
+	//std::cout << h << " " << k << " " << l << ", " << E << std::endl;
+	if(m_opts.matUB.size1() < 3 || m_opts.matUB.size2() < 3)
+	{
+		const char* pcErr = "Invalid UB matrix.";
+		tl::log_err(pcErr);
+		resores.strErr = pcErr;
+		resores.bOk = false;
+		return false;
+	}
+
+	t_vec vecHKLE;
+	if(m_opts.matUB.size1() == 3)
+		vecHKLE = tl::make_vec({h, k, l});
+	else
+		vecHKLE = tl::make_vec({h, k, l, E});
+
+	t_vec vecQ = ublas::prod(m_opts.matUB, vecHKLE);
+	if(vecQ.size() > 3)
+		vecQ.resize(3, true);
+
+	SetScatteringTriangle(ublas::norm_2(vecQ), E);
 
 	//tl::log_info("kiQ = ", tl::r2d(m_reso.angle_ki_Q/rads));
 	//m_reso.angle_ki_Q = units::abs(m_reso.angle_ki_Q);
@@ -393,19 +564,7 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 
 	if(m_foc != ResoFocus::FOC_UNCHANGED)
 	{
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_FLAT)) != 0)		// flat mono
-			m_reso.bMonoIsCurvedH = m_reso.bMonoIsCurvedV = 0;
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_H)) != 0)		// optimally curved mono (h)
-			m_reso.bMonoIsCurvedH = m_reso.bMonoIsOptimallyCurvedH = 1;
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_V)) != 0)		// optimally curved mono (v)
-			m_reso.bMonoIsCurvedV = m_reso.bMonoIsOptimallyCurvedV = 1;
-
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_FLAT)) != 0)		// flat ana
-			m_reso.bAnaIsCurvedH = m_reso.bAnaIsCurvedV = 0;
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_H)) != 0)			// optimally curved ana (h)
-			m_reso.bAnaIsCurvedH = m_reso.bAnaIsOptimallyCurvedH = 1;
-		if((unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_V)) != 0)			// optimally curved ana (v)
-			m_reso.bAnaIsCurvedV = m_reso.bAnaIsOptimallyCurvedV = 1;
+		ApplyFocus(m_reso);
 
 		//tl::log_info("Mono focus (h,v): ", m_reso.bMonoIsOptimallyCurvedH, ", ", m_reso.bMonoIsOptimallyCurvedV);
 		//tl::log_info("Ana focus (h,v): ", m_reso.bAnaIsOptimallyCurvedH, ", ", m_reso.bAnaIsOptimallyCurvedV);
@@ -453,10 +612,23 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 	//tl::log_info("angle Q vec0 = ", m_opts.dAngleQVec0);
 	//tl::log_info("calc r0: ", m_reso.bCalcR0);
 
-	for(ResoResults& resores_cur : m_res)
+	for(std::size_t iSamplePos=0; iSamplePos<m_res.size(); ++iSamplePos)
 	{
+		ResoResults& resores_cur = m_res[iSamplePos];
+
 		// if only one sample position is requested, don't randomise
-		if(m_res.size() > 1)
+		if(m_res.size() > 1 && m_bUseRng)
+		{
+			const McRandStream rngPos = m_rng.Sub(iSamplePos).Sub(1);
+
+			m_reso.pos_x = rngPos.Norm<t_real>(0) *
+				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_w_q/cm) * cm;
+			m_reso.pos_y = rngPos.Norm<t_real>(1) *
+				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_w_perpq/cm) * cm;
+			m_reso.pos_z = rngPos.Norm<t_real>(2) *
+				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_h/cm) * cm;
+		}
+		else if(m_res.size() > 1)
 		{
 			// TODO: use selected sample geometry
 			/*m_reso.pos_x = tl::rand_real(-t_real(m_reso.sample_w_q*0.5/cm),
@@ -474,34 +646,25 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_h/cm)) * cm;
 		}
 
-		// calculate resolution at (hkl) and E
-		if(m_algo == ResoAlgo::CN)
-		{
-			//tl::log_info("Algorithm: Cooper-Nathans (TAS)");
-			resores_cur = calc_cn(m_reso);
-		}
-		else if(m_algo == ResoAlgo::POP)
+		// calculate resolution at (hkl) and E, the cache is only used for a fixed sample position
+		if(m_pCache && m_res.size() == 1)
 		{
-			//tl::log_info("Algorithm: Popovici (TAS)");
-			resores_cur = calc_pop(m_reso);
+			const t_real dQ = t_real(m_reso.Q * angs);
+			UpdateParamHash();
+			resores_cur = m_pCache->Get(m_iParamHash, dQ, E,
+				[this](t_real dQNode, t_real dENode) -> ResoResults
+				{
+					ResoResults resNode;
+					SetScatteringTriangle(dQNode, dENode);
+					CalcReso(resNode);
+					return resNode;
+				});
+
+			// the nodes of the cache have changed the triangle
+			SetScatteringTriangle(dQ, E);
 		}
-		else if(m_algo == ResoAlgo::ECK)
+		else if(!CalcReso(resores_cur))
 		{
-			//tl::log_info("Algorithm: Eckold-Sobolev (TAS)");
-			resores_cur = calc_eck(m_reso);
-		}
-		else if(m_algo == ResoAlgo::VIOL)
-		{
-			//tl::log_info("Algorithm: Violini (TOF)");
-			m_reso.flags &= ~CALC_R0;
-			resores_cur = calc_viol(m_tofreso);
-		}
-		else
-		{
-			const char* pcErr = "Unknown algorithm selected.";
-			tl::log_err(pcErr);
-			resores_cur.strErr = pcErr;
-			resores_cur.bOk = false;
 			return false;
 		}
 
@@ -513,6 +676,8 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 		}
 
 		// reset values
+		if(m_reso.pos_x != t_real(0)*cm || m_reso.pos_y != t_real(0)*cm || m_reso.pos_z != t_real(0)*cm)
+			m_bParamHashValid = 0;
 		m_reso.pos_x = m_reso.pos_y = m_reso.pos_z = t_real(0)*cm;
 	}
 
@@ -523,17 +688,17 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 /**
  * generates MC neutrons using available threads
  */
-Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, McNeutrons<t_real>& neutrons) const
 {
 	// use deferred version if threading is disabled
 	//if(!m_bEnableThreads)
-	//	return GenerateMC_deferred(iNum, vecNeutrons);
+	//	return GenerateMC_deferred(iNum, neutrons);
 
 
 	// number of iterations over random sample positions
 	std::size_t iIter = m_res.size();
-	if(vecNeutrons.size() != iNum*iIter)
-		vecNeutrons.resize(iNum*iIter);
+	if(neutrons.size() != iNum*iIter)
+		neutrons.resize(iNum*iIter);
 
 	Ellipsoid4d<t_real> ell4dret;
 	for(std::size_t iCurIter=0; iCurIter<iIter; ++iCurIter)
@@ -543,6 +708,11 @@ Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& ve
 		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
 			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
 
+		// the neutrons of a sample position are numbers [0, iNum) of its stream,
+		// independent of the number of threads
+		const McRandStream rngNeutr = GetNeutronStream(iCurIter);
+		const McRandStream *pRng = UseNeutronStream() ? &rngNeutr : nullptr;
+
 		unsigned int iNumThreads = get_max_threads();
 		std::size_t iNumPerThread = iNum / iNumThreads;
 		std::size_t iRemaining = iNum % iNumThreads;
@@ -550,13 +720,14 @@ Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& ve
 		tl::ThreadPool<void()> tp(iNumThreads);
 		for(unsigned iThread=0; iThread<iNumThreads; ++iThread)
 		{
-			std::vector<t_vec>::iterator iterBegin = vecNeutrons.begin() + iNumPerThread*iThread + iCurIter*iNum;
+			std::size_t iFirst = iNumPerThread*iThread;
+			std::size_t iOffs = iFirst + iCurIter*iNum;
 			std::size_t iNumNeutr = iNumPerThread;
 			if(iThread == iNumThreads-1)
 				iNumNeutr = iNumPerThread + iRemaining;
 
-			tp.AddTask([iterBegin, iNumNeutr, this, &ell4d]()
-				{ mc_neutrons<t_vec>(ell4d, iNumNeutr, this->m_opts, iterBegin); });
+			tp.AddTask([iOffs, iFirst, iNumNeutr, pRng, this, &ell4d, &neutrons]()
+				{ mc_neutrons<t_vec>(ell4d, iNumNeutr, this->m_opts, neutrons, iOffs, pRng, iFirst); });
 		}
 
 		tp.StartTasks();
@@ -569,20 +740,37 @@ Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& ve
 			ell4dret = ell4d;
 	}
 
-	//mc_neutrons<t_vec>(ell4d, iNum, m_opts, vecNeutrons.begin());
+	//mc_neutrons<t_vec>(ell4d, iNum, m_opts, neutrons);
 	return ell4dret;
 }
 
 
+/**
+ * random stream for the neutrons of a sample position;
+ * without a given stream, quasi-random sampling gets a new one for every call
+ */
+McRandStream TASReso::GetNeutronStream(std::size_t iSamplePos) const
+{
+	if(m_bUseRng)
+		return m_rng.Sub(iSamplePos).Sub(0);
+	return McRandStream::Fresh().Sub(iSamplePos);
+}
+
+bool TASReso::UseNeutronStream() const
+{
+	return m_bUseRng || m_opts.sampling == McNeutronSampling::SOBOL;
+}
+
+
 /**
  * generates MC neutrons without using threads
  */
-Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, McNeutrons<t_real>& neutrons) const
 {
 	// number of iterations over random sample positions
 	std::size_t iIter = m_res.size();
-	if(vecNeutrons.size() != iNum*iIter)
-		vecNeutrons.resize(iNum*iIter);
+	if(neutrons.size() != iNum*iIter)
+		neutrons.resize(iNum*iIter);
 
 	Ellipsoid4d<t_real> ell4dret;
 	for(std::size_t iCurIter = 0; iCurIter<iIter; ++iCurIter)
@@ -592,8 +780,9 @@ Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, std::vector<t
 		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
 			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
 
-		std::vector<t_vec>::iterator iterBegin = vecNeutrons.begin() + iCurIter*iNum;
-		mc_neutrons<t_vec>(ell4d, iNum, m_opts, iterBegin);
+		const McRandStream rngNeutr = GetNeutronStream(iCurIter);
+		mc_neutrons<t_vec>(ell4d, iNum, m_opts, neutrons, iCurIter*iNum,
+			UseNeutronStream() ? &rngNeutr : nullptr, 0);
 
 		if(iCurIter == 0)
 			ell4dret = ell4d;
@@ -601,3 +790,96 @@ Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, std::vector<t
 
 	return ell4dret;
 }
+
+
+/**
+ * generates MC neutrons for the Q marginal of the ellipsoid (without using threads),
+ * their energies are the conditional mean energies m(Q),
+ * vecSigE receives the conditional energy width of every sample position
+ */
+Ellipsoid4d<t_real> TASReso::GenerateMC_Q(std::size_t iNum, McNeutrons<t_real>& neutrons,
+	std::vector<t_real>& vecSigE) const
+{
+	std::size_t iIter = m_res.size();
+	if(neutrons.size() != iNum*iIter)
+		neutrons.resize(iNum*iIter);
+	neutrons.w.clear();
+	vecSigE.resize(iIter);
+
+	Ellipsoid4d<t_real> ell4dret;
+	for(std::size_t iCurIter = 0; iCurIter<iIter; ++iCurIter)
+	{
+		const ResoResults& resores = m_res[iCurIter];
+
+		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
+			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
+
+		const McNeutronTrafo<t_real> trafo = mc_neutron_trafo<t_mat, t_real>(ell4d, m_opts);
+		McNeutronTrafo<t_real> trafoQ;
+		if(!mc_marginal_Q<t_real>(trafo, trafoQ, vecSigE[iCurIter]))
+		{
+			// degenerate ellipsoid: full neutrons without an energy average
+			tl::log_warn("Cannot integrate out the energy of the resolution ellipsoid.");
+			trafoQ = trafo;
+			vecSigE[iCurIter] = 0.;
+		}
+
+		const McRandStream rngNeutr = GetNeutronStream(iCurIter);
+		const std::size_t iOffs = iCurIter*iNum;
+		mc_neutrons_kernel<t_real>(trafoQ, iNum,
+			neutrons.h.data() + iOffs, neutrons.k.data() + iOffs,
+			neutrons.l.data() + iOffs, neutrons.E.data() + iOffs,
+			UseNeutronStream() ? &rngNeutr : nullptr, 0, m_opts.sampling);
+
+		if(iCurIter == 0)
+			ell4dret = ell4d;
+	}
+
+	return ell4dret;
+}
+
+
+/**
+ * generates the nodes of a sparse-grid cubature rule for every sample position,
+ * the weights of all nodes sum to 1
+ */
+Ellipsoid4d<t_real> TASReso::GenerateCubature(unsigned int iLevel, McNeutrons<t_real>& neutrons) const
+{
+	std::shared_ptr<const Cubature4d<t_real>> pCub = get_sparse_gauss_hermite_4d<t_real>(iLevel);
+	const std::size_t iNum = pCub->size();
+
+	std::size_t iIter = m_res.size();
+	neutrons.resize(iNum*iIter);
+	neutrons.w.resize(iNum*iIter);
+
+	Ellipsoid4d<t_real> ell4dret;
+	for(std::size_t iCurIter = 0; iCurIter<iIter; ++iCurIter)
+	{
+		const ResoResults& resores = m_res[iCurIter];
+
+		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
+			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
+
+		cubature_neutrons<t_vec>(ell4d, *pCub, m_opts, neutrons, iCurIter*iNum, t_real(1)/t_real(iIter));
+
+		if(iCurIter == 0)
+			ell4dret = ell4d;
+	}
+
+	return ell4dret;
+}
+
+
+/**
+ * trafo from the unit-variance principal axis system to the mc neutron coordinates
+ * for the given sample position
+ */
+McNeutronTrafo<t_real> TASReso::GetMCTrafo(std::size_t iSamplePos) const
+{
+	const ResoResults& resores = m_res[iSamplePos];
+
+	Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
+		resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
+
+	return mc_neutron_trafo<t_mat, t_real>(ell4d, m_opts);
+}
@@ -12,8 +12,14 @@
 #include "../res/viol.h"
 #include "../res/ellipse.h"
 #include "../res/mc.h"
+#include "../res/cubature.h"
 
 #include<vector>
+#include<memory>
+#include<cstdint>
+
+
+class ResoCache;
 
 
 enum class ResoFocus : unsigned
@@ -46,6 +52,36 @@ protected:
 	bool m_bKiFix = 0;
 	t_real_reso m_dKFix = 1.4;
 
+	// optional deterministic random stream for sample positions and neutrons
+	McRandStream m_rng;
+	bool m_bUseRng = 0;
+
+	// deterministic sparse-grid cubature instead of mc neutrons
+	bool m_bCubature = 0;
+	unsigned int m_iCubMaxLevel = 5;
+	t_real_reso m_dCubTol = 1e-3;
+
+	bool m_bImportance = 0;
+	t_real_reso m_dImpWidth = 0.1;
+
+	// mc neutrons only for Q, the energy is integrated by the S(q,w) model
+	bool m_bAnalyticE = 0;
+
+	// optional cache of the resolution matrices, shared between copies
+	std::shared_ptr<ResoCache> m_pCache;
+
+	// hash of the instrument parameters for the cache, invalidated by the setters
+	std::uint64_t m_iParamHash = 0;
+	bool m_bParamHashValid = 0;
+
+	McRandStream GetNeutronStream(std::size_t iSamplePos) const;
+	bool UseNeutronStream() const;
+
+	void SetScatteringTriangle(t_real_reso dQ, t_real_reso dE);
+	void ApplyFocus(EckParams& reso) const;
+	bool CalcReso(ResoResults& res);
+	std::uint64_t CalcParamHash() const;
+
 public:
 	TASReso();
 	TASReso(const TASReso& res);
@@ -60,24 +96,59 @@ public:
 		t_real_reso alpha, t_real_reso beta, t_real_reso gamma,
 		const ublas::vector<t_real_reso>& vec1, const ublas::vector<t_real_reso>& vec2);
 	bool SetHKLE(t_real_reso h, t_real_reso k, t_real_reso l, t_real_reso E);
-	Ellipsoid4d<t_real_reso> GenerateMC(std::size_t iNum, std::vector<ublas::vector<t_real_reso>>&) const;
-	Ellipsoid4d<t_real_reso> GenerateMC_deferred(std::size_t iNum, std::vector<ublas::vector<t_real_reso>>&) const;
-
-	void SetKiFix(bool bKiFix) { m_bKiFix = bKiFix; }
-	void SetKFix(t_real_reso dKFix) { m_dKFix = dKFix; }
-
-	void SetAlgo(ResoAlgo algo) { m_algo = algo; }
-	void SetOptimalFocus(ResoFocus foc) { m_foc = foc; }
+	Ellipsoid4d<t_real_reso> GenerateMC(std::size_t iNum, McNeutrons<t_real_reso>&) const;
+	Ellipsoid4d<t_real_reso> GenerateMC_deferred(std::size_t iNum, McNeutrons<t_real_reso>&) const;
+	Ellipsoid4d<t_real_reso> GenerateMC_Q(std::size_t iNum, McNeutrons<t_real_reso>&,
+		std::vector<t_real_reso>& vecSigE) const;
+	Ellipsoid4d<t_real_reso> GenerateCubature(unsigned int iLevel, McNeutrons<t_real_reso>&) const;
+	McNeutronTrafo<t_real_reso> GetMCTrafo(std::size_t iSamplePos=0) const;
+
+	void SetKiFix(bool bKiFix) { m_bKiFix = bKiFix; m_bParamHashValid = 0; }
+	void SetKFix(t_real_reso dKFix) { m_dKFix = dKFix; m_bParamHashValid = 0; }
+
+	void SetAlgo(ResoAlgo algo) { m_algo = algo; m_bParamHashValid = 0; }
+	void SetSampling(McNeutronSampling sampling) { m_opts.sampling = sampling; }
+	void SetOptimalFocus(ResoFocus foc) { m_foc = foc; m_bParamHashValid = 0; }
+
+	// levels of the cubature are increased until the result changes less than dTol (relative)
+	void SetCubature(bool b, unsigned int iMaxLevel=5, t_real_reso dTol=1e-3)
+	{ m_bCubature = b; m_iCubMaxLevel = iMaxLevel; m_dCubTol = dTol; }
+	bool UseCubature() const { return m_bCubature; }
+	unsigned int GetCubatureMaxLevel() const { return m_iCubMaxLevel; }
+	t_real_reso GetCubatureTolerance() const { return m_dCubTol; }
+
+	// draw the energies near the dispersion branches of the S(q,w) model (see convo_importance.h),
+	// the width is in units of the energy width of the ellipsoid
+	void SetImportance(bool b, t_real_reso dWidth=0.1) { m_bImportance = b; m_dImpWidth = dWidth; }
+	bool UseImportance() const { return m_bImportance; }
+	t_real_reso GetImportanceWidth() const { return m_dImpWidth; }
+
+	// sample only Q and average S(q,w) over the energy distribution at every Q (see convo_analytic.h)
+	void SetAnalyticE(bool b) { m_bAnalyticE = b; }
+	bool UseAnalyticE() const { return m_bAnalyticE; }
 
 	const EckParams& GetResoParams() const { return m_reso; }
 	const ViolParams& GetTofResoParams() const { return m_tofreso; }
 	const McNeutronOpts<ublas::matrix<t_real_reso>>& GetMCOpts() const { return m_opts; }
-	EckParams& GetResoParams() { return m_reso; }
-	ViolParams& GetTofResoParams() { return m_tofreso; }
+	EckParams& GetResoParams() { m_bParamHashValid = 0; return m_reso; }
+	ViolParams& GetTofResoParams() { m_bParamHashValid = 0; return m_tofreso; }
 
 	const ResoResults& GetResoResults() const { return m_res[0]; }
 
 	void SetRandomSamplePos(std::size_t iNum) { m_res.resize(iNum); }
+	std::size_t GetNumSamplePos() const { return m_res.size(); }
+
+	// use a random stream (e.g. keyed by seed and scan point) instead of the global generator
+	void SetRandStream(const McRandStream& rng) { m_rng = rng; m_bUseRng = 1; }
+	void UnsetRandStream() { m_bUseRng = 0; }
+
+	// look up the resolution matrices in a cache (see reso_cache.h), only for one sample position
+	void SetResoCache(const std::shared_ptr<ResoCache>& pCache) { m_pCache = pCache; UpdateParamHash(); }
+	const std::shared_ptr<ResoCache>& GetResoCache() const { return m_pCache; }
+	std::uint64_t GetParamHash() const { return m_bParamHashValid ? m_iParamHash : CalcParamHash(); }
+
+	// recalculates the stored hash after the parameters have changed, copies inherit it
+	void UpdateParamHash();
 };
 
 #endif
@@ -0,0 +1,137 @@
+/**
+ * resolution convolution with an adaptive number of mc neutrons
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __CONVO_ADAPTIVE_H__
+#define __CONVO_ADAPTIVE_H__
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#include "TASReso.h"
+#include "sqwbase.h"
+#include "convo_importance.h"
+#include "convo_analytic.h"
+
+
+template<class t_real = t_real_reso>
+struct ConvoAdaptiveOpts
+{
+	t_real dRelErr = 0.01;				// requested relative standard error of S
+	std::size_t iBatch = 250;			// neutrons per batch and sample position
+	std::size_t iMinBatches = 4;		// for a meaningful variance estimate
+	std::size_t iMaxNeutrons = 100000;	// upper limit per sample position
+	bool bUseThreads = 0;
+};
+
+
+template<class t_real = t_real_reso>
+struct ConvoAdaptiveResult
+{
+	t_real dS = 0., dSErr = 0.;
+	t_real dhklE_mean[4] = {0., 0., 0., 0.};
+
+	std::size_t iNumNeutrons = 0;		// per sample position
+	bool bConverged = 0;
+};
+
+
+/**
+ * draws the neutrons in batches until the standard error of the mean of S(q,w)
+ * falls below the requested relative error or the maximum number of neutrons is reached;
+ * every batch has its own random stream, so the batch means are independent,
+ * which also holds for quasi-random neutrons (i.e. randomly shifted sobol points)
+ * for the weighted neutrons of the importance sampling and for the Q-only neutrons;
+ * dS is the mean of S(q,w) over the resolution ellipsoid(s), like for the fixed number of neutrons;
+ * returns false if stopped
+ */
+template<class t_real = t_real_reso>
+bool convo_mc_adaptive(const TASReso& reso, const SqwBase& sqw, const McRandStream& rng,
+	const ConvoAdaptiveOpts<t_real>& opts, ConvoAdaptiveResult<t_real>& res,
+	const std::atomic<bool>* pStop = nullptr)
+{
+	res = ConvoAdaptiveResult<t_real>();
+
+	// small limits give smaller batches
+	const std::size_t iMinBatches = std::max<std::size_t>(opts.iMinBatches, 2);
+	const std::size_t iBatch = std::max<std::size_t>(1,
+		std::min<std::size_t>(opts.iBatch, opts.iMaxNeutrons / iMinBatches));
+
+	TASReso resoBatch = reso;
+	McNeutrons<t_real_reso> neutrons;
+	std::vector<t_real_reso> vecS;
+
+	// running mean and variance of the batch means (welford)
+	std::size_t iNumBatches = 0;
+	t_real dMean = 0., dM2 = 0.;
+
+	while(res.iNumNeutrons + iBatch <= std::max(opts.iMaxNeutrons, iBatch))
+	{
+		if(pStop && pStop->load())
+			return false;
+
+		resoBatch.SetRandStream(rng.Sub(iNumBatches));
+		if(reso.UseAnalyticE())
+		{
+			convo_analytic_E<t_real>(resoBatch, sqw, iBatch, neutrons, vecS);
+		}
+		else
+		{
+			if(opts.bUseThreads)
+				resoBatch.GenerateMC(iBatch, neutrons);
+			else
+				resoBatch.GenerateMC_deferred(iBatch, neutrons);
+			if(reso.UseImportance())
+				convo_importance<t_real>(resoBatch, sqw, rng.Sub(iNumBatches).Sub(3), neutrons);
+
+			vecS.resize(neutrons.size());
+			sqw.sqw_batch(neutrons.h.data(), neutrons.k.data(), neutrons.l.data(), neutrons.E.data(),
+				vecS.data(), neutrons.size());
+		}
+
+		t_real dSBatch = 0.;
+		for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+		{
+			const t_real dW = neutrons.HasWeights() ? t_real(neutrons.w[iNeutr]) : t_real(1);
+			dSBatch += dW*t_real(vecS[iNeutr]);
+
+			res.dhklE_mean[0] += dW*t_real(neutrons.h[iNeutr]); res.dhklE_mean[1] += dW*t_real(neutrons.k[iNeutr]);
+			res.dhklE_mean[2] += dW*t_real(neutrons.l[iNeutr]); res.dhklE_mean[3] += dW*t_real(neutrons.E[iNeutr]);
+		}
+		dSBatch /= t_real(neutrons.size());
+
+		++iNumBatches;
+		res.iNumNeutrons += iBatch;
+
+		const t_real dDelta = dSBatch - dMean;
+		dMean += dDelta / t_real(iNumBatches);
+		dM2 += dDelta * (dSBatch - dMean);
+
+		if(iNumBatches >= 2)
+			res.dSErr = std::sqrt(dM2 / t_real(iNumBatches-1) / t_real(iNumBatches));
+
+		// a vanishing error (e.g. flat background or no intensity) is also converged
+		if(iNumBatches >= iMinBatches && res.dSErr <= opts.dRelErr*std::abs(dMean))
+		{
+			res.bConverged = 1;
+			break;
+		}
+	}
+
+	res.dS = dMean;
+	if(iNumBatches)
+	{
+		const t_real dNumTotal = t_real(iNumBatches*iBatch*reso.GetNumSamplePos());
+		for(int i=0; i<4; ++i)
+			res.dhklE_mean[i] /= dNumTotal;
+	}
+
+	return true;
+}
+
+
+#endif
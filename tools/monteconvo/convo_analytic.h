@@ -0,0 +1,57 @@
+/**
+ * resolution convolution with mc neutrons only in Q and an energy integration per neutron
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __CONVO_ANALYTIC_H__
+#define __CONVO_ANALYTIC_H__
+
+#include <vector>
+
+#include "TASReso.h"
+#include "sqwbase.h"
+
+
+/**
+ * writes the S(q,w) values of the Q-only neutrons (see TASReso::GenerateMC_Q), averaged over
+ * the conditional energy distribution at every Q (see SqwBase::sqw_gauss_E_batch), to vecS
+ */
+template<class t_real = t_real_reso>
+void sqw_gauss_E_neutrons(const SqwBase& sqw, const McNeutrons<t_real_reso>& neutrons,
+	const std::vector<t_real_reso>& vecSigE, std::vector<t_real_reso>& vecS)
+{
+	vecS.resize(neutrons.size());
+	if(!vecSigE.size())
+		return;
+
+	const std::size_t iNum = neutrons.size() / vecSigE.size();
+	for(std::size_t iPos=0; iPos<vecSigE.size(); ++iPos)
+	{
+		const std::size_t iOffs = iPos*iNum;
+		sqw.sqw_gauss_E_batch(neutrons.h.data()+iOffs, neutrons.k.data()+iOffs,
+			neutrons.l.data()+iOffs, neutrons.E.data()+iOffs, vecSigE[iPos],
+			vecS.data()+iOffs, iNum);
+	}
+}
+
+
+/**
+ * draws iNum neutrons per sample position from the Q marginal of the resolution ellipsoid
+ * and evaluates the energy-averaged S(q,w) for them;
+ * the neutron energies are the conditional mean energies, so the mean of S and of (h, k, l, E)
+ * over the neutrons are estimates of the same quantities as for the full 4d sampling
+ */
+template<class t_real = t_real_reso>
+Ellipsoid4d<t_real_reso> convo_analytic_E(const TASReso& reso, const SqwBase& sqw, std::size_t iNum,
+	McNeutrons<t_real_reso>& neutrons, std::vector<t_real_reso>& vecS)
+{
+	std::vector<t_real_reso> vecSigE;
+	Ellipsoid4d<t_real_reso> elli = reso.GenerateMC_Q(iNum, neutrons, vecSigE);
+
+	sqw_gauss_E_neutrons<t_real>(sqw, neutrons, vecSigE, vecS);
+	return elli;
+}
+
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * resolution convolution using a deterministic sparse-grid cubature
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __CONVO_CUBATURE_H__
+#define __CONVO_CUBATURE_H__
+
+#include <vector>
+#include <cmath>
+
+#include "TASReso.h"
+#include "sqwbase.h"
+#include "tlibs/log/log.h"
+
+
+/**
+ * S(q,w) convolved with the resolution function, the cubature level is raised
+ * until two successive levels agree within the tolerance set in the resolution object;
+ * dS is the mean of S(q,w) over the resolution ellipsoid(s), dhklE_mean the mean position;
+ * returns false if the cubature does not converge, if two levels are both zero
+ * (e.g. for very sharp S(q,w) between the nodes) or if it yields a negative intensity,
+ * the caller should then fall back to mc neutrons
+ */
+template<class t_real = t_real_reso>
+bool convo_cubature(const TASReso& reso, const SqwBase& sqw, t_real& dS, t_real *dhklE_mean = nullptr)
+{
+	const unsigned int iMaxLevel = reso.GetCubatureMaxLevel();
+	const t_real dTol = t_real(reso.GetCubatureTolerance());
+
+	McNeutrons<t_real_reso> nodes;
+	std::vector<t_real_reso> vecS;
+	t_real dSLast = 0., dSAbsLast = 0.;
+
+	for(unsigned int iLevel=2; iLevel<=iMaxLevel; ++iLevel)
+	{
+		reso.GenerateCubature(iLevel, nodes);
+
+		vecS.resize(nodes.size());
+		sqw.sqw_batch(nodes.h.data(), nodes.k.data(), nodes.l.data(), nodes.E.data(),
+			vecS.data(), nodes.size());
+
+		t_real dSLevel = 0., dSAbsLevel = 0.;
+		for(std::size_t iNode=0; iNode<nodes.size(); ++iNode)
+		{
+			dSLevel += t_real(nodes.w[iNode] * vecS[iNode]);
+			dSAbsLevel += std::abs(t_real(nodes.w[iNode] * vecS[iNode]));
+		}
+
+		const CubatureCheck check = (iLevel > 2)
+			? cubature_check_levels<t_real>(dSLevel, dSAbsLevel, dSLast, dSAbsLast, dTol)
+			: CubatureCheck::REFINE;
+
+		if(check == CubatureCheck::FAILED)
+		{
+			tl::log_debug("Cubature is zero or negative at level ", iLevel, ", using mc neutrons.");
+			return false;
+		}
+		else if(check == CubatureCheck::CONVERGED)
+		{
+			dS = dSLevel;
+			if(dhklE_mean)
+			{
+				for(int i=0; i<4; ++i)
+					dhklE_mean[i] = 0.;
+				for(std::size_t iNode=0; iNode<nodes.size(); ++iNode)
+				{
+					dhklE_mean[0] += t_real(nodes.w[iNode] * nodes.h[iNode]);
+					dhklE_mean[1] += t_real(nodes.w[iNode] * nodes.k[iNode]);
+					dhklE_mean[2] += t_real(nodes.w[iNode] * nodes.l[iNode]);
+					dhklE_mean[3] += t_real(nodes.w[iNode] * nodes.E[iNode]);
+				}
+			}
+			return true;
+		}
+
+		dSLast = dSLevel;
+		dSAbsLast = dSAbsLevel;
+	}
+
+	tl::log_debug("Cubature did not converge up to level ", iMaxLevel, ", using mc neutrons.");
+	return false;
+}
+
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * importance sampling of the resolution ellipsoid towards the dispersion branches
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __CONVO_IMPORTANCE_H__
+#define __CONVO_IMPORTANCE_H__
+
+#include <vector>
+#include <tuple>
+#include <array>
+#include <cmath>
+
+#include "TASReso.h"
+#include "sqwbase.h"
+
+
+/**
+ * dispersion branches E_i(Q) linearised around the centre Q0 of a resolution ellipsoid;
+ * SqwBase::disp is only called at Q0 and at one step along each Q axis,
+ * which avoids a call (and for SqwProc an ipc round trip) per neutron
+ */
+template<class t_real = t_real_reso>
+struct ImportanceBranches
+{
+	t_real dQ0[3];
+	std::vector<t_real> vecE0, vecP;
+	std::vector<std::array<t_real, 3>> vecGrad;
+
+	t_real E(std::size_t iBranch, t_real h, t_real k, t_real l) const
+	{
+		return vecE0[iBranch] + vecGrad[iBranch][0]*(h-dQ0[0])
+			+ vecGrad[iBranch][1]*(k-dQ0[1]) + vecGrad[iBranch][2]*(l-dQ0[2]);
+	}
+};
+
+
+/**
+ * evaluates the branches around the centre of a neutron trafo, the step along
+ * each Q axis is the width of the ellipsoid's projection onto it;
+ * branches whose number changes within a step are taken as flat along that axis
+ */
+template<class t_real = t_real_reso>
+void importance_branches(const SqwBase& sqw, const McNeutronTrafo<t_real_reso>& trafo,
+	ImportanceBranches<t_real>& branches)
+{
+	for(int i=0; i<3; ++i)
+		branches.dQ0[i] = t_real(trafo.offs[i]);
+
+	std::vector<t_real_reso> vecE, vecW;
+	std::tie(vecE, vecW) = sqw.disp(trafo.offs[0], trafo.offs[1], trafo.offs[2]);
+
+	branches.vecE0.assign(vecE.begin(), vecE.end());
+	branches.vecP.resize(vecE.size());
+	for(std::size_t iBranch=0; iBranch<vecE.size(); ++iBranch)
+		branches.vecP[iBranch] = iBranch < vecW.size() ? std::abs(t_real(vecW[iBranch])) : t_real(1);
+	branches.vecGrad.assign(vecE.size(), std::array<t_real, 3>{{ 0., 0., 0. }});
+	if(!vecE.size())
+		return;
+
+	for(int iAxis=0; iAxis<3; ++iAxis)
+	{
+		const t_real dStep = std::sqrt(t_real(trafo.mat[iAxis][0]*trafo.mat[iAxis][0] +
+			trafo.mat[iAxis][1]*trafo.mat[iAxis][1] + trafo.mat[iAxis][2]*trafo.mat[iAxis][2] +
+			trafo.mat[iAxis][3]*trafo.mat[iAxis][3]));
+		if(!(dStep > t_real(0)))
+			continue;
+
+		t_real_reso dQ[3] = { trafo.offs[0], trafo.offs[1], trafo.offs[2] };
+		dQ[iAxis] += t_real_reso(dStep);
+
+		std::vector<t_real_reso> vecEStep, vecWStep;
+		std::tie(vecEStep, vecWStep) = sqw.disp(dQ[0], dQ[1], dQ[2]);
+		if(vecEStep.size() != vecE.size())
+			continue;
+
+		for(std::size_t iBranch=0; iBranch<vecE.size(); ++iBranch)
+			branches.vecGrad[iBranch][iAxis] = t_real(vecEStep[iBranch] - vecE[iBranch]) / dStep;
+	}
+}
+
+
+/**
+ * re-draws the energies of mc neutrons (from TASReso::GenerateMC*) near the branches E_i(Q)
+ * given by SqwBase::disp, and sets the weights that correct for it;
+ *
+ * for a given Q, the energy of a neutron is distributed as p(E) = N(E; m(Q), s^2),
+ * it is replaced with probability dMix by one drawn from the mixture of N(E_i, (dWidth*s)^2)
+ * over the branches within dRange*s (dWidth is set in the resolution object);
+ * with the resulting density q(E), the weight p(E)/q(E) <= 1/(1-dMix) keeps the estimate of <S> unbiased;
+ * the branches are linearised around the centre of each ellipsoid (see importance_branches),
+ * this only affects the efficiency, not the unbiasedness
+ *
+ * returns false if the model has no dispersion or if dWidth is not positive,
+ * the neutrons are then unchanged
+ */
+template<class t_real = t_real_reso>
+bool convo_importance(const TASReso& reso, const SqwBase& sqw, const McRandStream& rng,
+	McNeutrons<t_real_reso>& neutrons)
+{
+	const t_real dMix = 0.5;		// probability to draw the energy near a branch
+	const t_real dRange = 3.;		// only branches within this many energy widths are used
+	const t_real dWidth = t_real(reso.GetImportanceWidth());
+	if(!(dWidth > t_real(0)))
+		return false;
+
+	const std::size_t iNumPos = reso.GetNumSamplePos();
+	const std::size_t iNumPerPos = neutrons.size() / iNumPos;
+	if(!iNumPerPos)
+		return false;
+
+	neutrons.w.assign(neutrons.size(), t_real_reso(1));
+	bool bHasDisp = 0;
+
+	ImportanceBranches<t_real> branches;
+	std::vector<t_real> vecBranchE, vecBranchP;
+	for(std::size_t iPos=0; iPos<iNumPos; ++iPos)
+	{
+		McCondE<t_real_reso> cond;
+		if(!mc_cond_E<t_real_reso>(reso.GetMCTrafo(iPos), cond))
+			continue;
+
+		importance_branches<t_real>(sqw, reso.GetMCTrafo(iPos), branches);
+		if(!branches.vecE0.size())
+			continue;
+		bHasDisp = 1;
+
+		const t_real dSig = t_real(cond.dSigma);
+		const t_real dSigBranch = dWidth * dSig;
+		const McRandStream rngMix = rng.Sub(iPos).Sub(0);
+		const McRandStream rngBranch = rng.Sub(iPos).Sub(1);
+
+		for(std::size_t iCur=0; iCur<iNumPerPos; ++iCur)
+		{
+			const std::size_t iNeutr = iPos*iNumPerPos + iCur;
+			const t_real_reso h = neutrons.h[iNeutr], k = neutrons.k[iNeutr], l = neutrons.l[iNeutr];
+
+			// branches within the energy range of the ellipsoid at this Q
+			const t_real dMean = t_real(cond.Mean(h, k, l));
+			vecBranchE.clear();
+			vecBranchP.clear();
+			t_real dPTot = 0.;
+			for(std::size_t iBranch=0; iBranch<branches.vecE0.size(); ++iBranch)
+			{
+				const t_real dEBranch = branches.E(iBranch, t_real(h), t_real(k), t_real(l));
+				if(std::abs(dEBranch - dMean) > dRange*dSig)
+					continue;
+
+				vecBranchE.push_back(dEBranch);
+				vecBranchP.push_back(branches.vecP[iBranch]);
+				dPTot += branches.vecP[iBranch];
+			}
+			if(!vecBranchE.size())
+				continue;
+			if(dPTot <= t_real(0))
+			{
+				vecBranchP.assign(vecBranchE.size(), t_real(1));
+				dPTot = t_real(vecBranchE.size());
+			}
+
+			// choose the mixture component and re-draw the energy
+			t_real dE = t_real(neutrons.E[iNeutr]);
+			const t_real dU = rngMix.Uniform<t_real>(iCur);
+			if(dU <= dMix)
+			{
+				t_real dCumul = 0.;
+				std::size_t iBranch = 0;
+				for(; iBranch+1<vecBranchE.size(); ++iBranch)
+				{
+					dCumul += vecBranchP[iBranch] / dPTot;
+					if(dU <= dMix*dCumul)
+						break;
+				}
+
+				dE = vecBranchE[iBranch] + dSigBranch*rngBranch.Norm<t_real>(iCur);
+				neutrons.E[iNeutr] = t_real_reso(dE);
+			}
+
+			// weight p(E)/q(E), the common 1/sqrt(2pi) cancels
+			const t_real dPNominal = std::exp(-t_real(0.5)*(dE-dMean)*(dE-dMean)/(dSig*dSig)) / dSig;
+			t_real dPBranches = 0.;
+			for(std::size_t iBranch=0; iBranch<vecBranchE.size(); ++iBranch)
+			{
+				const t_real dX = (dE - vecBranchE[iBranch]) / dSigBranch;
+				dPBranches += vecBranchP[iBranch]/dPTot * std::exp(-t_real(0.5)*dX*dX) / dSigBranch;
+			}
+
+			neutrons.w[iNeutr] = t_real_reso(dPNominal /
+				((t_real(1)-dMix)*dPNominal + dMix*dPBranches));
+		}
+	}
+
+	if(!bHasDisp)
+	{
+		neutrons.w.clear();
+		return false;
+	}
+	return true;
+}
+
+
+#endif
@@ -5,7 +5,7 @@
  * @license GPLv2
  */
 
-// gcc -I. -o disptst -std=c++11 tools/monteconvo/disptst.cpp tools/monteconvo/sqw.cpp tools/monteconvo/sqwbase.cpp tlibs/log/log.cpp tlibs/string/eval.cpp tlibs/math/rand.cpp -lstdc++ -lm -lrt -lpthread
+// gcc -I. -o disptst -std=c++11 tools/monteconvo/disptst.cpp tools/monteconvo/sqw.cpp tools/monteconvo/sqwbase.cpp tlibs/log/log.cpp tlibs/string/eval.cpp tlibs/math/rand.cpp -lstdc++ -lm -lrt -lpthread -lboost_filesystem -lboost_system
 
 #include "sqw.h"
 #include "sqw_proc.h"
@@ -0,0 +1,214 @@
+/**
+ * line shapes integrated over a gaussian energy resolution
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __MCONV_LINESHAPE_H__
+#define __MCONV_LINESHAPE_H__
+
+#include <complex>
+#include <vector>
+#include <utility>
+#include <limits>
+#include <cmath>
+
+#include "tlibs/math/math.h"
+#include "tlibs/phys/neutrons.h"
+#include "../res/cubature.h"
+
+
+/**
+ * faddeeva function w(z) = exp(-z^2) erfc(-iz) for Im z >= 0
+ * (Humlicek's rational approximations, rel. error < 1e-4, i.e. not exact)
+ */
+template<class t_real = double>
+std::complex<t_real> faddeeva_w(const std::complex<t_real>& z)
+{
+	using t_cplx = std::complex<t_real>;
+
+	const t_real x = z.real(), y = z.imag();
+	const t_cplx t(y, -x);
+	const t_real s = std::abs(x) + y;
+
+	if(s >= t_real(15))
+	{
+		return t*t_real(0.5641896) / (t_real(0.5) + t*t);
+	}
+	else if(s >= t_real(5.5))
+	{
+		const t_cplx u = t*t;
+		return t*(t_real(1.410474) + u*t_real(0.5641896)) /
+			(t_real(0.75) + u*(t_real(3) + u));
+	}
+	else if(y >= t_real(0.195)*std::abs(x) - t_real(0.176))
+	{
+		return (t_real(16.4955) + t*(t_real(20.20933) + t*(t_real(11.96482) +
+			t*(t_real(3.778987) + t*t_real(0.5642236))))) /
+			(t_real(16.4955) + t*(t_real(38.82363) + t*(t_real(39.27121) +
+			t*(t_real(21.69274) + t*(t_real(6.699398) + t)))));
+	}
+
+	const t_cplx u = t*t;
+	return std::exp(u) - t*(t_real(36183.31) - u*(t_real(3321.9905) - u*(t_real(1540.787) -
+		u*(t_real(219.0313) - u*(t_real(35.76683) - u*(t_real(1.320522) - u*t_real(0.56419))))))) /
+		(t_real(32066.6) - u*(t_real(24322.84) - u*(t_real(9022.228) - u*(t_real(2186.181) -
+		u*(t_real(364.2191) - u*(t_real(61.57037) - u*(t_real(1.841439) - u)))))));
+}
+
+
+/**
+ * normalised voigt profile, i.e. a lorentzian with the given hwhm
+ * convolved with a gaussian with the given sigma
+ */
+template<class t_real = double>
+t_real voigt_profile(t_real x, t_real dSigma, t_real dHWHM)
+{
+	const t_real dNorm = dSigma * std::sqrt(t_real(2));
+	const std::complex<t_real> z(x/dNorm, std::abs(dHWHM)/dNorm);
+
+	return faddeeva_w<t_real>(z).real() / (dNorm * std::sqrt(tl::get_pi<t_real>()));
+}
+
+
+// number of gauss-hermite nodes for the smooth parts of the energy integrals
+#define LINESHAPE_GH_NODES 24
+
+
+/**
+ * gauss-hermite rule for the average over a normal distribution
+ */
+template<class t_real = double>
+const std::pair<std::vector<t_real>, std::vector<t_real>>& get_gauss_hermite_E()
+{
+	static const std::pair<std::vector<t_real>, std::vector<t_real>> rule = []()
+	{
+		std::pair<std::vector<t_real>, std::vector<t_real>> rule;
+		gauss_hermite_1d<t_real>(LINESHAPE_GH_NODES, rule.first, rule.second);
+		return rule;
+	}();
+
+	return rule;
+}
+
+
+/**
+ * kT in meV
+ */
+template<class t_real = double>
+t_real get_kT(t_real dT)
+{
+	return t_real(tl::get_kB<t_real>() / tl::get_one_meV<t_real>()
+		* tl::get_one_kelvin<t_real>()) * dT;
+}
+
+
+/**
+ * bose factor 1/(1 - exp(-E/kT)), which is negative for E < 0 (see tl::bose)
+ */
+template<class t_real = double>
+t_real bose_signed(t_real dE, t_real dT)
+{
+	if(!(dT > t_real(0)))
+		return dE > t_real(0) ? t_real(1) : t_real(0);
+	return -t_real(1) / std::expm1(-dE / get_kT<t_real>(dT));
+}
+
+
+/**
+ * damped harmonic oscillator |DHO(E)| (see tl::DHO_model) averaged over N(E; dE, dSigma^2);
+ *
+ * with the signed bose factor b(E), the dho is A/E0 b(E) [L(E-E0) - L(E+E0)] with normalised lorentzians L,
+ * with b(E) linearised around +-E0 this gives voigt profiles V(x) and their first moments
+ * W(x) = int t L(t) G(t-x) dt = x V(x) + sigma^2 V'(x), which are both given by the faddeeva function;
+ * the smooth remainder, i.e. the non-linear part of b(E), is integrated by gauss-hermite quadrature;
+ *
+ * this is only valid for peaks that are well separated from E = 0 (returns false otherwise);
+ *
+ * this is an approximation, not an exact integral: compared to a numerical integration
+ * (tools/test/tst_lineshape.cpp, E0 = 3 meV, sigma = 0.1..0.3 meV, hwhm = 0.02..0.4 meV)
+ * the relative error is below 1e-4 on the stokes side and below 1e-3 on the anti-stokes side for T >= 10 K;
+ * at lower T, when kT is not larger than the widths, the linearisation of b(E) fails on the anti-stokes side:
+ * the error there is ~1e-2 (up to 1e-1 for broad peaks) and the far tail can be clipped to zero;
+ * these values are suppressed by exp(-E0/kT) compared to the stokes peak
+ */
+template<class t_real = double>
+bool dho_gauss_E(t_real dE, t_real dSigma, t_real dE0, t_real dHWHM, t_real dT, t_real dAmp,
+	t_real& dS)
+{
+	dE0 = std::abs(dE0);
+	dHWHM = std::abs(dHWHM);
+	if(!(dSigma > t_real(0)) || dE0 < t_real(3)*(dHWHM + dSigma))
+		return false;
+
+	const t_real dPi = tl::get_pi<t_real>();
+	const t_real dkT = get_kT<t_real>(dT);
+	const t_real dBosePos = bose_signed<t_real>(dE0, dT);
+	const t_real dBoseNeg = bose_signed<t_real>(-dE0, dT);
+
+	// b'(E) = -b(E) (b(E)-1) / kT, which is the same at +E0 and -E0
+	const t_real dBoseDeriv = dT > t_real(0) ? -dBosePos*(dBosePos - t_real(1)) / dkT : t_real(0);
+
+	// analytical part
+	const t_real dNorm = dSigma * std::sqrt(t_real(2));
+	const t_real dSqrtPi = std::sqrt(dPi);
+	auto voigt = [dNorm, dSqrtPi, dHWHM](t_real x, t_real& dV, t_real& dW)
+	{
+		const std::complex<t_real> z(x/dNorm, dHWHM/dNorm);
+		const std::complex<t_real> w = faddeeva_w<t_real>(z);
+
+		dV = w.real() / (dNorm * dSqrtPi);
+		dW = x*dV - (z*w).real() / dSqrtPi;
+	};
+
+	t_real dVPos, dWPos, dVNeg, dWNeg;
+	voigt(dE - dE0, dVPos, dWPos);
+	voigt(dE + dE0, dVNeg, dWNeg);
+	t_real dSum = dBosePos*dVPos + dBoseDeriv*dWPos - dBoseNeg*dVNeg - dBoseDeriv*dWNeg;
+
+	// remainder, the dho is evaluated as E b(E) [L(E-E0) - L(E+E0)]/E, which is regular at E = 0
+	const auto& rule = get_gauss_hermite_E<t_real>();
+	const t_real dHWHM2 = dHWHM*dHWHM;
+	for(std::size_t iNode=0; iNode<rule.first.size(); ++iNode)
+	{
+		const t_real dECur = dE + dSigma*rule.first[iNode];
+		const t_real dPos = dECur - dE0, dNeg = dECur + dE0;
+		const t_real dLorPos = dHWHM / (dPi * (dPos*dPos + dHWHM2));
+		const t_real dLorNeg = dHWHM / (dPi * (dNeg*dNeg + dHWHM2));
+
+		t_real dEBose = 0.;
+		if(!(dT > t_real(0)))
+			dEBose = dECur > t_real(0) ? dECur : t_real(0);
+		else if(std::abs(dECur) <= std::numeric_limits<t_real>::epsilon()*dkT)
+			dEBose = dkT;
+		else
+			dEBose = -dECur / std::expm1(-dECur / dkT);
+
+		const t_real dDHO = dEBose * t_real(4)*dHWHM*dE0 /
+			(dPi * (dPos*dPos + dHWHM2) * (dNeg*dNeg + dHWHM2));
+		const t_real dLin = (dBosePos + dBoseDeriv*dPos)*dLorPos
+			- (dBoseNeg + dBoseDeriv*dNeg)*dLorNeg;
+
+		dSum += rule.second[iNode] * (dDHO - dLin);
+	}
+
+	dS = std::abs(dAmp) / dE0 * dSum;
+	if(dS < t_real(0))
+		dS = t_real(0);
+	return true;
+}
+
+
+/**
+ * normalised gaussian (see tl::gauss_model) averaged over N(E; dE, dSigma^2)
+ */
+template<class t_real = double>
+t_real gauss_gauss_E(t_real dE, t_real dSigma, t_real dE0, t_real dSigma0, t_real dAmp)
+{
+	const t_real dSig = std::sqrt(dSigma*dSigma + dSigma0*dSigma0);
+	return dAmp * std::exp(-t_real(0.5)*(dE-dE0)*(dE-dE0)/(dSig*dSig))
+		/ (std::sqrt(t_real(2)*tl::get_pi<t_real>()) * dSig);
+}
+
+
+#endif
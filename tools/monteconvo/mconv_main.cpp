@@ -17,6 +17,7 @@
 #include "tlibs/file/loaddat.h"
 #include "TASReso.h"
 #include "sqw.h"
+#include "convo_adaptive.h"
 #include "../res/defs.h"
 
 using t_real = t_real_reso;
@@ -158,6 +159,18 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 
 	tl::log_info("Number of neutrons: ", iNumNeutrons);
 
+	// optional adaptive number of neutrons, num_neutrons is then the upper limit
+	ConvoAdaptiveOpts<t_real> optsAdaptive;
+	optsAdaptive.iMaxNeutrons = iNumNeutrons;
+	optsAdaptive.bUseThreads = 1;
+	const auto iterAdaptive = steps.GetHeader().find("adaptive_error");
+	const bool bAdaptive = (iterAdaptive != steps.GetHeader().end());
+	if(bAdaptive)
+	{
+		optsAdaptive.dRelErr = tl::str_to_var<t_real>(iterAdaptive->second);
+		tl::log_info("Adaptive number of neutrons, relative error: ", optsAdaptive.dRelErr, ".");
+	}
+
 
 	std::shared_ptr<SqwBase> ptrSqw;
 	//std::shared_ptr<SqwBase> ptrSqw(new SqwElast());
@@ -190,10 +203,13 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 
 	std::ofstream ofstrOut(pcOut);
 	ofstrOut << "#\n";
-	ofstrOut << "# Format: h k l E S\n";
+	ofstrOut << "# Format: h k l E S" << (bAdaptive ? " S_err neutrons" : "") << "\n";
 	ofstrOut << "#\n";
 
-	std::vector<ublas::vector<t_real>> vecNeutrons;
+	const unsigned iSeed = tl::get_rand_seed();
+	tl::log_info("Random seed: ", iSeed, ".");
+
+	McNeutrons<t_real> neutrons;
 	for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
 	{
 		t_real dProgress = t_real(iStep)/t_real(iNumSteps)*100.;
@@ -201,43 +217,77 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 		tl::log_info("------------------------------------------------------------");
 		tl::log_info("Step ", iStep+1, " of ", iNumSteps, ".");
 		tl::log_info("Q = (", pH[iStep], " ", pK[iStep], " ", pL[iStep], "), E = ", pE[iStep], " meV.");
+		reso.SetRandStream(McRandStream(iSeed).Sub(iStep));
 		if(!reso.SetHKLE(pH[iStep], pK[iStep], pL[iStep], pE[iStep]))
 		{
 			tl::log_err("Invalid position.");
 			break;
 		}
 
-		std::cout <<"\x1b]0;"
-			<< std::setprecision(3) << dProgress <<  "%"
-			<< " - generating MC neutrons"
-			<< "\x07" << std::flush;
-		Ellipsoid4d<t_real> elli = reso.GenerateMC(iNumNeutrons, vecNeutrons);
-
-		t_real dS = 0.;
+		t_real dS = 0., dSErr = 0.;
 		t_real dhklE_mean[4] = {0., 0., 0., 0.};
+		std::size_t iNumNeutrUsed = iNumNeutrons;
 
-		std::cout <<"\x1b]0;"
-			<< std::setprecision(3) << dProgress <<  "%"
-			<< " - calculating S(q,w)"
-			<< "\x07" << std::flush;
-		for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
+		if(bAdaptive)
 		{
-			dS += (*psqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
+			std::cout <<"\x1b]0;"
+				<< std::setprecision(3) << dProgress <<  "%"
+				<< " - adaptive convolution"
+				<< "\x07" << std::flush;
+
+			ConvoAdaptiveResult<t_real> resAdaptive;
+			convo_mc_adaptive<t_real>(reso, *psqw, McRandStream(iSeed).Sub(iStep).Sub(2),
+				optsAdaptive, resAdaptive);
+
+			dS = resAdaptive.dS;
+			dSErr = resAdaptive.dSErr;
+			iNumNeutrUsed = resAdaptive.iNumNeutrons;
+			for(int i=0; i<4; ++i)
+				dhklE_mean[i] = resAdaptive.dhklE_mean[i];
 
+			tl::log_info("Used ", iNumNeutrUsed, " neutrons, S error: ", dSErr, ".");
+		}
+		else
+		{
+			std::cout <<"\x1b]0;"
+				<< std::setprecision(3) << dProgress <<  "%"
+				<< " - generating MC neutrons"
+				<< "\x07" << std::flush;
+			Ellipsoid4d<t_real> elli = reso.GenerateMC(iNumNeutrons, neutrons);
+
+			std::cout <<"\x1b]0;"
+				<< std::setprecision(3) << dProgress <<  "%"
+				<< " - calculating S(q,w)"
+				<< "\x07" << std::flush;
+			std::vector<t_real> vecS(neutrons.size());
+			psqw->sqw_batch(neutrons.h.data(), neutrons.k.data(),
+				neutrons.l.data(), neutrons.E.data(), vecS.data(), neutrons.size());
+
+			for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+			{
+				dS += vecS[iNeutr];
+
+				dhklE_mean[0] += neutrons.h[iNeutr]; dhklE_mean[1] += neutrons.k[iNeutr];
+				dhklE_mean[2] += neutrons.l[iNeutr]; dhklE_mean[3] += neutrons.E[iNeutr];
+			}
+
+			dS /= t_real(iNumNeutrons);
 			for(int i=0; i<4; ++i)
-				dhklE_mean[i] += vecHKLE[i];
+				dhklE_mean[i] /= t_real(iNumNeutrons);
 		}
 
-		dS /= t_real(iNumNeutrons);
-		for(int i=0; i<4; ++i)
-			dhklE_mean[i] /= t_real(iNumNeutrons);
-
 		ofstrOut.precision(16);
 		ofstrOut << std::left << std::setw(20) << pH[iStep] << " "
 			<< std::left << std::setw(20) << pK[iStep] << " "
 			<< std::left << std::setw(20) << pL[iStep] << " "
 			<< std::left << std::setw(20) << pE[iStep] << " "
-			<< std::left << std::setw(20) << dS << "\n";
+			<< std::left << std::setw(20) << dS;
+		if(bAdaptive)
+		{
+			ofstrOut << " " << std::left << std::setw(20) << dSErr
+				<< " " << std::left << std::setw(20) << iNumNeutrUsed;
+		}
+		ofstrOut << "\n";
 
 		tl::log_info("Mean position: Q = (", dhklE_mean[0], " ", dhklE_mean[1], " ", dhklE_mean[2], "), E = ", dhklE_mean[3], " meV.");
 		tl::log_info("S(", pH[iStep], ", ", pK[iStep],  ", ", pL[iStep], ", ", pE[iStep], ") = ", dS);
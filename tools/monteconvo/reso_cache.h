@@ -0,0 +1,685 @@
+/**
+ * cache of resolution matrices on an adaptive (|Q|, E) grid
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __RESO_CACHE_H__
+#define __RESO_CACHE_H__
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <cstdint>
+#include <thread>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+
+#include <boost/units/quantity.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include "tlibs/log/log.h"
+#include "../res/defs.h"
+
+
+// limits for the maps read from files
+#define RESO_CACHE_MAX_DIM	4		// the resolution is four-dimensional
+#define RESO_CACHE_MAX_IDX	(std::int64_t(1) << 40)
+
+
+/**
+ * FNV-1a hash of the instrument parameters
+ */
+class ResoParamHash
+{
+	protected:
+		std::uint64_t m_iHash = 0xcbf29ce484222325ull;
+
+	public:
+		void AddBytes(const void* pv, std::size_t iLen)
+		{
+			const unsigned char* pc = reinterpret_cast<const unsigned char*>(pv);
+			for(std::size_t i=0; i<iLen; ++i)
+			{
+				m_iHash ^= std::uint64_t(pc[i]);
+				m_iHash *= 0x100000001b3ull;
+			}
+		}
+
+		void AddReal(t_real_reso d)
+		{
+			if(d == t_real_reso(0)) d = t_real_reso(0);	// same hash for -0
+			AddBytes(&d, sizeof(d));
+		}
+
+		void AddInt(std::int64_t i) { AddBytes(&i, sizeof(i)); }
+
+		template<class t_unit>
+		void AddQuantity(const boost::units::quantity<t_unit, t_real_reso>& q)
+		{ AddReal(q.value()); }
+
+		std::uint64_t GetHash() const { return m_iHash; }
+};
+
+
+/**
+ * the resolution matrices only depend on |Q| and E for a given instrument,
+ * the orientation of Q only enters the mc neutron trafo;
+ * the nodes of a map are calculated on demand, a cell of the grid is interpolated bilinearly
+ * once its interpolation matches the exact calculation at a requested point and at its centre,
+ * otherwise it is refined up to the maximum level and then always calculated exactly
+ */
+class ResoCache
+{
+	public:
+		using t_real = t_real_reso;
+		using t_calc = std::function<ResoResults(t_real dQ, t_real dE)>;
+
+		enum class CellState : int
+		{
+			GOOD = 1,	// interpolate
+			REFINE = 2,	// look at the next level
+			EXACT = 3,	// calculate exactly, e.g. at the kinematic limits
+		};
+
+	protected:
+		using t_idx = std::int64_t;
+		using t_nodeidx = std::pair<t_idx, t_idx>;
+		using t_cellidx = std::tuple<unsigned, t_idx, t_idx>;
+
+		struct ResoMap
+		{
+			// node indices are in units of the finest grid
+			std::map<t_nodeidx, ResoResults> nodes;
+			std::map<t_cellidx, CellState> cells;
+			bool bDirty = 0;
+		};
+
+		// coarsest grid steps in 1/A and meV
+		t_real m_dQStep = 0.1, m_dEStep = 0.5;
+		unsigned m_iMaxLevel = 4;
+		t_real m_dTol = 1e-3;
+
+		// directory for persistent maps, in memory only if empty
+		std::string m_strDir;
+
+		std::map<std::uint64_t, ResoMap> m_maps;
+		mutable std::mutex m_mtx;
+
+		std::atomic<std::size_t> m_iNumInterp{0}, m_iNumExact{0};
+
+	protected:
+		t_real GetQStep(unsigned iLevel) const { return m_dQStep / t_real(t_idx(1) << iLevel); }
+		t_real GetEStep(unsigned iLevel) const { return m_dEStep / t_real(t_idx(1) << iLevel); }
+		t_idx GetNodeScale(unsigned iLevel) const { return t_idx(1) << (m_iMaxLevel - iLevel); }
+
+		t_cellidx GetCell(unsigned iLevel, t_real dQ, t_real dE) const
+		{
+			return t_cellidx(iLevel,
+				t_idx(std::floor(dQ / GetQStep(iLevel))),
+				t_idx(std::floor(dE / GetEStep(iLevel))));
+		}
+
+		t_nodeidx GetCorner(const t_cellidx& cell, int iQ, int iE) const
+		{
+			const t_idx iScale = GetNodeScale(std::get<0>(cell));
+			return t_nodeidx((std::get<1>(cell) + iQ)*iScale, (std::get<2>(cell) + iE)*iScale);
+		}
+
+		t_real GetNodeQ(const t_nodeidx& node) const { return t_real(node.first) * GetQStep(m_iMaxLevel); }
+		t_real GetNodeE(const t_nodeidx& node) const { return t_real(node.second) * GetEStep(m_iMaxLevel); }
+
+		/**
+		 * gets the map of an instrument, loading it from the directory if available
+		 */
+		ResoMap& GetMap(std::uint64_t iHash)
+		{
+			auto iter = m_maps.find(iHash);
+			if(iter != m_maps.end())
+				return iter->second;
+
+			ResoMap& map = m_maps[iHash];
+			if(m_strDir != "")
+				LoadMap(GetFileName(iHash), map);
+			return map;
+		}
+
+		/**
+		 * bilinear interpolation within a cell, all corners have to be valid
+		 */
+		ResoResults Interpolate(const ResoMap& map, const t_cellidx& cell, t_real dQ, t_real dE) const
+		{
+			const unsigned iLevel = std::get<0>(cell);
+			const t_real dFracQ = dQ/GetQStep(iLevel) - t_real(std::get<1>(cell));
+			const t_real dFracE = dE/GetEStep(iLevel) - t_real(std::get<2>(cell));
+
+			ResoResults res;
+			res.bOk = 1;
+			res.reso_s = res.dR0 = res.dResVol = t_real(0);
+			for(int i=0; i<4; ++i) res.dBraggFWHMs[i] = t_real(0);
+
+			for(int iQ=0; iQ<2; ++iQ)
+			for(int iE=0; iE<2; ++iE)
+			{
+				const ResoResults& node = map.nodes.at(GetCorner(cell, iQ, iE));
+				const t_real dW = (iQ ? dFracQ : t_real(1)-dFracQ) * (iE ? dFracE : t_real(1)-dFracE);
+
+				if(iQ==0 && iE==0)
+				{
+					res.reso = dW * node.reso;
+					res.reso_v = dW * node.reso_v;
+					res.Q_avg = dW * node.Q_avg;
+				}
+				else
+				{
+					res.reso += dW * node.reso;
+					res.reso_v += dW * node.reso_v;
+					res.Q_avg += dW * node.Q_avg;
+				}
+
+				res.reso_s += dW * node.reso_s;
+				res.dR0 += dW * node.dR0;
+				res.dResVol += dW * node.dResVol;
+				for(int i=0; i<4; ++i)
+					res.dBraggFWHMs[i] += dW * node.dBraggFWHMs[i];
+			}
+
+			return res;
+		}
+
+		/**
+		 * deviation of an interpolated from an exact result:
+		 * relative for the quadratic part, Q_avg and R0, and as error of the exponent
+		 * for the linear and constant parts of the quadric
+		 */
+		static t_real GetDeviation(const ResoResults& resInterp, const ResoResults& resExact)
+		{
+			const t_real dRMax = ublas::norm_inf(resExact.reso);
+			const t_real dQMax = ublas::norm_inf(resExact.Q_avg);
+			if(dRMax <= t_real(0) || dQMax <= t_real(0))
+				return std::numeric_limits<t_real>::infinity();
+
+			t_real dDev = ublas::norm_inf(resInterp.reso - resExact.reso) / dRMax;
+			dDev = std::max(dDev, t_real(ublas::norm_inf(resInterp.reso_v - resExact.reso_v) / std::sqrt(dRMax)));
+			dDev = std::max(dDev, std::abs(resInterp.reso_s - resExact.reso_s));
+			dDev = std::max(dDev, t_real(ublas::norm_inf(resInterp.Q_avg - resExact.Q_avg) / dQMax));
+			if(resExact.dR0 != t_real(0))
+				dDev = std::max(dDev, std::abs(resInterp.dR0/resExact.dR0 - t_real(1)));
+
+			// also catches nan
+			if(!(dDev < std::numeric_limits<t_real>::max()))
+				return std::numeric_limits<t_real>::infinity();
+			return dDev;
+		}
+
+		/**
+		 * decides if a cell with all corner nodes available can be interpolated
+		 */
+		CellState ValidateCell(const ResoMap& map, const t_cellidx& cell,
+			const std::vector<std::tuple<t_real, t_real, const ResoResults*>>& vecChecks) const
+		{
+			const bool bCanRefine = std::get<0>(cell) < m_iMaxLevel;
+
+			// cells at the kinematic limits are refined, cells beyond them are not
+			std::size_t iNumInvalid = 0;
+			for(int iQ=0; iQ<2; ++iQ)
+				for(int iE=0; iE<2; ++iE)
+				{
+					if(!map.nodes.at(GetCorner(cell, iQ, iE)).bOk)
+						++iNumInvalid;
+				}
+			if(iNumInvalid == 4)
+				return CellState::EXACT;
+			else if(iNumInvalid > 0)
+				return bCanRefine ? CellState::REFINE : CellState::EXACT;
+
+			for(int iQ=0; iQ<2; ++iQ)
+				for(int iE=0; iE<2; ++iE)
+				{
+					const ResoResults& node = map.nodes.at(GetCorner(cell, iQ, iE));
+					const ResoResults& node0 = map.nodes.at(GetCorner(cell, 0, 0));
+					if(node.reso.size1() != node0.reso.size1() ||
+						node.reso.size2() != node0.reso.size2() ||
+						node.reso_v.size() != node0.reso_v.size() ||
+						node.Q_avg.size() != node0.Q_avg.size())
+						return CellState::EXACT;
+				}
+
+			for(const auto& check : vecChecks)
+			{
+				const ResoResults& resExact = *std::get<2>(check);
+				if(!resExact.bOk || resExact.reso.size1() != map.nodes.at(GetCorner(cell, 0, 0)).reso.size1())
+					return CellState::EXACT;
+
+				ResoResults resInterp = Interpolate(map, cell, std::get<0>(check), std::get<1>(check));
+				if(GetDeviation(resInterp, resExact) > m_dTol)
+					return bCanRefine ? CellState::REFINE : CellState::EXACT;
+			}
+
+			return CellState::GOOD;
+		}
+
+	public:
+		ResoCache() = default;
+		~ResoCache() = default;
+
+		ResoCache(const ResoCache&) = delete;
+		const ResoCache& operator=(const ResoCache&) = delete;
+
+		/**
+		 * cache shared by all jobs of the process which use the same directory and tolerance,
+		 * so that they do not overwrite each other's maps
+		 */
+		static std::shared_ptr<ResoCache> GetShared(const std::string& strDir, t_real dTol)
+		{
+			static std::mutex s_mtx;
+			static std::map<std::pair<std::string, t_real>, std::weak_ptr<ResoCache>> s_caches;
+
+			std::lock_guard<std::mutex> lock(s_mtx);
+			std::weak_ptr<ResoCache>& pWeak = s_caches[std::make_pair(strDir, dTol)];
+			std::shared_ptr<ResoCache> pCache = pWeak.lock();
+			if(!pCache)
+			{
+				pCache = std::make_shared<ResoCache>();
+				pCache->SetTolerance(dTol);
+				pCache->SetDir(strDir);
+				pWeak = pCache;
+			}
+			return pCache;
+		}
+
+		/**
+		 * grid settings, have to be set before the cache is used
+		 */
+		void SetGrid(t_real dQStep, t_real dEStep, unsigned iMaxLevel)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_dQStep = dQStep; m_dEStep = dEStep; m_iMaxLevel = iMaxLevel;
+			m_maps.clear();
+		}
+
+		void SetTolerance(t_real dTol)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_dTol = dTol;
+			m_maps.clear();
+		}
+
+		void SetDir(const std::string& strDir)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_strDir = strDir;
+		}
+
+		/**
+		 * file of an instrument's map, caches with other grid settings or tolerances
+		 * in the same directory use different files
+		 */
+		std::string GetFileName(std::uint64_t iHash) const
+		{
+			ResoParamHash hashSettings;
+			hashSettings.AddReal(m_dQStep);
+			hashSettings.AddReal(m_dEStep);
+			hashSettings.AddInt(m_iMaxLevel);
+			hashSettings.AddReal(m_dTol);
+
+			std::ostringstream ostr;
+			ostr << m_strDir << "/resomap_" << std::hex << std::setfill('0')
+				<< std::setw(16) << iHash << "_" << std::setw(16) << hashSettings.GetHash() << ".dat";
+			return ostr.str();
+		}
+
+		std::size_t GetNumInterpolated() const { return m_iNumInterp.load(); }
+		std::size_t GetNumExact() const { return m_iNumExact.load(); }
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_maps.clear();
+		}
+
+		/**
+		 * gets the resolution of the instrument with the given parameter hash at (|Q|, E),
+		 * funcCalc calculates it exactly and is called without holding the lock
+		 */
+		ResoResults Get(std::uint64_t iHash, t_real dQ, t_real dE, const t_calc& funcCalc)
+		{
+			t_cellidx cell;
+			std::vector<t_nodeidx> vecMissing;
+			bool bValidate = 0;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				ResoMap& map = GetMap(iHash);
+
+				for(unsigned iLevel=0; iLevel<=m_iMaxLevel; ++iLevel)
+				{
+					cell = GetCell(iLevel, dQ, dE);
+
+					auto iter = map.cells.find(cell);
+					if(iter == map.cells.end())
+					{
+						for(int iQ=0; iQ<2; ++iQ)
+							for(int iE=0; iE<2; ++iE)
+							{
+								t_nodeidx node = GetCorner(cell, iQ, iE);
+								if(map.nodes.find(node) == map.nodes.end())
+									vecMissing.push_back(node);
+							}
+						bValidate = 1;
+						break;
+					}
+
+					if(iter->second == CellState::GOOD)
+					{
+						++m_iNumInterp;
+						return Interpolate(map, cell, dQ, dE);
+					}
+					else if(iter->second == CellState::EXACT)
+					{
+						break;
+					}
+				}
+			}
+
+			++m_iNumExact;
+			ResoResults res = funcCalc(dQ, dE);
+			if(!bValidate)
+				return res;
+
+
+			// calculate the missing corners and the centre of the new cell
+			std::vector<std::pair<t_nodeidx, ResoResults>> vecNewNodes;
+			vecNewNodes.reserve(vecMissing.size());
+			for(const t_nodeidx& node : vecMissing)
+				vecNewNodes.push_back(std::make_pair(node, funcCalc(GetNodeQ(node), GetNodeE(node))));
+
+			const unsigned iLevel = std::get<0>(cell);
+			const t_real dQCentre = (t_real(std::get<1>(cell)) + t_real(0.5)) * GetQStep(iLevel);
+			const t_real dECentre = (t_real(std::get<2>(cell)) + t_real(0.5)) * GetEStep(iLevel);
+			const ResoResults resCentre = funcCalc(dQCentre, dECentre);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				ResoMap& map = GetMap(iHash);
+
+				for(const auto& node : vecNewNodes)
+					map.nodes.insert(node);
+
+				if(map.cells.find(cell) == map.cells.end())
+				{
+					map.cells[cell] = ValidateCell(map, cell,
+						{ std::make_tuple(dQ, dE, &res),
+						std::make_tuple(dQCentre, dECentre, &resCentre) });
+				}
+				map.bDirty = 1;
+			}
+
+			return res;
+		}
+
+
+		/**
+		 * loads a map, it is discarded if the grid settings differ
+		 */
+		bool LoadMap(const std::string& strFile, ResoMap& map) const
+		{
+			std::ifstream ifstr(strFile);
+			if(!ifstr)
+				return false;
+
+			std::string strKey;
+			t_real dQStep = 0, dEStep = 0, dTol = 0;
+			unsigned iMaxLevel = 0;
+
+			ifstr >> strKey >> dQStep >> dEStep >> iMaxLevel >> dTol;
+			if(strKey != "grid" || !ifstr)
+			{
+				tl::log_err("Invalid resolution map file \"", strFile, "\".");
+				return false;
+			}
+			if(dQStep != m_dQStep || dEStep != m_dEStep || iMaxLevel != m_iMaxLevel || dTol != m_dTol)
+			{
+				tl::log_warn("Grid of resolution map \"", strFile, "\" differs, ignoring it.");
+				return false;
+			}
+
+			auto read_mat = [&ifstr](ublas::matrix<t_real>& mat) -> bool
+			{
+				std::size_t iRows = 0, iCols = 0;
+				if(!(ifstr >> iRows >> iCols) || iRows > RESO_CACHE_MAX_DIM || iCols > RESO_CACHE_MAX_DIM)
+					return false;
+				mat.resize(iRows, iCols, false);
+				for(std::size_t i=0; i<iRows; ++i)
+					for(std::size_t j=0; j<iCols; ++j)
+						ifstr >> mat(i,j);
+				return bool(ifstr);
+			};
+			auto read_vec = [&ifstr](ublas::vector<t_real>& vec) -> bool
+			{
+				std::size_t iLen = 0;
+				if(!(ifstr >> iLen) || iLen > RESO_CACHE_MAX_DIM)
+					return false;
+				vec.resize(iLen, false);
+				for(std::size_t i=0; i<iLen; ++i)
+					ifstr >> vec[i];
+				return bool(ifstr);
+			};
+			auto valid_idx = [](t_idx iIdx) -> bool
+			{ return iIdx > -RESO_CACHE_MAX_IDX && iIdx < RESO_CACHE_MAX_IDX; };
+
+			std::map<t_nodeidx, ResoResults> mapNodes;
+			std::map<t_cellidx, CellState> mapCells;
+
+			bool bValid = 1;
+			while(bValid && ifstr >> strKey)
+			{
+				if(strKey == "node")
+				{
+					t_nodeidx node;
+					ResoResults res;
+					ifstr >> node.first >> node.second >> res.bOk;
+					bValid = ifstr && valid_idx(node.first) && valid_idx(node.second);
+					if(bValid && res.bOk)
+					{
+						ifstr >> res.dR0 >> res.dResVol >> res.reso_s;
+						for(int i=0; i<4; ++i)
+							ifstr >> res.dBraggFWHMs[i];
+						bValid = read_mat(res.reso) && read_vec(res.reso_v) && read_vec(res.Q_avg);
+					}
+					if(bValid)
+						mapNodes.insert(std::make_pair(node, res));
+				}
+				else if(strKey == "cell")
+				{
+					unsigned iLevel = 0;
+					t_idx iQ = 0, iE = 0;
+					int iState = 0;
+					ifstr >> iLevel >> iQ >> iE >> iState;
+					bValid = ifstr && iLevel <= m_iMaxLevel && valid_idx(iQ) && valid_idx(iE) &&
+						(iState == int(CellState::GOOD) || iState == int(CellState::REFINE) ||
+						iState == int(CellState::EXACT));
+					if(bValid)
+						mapCells[t_cellidx(iLevel, iQ, iE)] = CellState(iState);
+				}
+				else
+				{
+					bValid = 0;
+				}
+			}
+
+			// interpolated cells need valid corners of the same size
+			for(const auto& cell : mapCells)
+			{
+				if(!bValid)
+					break;
+				if(cell.second != CellState::GOOD)
+					continue;
+
+				const ResoResults *pNode0 = nullptr;
+				for(int iQ=0; iQ<2 && bValid; ++iQ)
+					for(int iE=0; iE<2 && bValid; ++iE)
+					{
+						auto iterNode = mapNodes.find(GetCorner(cell.first, iQ, iE));
+						if(iterNode == mapNodes.end() || !iterNode->second.bOk)
+						{
+							bValid = 0;
+							break;
+						}
+
+						const ResoResults& node = iterNode->second;
+						if(!pNode0)
+							pNode0 = &node;
+						bValid = node.reso.size1() == pNode0->reso.size1() &&
+							node.reso.size2() == pNode0->reso.size2() &&
+							node.reso_v.size() == pNode0->reso_v.size() &&
+							node.Q_avg.size() == pNode0->Q_avg.size();
+					}
+			}
+
+			if(!bValid || !ifstr.eof())
+			{
+				tl::log_err("Invalid resolution map file \"", strFile, "\".");
+				return false;
+			}
+
+			map.nodes = std::move(mapNodes);
+			map.cells = std::move(mapCells);
+			map.bDirty = 0;
+			tl::log_info("Loaded resolution map \"", strFile, "\" with ",
+				map.nodes.size(), " nodes and ", map.cells.size(), " cells.");
+			return true;
+		}
+
+
+		/**
+		 * writes all changed maps to the directory, merged with the maps which other
+		 * processes have saved there in the meantime
+		 */
+		bool Save()
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if(m_strDir == "")
+				return false;
+
+			bool bOk = 1;
+			for(auto& pair : m_maps)
+			{
+				ResoMap& map = pair.second;
+				if(!map.bDirty)
+					continue;
+
+				const std::string strFile = GetFileName(pair.first);
+
+				// only one process at a time merges and replaces a map
+				namespace ipr = boost::interprocess;
+				const std::string strLockFile = strFile + ".lock";
+				std::unique_ptr<ipr::file_lock> pFileLock;
+				try
+				{
+					std::ofstream(strLockFile, std::ios_base::app);
+					pFileLock.reset(new ipr::file_lock(strLockFile.c_str()));
+				}
+				catch(const std::exception& ex)
+				{
+					tl::log_err("Cannot lock resolution map \"", strFile, "\": ", ex.what(), ".");
+					bOk = 0;
+					continue;
+				}
+				ipr::scoped_lock<ipr::file_lock> lockFile(*pFileLock);
+
+				// the existing entries are kept, the results at a node are the same for all processes
+				ResoMap mapOnDisk;
+				if(LoadMap(strFile, mapOnDisk))
+				{
+					map.nodes.insert(mapOnDisk.nodes.begin(), mapOnDisk.nodes.end());
+					map.cells.insert(mapOnDisk.cells.begin(), mapOnDisk.cells.end());
+				}
+
+				// write to a temporary file first, so concurrent jobs never read a partial map
+				std::ostringstream ostrTmp;
+				ostrTmp << strFile << ".tmp." << getpid() << "." << std::this_thread::get_id();
+				const std::string strTmpFile = ostrTmp.str();
+				{
+					std::ofstream ofstr(strTmpFile);
+					if(!ofstr)
+					{
+						tl::log_err("Cannot write resolution map \"", strTmpFile, "\".");
+						bOk = 0;
+						continue;
+					}
+					ofstr.precision(std::numeric_limits<t_real>::max_digits10);
+
+					ofstr << "grid " << m_dQStep << " " << m_dEStep << " "
+						<< m_iMaxLevel << " " << m_dTol << "\n";
+
+					for(const auto& node : map.nodes)
+					{
+						const ResoResults& res = node.second;
+						ofstr << "node " << node.first.first << " " << node.first.second << " " << res.bOk;
+						if(res.bOk)
+						{
+							ofstr << " " << res.dR0 << " " << res.dResVol << " " << res.reso_s;
+							for(int i=0; i<4; ++i)
+								ofstr << " " << res.dBraggFWHMs[i];
+
+							ofstr << " " << res.reso.size1() << " " << res.reso.size2();
+							for(std::size_t i=0; i<res.reso.size1(); ++i)
+								for(std::size_t j=0; j<res.reso.size2(); ++j)
+									ofstr << " " << res.reso(i,j);
+							ofstr << " " << res.reso_v.size();
+							for(std::size_t i=0; i<res.reso_v.size(); ++i)
+								ofstr << " " << res.reso_v[i];
+							ofstr << " " << res.Q_avg.size();
+							for(std::size_t i=0; i<res.Q_avg.size(); ++i)
+								ofstr << " " << res.Q_avg[i];
+						}
+						ofstr << "\n";
+					}
+
+					for(const auto& cell : map.cells)
+					{
+						ofstr << "cell " << std::get<0>(cell.first) << " " << std::get<1>(cell.first)
+							<< " " << std::get<2>(cell.first) << " " << int(cell.second) << "\n";
+					}
+
+					if(!ofstr.flush())
+					{
+						tl::log_err("Cannot write resolution map \"", strTmpFile, "\".");
+						ofstr.close();
+						std::remove(strTmpFile.c_str());
+						bOk = 0;
+						continue;
+					}
+				}
+
+				if(std::rename(strTmpFile.c_str(), strFile.c_str()) != 0)
+				{
+					tl::log_err("Cannot write resolution map \"", strFile, "\".");
+					std::remove(strTmpFile.c_str());
+					bOk = 0;
+					continue;
+				}
+
+				map.bDirty = 0;
+				tl::log_info("Saved resolution map \"", strFile, "\" with ",
+					map.nodes.size(), " nodes and ", map.cells.size(), " cells.");
+			}
+
+			return bOk;
+		}
+};
+
+
+#endif
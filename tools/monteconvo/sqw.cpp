@@ -6,14 +6,19 @@
  */
 
 #include "sqw.h"
+#include "lineshape.h"
 #include "tlibs/string/string.h"
 #include "tlibs/log/log.h"
 #include "tlibs/math/math.h"
 #include "tlibs/math/linalg.h"
 #include "tlibs/phys/neutrons.h"
 #include <fstream>
+#include <algorithm>
 #include <list>
 
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
 using t_real = t_real_reso;
 
 
@@ -129,13 +134,39 @@ SqwKdTree::SqwKdTree(const char* pcFile)
 
 bool SqwKdTree::open(const char* pcFile)
 {
-	m_kd = std::make_shared<tl::Kd<t_real>>();
+	m_kd = std::make_shared<FlatKd<t_real>>();
+	m_mapParams.clear();
+
+	// use the cached tree if it is newer than the table
+	const std::string strCache = std::string(pcFile) + ".kdbin";
+	try
+	{
+		if(fs::exists(strCache) && fs::exists(pcFile) &&
+			fs::last_write_time(strCache) >= fs::last_write_time(pcFile))
+		{
+			if(m_kd->Map(strCache.c_str(), m_mapParams))
+			{
+				tl::log_info("Mapped k-d tree with ", m_kd->GetNumPoints(),
+					" S(q,w) points from \"", strCache, "\".");
+				return true;
+			}
+
+			tl::log_warn("Invalid k-d tree file \"", strCache, "\", regenerating.");
+			m_mapParams.clear();
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_warn(ex.what());
+	}
+
 
 	std::ifstream ifstr(pcFile);
 	if(!ifstr.is_open())
 		return false;
 
-	std::list<std::vector<t_real>> lstPoints;
+	std::vector<t_real> vecPoints;
+	std::vector<t_real> vecSqw;
 	std::size_t iCurPoint = 0;
 	while(!ifstr.eof())
 	{
@@ -153,7 +184,7 @@ bool SqwKdTree::open(const char* pcFile)
 			continue;
 		}
 
-		std::vector<t_real> vecSqw;
+		vecSqw.clear();
 		tl::get_tokens<t_real>(strLine, std::string(" \t"), vecSqw);
 		if(vecSqw.size() != 5)
 		{
@@ -161,16 +192,19 @@ bool SqwKdTree::open(const char* pcFile)
 			return false;
 		}
 
-		lstPoints.push_back(vecSqw);
+		vecPoints.insert(vecPoints.end(), vecSqw.begin(), vecSqw.end());
 		++iCurPoint;
 	}
 
 	tl::log_info("Loaded ",  iCurPoint, " S(q,w) points.");
-	m_kd->Load(lstPoints, 4);
+	m_kd->Build(std::move(vecPoints));
 	tl::log_info("Generated k-d tree.");
 
-	//std::ofstream ofstrkd("kd.dbg");
-	//m_kd->GetRootNode()->print(ofstrkd);
+	if(m_kd->Save(strCache.c_str(), m_mapParams))
+		tl::log_info("Saved k-d tree to \"", strCache, "\".");
+	else
+		tl::log_warn("Could not save k-d tree to \"", strCache, "\".");
+
 	return true;
 }
 
@@ -178,20 +212,32 @@ bool SqwKdTree::open(const char* pcFile)
 t_real SqwKdTree::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
 	// meV and rlu units will have equal scaling in the kd tree!
-	std::vector<t_real> vechklE = {dh, dk, dl, dE};
-	if(!m_kd->IsPointInGrid(vechklE))
+	const t_real hklE[] = {dh, dk, dl, dE};
+	if(!m_kd->IsPointInGrid(hklE))
 		return 0.;
 
-	std::vector<t_real> vec = m_kd->GetNearestNode(vechklE);
+	const t_real *pNode = m_kd->GetNearestNode(hklE);
+	if(!pNode)
+		return 0.;
+
+	//tl::log_info("Nearest node: ", pNode[0], ", ", pNode[1], ", ", pNode[2], ", ", pNode[3], ", ", pNode[4]);
+	return pNode[4];
+}
 
-	/*t_real dDist = std::sqrt(std::pow(vec[0]-vechklE[0], 2.) +
-			std::pow(vec[1]-vechklE[1], 2.) +
-			std::pow(vec[2]-vechklE[2], 2.) +
-			std::pow(vec[3]-vechklE[3], 2.));
-	tl::log_info("Distance to node: ", dDist);*/
 
-	//tl::log_info("Nearest node: ", vec[0], ", ", vec[1], ", ", vec[2], ", ", vec[3], ", ", vec[4]);
-	return vec[4];
+/**
+ * batch evaluation without temporary query vectors
+ */
+void SqwKdTree::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		const t_real hklE[] = {ph[i], pk[i], pl[i], pE[i]};
+
+		const t_real *pNode = m_kd->IsPointInGrid(hklE) ? m_kd->GetNearestNode(hklE) : nullptr;
+		pS[i] = pNode ? pNode[4] : t_real(0);
+	}
 }
 
 
@@ -307,6 +353,42 @@ t_real SqwTable1d::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * batch evaluation re-using the query vector
+ */
+void SqwTable1d::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	if(!m_bOk)
+	{
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+	std::vector<t_real> vecqE(2);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		// get reduced q
+		const t_real dh = ph[i] - m_G[0];
+		const t_real dk = pk[i] - m_G[1];
+		const t_real dl = pl[i] - m_G[2];
+
+		vecqE[0] = std::sqrt(dh*dh + dk*dk + dl*dl);
+		vecqE[1] = pE[i];
+
+		if(!m_kd->IsPointInGrid(vecqE))
+		{
+			pS[i] = t_real(0);
+			continue;
+		}
+
+		const std::vector<t_real>& vec = m_kd->GetNearestNode(vecqE);
+		pS[i] = vec[2];
+	}
+}
+
+
 std::vector<SqwBase::t_var> SqwTable1d::GetVars() const
 {
 	std::ostringstream ostr;
@@ -573,6 +655,31 @@ SqwPhonon::SqwPhonon(const char* pcFile)
 t_real SqwPhonon::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
 	std::vector<t_real> vechklE = {dh, dk, dl, dE};
+	return sqw_point(vechklE);
+}
+
+
+/**
+ * batch evaluation re-using the query vector
+ */
+void SqwPhonon::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	std::vector<t_real> vechklE(4);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		vechklE[0] = ph[i]; vechklE[1] = pk[i];
+		vechklE[2] = pl[i]; vechklE[3] = pE[i];
+
+		pS[i] = sqw_point(vechklE);
+	}
+}
+
+
+t_real SqwPhonon::sqw_point(const std::vector<t_real>& vechklE) const
+{
+	const t_real dE = vechklE[3];
 #ifdef USE_RTREE
 	if(!m_rt->IsPointInGrid(vechklE)) return 0.;
 	std::vector<t_real> vec = m_rt->GetNearestNode(vechklE);
@@ -865,6 +972,36 @@ t_real SqwPhononSingleBranch::operator()(t_real dh, t_real dk, t_real dl, t_real
 }
 
 
+/**
+ * S(Q,E) averaged over the energy resolution: approximate closed form for the dho (see dho_gauss_E),
+ * quadrature if the branch is too close to E = 0
+ */
+void SqwPhononSingleBranch::sqw_gauss_E_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real dSigE, t_real *pS, std::size_t iNum) const
+{
+	const bool bInc = !tl::float_equal<t_real>(m_dIncAmp, 0.);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		const t_real dh = ph[i] - m_vecBragg[0];
+		const t_real dk = pk[i] - m_vecBragg[1];
+		const t_real dl = pl[i] - m_vecBragg[2];
+		const t_real dE0 = phonon_disp(std::sqrt(dh*dh + dk*dk + dl*dl), m_damp, m_dfreq);
+
+		t_real dS = 0.;
+		if(!dho_gauss_E<t_real>(pE[i], dSigE, dE0, m_dHWHM, m_dT, m_dS0, dS))
+		{
+			SqwBase::sqw_gauss_E_batch(ph+i, pk+i, pl+i, pE+i, dSigE, pS+i, 1);
+			continue;
+		}
+
+		if(bInc)
+			dS += gauss_gauss_E<t_real>(pE[i], dSigE, 0., m_dIncSig, m_dIncAmp);
+		pS[i] = dS;
+	}
+}
+
+
 std::vector<SqwBase::t_var> SqwPhononSingleBranch::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -1041,6 +1178,92 @@ t_real SqwMagnon::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * batch evaluation without the intermediate dispersion vectors
+ */
+void SqwMagnon::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	t_real (*pDisp)(t_real, t_real, t_real) = nullptr;
+	switch(m_iWhichDisp)
+	{
+		case 0: pDisp = &ferro_disp; break;
+		case 1: pDisp = &antiferro_disp; break;
+	}
+
+	const bool bInc = !tl::float_equal<t_real>(m_dIncAmp, 0.);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		const t_real dE = pE[i];
+
+		t_real dInc = 0.;
+		if(bInc)
+			dInc = tl::gauss_model<t_real>(dE, 0., m_dIncSig, m_dIncAmp, 0.);
+
+		t_real dS = 0.;
+		if(pDisp)
+		{
+			const t_real dh = ph[i] - m_vecBragg[0];
+			const t_real dk = pk[i] - m_vecBragg[1];
+			const t_real dl = pl[i] - m_vecBragg[2];
+			const t_real dq = std::sqrt(dh*dh + dk*dk + dl*dl);
+			const t_real dE0 = pDisp(dq, m_dD, m_dOffs);
+
+			// magnon creation and annihilation with unit weights
+			dS += std::abs(tl::DHO_model<t_real>(dE, m_dT, dE0, m_dE_HWHM, t_real(1), 0.));
+			dS += std::abs(tl::DHO_model<t_real>(dE, m_dT, -dE0, m_dE_HWHM, t_real(1), 0.));
+			dS *= m_dS0;
+		}
+
+		pS[i] = dS + dInc;
+	}
+}
+
+
+/**
+ * S(Q,E) averaged over the energy resolution: approximate closed form for the dho (see dho_gauss_E),
+ * quadrature if the magnon is too close to E = 0
+ */
+void SqwMagnon::sqw_gauss_E_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real dSigE, t_real *pS, std::size_t iNum) const
+{
+	t_real (*pDisp)(t_real, t_real, t_real) = nullptr;
+	switch(m_iWhichDisp)
+	{
+		case 0: pDisp = &ferro_disp; break;
+		case 1: pDisp = &antiferro_disp; break;
+	}
+
+	const bool bInc = !tl::float_equal<t_real>(m_dIncAmp, 0.);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		t_real dS = 0.;
+		if(pDisp)
+		{
+			const t_real dh = ph[i] - m_vecBragg[0];
+			const t_real dk = pk[i] - m_vecBragg[1];
+			const t_real dl = pl[i] - m_vecBragg[2];
+			const t_real dE0 = pDisp(std::sqrt(dh*dh + dk*dk + dl*dl), m_dD, m_dOffs);
+
+			if(!dho_gauss_E<t_real>(pE[i], dSigE, dE0, m_dE_HWHM, m_dT, t_real(1), dS))
+			{
+				SqwBase::sqw_gauss_E_batch(ph+i, pk+i, pl+i, pE+i, dSigE, pS+i, 1);
+				continue;
+			}
+
+			// the dho at +E0 and at -E0 are the same
+			dS *= t_real(2)*m_dS0;
+		}
+
+		if(bInc)
+			dS += gauss_gauss_E<t_real>(pE[i], dSigE, 0., m_dIncSig, m_dIncAmp);
+		pS[i] = dS;
+	}
+}
+
+
 std::vector<SqwBase::t_var> SqwMagnon::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -21,6 +21,7 @@
 #include "tlibs/file/loaddat.h"
 #include "../res/defs.h"
 #include "sqwbase.h"
+#include "sqw_kd.h"
 
 #ifdef USE_RTREE
 	#include "tlibs/math/rt.h"
@@ -67,13 +68,14 @@ public:
 
 
 /**
- * tabulated model
+ * tabulated model,
+ * the k-d tree is cached in a binary file next to the table
  */
 class SqwKdTree : public SqwBase
 {
 protected:
 	std::unordered_map<std::string, std::string> m_mapParams;
-	std::shared_ptr<tl::Kd<t_real_reso>> m_kd;
+	std::shared_ptr<FlatKd<t_real_reso>> m_kd;
 
 public:
 	SqwKdTree(const char* pcFile = nullptr);
@@ -81,6 +83,9 @@ public:
 
 	bool open(const char* pcFile);
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
@@ -117,6 +122,9 @@ public:
 
 	bool open(const char* pcFile);
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
@@ -144,6 +152,8 @@ protected:
 	void create();
 	void destroy();
 
+	t_real_reso sqw_point(const std::vector<t_real_reso>& vechklE) const;
+
 protected:
 #ifdef USE_RTREE
 	std::shared_ptr<tl::Rt<t_real_reso, 3, RT_ELEMS>> m_rt;
@@ -180,6 +190,9 @@ public:
 	virtual ~SqwPhonon() = default;
 
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
@@ -221,6 +234,10 @@ public:
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_gauss_E_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE, t_real_reso dSigE,
+		t_real_reso *pS, std::size_t iNum) const override;
+	virtual bool HasGaussEBatch() const override { return true; }
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
 
@@ -264,6 +281,13 @@ public:
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
+	virtual void sqw_gauss_E_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE, t_real_reso dSigE,
+		t_real_reso *pS, std::size_t iNum) const override;
+	virtual bool HasGaussEBatch() const override { return true; }
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
 
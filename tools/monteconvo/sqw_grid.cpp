@@ -0,0 +1,600 @@
+/**
+ * gridded S(q,w) model with interpolation and tiled storage
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#include "sqw_grid.h"
+#include "tlibs/string/string.h"
+#include "tlibs/log/log.h"
+#include "tlibs/math/math.h"
+#include "tlibs/phys/neutrons.h"
+
+#if !defined NO_IOSTR
+	#include <boost/iostreams/filtering_stream.hpp>
+	#include <boost/iostreams/filter/zlib.hpp>
+	#include <boost/iostreams/device/array.hpp>
+	#include <boost/iostreams/device/back_inserter.hpp>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if !defined NO_IOSTR
+	namespace ios = boost::iostreams;
+#endif
+using t_real = t_real_reso;
+
+
+//------------------------------------------------------------------------------
+// grid data
+
+SqwGridData::SqwGridData(const char* pcFile)
+	: m_ifstr(pcFile, std::ios_base::binary)
+{
+	if(!m_ifstr)
+	{
+		tl::log_err("Cannot open grid file \"", pcFile, "\".");
+		return;
+	}
+
+	SqwGridHeader hdrRef;
+	m_ifstr.read(reinterpret_cast<char*>(&m_hdr), sizeof(m_hdr));
+	if(!m_ifstr || std::memcmp(m_hdr.magic, hdrRef.magic, sizeof(hdrRef.magic)) != 0)
+	{
+		tl::log_err("\"", pcFile, "\" is not a valid grid file.");
+		return;
+	}
+
+	// decoded size of a tile, cannot overflow for the allowed tile sizes
+	const std::uint64_t iRawLen = std::uint64_t(m_hdr.iTileSize)*m_hdr.iTileSize*m_hdr.iTileSize *
+		m_hdr.iNumBranches * 2 * (m_hdr.iFloat32 ? sizeof(float) : sizeof(double));
+
+	if(m_hdr.iTileSize == 0 || m_hdr.iTileSize > SQW_GRID_MAX_TILE_SIZE ||
+		m_hdr.iNumBranches == 0 || iRawLen > SQW_GRID_MAX_TILE_LEN)
+	{
+		tl::log_err("Invalid tile size or number of branches in grid file \"", pcFile, "\".");
+		return;
+	}
+
+#if defined NO_IOSTR
+	if(m_hdr.iCompressed)
+	{
+		tl::log_err("Grid file \"", pcFile, "\" has compressed tiles, but compression is not supported.");
+		return;
+	}
+#endif
+
+	for(int i=0; i<3; ++i)
+	{
+		if(m_hdr.iCount[i] == 0 || !std::isfinite(m_hdr.dMin[i]) ||
+			!std::isfinite(m_hdr.dStep[i]) || m_hdr.dStep[i] <= 0.)
+		{
+			tl::log_err("Invalid grid axis ", i, " in grid file \"", pcFile, "\".");
+			return;
+		}
+	}
+
+	// the header and the tile table have to fit into the file
+	m_ifstr.seekg(0, std::ios_base::end);
+	const std::uint64_t iFileLen = std::uint64_t(m_ifstr.tellg());
+	m_ifstr.seekg(sizeof(m_hdr), std::ios_base::beg);
+
+	const std::uint64_t iEntryLen = sizeof(decltype(m_vecTileTable)::value_type);
+	const std::uint64_t iMaxTiles = (iFileLen - sizeof(m_hdr)) / iEntryLen;
+
+	std::uint64_t iNumTiles = 1;
+	for(int i=0; i<3; ++i)
+	{
+		m_iTiles[i] = (m_hdr.iCount[i] + m_hdr.iTileSize - 1) / m_hdr.iTileSize;
+		if(m_iTiles[i] > iMaxTiles / iNumTiles)
+		{
+			iNumTiles = 0;
+			break;
+		}
+		iNumTiles *= m_iTiles[i];
+	}
+	if(iNumTiles == 0 || iNumTiles != m_hdr.iNumTiles)
+	{
+		tl::log_err("Tile count mismatch in grid file \"", pcFile, "\".");
+		return;
+	}
+
+	m_vecTileTable.resize(m_hdr.iNumTiles);
+	m_ifstr.read(reinterpret_cast<char*>(m_vecTileTable.data()),
+		m_vecTileTable.size() * iEntryLen);
+	if(!m_ifstr)
+	{
+		tl::log_err("Cannot read tile table of grid file \"", pcFile, "\".");
+		return;
+	}
+
+	// every tile has to lie behind the table and inside the file
+	const std::uint64_t iDataStart = sizeof(m_hdr) + m_vecTileTable.size()*iEntryLen;
+	for(std::size_t iTile=0; iTile<m_vecTileTable.size(); ++iTile)
+	{
+		const std::uint64_t iOffs = m_vecTileTable[iTile].first;
+		const std::uint64_t iLen = m_vecTileTable[iTile].second;
+
+		bool bValid = iOffs >= iDataStart && iLen <= iFileLen && iOffs <= iFileLen - iLen;
+		if(m_hdr.iCompressed)
+			bValid = bValid && iLen > 0;
+		else
+			bValid = bValid && iLen == iRawLen;
+
+		if(!bValid)
+		{
+			tl::log_err("Invalid entry for tile ", iTile, " in grid file \"", pcFile, "\".");
+			m_vecTileTable.clear();
+			return;
+		}
+	}
+
+	tl::log_info("Grid file \"", pcFile, "\": ",
+		m_hdr.iCount[0], "x", m_hdr.iCount[1], "x", m_hdr.iCount[2], " nodes, ",
+		m_hdr.iNumBranches, " branches, ", m_hdr.iNumTiles, " tiles.");
+	m_bOk = true;
+}
+
+
+void SqwGridData::SetCacheSize(std::size_t iMaxTiles)
+{
+	std::lock_guard<std::mutex> lock(m_mtxCache);
+	m_iMaxTiles = std::max<std::size_t>(iMaxTiles, 1);
+
+	while(m_lstLru.size() > m_iMaxTiles)
+	{
+		m_mapCache.erase(m_lstLru.back());
+		m_lstLru.pop_back();
+	}
+}
+
+
+/**
+ * reads and decodes a tile from the file
+ */
+std::shared_ptr<const SqwGridData::t_tile> SqwGridData::LoadTile(std::size_t iTile) const
+{
+	const std::size_t iTileSize = m_hdr.iTileSize;
+	const std::size_t iNumVals = iTileSize*iTileSize*iTileSize * m_hdr.iNumBranches * 2;
+	const std::size_t iRawLen = iNumVals * (m_hdr.iFloat32 ? sizeof(float) : sizeof(double));
+
+	std::vector<char> vecStored(m_vecTileTable[iTile].second);
+	{
+		std::lock_guard<std::mutex> lock(m_mtxFile);
+		m_ifstr.seekg(m_vecTileTable[iTile].first, std::ios_base::beg);
+		m_ifstr.read(vecStored.data(), vecStored.size());
+		if(!m_ifstr)
+		{
+			m_ifstr.clear();
+			tl::log_err("Cannot read grid tile ", iTile, ".");
+			return nullptr;
+		}
+	}
+
+	std::vector<char> vecRaw;
+	if(m_hdr.iCompressed)
+	{
+#if !defined NO_IOSTR
+		vecRaw.resize(iRawLen);
+
+		ios::filtering_istream istr;
+		istr.push(ios::zlib_decompressor());
+		istr.push(ios::array_source(vecStored.data(), vecStored.size()));
+		istr.read(vecRaw.data(), iRawLen);
+
+		if(std::size_t(istr.gcount()) != iRawLen)
+		{
+			tl::log_err("Cannot decompress grid tile ", iTile, ".");
+			return nullptr;
+		}
+#else
+		// rejected on loading
+		return nullptr;
+#endif
+	}
+	else
+	{
+		if(vecStored.size() != iRawLen)
+		{
+			tl::log_err("Size mismatch in grid tile ", iTile, ".");
+			return nullptr;
+		}
+		vecRaw = std::move(vecStored);
+	}
+
+	std::shared_ptr<t_tile> pTile = std::make_shared<t_tile>(iNumVals);
+	if(m_hdr.iFloat32)
+	{
+		const float *pVals = reinterpret_cast<const float*>(vecRaw.data());
+		std::copy(pVals, pVals+iNumVals, pTile->begin());
+	}
+	else
+	{
+		const double *pVals = reinterpret_cast<const double*>(vecRaw.data());
+		std::copy(pVals, pVals+iNumVals, pTile->begin());
+	}
+
+	return pTile;
+}
+
+
+/**
+ * gets a tile from the cache or loads it
+ */
+std::shared_ptr<const SqwGridData::t_tile> SqwGridData::GetTile(std::size_t iTile) const
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mtxCache);
+		auto iter = m_mapCache.find(iTile);
+		if(iter != m_mapCache.end())
+		{
+			m_lstLru.splice(m_lstLru.begin(), m_lstLru, iter->second.second);
+			return iter->second.first;
+		}
+	}
+
+	// load without holding the cache lock
+	std::shared_ptr<const t_tile> pTile = LoadTile(iTile);
+	if(!pTile) return nullptr;
+
+	std::lock_guard<std::mutex> lock(m_mtxCache);
+	auto iter = m_mapCache.find(iTile);
+	if(iter != m_mapCache.end())	// another thread was faster
+		return iter->second.first;
+
+	m_lstLru.push_front(iTile);
+	m_mapCache.emplace(iTile, std::make_pair(pTile, m_lstLru.begin()));
+
+	while(m_lstLru.size() > m_iMaxTiles)
+	{
+		m_mapCache.erase(m_lstLru.back());
+		m_lstLru.pop_back();
+	}
+
+	return pTile;
+}
+
+
+/**
+ * tile index and node index inside the tile for a grid node
+ */
+std::size_t SqwGridData::GetTileIndex(std::size_t iNode[3], std::size_t& iLocalNode) const
+{
+	const std::size_t iTileSize = m_hdr.iTileSize;
+
+	std::size_t iTile[3], iLocal[3];
+	for(int i=0; i<3; ++i)
+	{
+		iTile[i] = iNode[i] / iTileSize;
+		iLocal[i] = iNode[i] % iTileSize;
+	}
+
+	iLocalNode = (iLocal[0]*iTileSize + iLocal[1])*iTileSize + iLocal[2];
+	return (iTile[0]*m_iTiles[1] + iTile[1])*m_iTiles[2] + iTile[2];
+}
+
+//------------------------------------------------------------------------------
+
+
+
+//------------------------------------------------------------------------------
+// model
+
+SqwGrid::SqwGrid(const char* pcFile)
+	: m_pGrid(std::make_shared<SqwGridData>(pcFile))
+{
+	m_bOk = m_pGrid->IsOk();
+}
+
+
+/**
+ * interpolates the branch energies and weights between the surrounding grid nodes;
+ * branches are assumed to keep their indices between neighbouring nodes
+ */
+std::tuple<std::vector<t_real>, std::vector<t_real>>
+SqwGrid::disp(t_real dh, t_real dk, t_real dl) const
+{
+	std::vector<t_real> vecE, vecW;
+	if(!m_pGrid || !m_pGrid->IsOk())
+		return std::make_tuple(vecE, vecW);
+
+	const SqwGridHeader& hdr = m_pGrid->GetHeader();
+	const std::size_t iNumBranches = hdr.iNumBranches;
+	const t_real dPos[3] = { dh, dk, dl };
+
+	// lower corner node and fractional position in the cell
+	std::size_t iNode0[3];
+	t_real dFrac[3];
+	for(int i=0; i<3; ++i)
+	{
+		const std::size_t iCount = hdr.iCount[i];
+		t_real dIdx = (dPos[i] - hdr.dMin[i]) / hdr.dStep[i];
+		dIdx = tl::clamp<t_real>(dIdx, 0., t_real(iCount-1));
+
+		if(!m_bInterpolate)
+			dIdx = std::round(dIdx);
+
+		iNode0[i] = std::min<std::size_t>(std::size_t(dIdx), iCount>1 ? iCount-2 : 0);
+		dFrac[i] = iCount>1 ? tl::clamp<t_real>(dIdx - t_real(iNode0[i]), 0., 1.) : 0.;
+	}
+
+	std::vector<t_real> vecESum(iNumBranches, 0.), vecECoeff(iNumBranches, 0.);
+	std::vector<t_real> vecWSum(iNumBranches, 0.);
+
+	// the corners usually lie in the same tile
+	std::size_t iLastTile = std::size_t(-1);
+	std::shared_ptr<const SqwGridData::t_tile> pTile;
+
+	for(unsigned int iCorner=0; iCorner<8; ++iCorner)
+	{
+		t_real dCoeff = 1.;
+		std::size_t iNode[3];
+		for(int i=0; i<3; ++i)
+		{
+			const bool bUpper = (iCorner >> i) & 1;
+			dCoeff *= bUpper ? dFrac[i] : (1.-dFrac[i]);
+			iNode[i] = std::min<std::size_t>(iNode0[i] + (bUpper ? 1 : 0), hdr.iCount[i]-1);
+		}
+		if(tl::float_equal<t_real>(dCoeff, 0.))
+			continue;
+
+		std::size_t iLocalNode = 0;
+		std::size_t iTile = m_pGrid->GetTileIndex(iNode, iLocalNode);
+		if(iTile != iLastTile)
+		{
+			pTile = m_pGrid->GetTile(iTile);
+			iLastTile = iTile;
+		}
+		if(!pTile) return std::make_tuple(vecE, vecW);
+
+		const t_real *pNode = pTile->data() + iLocalNode*iNumBranches*2;
+		for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+		{
+			const t_real dE = pNode[iBranch*2 + 0];
+			const t_real dW = pNode[iBranch*2 + 1];
+
+			vecWSum[iBranch] += dCoeff*dW;
+
+			// only use energies of nodes where the branch exists
+			if(!tl::float_equal<t_real>(dW, 0.))
+			{
+				vecESum[iBranch] += dCoeff*dE;
+				vecECoeff[iBranch] += dCoeff;
+			}
+		}
+	}
+
+	vecE.reserve(iNumBranches);
+	vecW.reserve(iNumBranches);
+	for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+	{
+		if(tl::float_equal<t_real>(vecWSum[iBranch], 0.) ||
+			tl::float_equal<t_real>(vecECoeff[iBranch], 0.))
+			continue;
+
+		vecE.push_back(vecESum[iBranch] / vecECoeff[iBranch]);
+		vecW.push_back(vecWSum[iBranch]);
+	}
+
+	return std::make_tuple(vecE, vecW);
+}
+
+
+/**
+ * dynamical structure factor S(Q,E)
+ */
+t_real SqwGrid::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
+{
+	std::vector<t_real> vecE, vecW;
+	std::tie(vecE, vecW) = disp(dh, dk, dl);
+
+	t_real dInc = 0.;
+	if(!tl::float_equal<t_real>(m_dIncAmp, 0.))
+		dInc = tl::gauss_model<t_real>(dE, 0., m_dIncSigma, m_dIncAmp, 0.);
+
+	t_real dS = 0.;
+	for(std::size_t iE=0; iE<vecE.size(); ++iE)
+		dS += tl::gauss_model<t_real>(dE, vecE[iE], m_dSigma, vecW[iE], 0.);
+
+	return m_dS0*dS * tl::bose_cutoff(dE, m_dT, m_dcut) + dInc;
+}
+
+
+std::vector<SqwBase::t_var> SqwGrid::GetVars() const
+{
+	std::vector<SqwBase::t_var> vecVars;
+
+	vecVars.push_back(SqwBase::t_var{"T", "real", tl::var_to_str(m_dT)});
+	vecVars.push_back(SqwBase::t_var{"bose_cutoff", "real", tl::var_to_str(m_dcut)});
+	vecVars.push_back(SqwBase::t_var{"sigma", "real", tl::var_to_str(m_dSigma)});
+	vecVars.push_back(SqwBase::t_var{"S0", "real", tl::var_to_str(m_dS0)});
+	vecVars.push_back(SqwBase::t_var{"inc_amp", "real", tl::var_to_str(m_dIncAmp)});
+	vecVars.push_back(SqwBase::t_var{"inc_sigma", "real", tl::var_to_str(m_dIncSigma)});
+	vecVars.push_back(SqwBase::t_var{"interpolate", "bool", tl::var_to_str(m_bInterpolate)});
+	if(m_pGrid)
+		vecVars.push_back(SqwBase::t_var{"cache_tiles", "uint", tl::var_to_str(m_pGrid->GetCacheSize())});
+
+	return vecVars;
+}
+
+
+void SqwGrid::SetVars(const std::vector<SqwBase::t_var>& vecVars)
+{
+	if(vecVars.size() == 0)
+		return;
+
+	for(const SqwBase::t_var& var : vecVars)
+	{
+		const std::string& strVar = std::get<0>(var);
+		const std::string& strVal = std::get<2>(var);
+
+		if(strVar == "T") m_dT = tl::str_to_var<decltype(m_dT)>(strVal);
+		else if(strVar == "bose_cutoff") m_dcut = tl::str_to_var<decltype(m_dcut)>(strVal);
+		else if(strVar == "sigma") m_dSigma = tl::str_to_var<decltype(m_dSigma)>(strVal);
+		else if(strVar == "S0") m_dS0 = tl::str_to_var<decltype(m_dS0)>(strVal);
+		else if(strVar == "inc_amp") m_dIncAmp = tl::str_to_var<decltype(m_dIncAmp)>(strVal);
+		else if(strVar == "inc_sigma") m_dIncSigma = tl::str_to_var<decltype(m_dIncSigma)>(strVal);
+		else if(strVar == "interpolate") m_bInterpolate = tl::str_to_var<bool>(strVal);
+		else if(strVar == "cache_tiles" && m_pGrid)
+			m_pGrid->SetCacheSize(tl::str_to_var<std::size_t>(strVal));
+	}
+}
+
+
+SqwBase* SqwGrid::shallow_copy() const
+{
+	SqwGrid *pCpy = new SqwGrid();
+	*static_cast<SqwBase*>(pCpy) = *static_cast<const SqwBase*>(this);
+
+	pCpy->m_pGrid = m_pGrid;
+
+	pCpy->m_dT = m_dT;
+	pCpy->m_dcut = m_dcut;
+	pCpy->m_dSigma = m_dSigma;
+	pCpy->m_dS0 = m_dS0;
+	pCpy->m_dIncAmp = m_dIncAmp;
+	pCpy->m_dIncSigma = m_dIncSigma;
+	pCpy->m_bInterpolate = m_bInterpolate;
+
+	return pCpy;
+}
+
+//------------------------------------------------------------------------------
+
+
+
+//------------------------------------------------------------------------------
+// grid creation
+
+bool save_sqw_grid(const char* pcFile, const SqwBase& sqw,
+	const t_real dMin[3], const t_real dMax[3], const t_real dStep[3],
+	unsigned int iNumBranches, bool bFloat32, bool bCompress, unsigned int iTileSize)
+{
+	if(iTileSize == 0 || iTileSize > SQW_GRID_MAX_TILE_SIZE || iNumBranches == 0)
+		return false;
+	for(int i=0; i<3; ++i)
+		if(dStep[i] <= 0.)
+			return false;
+
+#if defined NO_IOSTR
+	if(bCompress)
+	{
+		tl::log_warn("Compression is not supported, writing uncompressed grid tiles.");
+		bCompress = 0;
+	}
+#endif
+
+	SqwGridHeader hdr;
+	hdr.iNumBranches = iNumBranches;
+	hdr.iFloat32 = bFloat32;
+	hdr.iCompressed = bCompress;
+	hdr.iTileSize = iTileSize;
+
+	std::uint64_t iTiles[3];
+	for(int i=0; i<3; ++i)
+	{
+		hdr.dMin[i] = dMin[i];
+		hdr.dStep[i] = dStep[i];
+		hdr.iCount[i] = std::uint64_t(std::max<t_real>(std::round((dMax[i]-dMin[i]) / dStep[i]), 0.)) + 1;
+		iTiles[i] = (hdr.iCount[i] + iTileSize - 1) / iTileSize;
+	}
+	hdr.iNumTiles = iTiles[0]*iTiles[1]*iTiles[2];
+
+	std::ofstream ofstr(pcFile, std::ios_base::binary);
+	if(!ofstr)
+	{
+		tl::log_err("Cannot open grid file \"", pcFile, "\" for writing.");
+		return false;
+	}
+
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> vecTileTable(hdr.iNumTiles);
+	const std::size_t iTableLen = vecTileTable.size() * sizeof(decltype(vecTileTable)::value_type);
+
+	ofstr.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+	ofstr.write(reinterpret_cast<const char*>(vecTileTable.data()), iTableLen);
+
+	const std::size_t iNodesPerTile = std::size_t(iTileSize)*iTileSize*iTileSize;
+	std::vector<double> vecVals(iNodesPerTile * iNumBranches * 2);
+	std::vector<float> vecValsF;
+
+	std::size_t iTile = 0;
+	for(std::uint64_t iTileH=0; iTileH<iTiles[0]; ++iTileH)
+	for(std::uint64_t iTileK=0; iTileK<iTiles[1]; ++iTileK)
+	for(std::uint64_t iTileL=0; iTileL<iTiles[2]; ++iTileL)
+	{
+		std::fill(vecVals.begin(), vecVals.end(), 0.);
+		const std::uint64_t iTile3[3] = { iTileH, iTileK, iTileL };
+
+		// nodes outside the grid repeat the last node
+		for(std::size_t iLocal=0; iLocal<iNodesPerTile; ++iLocal)
+		{
+			const std::size_t iLocal3[3] = { iLocal / (iTileSize*iTileSize),
+				(iLocal / iTileSize) % iTileSize, iLocal % iTileSize };
+
+			t_real dPos[3];
+			for(int i=0; i<3; ++i)
+			{
+				std::uint64_t iNode = std::min<std::uint64_t>(
+					iTile3[i]*iTileSize + iLocal3[i], hdr.iCount[i]-1);
+				dPos[i] = dMin[i] + t_real(iNode)*dStep[i];
+			}
+
+			std::vector<t_real> vecE, vecW;
+			std::tie(vecE, vecW) = sqw.disp(dPos[0], dPos[1], dPos[2]);
+
+			for(std::size_t iBranch=0; iBranch<std::min<std::size_t>(vecE.size(), iNumBranches); ++iBranch)
+			{
+				vecVals[(iLocal*iNumBranches + iBranch)*2 + 0] = vecE[iBranch];
+				vecVals[(iLocal*iNumBranches + iBranch)*2 + 1] = vecW[iBranch];
+			}
+		}
+
+		const char *pRaw = reinterpret_cast<const char*>(vecVals.data());
+		std::size_t iRawLen = vecVals.size() * sizeof(double);
+		if(bFloat32)
+		{
+			vecValsF.assign(vecVals.begin(), vecVals.end());
+			pRaw = reinterpret_cast<const char*>(vecValsF.data());
+			iRawLen = vecValsF.size() * sizeof(float);
+		}
+
+		vecTileTable[iTile].first = std::uint64_t(ofstr.tellp());
+#if !defined NO_IOSTR
+		if(bCompress)
+		{
+			std::vector<char> vecComp;
+			{
+				ios::filtering_ostream ostr;
+				ostr.push(ios::zlib_compressor());
+				ostr.push(ios::back_inserter(vecComp));
+				ostr.write(pRaw, iRawLen);
+			}
+
+			ofstr.write(vecComp.data(), vecComp.size());
+			vecTileTable[iTile].second = vecComp.size();
+		}
+		else
+#endif
+		{
+			ofstr.write(pRaw, iRawLen);
+			vecTileTable[iTile].second = iRawLen;
+		}
+
+		++iTile;
+	}
+
+	// write the actual tile table
+	ofstr.seekp(sizeof(hdr), std::ios_base::beg);
+	ofstr.write(reinterpret_cast<const char*>(vecTileTable.data()), iTableLen);
+
+	if(!ofstr)
+	{
+		tl::log_err("Could not write grid file \"", pcFile, "\".");
+		return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------------
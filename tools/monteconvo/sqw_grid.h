@@ -0,0 +1,133 @@
+/**
+ * gridded S(q,w) model with interpolation and tiled storage
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __MCONV_SQW_GRID_H__
+#define __MCONV_SQW_GRID_H__
+
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+
+#include "sqwbase.h"
+
+// sanity limits for the header of a grid file
+#define SQW_GRID_MAX_TILE_SIZE 256
+#define SQW_GRID_MAX_TILE_LEN (std::uint64_t(1) << 30)
+
+
+/**
+ * grid file layout:
+ *	header (SqwGridHeader),
+ *	tile table: iNumTiles * (uint64 offset, uint64 length),
+ *	tiles: iTileSize^3 nodes, each with iNumBranches * (E, weight),
+ *	       stored as float64 or float32 values, optionally zlib-compressed
+ */
+struct SqwGridHeader
+{
+	char magic[8] = { 'T', 'A', 'K', 'G', 'R', 'I', 'D', '1' };
+
+	std::uint32_t iNumBranches = 0;
+	std::uint32_t iFloat32 = 0;		// 0: float64, 1: float32 values
+	std::uint32_t iCompressed = 0;		// 0: raw, 1: zlib-compressed tiles
+	std::uint32_t iTileSize = 16;		// nodes per tile edge
+
+	// grid nodes: min + i*step, i = 0 ... count-1
+	double dMin[3] = { 0., 0., 0. };
+	double dStep[3] = { 1., 1., 1. };
+	std::uint64_t iCount[3] = { 1, 1, 1 };
+
+	std::uint64_t iNumTiles = 0;
+};
+
+
+/**
+ * grid data with LRU tile cache, shared between shallow copies
+ */
+class SqwGridData
+{
+public:
+	using t_tile = std::vector<t_real_reso>;
+
+protected:
+	SqwGridHeader m_hdr;
+	std::uint64_t m_iTiles[3] = { 0, 0, 0 };
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> m_vecTileTable;
+
+	mutable std::ifstream m_ifstr;
+	mutable std::mutex m_mtxFile;
+
+	// least recently used tiles are at the end of the list
+	std::size_t m_iMaxTiles = 256;
+	mutable std::list<std::size_t> m_lstLru;
+	mutable std::unordered_map<std::size_t,
+		std::pair<std::shared_ptr<const t_tile>, std::list<std::size_t>::iterator>> m_mapCache;
+	mutable std::mutex m_mtxCache;
+
+	bool m_bOk = false;
+
+protected:
+	std::shared_ptr<const t_tile> LoadTile(std::size_t iTile) const;
+
+public:
+	SqwGridData(const char* pcFile);
+
+	bool IsOk() const { return m_bOk; }
+	const SqwGridHeader& GetHeader() const { return m_hdr; }
+
+	std::size_t GetCacheSize() const { return m_iMaxTiles; }
+	void SetCacheSize(std::size_t iMaxTiles);
+
+	std::shared_ptr<const t_tile> GetTile(std::size_t iTile) const;
+
+	std::size_t GetTileIndex(std::size_t iNode[3], std::size_t& iLocalNode) const;
+};
+
+
+/**
+ * interpolated S(q,w) on a pre-calculated (h,k,l) grid
+ */
+class SqwGrid : public SqwBase
+{
+protected:
+	std::shared_ptr<SqwGridData> m_pGrid;
+
+	t_real_reso m_dT = 100.;
+	t_real_reso m_dcut = 0.02;
+	t_real_reso m_dSigma = 0.05;
+	t_real_reso m_dS0 = 1.;
+	t_real_reso m_dIncAmp = 0., m_dIncSigma = 0.05;
+
+	// trilinear interpolation between grid nodes, otherwise nearest node
+	bool m_bInterpolate = 1;
+
+public:
+	SqwGrid() = default;
+	SqwGrid(const char* pcFile);
+	virtual ~SqwGrid() = default;
+
+	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
+		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
+	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+
+	virtual std::vector<SqwBase::t_var> GetVars() const override;
+	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
+
+	virtual SqwBase* shallow_copy() const override;
+};
+
+
+/**
+ * tabulates the dispersion of a model on a grid and writes it to a grid file
+ */
+extern bool save_sqw_grid(const char* pcFile, const SqwBase& sqw,
+	const t_real_reso dMin[3], const t_real_reso dMax[3], const t_real_reso dStep[3],
+	unsigned int iNumBranches, bool bFloat32=0, bool bCompress=1, unsigned int iTileSize=16);
+
+
+#endif
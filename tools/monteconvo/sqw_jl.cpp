@@ -11,6 +11,8 @@
 #include "tlibs/file/file.h"
 #include "tlibs/ext/jl.h"
 
+#include <algorithm>
+
 using t_real = t_real_reso;
 
 #define MAX_PARAM_VAL_SIZE 128
@@ -24,10 +26,6 @@ SqwJl::SqwJl(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 		return;
 	}
 
-	std::string strFile = pcFile;
-	std::string strDir = tl::get_dir(strFile);
-	const bool bSetScriptCWD = 1;
-
 	// init interpreter
 	static bool bInited = 0;
 	if(!bInited)
@@ -43,18 +41,14 @@ SqwJl::SqwJl(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 	jl_value_t *pMod = jl_cstr_to_string(pcFile);
 	jl_call1(pInc, pMod);
 
-	// working dir
-	if(bSetScriptCWD)
-	{
-		jl_function_t *pCwd = jl_get_function(jl_base_module, "cd");
-		jl_value_t *pDir = jl_cstr_to_string(strDir.c_str());
-		jl_call1(pCwd, pDir);
-	}
+	// the working directory is not changed here, as it is shared by the whole
+	// process; the script directory is set by the worker process (see SqwProc)
 
 	// import takin functions
 	m_pInit = jl_get_function(jl_main_module, "TakinInit");
 	m_pSqw = jl_get_function(jl_main_module, "TakinSqw");
 	m_pDisp = jl_get_function(jl_main_module, "TakinDisp");
+	m_pSqwBatch = jl_get_function(jl_main_module, "TakinSqwBatch");	// optional
 
 	PrintExceptions();
 
@@ -184,6 +178,77 @@ t_real SqwJl::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * S(Q,E) for a batch of points: one call to TakinSqwBatch if available,
+ * otherwise a loop over TakinSqw under a single lock
+ */
+void SqwJl::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	if(!m_bOk)
+	{
+		tl::log_err("Julia interpreter has not initialised, cannot query S(q,w).");
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+
+	bool bBatchOk = 0;
+	if(m_pSqwBatch && m_bUseSqwBatch)
+	{
+		// wrap the input arrays without copying them
+		jl_datatype_t *pTy = sizeof(t_real)==sizeof(float) ? jl_float32_type : jl_float64_type;
+		jl_value_t *pArrTy = jl_apply_array_type((jl_value_t*)pTy, 1);
+
+		jl_value_t *phklE[4] = { nullptr, nullptr, nullptr, nullptr };
+		jl_value_t *pRet = nullptr;
+		JL_GC_PUSH5(&phklE[0], &phklE[1], &phklE[2], &phklE[3], &pRet);
+
+		const t_real *pIn[4] = { ph, pk, pl, pE };
+		for(int i=0; i<4; ++i)
+		{
+			phklE[i] = (jl_value_t*)jl_ptr_to_array_1d(pArrTy,
+				const_cast<t_real*>(pIn[i]), iNum, 0);
+		}
+
+		pRet = jl_call((jl_function_t*)m_pSqwBatch, phklE, 4);
+
+		// only use arrays of the same element type and length as the input
+		if(pRet && jl_is_array(pRet) && jl_array_eltype(pRet) == (void*)pTy
+			&& jl_array_len((jl_array_t*)pRet) == iNum)
+		{
+			const t_real *pS_jl = reinterpret_cast<const t_real*>(jl_array_data((jl_array_t*)pRet));
+			std::copy(pS_jl, pS_jl+iNum, pS);
+			bBatchOk = 1;
+		}
+		else
+		{
+			tl::log_err("TakinSqwBatch has to return an array of ",
+				sizeof(t_real)==sizeof(float) ? "Float32" : "Float64",
+				" with one value per point, evaluating the points one by one.");
+			m_bUseSqwBatch = 0;
+		}
+
+		JL_GC_POP();
+	}
+
+	if(!bBatchOk)
+	{
+		for(std::size_t iPt=0; iPt<iNum; ++iPt)
+		{
+			jl_value_t *phklE[4] =
+				{ tl::jl_traits<t_real>::box(ph[iPt]), tl::jl_traits<t_real>::box(pk[iPt]),
+				tl::jl_traits<t_real>::box(pl[iPt]), tl::jl_traits<t_real>::box(pE[iPt]) };
+			jl_value_t *pSqw = jl_call((jl_function_t*)m_pSqw, phklE, 4);
+			pS[iPt] = pSqw ? t_real(tl::jl_traits<t_real>::unbox(pSqw)) : t_real(0);
+		}
+	}
+
+	PrintExceptions();
+}
+
+
 std::vector<SqwBase::t_var> SqwJl::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -294,6 +359,8 @@ SqwBase* SqwJl::shallow_copy() const
 	pSqw->m_pInit = this->m_pInit;
 	pSqw->m_pSqw = this->m_pSqw;
 	pSqw->m_pDisp = this->m_pDisp;
+	pSqw->m_pSqwBatch = this->m_pSqwBatch;
+	pSqw->m_bUseSqwBatch = this->m_bUseSqwBatch;
 	pSqw->m_pmtx = this->m_pmtx;
 
 	return pSqw;
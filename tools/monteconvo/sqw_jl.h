@@ -22,6 +22,9 @@ protected:
 	/*jl_function_t*/ void *m_pInit = nullptr;
 	/*jl_function_t*/ void *m_pSqw = nullptr;
 	/*jl_function_t*/ void *m_pDisp = nullptr;
+	/*jl_function_t*/ void *m_pSqwBatch = nullptr;
+	// set to false if TakinSqwBatch returned an unusable array
+	mutable bool m_bUseSqwBatch = 1;
 
 	// filter variables that don't start with the given prefix
 	std::string m_strVarPrefix = "g_";
@@ -38,6 +41,9 @@ public:
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
@@ -0,0 +1,317 @@
+/**
+ * flat k-d tree for tabulated S(q,w), can be stored in and mapped from a file
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __MCONV_SQW_KD_H__
+#define __MCONV_SQW_KD_H__
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "tlibs/log/log.h"
+
+
+/**
+ * k-d tree over (h, k, l, E) points with an S value each;
+ * the tree is implicit in the order of the points: the median of
+ * a range [lo, hi) splits it along the dimension (depth % DIM)
+ */
+template<class t_real = double>
+class FlatKd
+{
+public:
+	static constexpr std::size_t DIM = 4;		// search dimensions: h, k, l, E
+	static constexpr std::size_t STRIDE = 5;	// values per point: h, k, l, E, S
+
+	using t_params = std::unordered_map<std::string, std::string>;
+
+protected:
+	// cache file layout: header, parameter string, min/max of the points, points
+	struct Header
+	{
+		char magic[8] = { 'T', 'A', 'K', 'K', 'D', '0', '0', '1' };
+		std::uint64_t iRealSize = sizeof(t_real);
+		std::uint64_t iNumPoints = 0;
+		std::uint64_t iParamLen = 0;		// padded to a multiple of 8
+	};
+
+	const t_real *m_pPoints = nullptr;
+	std::size_t m_iNumPoints = 0;
+
+	t_real m_dMin[DIM], m_dMax[DIM];
+
+	// either the points are owned or they are in a read-only file mapping
+	std::vector<t_real> m_vecPoints;
+	std::shared_ptr<boost::interprocess::mapped_region> m_pRegion;
+
+protected:
+	void BuildRange(std::vector<std::size_t>& vecIdx, std::size_t iLo, std::size_t iHi,
+		std::size_t iDepth, const std::vector<t_real>& vecPts)
+	{
+		if(iHi - iLo <= 1) return;
+
+		const std::size_t iMid = iLo + (iHi-iLo)/2;
+		const std::size_t iDim = iDepth % DIM;
+
+		std::nth_element(vecIdx.begin()+iLo, vecIdx.begin()+iMid, vecIdx.begin()+iHi,
+			[&vecPts, iDim](std::size_t i0, std::size_t i1) -> bool
+			{ return vecPts[i0*STRIDE + iDim] < vecPts[i1*STRIDE + iDim]; });
+
+		BuildRange(vecIdx, iLo, iMid, iDepth+1, vecPts);
+		BuildRange(vecIdx, iMid+1, iHi, iDepth+1, vecPts);
+	}
+
+	void Nearest(std::size_t iLo, std::size_t iHi, std::size_t iDepth,
+		const t_real* pt, const t_real*& pBest, t_real& dBestDist) const
+	{
+		if(iLo >= iHi) return;
+
+		const std::size_t iMid = iLo + (iHi-iLo)/2;
+		const t_real *pNode = m_pPoints + iMid*STRIDE;
+
+		t_real dDist = 0.;
+		for(std::size_t i=0; i<DIM; ++i)
+			dDist += (pNode[i]-pt[i]) * (pNode[i]-pt[i]);
+		if(dDist < dBestDist)
+		{
+			dBestDist = dDist;
+			pBest = pNode;
+		}
+
+		const std::size_t iDim = iDepth % DIM;
+		const t_real dDiff = pt[iDim] - pNode[iDim];
+
+		// search the side containing the point first
+		if(dDiff < 0.)
+		{
+			Nearest(iLo, iMid, iDepth+1, pt, pBest, dBestDist);
+			if(dDiff*dDiff < dBestDist)
+				Nearest(iMid+1, iHi, iDepth+1, pt, pBest, dBestDist);
+		}
+		else
+		{
+			Nearest(iMid+1, iHi, iDepth+1, pt, pBest, dBestDist);
+			if(dDiff*dDiff < dBestDist)
+				Nearest(iLo, iMid, iDepth+1, pt, pBest, dBestDist);
+		}
+	}
+
+	void CalcMinMax()
+	{
+		std::fill(m_dMin, m_dMin+DIM, std::numeric_limits<t_real>::max());
+		std::fill(m_dMax, m_dMax+DIM, std::numeric_limits<t_real>::lowest());
+
+		for(std::size_t iPt=0; iPt<m_iNumPoints; ++iPt)
+		{
+			for(std::size_t i=0; i<DIM; ++i)
+			{
+				m_dMin[i] = std::min(m_dMin[i], m_pPoints[iPt*STRIDE + i]);
+				m_dMax[i] = std::max(m_dMax[i], m_pPoints[iPt*STRIDE + i]);
+			}
+		}
+	}
+
+
+	/**
+	 * writes the cache file
+	 */
+	bool WriteFile(const char* pcFile, const t_params& mapParams) const
+	{
+		std::ofstream ofstr(pcFile, std::ios_base::binary);
+		if(!ofstr)
+			return false;
+
+		std::string strParams;
+		for(const typename t_params::value_type& pair : mapParams)
+			strParams += pair.first + '\n' + pair.second + '\n';
+		strParams.resize((strParams.length() + 7) / 8 * 8, '\0');
+
+		Header hdr;
+		hdr.iNumPoints = m_iNumPoints;
+		hdr.iParamLen = strParams.length();
+
+		ofstr.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+		ofstr.write(strParams.data(), strParams.length());
+		ofstr.write(reinterpret_cast<const char*>(m_dMin), sizeof(m_dMin));
+		ofstr.write(reinterpret_cast<const char*>(m_dMax), sizeof(m_dMax));
+		ofstr.write(reinterpret_cast<const char*>(m_pPoints), m_iNumPoints*STRIDE*sizeof(t_real));
+
+		ofstr.close();
+		return !!ofstr;
+	}
+
+public:
+	FlatKd() = default;
+	FlatKd(const FlatKd&) = delete;
+	const FlatKd& operator=(const FlatKd&) = delete;
+
+	/**
+	 * sorts the points (STRIDE values each) into k-d tree order
+	 */
+	void Build(std::vector<t_real>&& vecPts)
+	{
+		const std::size_t iNum = vecPts.size() / STRIDE;
+
+		std::vector<std::size_t> vecIdx(iNum);
+		std::iota(vecIdx.begin(), vecIdx.end(), 0);
+		BuildRange(vecIdx, 0, iNum, 0, vecPts);
+
+		m_vecPoints.resize(iNum*STRIDE);
+		for(std::size_t iPt=0; iPt<iNum; ++iPt)
+			std::copy(vecPts.begin() + vecIdx[iPt]*STRIDE,
+				vecPts.begin() + (vecIdx[iPt]+1)*STRIDE,
+				m_vecPoints.begin() + iPt*STRIDE);
+
+		m_pRegion.reset();
+		m_pPoints = m_vecPoints.data();
+		m_iNumPoints = iNum;
+		CalcMinMax();
+	}
+
+
+	/**
+	 * writes the tree and the table parameters to a cache file;
+	 * the file is written under a unique name and then renamed over the target,
+	 * so processes which have mapped the old file keep their (unlinked) copy intact
+	 */
+	bool Save(const char* pcFile, const t_params& mapParams) const
+	{
+		std::ostringstream ostrTmp;
+		ostrTmp << pcFile << ".tmp." << getpid() << "." << std::this_thread::get_id();
+		const std::string strTmp = ostrTmp.str();
+
+		if(!WriteFile(strTmp.c_str(), mapParams) || std::rename(strTmp.c_str(), pcFile) != 0)
+		{
+			std::remove(strTmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+
+	/**
+	 * maps a cache file read-only, the pages are shared between processes
+	 */
+	bool Map(const char* pcFile, t_params& mapParams)
+	{
+		namespace ipr = boost::interprocess;
+
+		try
+		{
+			// check the header against the file size before mapping it
+			Header hdrRef, hdr;
+			{
+				std::ifstream ifstr(pcFile, std::ios_base::binary);
+				if(!ifstr)
+					return false;
+				ifstr.seekg(0, std::ios_base::end);
+				const std::uint64_t iFileLen = std::uint64_t(ifstr.tellg());
+				ifstr.seekg(0, std::ios_base::beg);
+
+				if(!ifstr.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)))
+					return false;
+				if(std::memcmp(hdr.magic, hdrRef.magic, sizeof(hdr.magic)) != 0 ||
+					hdr.iRealSize != sizeof(t_real) || hdr.iParamLen % 8 != 0)
+					return false;
+
+				const std::uint64_t iFixedLen = sizeof(hdr) + 2*sizeof(m_dMin);
+				const std::uint64_t iPointLen = STRIDE*sizeof(t_real);
+				if(iFileLen < iFixedLen || hdr.iParamLen > iFileLen - iFixedLen ||
+					hdr.iNumPoints > (iFileLen - iFixedLen - hdr.iParamLen) / iPointLen ||
+					iFileLen != iFixedLen + hdr.iParamLen + hdr.iNumPoints*iPointLen)
+				{
+					tl::log_err("Size mismatch in k-d tree file \"", pcFile, "\".");
+					return false;
+				}
+			}
+
+			ipr::file_mapping file(pcFile, ipr::read_only);
+			std::shared_ptr<ipr::mapped_region> pRegion =
+				std::make_shared<ipr::mapped_region>(file, ipr::read_only);
+
+			const char *pMem = static_cast<const char*>(pRegion->get_address());
+			const std::size_t iSize = pRegion->get_size();
+
+			// the file could have been replaced in the meantime
+			if(iSize < sizeof(hdr) || std::memcmp(pMem, &hdr, sizeof(hdr)) != 0)
+				return false;
+
+			const std::size_t iPtsOffs = sizeof(hdr) + hdr.iParamLen + 2*sizeof(m_dMin);
+			if(iSize != iPtsOffs + hdr.iNumPoints*STRIDE*sizeof(t_real))
+				return false;
+
+			// parameters
+			std::string strParams(pMem + sizeof(hdr), hdr.iParamLen);
+			strParams.erase(std::find(strParams.begin(), strParams.end(), '\0'), strParams.end());
+			std::size_t iPos = 0;
+			while(iPos < strParams.length())
+			{
+				std::size_t iKeyEnd = strParams.find('\n', iPos);
+				if(iKeyEnd == std::string::npos) break;
+				std::size_t iValEnd = strParams.find('\n', iKeyEnd+1);
+				if(iValEnd == std::string::npos) break;
+
+				mapParams[strParams.substr(iPos, iKeyEnd-iPos)] =
+					strParams.substr(iKeyEnd+1, iValEnd-iKeyEnd-1);
+				iPos = iValEnd + 1;
+			}
+
+			std::memcpy(m_dMin, pMem + sizeof(hdr) + hdr.iParamLen, sizeof(m_dMin));
+			std::memcpy(m_dMax, pMem + sizeof(hdr) + hdr.iParamLen + sizeof(m_dMin), sizeof(m_dMax));
+
+			m_vecPoints.clear();
+			m_pRegion = pRegion;
+			m_pPoints = reinterpret_cast<const t_real*>(pMem + iPtsOffs);
+			m_iNumPoints = hdr.iNumPoints;
+		}
+		catch(const std::exception& ex)
+		{
+			tl::log_err("Cannot map k-d tree file \"", pcFile, "\": ", ex.what());
+			return false;
+		}
+
+		return true;
+	}
+
+
+	std::size_t GetNumPoints() const { return m_iNumPoints; }
+
+	bool IsPointInGrid(const t_real* pt) const
+	{
+		for(std::size_t i=0; i<DIM; ++i)
+			if(pt[i] < m_dMin[i] || pt[i] > m_dMax[i])
+				return false;
+		return true;
+	}
+
+	/**
+	 * returns the nearest point (STRIDE values) or nullptr if the tree is empty
+	 */
+	const t_real* GetNearestNode(const t_real* pt) const
+	{
+		const t_real *pBest = nullptr;
+		t_real dBestDist = std::numeric_limits<t_real>::max();
+		Nearest(0, m_iNumPoints, 0, pt, pBest, dBestDist);
+		return pBest;
+	}
+};
+
+
+#endif
@@ -10,42 +10,236 @@
 
 #include "sqw.h"
 #include <mutex>
+#include <condition_variable>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <chrono>
 #include <unistd.h>
 #include <boost/interprocess/ipc/message_queue.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
 
 
-template<class t_sqw>
-class SqwProc : public SqwBase
+/**
+ * one forked worker process and its communication channels
+ */
+struct SqwProcChild
 {
-private:
-	std::size_t m_iRefCnt = 0;
+	std::string strName;
+	pid_t pid = 0;
+
+	std::shared_ptr<boost::interprocess::managed_shared_memory> pMem;
+	std::shared_ptr<boost::interprocess::message_queue> pmsgIn, pmsgOut;
+	void *pSharedPars = nullptr;
+	void *pSharedRing = nullptr;
+
+	// the process has terminated and is no longer handed out by the pool
+	bool bDead = false;
+
+	// usage statistics
+	std::size_t iNumCalls = 0;
+	std::size_t iNumPoints = 0;
+	double dBusySecs = 0.;
+};
+
+
+/**
+ * usage statistics of one worker process
+ */
+struct SqwProcChildStats
+{
+	std::size_t iNumCalls = 0;
+	std::size_t iNumPoints = 0;
+	double dBusySecs = 0.;
+
+	// busy time relative to the lifetime of the pool
+	double dUtilisation = 0.;
+};
+
+
+/**
+ * pool of worker processes, shared between shallow copies
+ */
+struct SqwProcPool
+{
+	std::vector<SqwProcChild> vecChildren;
+
+	// indices of currently unused children
+	std::vector<std::size_t> vecIdle;
+	std::mutex mtx;
+	std::condition_variable cond;
+
+	// number of children which have not terminated
+	std::size_t iNumAlive = 0;
+
+	// serialises operations which need all children at once
+	std::mutex mtxAll;
+
+	std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+
+	/**
+	 * takes the least loaded idle child from the pool, waits if all are busy,
+	 * returns false if no child is alive anymore
+	 */
+	bool Acquire(std::size_t& iChild)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cond.wait(lock, [this]() -> bool { return !vecIdle.empty() || iNumAlive == 0; });
+		if(vecIdle.empty())
+			return false;
+
+		auto iterIdle = std::min_element(vecIdle.begin(), vecIdle.end(),
+			[this](std::size_t iChild0, std::size_t iChild1) -> bool
+			{ return vecChildren[iChild0].dBusySecs < vecChildren[iChild1].dBusySecs; });
+
+		iChild = *iterIdle;
+		vecIdle.erase(iterIdle);
+		return true;
+	}
+
+	/**
+	 * takes all children which are alive, waits until the busy ones are released
+	 */
+	std::vector<std::size_t> AcquireAll()
+	{
+		std::vector<std::size_t> vecAcquired;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		while(1)
+		{
+			vecAcquired.insert(vecAcquired.end(), vecIdle.begin(), vecIdle.end());
+			vecIdle.clear();
 
+			if(vecAcquired.size() >= iNumAlive)
+				break;
+			cond.wait(lock);
+		}
+		return vecAcquired;
+	}
+
+	/**
+	 * puts a child back into the pool and updates its statistics,
+	 * a terminated child is removed from the pool instead
+	 */
+	void Release(std::size_t iChild, double dBusySecs=0., std::size_t iNumPoints=0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			SqwProcChild& child = vecChildren[iChild];
+			++child.iNumCalls;
+			child.iNumPoints += iNumPoints;
+			child.dBusySecs += dBusySecs;
+
+			if(child.bDead)
+				--iNumAlive;
+			else
+				vecIdle.push_back(iChild);
+		}
+
+		// waiters in Acquire and AcquireAll have different conditions
+		cond.notify_all();
+	}
+
+	std::vector<SqwProcChildStats> GetStats()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		const double dTotal = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - tpStart).count();
+
+		std::vector<SqwProcChildStats> vecStats;
+		vecStats.reserve(vecChildren.size());
+		for(const SqwProcChild& child : vecChildren)
+		{
+			SqwProcChildStats stats;
+			stats.iNumCalls = child.iNumCalls;
+			stats.iNumPoints = child.iNumPoints;
+			stats.dBusySecs = child.dBusySecs;
+			stats.dUtilisation = dTotal > 0. ? child.dBusySecs / dTotal : 0.;
+			vecStats.push_back(stats);
+		}
+		return vecStats;
+	}
+};
+
+
+/**
+ * holds a child of the pool for the lifetime of the object
+ */
+class SqwProcChildLock
+{
 protected:
-	mutable std::shared_ptr<std::mutex> m_pmtx;
+	SqwProcPool& m_pool;
+	std::size_t m_iChild = 0;
+	bool m_bOk = false;
+	std::size_t m_iNumPoints = 1;
+	std::chrono::steady_clock::time_point m_tpStart;
+
+public:
+	SqwProcChildLock(SqwProcPool& pool)
+		: m_pool(pool), m_bOk(pool.Acquire(m_iChild)),
+		m_tpStart(std::chrono::steady_clock::now())
+	{}
+
+	~SqwProcChildLock()
+	{
+		if(!m_bOk) return;
 
+		const double dBusy = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - m_tpStart).count();
+		m_pool.Release(m_iChild, dBusy, m_iNumPoints);
+	}
+
+	void SetNumPoints(std::size_t iNum) { m_iNumPoints = iNum; }
+
+	// false if all children of the pool have terminated
+	explicit operator bool() const { return m_bOk; }
+
+	SqwProcChildLock(const SqwProcChildLock&) = delete;
+	const SqwProcChildLock& operator=(const SqwProcChildLock&) = delete;
+
+	SqwProcChild& operator*() { return m_pool.vecChildren[m_iChild]; }
+	SqwProcChild* operator->() { return &m_pool.vecChildren[m_iChild]; }
+};
+
+
+/**
+ * runs iNumChildren independent instances of t_sqw in forked processes,
+ * each call is delegated to the next idle one, batches are sharded
+ */
+template<class t_sqw>
+class SqwProc : public SqwBase
+{
+protected:
 	std::string m_strProcName;
-	pid_t m_pidChild = 0;
+	mutable std::shared_ptr<SqwProcPool> m_pPool;
 
-	std::shared_ptr<boost::interprocess::managed_shared_memory> m_pMem;
-	std::shared_ptr<boost::interprocess::message_queue> m_pmsgIn, m_pmsgOut;
-	void *m_pSharedPars = nullptr;
+	void sqw_batch_child(SqwProcChildLock& child, const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const;
 
 public:
 	SqwProc();
-	SqwProc(const char* pcCfg);
+	SqwProc(const char* pcCfg, std::size_t iNumChildren=1);
 	virtual ~SqwProc();
 
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 	virtual bool IsOk() const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
 
 	virtual SqwBase* shallow_copy() const override;
+
+	std::size_t GetNumChildren() const { return m_pPool ? m_pPool->vecChildren.size() : 0; }
+	std::size_t GetNumAliveChildren() const;
+	std::vector<SqwProcChildStats> GetChildStats() const;
+	void LogChildStats() const;
 };
 
 #endif
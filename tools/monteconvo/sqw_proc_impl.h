@@ -16,10 +16,24 @@
 #include <boost/interprocess/managed_shared_memory.hpp>
 #include <boost/interprocess/allocators/allocator.hpp>
 #include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <algorithm>
+#include <future>
+#include <cstdlib>
+#include <sys/wait.h>
 
 #define MSG_QUEUE_SIZE 128
 #define PARAM_MEM 1024*1024
 
+// number of points per ring buffer slot: h, k, l, E and S arrays
+#define SQW_BATCH_SIZE 4096
+// number of slots in the ring buffer
+#define SQW_RING_SLOTS 4
+// interval in which the parent checks if a busy child is still alive
+#define SQW_RING_TIMEOUT_MS 250
+
 
 namespace ipr = boost::interprocess;
 using t_real = t_real_reso;
@@ -176,6 +190,40 @@ static std::vector<SqwBase::t_var> str_to_pars(const t_sh_str& _str)
 
 
 
+// ----------------------------------------------------------------------------
+// ring buffer for bulk transfers
+
+struct SqwProcRingSlot
+{
+	std::size_t iLen = 0;
+
+	// [h, k, l, E, S] * SQW_BATCH_SIZE
+	t_real dat[5*SQW_BATCH_SIZE];
+};
+
+/**
+ * ring buffer in the shared memory segment of a child:
+ * the parent fills slots with (h,k,l,E) chunks, the child writes S into them.
+ * semaphores have no owner, so a child dying mid-chunk cannot leave a lock behind
+ */
+struct SqwProcRing
+{
+	// chunks written by the parent but not yet taken by the child
+	ipr::interprocess_semaphore semFilled;
+	// chunks evaluated by the child but not yet collected by the parent
+	ipr::interprocess_semaphore semDone;
+
+	SqwProcRingSlot slots[SQW_RING_SLOTS];
+
+	SqwProcRing() : semFilled(0), semDone(0) {}
+};
+
+#define BATCH_MEM (sizeof(SqwProcRing) + 1024)
+
+// ----------------------------------------------------------------------------
+
+
+
 // ----------------------------------------------------------------------------
 // messages
 
@@ -186,6 +234,7 @@ enum class ProcMsgTypes
 
 	DISP,
 	SQW,
+	SQW_RING,
 	GET_VARS,
 	SET_VARS,
 
@@ -202,6 +251,10 @@ struct ProcMsg
 	bool bRet;
 
 	t_sh_str *pPars = nullptr;
+
+	// ring buffer in shared memory and number of chunks to process
+	SqwProcRing *pRing = nullptr;
+	std::size_t iNumChunks = 0;
 };
 
 static void msg_send(ipr::message_queue& msgqueue, const ProcMsg& msg)
@@ -247,7 +300,20 @@ template<class t_sqw>
 static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgFromParent,
 	const char* pcCfg)
 {
-	std::unique_ptr<t_sqw> pSqw(new t_sqw(pcCfg));
+	// the worker process only hosts the model, so it can run in the directory
+	// of the model's script without changing the main process' working directory
+	std::string strCfg = pcCfg ? pcCfg : "";
+	if(char *pcAbsCfg = (strCfg != "" ? realpath(strCfg.c_str(), nullptr) : nullptr))
+	{
+		strCfg = pcAbsCfg;
+		free(pcAbsCfg);
+
+		const std::string strDir = tl::get_dir(strCfg);
+		if(strDir != "" && chdir(strDir.c_str()) != 0)
+			tl::log_warn("Cannot change to script directory \"", strDir, "\".");
+	}
+
+	std::unique_ptr<t_sqw> pSqw(new t_sqw(strCfg.c_str()));
 
 	// tell parent that pSqw is inited
 	ProcMsg msgReady;
@@ -277,6 +343,24 @@ static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgF
 				msg_send(msgToParent, msgRet);
 				break;
 			}
+			case ProcMsgTypes::SQW_RING:	// structure factors for chunks in the ring buffer
+			{
+				// no reply message, completion is signalled via the ring buffer
+				SqwProcRing& ring = *msg.pRing;	// use provided pointer to shared mem
+
+				for(std::size_t iChunk=0; iChunk<msg.iNumChunks; ++iChunk)
+				{
+					ring.semFilled.wait();
+
+					t_real *pDat = ring.slots[iChunk % SQW_RING_SLOTS].dat;
+					pSqw->sqw_batch(pDat, pDat + SQW_BATCH_SIZE,
+						pDat + 2*SQW_BATCH_SIZE, pDat + 3*SQW_BATCH_SIZE,
+						pDat + 4*SQW_BATCH_SIZE, ring.slots[iChunk % SQW_RING_SLOTS].iLen);
+
+					ring.semDone.post();
+				}
+				break;
+			}
 			case ProcMsgTypes::GET_VARS:	// get variables
 			{
 				msgRet.ty = msg.ty;
@@ -318,58 +402,163 @@ static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgF
 // ----------------------------------------------------------------------------
 // parent process
 
-template<class t_sqw>
-SqwProc<t_sqw>::SqwProc()
+/**
+ * removes the shared memory and message queues of a child
+ */
+static inline void remove_child_res(const std::string& strName)
 {
-	++m_iRefCnt;
+	try
+	{
+		ipr::shared_memory_object::remove(("takin_sqw_proc_mem_" + strName).c_str());
+
+		ipr::message_queue::remove(("takin_sqw_proc_in_" + strName).c_str());
+		ipr::message_queue::remove(("takin_sqw_proc_out_" + strName).c_str());
+	}
+	catch(const std::exception&)
+	{}
 }
 
 
 /**
- * create sub-process
+ * checks if a child process is still running,
+ * a child which has already been reaped (ECHILD) counts as terminated
  */
-template<class t_sqw>
-SqwProc<t_sqw>::SqwProc(const char* pcCfg)
-	: m_pmtx(std::make_shared<std::mutex>()),
-	m_strProcName(tl::rand_name<std::string>(8))
+static inline bool child_alive(pid_t pidChild)
 {
-	++m_iRefCnt;
+	int iStatus = 0;
+	return waitpid(pidChild, &iStatus, WNOHANG) == 0;
+}
+
+
+/**
+ * marks a child as terminated, the pool removes it on release
+ */
+static inline void child_set_dead(SqwProcChild& child)
+{
+	if(!child.bDead)
+		tl::log_err("S(q,w) process ", child.pid, " has terminated.");
+	child.bDead = true;
+}
+
+
+/**
+ * receives the reply of a child, checks periodically if the child is still alive,
+ * returns false if it has terminated
+ */
+static bool msg_recv_child(SqwProcChild& child, ProcMsg& msg)
+{
+	if(child.bDead) return false;
 
 	try
 	{
-		tl::log_debug("Creating process memory \"", "takin_sqw_proc_*_", m_strProcName, "\".");
+		while(1)
+		{
+			const boost::posix_time::ptime tTimeout =
+				boost::posix_time::microsec_clock::universal_time() +
+				boost::posix_time::milliseconds(SQW_RING_TIMEOUT_MS);
+
+			std::size_t iSize;
+			unsigned int iPrio;
+			if(child.pmsgIn->timed_receive(&msg, sizeof(msg), iSize, iPrio, tTimeout))
+			{
+				if(iSize != sizeof(msg))
+					tl::log_err("Message size mismatch.");
+				return true;
+			}
+
+			if(!child_alive(child.pid))
+				break;
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_err(ex.what());
+	}
+
+	child_set_dead(child);
+	return false;
+}
+
+
+template<class t_sqw>
+SqwProc<t_sqw>::SqwProc()
+{}
 
-		m_pMem = std::make_shared<ipr::managed_shared_memory>(ipr::create_only,
-			("takin_sqw_proc_mem_" + m_strProcName).c_str(), PARAM_MEM);
-		m_pSharedPars = static_cast<void*>(m_pMem->construct<t_sh_str>
-			(("takin_sqw_proc_params_" + m_strProcName).c_str())
-			(t_sh_str_alloc(m_pMem->get_segment_manager())));
 
-		m_pmsgIn = std::make_shared<ipr::message_queue>(ipr::create_only,
-			("takin_sqw_proc_in_" + m_strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
-		m_pmsgOut = std::make_shared<ipr::message_queue>(ipr::create_only,
-			("takin_sqw_proc_out_" + m_strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
+/**
+ * create sub-processes
+ */
+template<class t_sqw>
+SqwProc<t_sqw>::SqwProc(const char* pcCfg, std::size_t iNumChildren)
+	: m_strProcName(tl::rand_name<std::string>(8)),
+	m_pPool(std::make_shared<SqwProcPool>())
+{
+	if(iNumChildren == 0)
+		iNumChildren = 1;
+	m_pPool->vecChildren.reserve(iNumChildren);
 
-		m_pidChild = fork();
-		if(m_pidChild < 0)
+	try
+	{
+		for(std::size_t iChild=0; iChild<iNumChildren; ++iChild)
 		{
-			tl::log_err("Cannot fork process.");
-			return;
+			SqwProcChild child;
+			child.strName = m_strProcName + "_" + tl::var_to_str(iChild);
+			tl::log_debug("Creating process memory \"", "takin_sqw_proc_*_", child.strName, "\".");
+
+			child.pMem = std::make_shared<ipr::managed_shared_memory>(ipr::create_only,
+				("takin_sqw_proc_mem_" + child.strName).c_str(), PARAM_MEM + BATCH_MEM);
+			child.pSharedPars = static_cast<void*>(child.pMem->construct<t_sh_str>
+				(("takin_sqw_proc_params_" + child.strName).c_str())
+				(t_sh_str_alloc(child.pMem->get_segment_manager())));
+			child.pSharedRing = static_cast<void*>(child.pMem->construct<SqwProcRing>
+				(("takin_sqw_proc_ring_" + child.strName).c_str())());
+
+			child.pmsgIn = std::make_shared<ipr::message_queue>(ipr::create_only,
+				("takin_sqw_proc_in_" + child.strName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
+			child.pmsgOut = std::make_shared<ipr::message_queue>(ipr::create_only,
+				("takin_sqw_proc_out_" + child.strName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
+
+			child.pid = fork();
+			if(child.pid < 0)
+			{
+				tl::log_err("Cannot fork process.");
+				remove_child_res(child.strName);
+				break;
+			}
+			else if(child.pid == 0)
+			{
+				child_proc<t_sqw>(*child.pmsgIn, *child.pmsgOut, pcCfg);
+				exit(0);
+			}
+
+			m_pPool->vecChildren.emplace_back(std::move(child));
 		}
-		else if(m_pidChild == 0)
+
+		// the children initialise in parallel
+		tl::log_debug("Waiting for ", m_pPool->vecChildren.size(), " client(s) to become ready...");
+		m_bOk = (m_pPool->vecChildren.size() != 0);
+
+		for(std::size_t iChild=0; iChild<m_pPool->vecChildren.size(); ++iChild)
 		{
-			child_proc<t_sqw>(*m_pmsgIn, *m_pmsgOut, pcCfg);
-			exit(0);
-		}
+			ProcMsg msgReady;
+			if(!msg_recv_child(m_pPool->vecChildren[iChild], msgReady))
+			{
+				m_bOk = 0;
+				continue;
+			}
 
-		tl::log_debug("Waiting for client to become ready...");
-		ProcMsg msgReady = msg_recv(*m_pmsgIn);
-		if(!msgReady.bRet)
-			tl::log_err("Client reports failure.");
-		else
-			tl::log_debug("Client is ready.");
+			if(!msgReady.bRet)
+			{
+				tl::log_err("Client ", iChild, " reports failure.");
+				m_bOk = 0;
+			}
+
+			m_pPool->vecIdle.push_back(iChild);
+			++m_pPool->iNumAlive;
+		}
 
-		m_bOk = msgReady.bRet;
+		if(m_bOk)
+			tl::log_debug("Clients are ready.");
 	}
 	catch(const std::exception& ex)
 	{
@@ -380,35 +569,32 @@ SqwProc<t_sqw>::SqwProc(const char* pcCfg)
 
 
 /**
- * clean up sub-process
+ * clean up sub-processes
  */
 template<class t_sqw>
 SqwProc<t_sqw>::~SqwProc()
 {
 	// is this instance the last?
-	if(m_pMem.use_count() > 1) return;
+	if(!m_pPool || m_pPool.use_count() > 1) return;
+	LogChildStats();
 
-	try
+	for(SqwProcChild& child : m_pPool->vecChildren)
 	{
-		if(m_pmsgOut)
-		{
-			ProcMsg msg;
-			msg.ty = ProcMsgTypes::QUIT;
-			msg_send(*m_pmsgOut, msg);
-		}
-
-		if(--m_iRefCnt == 0)
+		try
 		{
-			tl::log_debug("Removing process memory \"", "takin_sqw_proc_*_", m_strProcName, "\".");
-
-			ipr::shared_memory_object::remove(("takin_sqw_proc_mem_" + m_strProcName).c_str());
+			if(child.pmsgOut && !child.bDead)
+			{
+				ProcMsg msg;
+				msg.ty = ProcMsgTypes::QUIT;
+				msg_send(*child.pmsgOut, msg);
+			}
 
-			ipr::message_queue::remove(("takin_sqw_proc_in_" + m_strProcName).c_str());
-			ipr::message_queue::remove(("takin_sqw_proc_out_" + m_strProcName).c_str());
+			tl::log_debug("Removing process memory \"", "takin_sqw_proc_*_", child.strName, "\".");
+			remove_child_res(child.strName);
 		}
+		catch(const std::exception&)
+		{}
 	}
-	catch(const std::exception&)
-	{}
 }
 
 
@@ -419,17 +605,21 @@ template<class t_sqw>
 std::tuple<std::vector<t_real>, std::vector<t_real>>
 SqwProc<t_sqw>::disp(t_real dh, t_real dk, t_real dl) const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	SqwProcChildLock child(*m_pPool);
+	if(!child)
+		return std::tuple<std::vector<t_real>, std::vector<t_real>>({}, {});
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::DISP;
 	msg.dParam1 = dh;
 	msg.dParam2 = dk;
 	msg.dParam3 = dl;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	msg_send(*m_pmsgOut, msg);
+	msg.pPars = static_cast<decltype(msg.pPars)>(child->pSharedPars);
+	msg_send(*child->pmsgOut, msg);
 
-	ProcMsg msgDisp = msg_recv(*m_pmsgIn);
+	ProcMsg msgDisp;
+	if(!msg_recv_child(*child, msgDisp))
+		return std::tuple<std::vector<t_real>, std::vector<t_real>>({}, {});
 	return str_to_disp(*msgDisp.pPars);
 }
 
@@ -440,7 +630,8 @@ SqwProc<t_sqw>::disp(t_real dh, t_real dk, t_real dl) const
 template<class t_sqw>
 t_real SqwProc<t_sqw>::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	SqwProcChildLock child(*m_pPool);
+	if(!child) return t_real(0);
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::SQW;
@@ -448,63 +639,219 @@ t_real SqwProc<t_sqw>::operator()(t_real dh, t_real dk, t_real dl, t_real dE) co
 	msg.dParam2 = dk;
 	msg.dParam3 = dl;
 	msg.dParam4 = dE;
-	msg_send(*m_pmsgOut, msg);
+	msg_send(*child->pmsgOut, msg);
 
-	ProcMsg msgS = msg_recv(*m_pmsgIn);
+	ProcMsg msgS;
+	if(!msg_recv_child(*child, msgS))
+		return t_real(0);
 	return msgS.dRet;
 }
 
+
+/**
+ * waits until the child has evaluated the next chunk,
+ * returns false if the child has died in the meantime
+ */
+static bool ring_wait_done(SqwProcRing& ring, SqwProcChild& child)
+{
+	while(1)
+	{
+		const boost::posix_time::ptime tTimeout =
+			boost::posix_time::microsec_clock::universal_time() +
+			boost::posix_time::milliseconds(SQW_RING_TIMEOUT_MS);
+
+		if(ring.semDone.timed_wait(tTimeout))
+			return true;
+
+		if(!child_alive(child.pid))
+		{
+			child_set_dead(child);
+			return false;
+		}
+	}
+}
+
+
+/**
+ * query dynamical structure factor for a batch of points in one child,
+ * transferred in chunks of SQW_BATCH_SIZE via the shared ring buffer
+ */
+template<class t_sqw>
+void SqwProc<t_sqw>::sqw_batch_child(SqwProcChildLock& child,
+	const t_real *ph, const t_real *pk, const t_real *pl, const t_real *pE,
+	t_real *pS, std::size_t iNum) const
+{
+	child.SetNumPoints(iNum);
+	if(iNum == 0) return;
+
+	// the semaphores of the ring are balanced after every complete session,
+	// an incomplete one only happens if the child has died, which is then not reused
+	SqwProcRing& ring = *static_cast<SqwProcRing*>(child->pSharedRing);
+	const std::size_t iNumChunks = (iNum + SQW_BATCH_SIZE - 1) / SQW_BATCH_SIZE;
+
+	// a single message starts the session, the rest is synchronised via the ring
+	ProcMsg msg;
+	msg.ty = ProcMsgTypes::SQW_RING;
+	msg.pRing = &ring;
+	msg.iNumChunks = iNumChunks;
+	msg_send(*child->pmsgOut, msg);
+
+	// copies the results of the next evaluated chunk
+	std::size_t iCollected = 0;
+	auto collect = [&ring, &iCollected, &child, pS, iNum]() -> bool
+	{
+		if(!ring_wait_done(ring, *child))
+		{
+			std::fill(pS + iCollected*SQW_BATCH_SIZE, pS+iNum, t_real(0));
+			return false;
+		}
+
+		const SqwProcRingSlot& slot = ring.slots[iCollected % SQW_RING_SLOTS];
+		const t_real *pRet = slot.dat + 4*SQW_BATCH_SIZE;
+		std::copy(pRet, pRet+slot.iLen, pS + iCollected*SQW_BATCH_SIZE);
+
+		++iCollected;
+		return true;
+	};
+
+	for(std::size_t iChunk=0; iChunk<iNumChunks; ++iChunk)
+	{
+		// wait for a free slot
+		while(iChunk - iCollected >= SQW_RING_SLOTS)
+			if(!collect()) return;
+
+		const std::size_t iStart = iChunk*SQW_BATCH_SIZE;
+		const std::size_t iLen = std::min<std::size_t>(SQW_BATCH_SIZE, iNum-iStart);
+
+		SqwProcRingSlot& slot = ring.slots[iChunk % SQW_RING_SLOTS];
+		slot.iLen = iLen;
+		std::copy(ph+iStart, ph+iStart+iLen, slot.dat);
+		std::copy(pk+iStart, pk+iStart+iLen, slot.dat + SQW_BATCH_SIZE);
+		std::copy(pl+iStart, pl+iStart+iLen, slot.dat + 2*SQW_BATCH_SIZE);
+		std::copy(pE+iStart, pE+iStart+iLen, slot.dat + 3*SQW_BATCH_SIZE);
+
+		ring.semFilled.post();
+	}
+
+	while(iCollected < iNumChunks)
+		if(!collect()) return;
+}
+
+
+/**
+ * query dynamical structure factor for a batch of points,
+ * large batches are sharded across the children
+ */
+template<class t_sqw>
+void SqwProc<t_sqw>::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	const std::size_t iNumChunks = (iNum + SQW_BATCH_SIZE - 1) / SQW_BATCH_SIZE;
+	const std::size_t iNumShards = std::max<std::size_t>(1,
+		std::min<std::size_t>(m_pPool->vecChildren.size(), iNumChunks));
+	const std::size_t iShardLen = (iNum + iNumShards - 1) / iNumShards;
+
+	auto shard = [this, ph, pk, pl, pE, pS, iNum, iShardLen](std::size_t iShard) -> void
+	{
+		const std::size_t iStart = iShard * iShardLen;
+		if(iStart >= iNum) return;
+		const std::size_t iLen = std::min(iShardLen, iNum - iStart);
+
+		SqwProcChildLock child(*m_pPool);
+		if(!child)
+		{
+			std::fill(pS+iStart, pS+iStart+iLen, t_real(0));
+			return;
+		}
+		sqw_batch_child(child, ph+iStart, pk+iStart, pl+iStart, pE+iStart, pS+iStart, iLen);
+	};
+
+	std::vector<std::future<void>> vecFut;
+	vecFut.reserve(iNumShards);
+	for(std::size_t iShard=1; iShard<iNumShards; ++iShard)
+		vecFut.emplace_back(std::async(std::launch::async, shard, iShard));
+
+	// first shard in the calling thread
+	shard(0);
+
+	for(std::future<void>& fut : vecFut)
+		fut.get();
+}
+
+
 template<class t_sqw>
 bool SqwProc<t_sqw>::IsOk() const
 {
 	if(!m_bOk) return false;
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	SqwProcChildLock child(*m_pPool);
+	if(!child) return false;
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::IS_OK;
-	msg_send(*m_pmsgOut, msg);
+	msg_send(*child->pmsgOut, msg);
 
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
+	ProcMsg msgRet;
+	if(!msg_recv_child(*child, msgRet))
+		return false;
 	return msgRet.bRet;
 }
 
 
 /**
- * query variables
+ * query variables (all children have the same ones)
  */
 template<class t_sqw>
 std::vector<SqwBase::t_var> SqwProc<t_sqw>::GetVars() const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	SqwProcChildLock child(*m_pPool);
+	if(!child) return std::vector<SqwBase::t_var>{};
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::GET_VARS;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	msg_send(*m_pmsgOut, msg);
+	msg.pPars = static_cast<decltype(msg.pPars)>(child->pSharedPars);
+	msg_send(*child->pmsgOut, msg);
 
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
+	ProcMsg msgRet;
+	if(!msg_recv_child(*child, msgRet))
+		return std::vector<SqwBase::t_var>{};
 	return str_to_pars(*msg.pPars);
 }
 
 
 /**
- * set variables
+ * set variables in all children
  */
 template<class t_sqw>
 void SqwProc<t_sqw>::SetVars(const std::vector<SqwBase::t_var>& vecVars)
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	std::lock_guard<std::mutex> lockAll(m_pPool->mtxAll);
 
-	ProcMsg msg;
-	msg.ty = ProcMsgTypes::SET_VARS;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	pars_to_str(*msg.pPars, vecVars);
-	//tl::log_debug("Message string: ", *msg.pPars);
-	msg_send(*m_pmsgOut, msg);
-
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
-	if(!msgRet.bRet)
-		tl::log_err("Could not set variables.");
+	// wait until all living children are idle
+	const std::vector<std::size_t> vecChildren = m_pPool->AcquireAll();
+
+	// let the children update their parameters in parallel
+	for(std::size_t iChild : vecChildren)
+	{
+		SqwProcChild& child = m_pPool->vecChildren[iChild];
+
+		ProcMsg msg;
+		msg.ty = ProcMsgTypes::SET_VARS;
+		msg.pPars = static_cast<decltype(msg.pPars)>(child.pSharedPars);
+		pars_to_str(*msg.pPars, vecVars);
+		//tl::log_debug("Message string: ", *msg.pPars);
+		msg_send(*child.pmsgOut, msg);
+	}
+
+	for(std::size_t iChild : vecChildren)
+	{
+		SqwProcChild& child = m_pPool->vecChildren[iChild];
+
+		ProcMsg msgRet;
+		if(!msg_recv_child(child, msgRet) || !msgRet.bRet)
+			tl::log_err("Could not set variables in client ", iChild, ".");
+
+		m_pPool->Release(iChild);
+	}
 }
 
 
@@ -514,17 +861,45 @@ SqwBase* SqwProc<t_sqw>::shallow_copy() const
 	SqwProc* pSqw = new SqwProc();
 	*static_cast<SqwBase*>(pSqw) = *static_cast<const SqwBase*>(this);
 
-	pSqw->m_pmtx = this->m_pmtx;
-	pSqw->m_pMem = this->m_pMem;
-	pSqw->m_pmsgIn = this->m_pmsgIn;
-	pSqw->m_pmsgOut = this->m_pmsgOut;
 	pSqw->m_strProcName = this->m_strProcName;
-	pSqw->m_pidChild = this->m_pidChild;
-	pSqw->m_pSharedPars = this->m_pSharedPars;
+	pSqw->m_pPool = this->m_pPool;
 
 	return pSqw;
 }
 
+template<class t_sqw>
+std::size_t SqwProc<t_sqw>::GetNumAliveChildren() const
+{
+	if(!m_pPool) return 0;
+
+	std::lock_guard<std::mutex> lock(m_pPool->mtx);
+	return m_pPool->iNumAlive;
+}
+
+template<class t_sqw>
+std::vector<SqwProcChildStats> SqwProc<t_sqw>::GetChildStats() const
+{
+	if(!m_pPool) return std::vector<SqwProcChildStats>{};
+	return m_pPool->GetStats();
+}
+
+
+/**
+ * writes the usage of each worker process to the log, e.g. to find a suitable pool size
+ */
+template<class t_sqw>
+void SqwProc<t_sqw>::LogChildStats() const
+{
+	const std::vector<SqwProcChildStats> vecStats = GetChildStats();
+	for(std::size_t iChild=0; iChild<vecStats.size(); ++iChild)
+	{
+		const SqwProcChildStats& stats = vecStats[iChild];
+		tl::log_info("S(q,w) worker ", iChild, ": ", stats.iNumCalls, " calls, ",
+			stats.iNumPoints, " points, busy ", stats.dBusySecs, " s (",
+			stats.dUtilisation*100., " %).");
+	}
+}
+
 // ----------------------------------------------------------------------------
 
 #endif
@@ -11,6 +11,7 @@
 #include "tlibs/file/file.h"
 
 #include <boost/python/stl_iterator.hpp>
+#include <algorithm>
 
 using t_real = t_real_reso;
 
@@ -29,7 +30,6 @@ SqwPy::SqwPy(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 	std::string strFile = pcFile;
 	std::string strDir = tl::get_dir(strFile);
 	std::string strMod = tl::get_file_noext(tl::get_file_nodir(strFile));
-	const bool bSetScriptCWD = 1;
 
 	try	// mandatory stuff
 	{
@@ -50,17 +50,8 @@ SqwPy::SqwPy(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 		path.append(strDir.c_str());
 		path.append(".");
 
-		if(bSetScriptCWD)
-		{
-			// set script working directory -> warning: also sets main cwd
-			m_os = py::import("os");
-			py::dict osdict = py::extract<py::dict>(m_os.attr("__dict__"));
-			py::object pycwd = osdict["chdir"];
-			if(!!pycwd)
-				pycwd(strDir.c_str());
-			else
-				tl::log_warn("Cannot set python script working directory.");
-		}
+		// the working directory is not changed here, as it is shared by the whole
+		// process; the script directory is set by the worker process (see SqwProc)
 
 		// import takin functions
 		m_mod = py::import(strMod.c_str());
@@ -93,6 +84,13 @@ SqwPy::SqwPy(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 				m_disp = moddict["TakinDisp"];
 			else
 				tl::log_warn("Python script has no TakinDisp function.");
+
+			// vectorised S(q,w) function operating on numpy arrays
+			if(moddict.has_key("TakinSqwBatch"))
+			{
+				m_np = py::import("numpy");
+				m_SqwBatch = moddict["TakinSqwBatch"];
+			}
 		}
 		catch(const py::error_already_set& ex) {}
 	}
@@ -203,6 +201,78 @@ t_real SqwPy::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * wraps a memory block in a numpy array without copying it
+ */
+static py::object to_np_array(const py::object& np, const t_real* pArr, std::size_t iNum)
+{
+#if PY_MAJOR_VERSION >= 3
+	PyObject *pBuf = PyMemoryView_FromMemory(
+		reinterpret_cast<char*>(const_cast<t_real*>(pArr)),
+		Py_ssize_t(iNum*sizeof(t_real)), PyBUF_READ);
+#else
+	PyObject *pBuf = PyBuffer_FromMemory(
+		const_cast<t_real*>(pArr), Py_ssize_t(iNum*sizeof(t_real)));
+#endif
+	py::object buf{py::handle<>(pBuf)};
+	const char* pcType = sizeof(t_real)==sizeof(float) ? "float32" : "float64";
+	return np.attr("frombuffer")(buf, np.attr(pcType));
+}
+
+
+/**
+ * S(Q,E) for a batch of points: one call to TakinSqwBatch if available,
+ * otherwise a loop over TakinSqw under a single lock
+ */
+void SqwPy::sqw_batch(const t_real *ph, const t_real *pk,
+	const t_real *pl, const t_real *pE, t_real *pS, std::size_t iNum) const
+{
+	if(!m_bOk)
+	{
+		tl::log_err("Interpreter has not initialised, cannot query S(q,w).");
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+	try
+	{
+		if(!!m_SqwBatch)
+		{
+			py::object arrS = m_SqwBatch(
+				to_np_array(m_np, ph, iNum), to_np_array(m_np, pk, iNum),
+				to_np_array(m_np, pl, iNum), to_np_array(m_np, pE, iNum));
+
+			py::stl_input_iterator<t_real> iterS(arrS), endS;
+			std::size_t iIdx = 0;
+			for(; iterS!=endS && iIdx<iNum; ++iterS, ++iIdx)
+				pS[iIdx] = *iterS;
+
+			if(iIdx != iNum)
+			{
+				tl::log_err("TakinSqwBatch returned ", iIdx, " values, expected ", iNum, ".");
+				std::fill(pS+iIdx, pS+iNum, t_real(0));
+			}
+		}
+		else
+		{
+			for(std::size_t i=0; i<iNum; ++i)
+				pS[i] = py::extract<t_real>(m_Sqw(ph[i], pk[i], pl[i], pE[i]));
+		}
+
+		return;
+	}
+	catch(const py::error_already_set& ex)
+	{
+		PyErr_Print();
+		PyErr_Clear();
+	}
+
+	std::fill(pS, pS+iNum, t_real(0));
+}
+
+
 /**
  * Gets model variables.
  */
@@ -351,11 +421,12 @@ SqwBase* SqwPy::shallow_copy() const
 
 	pSqw->m_pmtx = this->m_pmtx;
 	pSqw->m_sys = this->m_sys;
-	pSqw->m_os = this->m_os;
 	pSqw->m_mod = this->m_mod;
 	pSqw->m_Sqw = this->m_Sqw;
 	pSqw->m_Init = this->m_Init;
 	pSqw->m_disp = this->m_disp;
+	pSqw->m_SqwBatch = this->m_SqwBatch;
+	pSqw->m_np = this->m_np;
 
 	return pSqw;
 }
@@ -26,8 +26,9 @@ class SqwPy : public SqwBase
 protected:
 	mutable std::shared_ptr<std::mutex> m_pmtx;
 
-	py::object m_sys, m_os, m_mod;
+	py::object m_sys, m_mod;
 	py::object m_Sqw, m_disp, m_Init;
+	py::object m_SqwBatch, m_np;
 
 	// filter variables that don't start with the given prefix
 	std::string m_strVarPrefix = "g_";
@@ -40,6 +41,9 @@ public:
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
@@ -6,6 +6,71 @@
  */
 
 #include "sqwbase.h"
+#include "lineshape.h"
+
+#include <algorithm>
+
+
+/**
+ * default batch evaluation: loop over the single-point function
+ */
+void SqwBase::sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+	const t_real_reso *pl, const t_real_reso *pE,
+	t_real_reso *pS, std::size_t iNum) const
+{
+	for(std::size_t i=0; i<iNum; ++i)
+		pS[i] = this->operator()(ph[i], pk[i], pl[i], pE[i]);
+}
+
+
+/**
+ * default average over the energy distribution:
+ * gauss-hermite quadrature using the batch function, in blocks of points
+ */
+void SqwBase::sqw_gauss_E_batch(const t_real_reso *ph, const t_real_reso *pk,
+	const t_real_reso *pl, const t_real_reso *pE, t_real_reso dSigE,
+	t_real_reso *pS, std::size_t iNum) const
+{
+	if(!(dSigE > t_real_reso(0)))
+	{
+		sqw_batch(ph, pk, pl, pE, pS, iNum);
+		return;
+	}
+
+	const std::size_t iBlock = 256;
+	const auto& rule = get_gauss_hermite_E<t_real_reso>();
+	const std::size_t iNodes = rule.first.size();
+
+	std::vector<t_real_reso> vecH, vecK, vecL, vecE, vecS;
+	for(std::size_t iStart=0; iStart<iNum; iStart+=iBlock)
+	{
+		const std::size_t iCurBlock = std::min(iBlock, iNum-iStart);
+		const std::size_t iNumPts = iCurBlock*iNodes;
+		vecH.resize(iNumPts); vecK.resize(iNumPts);
+		vecL.resize(iNumPts); vecE.resize(iNumPts);
+		vecS.resize(iNumPts);
+
+		for(std::size_t iCur=0; iCur<iCurBlock; ++iCur)
+		{
+			for(std::size_t iNode=0; iNode<iNodes; ++iNode)
+			{
+				const std::size_t iPt = iCur*iNodes + iNode;
+				vecH[iPt] = ph[iStart+iCur]; vecK[iPt] = pk[iStart+iCur]; vecL[iPt] = pl[iStart+iCur];
+				vecE[iPt] = pE[iStart+iCur] + dSigE*rule.first[iNode];
+			}
+		}
+
+		sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecS.data(), iNumPts);
+
+		for(std::size_t iCur=0; iCur<iCurBlock; ++iCur)
+		{
+			t_real_reso dS = 0.;
+			for(std::size_t iNode=0; iNode<iNodes; ++iNode)
+				dS += rule.second[iNode] * vecS[iCur*iNodes + iNode];
+			pS[iStart+iCur] = dS;
+		}
+	}
+}
 
 
 /**
@@ -46,6 +46,22 @@ public:
 
 	// S(Q,E) dynamical structure factor function
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const = 0;
+
+	// S(Q,E) for a batch of iNum points, the results are written to pS
+	virtual void sqw_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE,
+		t_real_reso *pS, std::size_t iNum) const;
+
+	// S(Q,E) averaged over the energy distribution N(E; pE[i], dSigE^2) for a batch of iNum points,
+	// models with a (possibly approximate) closed form, e.g. for voigt profiles, can override the default quadrature
+	virtual void sqw_gauss_E_batch(const t_real_reso *ph, const t_real_reso *pk,
+		const t_real_reso *pl, const t_real_reso *pE, t_real_reso dSigE,
+		t_real_reso *pS, std::size_t iNum) const;
+
+	// true if sqw_gauss_E_batch is a closed form, the default quadrature needs
+	// many S(q,w) calls per point and is slower than sampling the energy
+	virtual bool HasGaussEBatch() const { return false; }
+
 	virtual bool IsOk() const { return m_bOk; }
 
 	// return model variables
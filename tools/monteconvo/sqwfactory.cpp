@@ -7,6 +7,7 @@
 
 #include "sqwfactory.h"
 #include "sqw.h"
+#include "sqw_grid.h"
 
 #if !defined(NO_PY) || defined(USE_JL)
 	#include "sqw_proc.h"
@@ -67,16 +68,20 @@ static t_mapSqw g_mapSqw =
 	{ "py", t_mapSqw::mapped_type {
 		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
 		//{ return std::make_shared<SqwPy>(strCfgFile.c_str()); },
-		{ return std::make_shared<SqwProc<SqwPy>>(strCfgFile.c_str()); },
+		{ return std::make_shared<SqwProc<SqwPy>>(strCfgFile.c_str(), get_max_processes()); },
 		"Python Model" } },
 #endif
 #ifdef USE_JL
 	{ "jl", t_mapSqw::mapped_type {
 		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
 		//{ return std::make_shared<SqwJl>(strCfgFile.c_str()); },
-		{ return std::make_shared<SqwProc<SqwJl>>(strCfgFile.c_str()); },
+		{ return std::make_shared<SqwProc<SqwJl>>(strCfgFile.c_str(), get_max_processes()); },
 		"Julia Model" } },
 #endif
+	{ "grid", t_mapSqw::mapped_type {
+		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
+		{ return std::make_shared<SqwGrid>(strCfgFile.c_str()); },
+		"Interpolated (h, k, l) Grid of Dispersion Branches" } },
 	{ "elastic", t_mapSqw::mapped_type {
 		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
 		{ return std::make_shared<SqwElast>(strCfgFile.c_str()); },
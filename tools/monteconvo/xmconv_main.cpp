@@ -19,6 +19,12 @@
 #include "ConvoDlg.h"
 
 
+static void print_usage(const char* pcProg)
+{
+	tl::log_info("Usage: ", pcProg, " [-t <max. threads>] [-p <worker processes>] [convolution file]");
+}
+
+
 int main(int argc, char** argv)
 {
 	tl::init_rand();
@@ -53,7 +59,27 @@ int main(int argc, char** argv)
 		{
 			std::string strVal = argv[iArg+1];
 
-			g_iMaxThreads = tl::str_to_var<int>(strVal);
+			if(!str_to_count(strVal, g_iMaxThreads))
+			{
+				tl::log_err("Invalid number of threads: \"", strVal, "\", need an integer >= 1.");
+				print_usage(argv[0]);
+				return -1;
+			}
+			++iArg;
+			iNextValidOption = iArg+1;
+		}
+
+		// number of worker processes for external models
+		else if(strArg == "-p" && iArg+1 < argc)
+		{
+			std::string strVal = argv[iArg+1];
+
+			if(!str_to_count(strVal, g_iMaxProcesses))
+			{
+				tl::log_err("Invalid number of processes: \"", strVal, "\", need an integer >= 1.");
+				print_usage(argv[0]);
+				return -1;
+			}
 			++iArg;
 			iNextValidOption = iArg+1;
 		}
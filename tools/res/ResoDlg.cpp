@@ -9,6 +9,8 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
 //#include <boost/units/io.hpp>
 
 #include "tlibs/string/string.h"
@@ -186,13 +188,31 @@ ResoDlg::ResoDlg(QWidget *pParent, QSettings* pSettings)
 	connect(btnMonoRefl, SIGNAL(clicked()), this, SLOT(LoadMonoRefl()));
 	connect(btnAnaEffic, SIGNAL(clicked()), this, SLOT(LoadAnaEffic()));
 
+	m_pCalcWorker.reset(new CoalescingWorker<ResoCalcResult>([this](std::size_t iJob)
+	{
+		emit CalcDone(qulonglong(iJob));
+	}));
+	m_pMCWorker.reset(new CoalescingWorker<ResoMCChunk>([this](std::size_t iJob)
+	{
+		emit MCChunkDone(qulonglong(iJob));
+	}));
+	QObject::connect(this, SIGNAL(CalcDone(qulonglong)),
+		this, SLOT(ResultsCalculated(qulonglong)), Qt::QueuedConnection);
+	QObject::connect(this, SIGNAL(MCChunkDone(qulonglong)),
+		this, SLOT(MCChunkCalculated(qulonglong)), Qt::QueuedConnection);
+
 	m_bDontCalc = 0;
 	RefreshQEPos();
 	//Calc();
 }
 
 
-ResoDlg::~ResoDlg() {}
+ResoDlg::~ResoDlg()
+{
+	// no more results from the worker threads
+	m_pMCWorker->Stop();
+	m_pCalcWorker->Stop();
+}
 
 
 void ResoDlg::setupAlgos()
@@ -280,8 +300,109 @@ std::shared_ptr<ReflCurve<t_real_reso>> ResoDlg::load_cache_refl(const std::stri
 }
 
 
+// size of the first chunk of live mc neutrons
+static const std::size_t s_iMCFirstChunk = 2500;
+
+
+/**
+ * generates the live mc neutrons [iFirst, iFirst+iNum) of a calculation;
+ * both coordinate systems use the same random numbers, i.e. they show the same neutrons
+ */
+static ResoMCChunk calc_mc_chunk(const ResoCalcResult& calc, std::size_t iFirst, std::size_t iNum)
+{
+	ResoMCChunk chunk;
+	chunk.iFirst = iFirst;
+
+	McNeutronOpts<t_mat> opts = calc.input.mcopts;
+	McNeutrons<t_real_reso> neutrons;
+	neutrons.resize(iNum);
+
+	auto to_vecs = [&neutrons, iNum](std::vector<t_vec>& vec) -> void
+	{
+		vec.reserve(iNum);
+		for(std::size_t iCur=0; iCur<iNum; ++iCur)
+		{
+			vec.push_back(tl::make_vec<t_vec>({ neutrons.h[iCur], neutrons.k[iCur],
+				neutrons.l[iCur], neutrons.E[iCur] }));
+		}
+	};
+
+	if(calc.input.bHasUB)
+	{
+		// rlu system
+		opts.coords = McNeutronCoords::RLU;
+		mc_neutrons<t_vec>(calc.ell4d, iNum, opts, neutrons, 0, &calc.input.rngMC, iFirst);
+		to_vecs(chunk.vecHKL);
+	}
+
+	// Qpara, Qperp system
+	opts.coords = McNeutronCoords::DIRECT;
+	mc_neutrons<t_vec>(calc.ell4d, iNum, opts, neutrons, 0, &calc.input.rngMC, iFirst);
+	to_vecs(chunk.vecDirect);
+
+	return chunk;
+}
+
+
 /**
- * calculates the resolution
+ * calculates the resolution of a parameter snapshot in the worker thread
+ */
+static std::shared_ptr<const ResoCalcResult> calc_reso(const ResoCalcInput& input,
+	const std::atomic<bool>& bCancel)
+{
+	std::shared_ptr<ResoCalcResult> pCalc = std::make_shared<ResoCalcResult>();
+	pCalc->input = input;
+	ResoResults &res = pCalc->res;
+
+	switch(input.algo)
+	{
+		case ResoAlgo::CN: res = calc_cn(input.tas); break;
+		case ResoAlgo::POP: res = calc_pop(input.tas); break;
+		case ResoAlgo::ECK: res = calc_eck(input.tas); break;
+		case ResoAlgo::VIOL: res = calc_viol(input.tof); break;
+		case ResoAlgo::SIMPLE: res = calc_simplereso(input.simple); break;
+		default: res.bOk = 0; res.strErr = "Unknown resolution algorithm."; break;
+	}
+
+	if(bCancel.load())
+		return nullptr;
+	if(!res.bOk)
+		return pCalc;
+
+	// Vanadium width
+	std::tie(pCalc->dVanadiumFWHM_Q, pCalc->dVanadiumFWHM_E) =
+		calc_vanadium_fwhms<t_real_reso>(
+			res.reso, res.reso_v, res.reso_s, res.Q_avg);
+
+	// calculate rlu quadric if a sample is defined
+	if(input.bHasUB)
+	{
+		std::tie(pCalc->resoHKL, pCalc->reso_vHKL, pCalc->Q_avgHKL) =
+			conv_lab_to_rlu<t_mat, t_vec, t_real_reso>
+				(input.dAngleQVec0, input.matUB, input.matUBinv,
+				res.reso, res.reso_v, res.Q_avg);
+		std::tie(pCalc->resoOrient, pCalc->reso_vOrient, pCalc->Q_avgOrient) =
+			conv_lab_to_rlu_orient<t_mat, t_vec, t_real_reso>
+				(input.dAngleQVec0, input.matUB, input.matUBinv,
+				input.matUrlu, input.matUinvrlu,
+				res.reso, res.reso_v, res.Q_avg);
+	}
+
+	// the ellipsoid is always needed for the live mc neutrons
+	pCalc->ell4d = calc_res_ellipsoid4d<t_real_reso>(
+		res.reso, res.reso_v, res.reso_s, res.Q_avg);
+
+	if(bCancel.load())
+		return nullptr;
+	if(input.iNumMC)
+		pCalc->mcFirst = calc_mc_chunk(*pCalc, 0, std::min(input.iNumMC, s_iMCFirstChunk));
+
+	return pCalc;
+}
+
+
+/**
+ * reads the parameters and calculates the resolution in the worker thread
  */
 void ResoDlg::Calc()
 {
@@ -294,8 +415,6 @@ void ResoDlg::Calc()
 		ViolParams &tof = m_tofparams;
 		SimpleResoParams &simple = m_simpleparams;
 
-		ResoResults &res = m_res;
-
 		// CN
 		cn.mono_d = t_real_reso(spinMonod->value()) * angs;
 		cn.mono_mosaic = t_real_reso(tl::m2r(spinMonoMosaic->value())) * rads;
@@ -499,244 +618,303 @@ void ResoDlg::Calc()
 		//tl::log_debug(m_tofparams.angle_kf_Q);
 		//tl::log_debug(m_tofparams.twotheta);
 
-		// Calculation
-		switch(ResoDlg::GetSelectedAlgo())
+		const ResoAlgo algo = GetSelectedAlgo();
+		if(algo == ResoAlgo::UNKNOWN)
 		{
-			case ResoAlgo::CN: res = calc_cn(cn); break;
-			case ResoAlgo::POP: res = calc_pop(cn); break;
-			case ResoAlgo::ECK: res = calc_eck(cn); break;
-			case ResoAlgo::VIOL: res = calc_viol(tof); break;
-			case ResoAlgo::SIMPLE: res = calc_simplereso(simple); break;
-			default: tl::log_err("Unknown resolution algorithm selected."); return;
+			tl::log_err("Unknown resolution algorithm selected.");
+			return;
 		}
 
 		editE->setText(tl::var_to_str(t_real_reso(cn.E/meV), g_iPrec).c_str());
-		//if(m_pInstDlg) m_pInstDlg->SetParams(cn, res);
-		//if(m_pScatterDlg) m_pScatterDlg->SetParams(cn, res);
 
-		if(res.bOk)
+
+		// Calculation in the worker thread
+		ResoCalcInput input;
+		input.algo = algo;
+		input.tas = cn;
+		input.tof = tof;
+		input.simple = simple;
+
+		input.bHasUB = m_bHasUB;
+		input.dAngleQVec0 = m_dAngleQVec0;
+		input.matUB = m_matUB;
+		input.matUBinv = m_matUBinv;
+		input.matUrlu = m_matUrlu;
+		input.matUinvrlu = m_matUinvrlu;
+
+		// live MC neutrons
+		input.iNumMC = spinMCNeutronsLive->value();
+		if(input.iNumMC)
+		{
+			McNeutronOpts<t_mat>& opts = input.mcopts;
+			opts.bCenter = 0;
+			opts.matU = m_matU;
+			opts.matB = m_matB;
+			opts.matUB = m_matUB;
+			opts.matUinv = m_matUinv;
+			opts.matBinv = m_matBinv;
+			opts.matUBinv = m_matUBinv;
+
+			t_mat* pMats[] = {&opts.matU, &opts.matB, &opts.matUB,
+				&opts.matUinv, &opts.matBinv, &opts.matUBinv};
+
+			for(t_mat *pMat : pMats)
+			{
+				pMat->resize(4,4,1);
+
+				for(int i0=0; i0<3; ++i0)
+					(*pMat)(i0,3) = (*pMat)(3,i0) = 0.;
+				(*pMat)(3,3) = 1.;
+			}
+
+			opts.dAngleQVec0 = m_dAngleQVec0;
+			input.rngMC = McRandStream::Fresh();
+		}
+
+		// the mc chunks still being calculated belong to the old parameters
+		m_pMCWorker->Cancel();
+		m_pCalcWorker->Submit([input](const std::atomic<bool>& bCancel)
+			-> std::shared_ptr<const ResoCalcResult>
 		{
-			// --------------------------------------------------------------------------------
-			// Vanadium width
-			t_real_reso dVanadiumFWHM_Q, dVanadiumFWHM_E;
-			std::tie(dVanadiumFWHM_Q, dVanadiumFWHM_E) =
-				calc_vanadium_fwhms<t_real_reso>(
-					res.reso, res.reso_v, res.reso_s, res.Q_avg);
-			// --------------------------------------------------------------------------------
-
-			const std::string& strAA_1 = tl::get_spec_char_utf8("AA")
-				+ tl::get_spec_char_utf8("sup-")
-				+ tl::get_spec_char_utf8("sup1");
-			const std::string& strAA_3 = tl::get_spec_char_utf8("AA")
-				+ tl::get_spec_char_utf8("sup-")
-				+ tl::get_spec_char_utf8("sup3");
+			return calc_reso(input, bCancel);
+		});
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_err("Cannot calculate resolution: ", ex.what(), ".");
+	}
+}
+
+
+/**
+ * shows the results of the latest calculation and starts the remaining live mc neutrons
+ */
+void ResoDlg::ResultsCalculated(qulonglong iJob)
+{
+	std::shared_ptr<const ResoCalcResult> pCalc = m_pCalcWorker->TakeResult(iJob);
+	if(!pCalc)	// superseded by newer parameters
+		return;
+
+	try
+	{
+		m_pCalcRes = pCalc->res.bOk ? pCalc : nullptr;
+		ShowResults(*pCalc);
+		SubmitMCChunk();
+
+		// results of the current value of a running DebugOutput scan
+		if(m_iDebugScan < m_vecDebugScan.size())
+		{
+			std::cout << m_vecDebugScan[m_iDebugScan] << "\t"
+				<< m_res.dR0 << "\t" << m_res.dResVol << std::endl;
+			++m_iDebugScan;
+			DebugOutputStep();
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_err("Cannot show resolution: ", ex.what(), ".");
+	}
+}
+
+
+void ResoDlg::ShowResults(const ResoCalcResult& calc)
+{
+	const ResoResults &res = calc.res;
+	m_res = res;
+
+	if(res.bOk)
+	{
+		const std::string& strAA_1 = tl::get_spec_char_utf8("AA")
+			+ tl::get_spec_char_utf8("sup-")
+			+ tl::get_spec_char_utf8("sup1");
+		const std::string& strAA_3 = tl::get_spec_char_utf8("AA")
+			+ tl::get_spec_char_utf8("sup-")
+			+ tl::get_spec_char_utf8("sup3");
 
 #ifndef NDEBUG
-			// check against ELASTIC approximation for perp. slope from Shirane p. 268
-			// valid for small mosaicities
-			t_real_reso dEoverQperp = tl::co::hbar*tl::co::hbar*cn.ki / tl::co::m_n
-				* units::cos(cn.twotheta/2.)
-				* (1. + units::tan(units::abs(cn.twotheta/2.))
-				* units::tan(units::abs(cn.twotheta/2.) - units::abs(cn.thetam)))
-					/ meV / angs;
-
-			tl::log_info("E/Q_perp (approximation for ki=kf) = ", dEoverQperp, " meV*A");
-			tl::log_info("E/Q_perp (2nd approximation for ki=kf) = ", t_real_reso(4.*cn.ki * angs), " meV*A");
-
-			//std::cout << "thetas = " << m_tasparams.thetas/rads/M_PI*180. << std::endl;
-			//std::cout << "2thetam = " << 2.*m_tasparams.thetam/rads/M_PI*180. << std::endl;
-			//std::cout << "2thetaa = " << 2.*m_tasparams.thetaa/rads/M_PI*180. << std::endl;
+		// check against ELASTIC approximation for perp. slope from Shirane p. 268
+		// valid for small mosaicities
+		const EckParams &cn = calc.input.tas;
+		t_real_reso dEoverQperp = tl::co::hbar*tl::co::hbar*cn.ki / tl::co::m_n
+			* units::cos(cn.twotheta/2.)
+			* (1. + units::tan(units::abs(cn.twotheta/2.))
+			* units::tan(units::abs(cn.twotheta/2.) - units::abs(cn.thetam)))
+				/ meV / angs;
+
+		tl::log_info("E/Q_perp (approximation for ki=kf) = ", dEoverQperp, " meV*A");
+		tl::log_info("E/Q_perp (2nd approximation for ki=kf) = ", t_real_reso(4.*cn.ki * angs), " meV*A");
 #endif
 
-			if(checkElli4dAutoCalc->isChecked())
-			{
-				CalcElli4d();
-				m_bEll4dCurrent = 1;
-			}
+		if(checkElli4dAutoCalc->isChecked())
+		{
+			CalcElli4d();
+			m_bEll4dCurrent = 1;
+		}
+
+		if(groupSim->isChecked())
+			RefreshSimCmd();
+
+		const bool bHasUB = calc.input.bHasUB;
+		if(bHasUB)
+		{
+			m_resoHKL = calc.resoHKL; m_reso_vHKL = calc.reso_vHKL; m_Q_avgHKL = calc.Q_avgHKL;
+			m_resoOrient = calc.resoOrient; m_reso_vOrient = calc.reso_vOrient; m_Q_avgOrient = calc.Q_avgOrient;
+		}
 
-			if(groupSim->isChecked())
-				RefreshSimCmd();
+		// print results
+		std::ostringstream ostrRes;
 
-			// calculate rlu quadric if a sample is defined
-			if(m_bHasUB)
+		//ostrRes << std::scientific;
+		ostrRes.precision(g_iPrec);
+		ostrRes << "<html><body>\n";
+
+		ostrRes << "<p><b>Correction Factors:</b>\n";
+		ostrRes << "\t<ul><li>Resolution Volume: " << res.dResVol << " meV " << strAA_3 << "</li>\n";
+		ostrRes << "\t<li>R0: " << res.dR0 << "</li></ul></p>\n\n";
+
+		ostrRes << "<p><b>Coherent (Bragg) FWHMs:</b>\n";
+		ostrRes << "\t<ul><li>Q_para: " << res.dBraggFWHMs[0] << " " << strAA_1 << "</li>\n";
+		ostrRes << "\t<li>Q_ortho: " << res.dBraggFWHMs[1] << " " << strAA_1 << "</li>\n";
+		ostrRes << "\t<li>Q_z: " << res.dBraggFWHMs[2] << " " << strAA_1 << "</li>\n";
+		if(bHasUB)
+		{
+			static const char* pcHkl[] = { "h", "k", "l" };
+			const std::vector<t_real_reso> vecFwhms = calc_bragg_fwhms(m_resoHKL);
+
+			for(unsigned iHkl=0; iHkl<3; ++iHkl)
 			{
-				std::tie(m_resoHKL, m_reso_vHKL, m_Q_avgHKL) =
-					conv_lab_to_rlu<t_mat, t_vec, t_real_reso>
-						(m_dAngleQVec0, m_matUB, m_matUBinv,
-						res.reso, res.reso_v, res.Q_avg);
-				std::tie(m_resoOrient, m_reso_vOrient, m_Q_avgOrient) =
-					conv_lab_to_rlu_orient<t_mat, t_vec, t_real_reso>
-						(m_dAngleQVec0, m_matUB, m_matUBinv,
-						m_matUrlu, m_matUinvrlu,
-						res.reso, res.reso_v, res.Q_avg);
+				ostrRes << "\t<li>" << pcHkl[iHkl] << ": "
+					<< vecFwhms[iHkl] << " rlu</li>\n";
 			}
+		}
+		ostrRes << "\t<li>E: " << res.dBraggFWHMs[3] << " meV</li></ul></p>\n\n";
 
-			// print results
-			std::ostringstream ostrRes;
-
-			//ostrRes << std::scientific;
-			ostrRes.precision(g_iPrec);
-			ostrRes << "<html><body>\n";
+		ostrRes << "<p><b>Incoherent (Vanadium) FWHMs:</b>\n";
+		ostrRes << "\t<ul><li>Q: " << calc.dVanadiumFWHM_Q << " " << strAA_1 << "</li>\n";
+		ostrRes << "\t<li>E: " << calc.dVanadiumFWHM_E << " meV</li></ul></p>\n\n";
 
-			ostrRes << "<p><b>Correction Factors:</b>\n";
-			ostrRes << "\t<ul><li>Resolution Volume: " << res.dResVol << " meV " << strAA_3 << "</li>\n";
-			ostrRes << "\t<li>R0: " << res.dR0 << "</li></ul></p>\n\n";
 
-			ostrRes << "<p><b>Coherent (Bragg) FWHMs:</b>\n";
-			ostrRes << "\t<ul><li>Q_para: " << res.dBraggFWHMs[0] << " " << strAA_1 << "</li>\n";
-			ostrRes << "\t<li>Q_ortho: " << res.dBraggFWHMs[1] << " " << strAA_1 << "</li>\n";
-			ostrRes << "\t<li>Q_z: " << res.dBraggFWHMs[2] << " " << strAA_1 << "</li>\n";
-			if(m_bHasUB)
+		ostrRes << "<p><b>Resolution Matrix (Q_para, Q_ortho, Q_z, E) in 1/A, meV:</b>\n\n";
+		ostrRes << "<blockquote><table border=\"0\" width=\"75%\">\n";
+		for(std::size_t i=0; i<res.reso.size1(); ++i)
+		{
+			ostrRes << "<tr>\n";
+			for(std::size_t j=0; j<res.reso.size2(); ++j)
 			{
-				static const char* pcHkl[] = { "h", "k", "l" };
-				const std::vector<t_real_reso> vecFwhms = calc_bragg_fwhms(m_resoHKL);
+				t_real_reso dVal = res.reso(i,j);
+				tl::set_eps_0(dVal, g_dEps);
 
-				for(unsigned iHkl=0; iHkl<3; ++iHkl)
-				{
-					ostrRes << "\t<li>" << pcHkl[iHkl] << ": "
-						<< vecFwhms[iHkl] << " rlu</li>\n";
-				}
+				ostrRes << "<td>" << std::setw(g_iPrec*2) << dVal << "</td>";
 			}
-			ostrRes << "\t<li>E: " << res.dBraggFWHMs[3] << " meV</li></ul></p>\n\n";
+			ostrRes << "</tr>\n";
 
-			ostrRes << "<p><b>Incoherent (Vanadium) FWHMs:</b>\n";
-			ostrRes << "\t<ul><li>Q: " << dVanadiumFWHM_Q << " " << strAA_1 << "</li>\n";
-			ostrRes << "\t<li>E: " << dVanadiumFWHM_E << " meV</li></ul></p>\n\n";
+			if(i!=res.reso.size1()-1)
+				ostrRes << "\n";
+		}
+		ostrRes << "</table></blockquote></p>\n";
 
+		ostrRes << "<p><b>Resolution Vector in 1/A, meV:</b> ";
+		for(std::size_t iVec=0; iVec<res.reso_v.size(); ++iVec)
+		{
+			ostrRes << res.reso_v[iVec];
+			if(iVec != res.reso_v.size()-1)
+				ostrRes << ", ";
+		}
+		ostrRes << "</p>\n";
+
+		ostrRes << "<p><b>Resolution Scalar</b>: " << res.reso_s << "</p>\n";
 
-			ostrRes << "<p><b>Resolution Matrix (Q_para, Q_ortho, Q_z, E) in 1/A, meV:</b>\n\n";
+
+		if(bHasUB)
+		{
+			ostrRes << "<p><b>Resolution Matrix (h, k, l, E) in rlu, meV:</b>\n\n";
 			ostrRes << "<blockquote><table border=\"0\" width=\"75%\">\n";
-			for(std::size_t i=0; i<res.reso.size1(); ++i)
+			for(std::size_t i=0; i<m_resoHKL.size1(); ++i)
 			{
 				ostrRes << "<tr>\n";
-				for(std::size_t j=0; j<res.reso.size2(); ++j)
+				for(std::size_t j=0; j<m_resoHKL.size2(); ++j)
 				{
-					t_real_reso dVal = res.reso(i,j);
+					t_real_reso dVal = m_resoHKL(i,j);
 					tl::set_eps_0(dVal, g_dEps);
-
 					ostrRes << "<td>" << std::setw(g_iPrec*2) << dVal << "</td>";
 				}
 				ostrRes << "</tr>\n";
 
-				if(i!=res.reso.size1()-1)
+				if(i!=m_resoHKL.size1()-1)
 					ostrRes << "\n";
 			}
 			ostrRes << "</table></blockquote></p>\n";
 
-			ostrRes << "<p><b>Resolution Vector in 1/A, meV:</b> ";
-			for(std::size_t iVec=0; iVec<res.reso_v.size(); ++iVec)
+			ostrRes << "<p><b>Resolution Vector in rlu, meV:</b> ";
+			for(std::size_t iVec=0; iVec<m_reso_vHKL.size(); ++iVec)
 			{
-				ostrRes << res.reso_v[iVec];
-				if(iVec != res.reso_v.size()-1)
+				ostrRes << m_reso_vHKL[iVec];
+				if(iVec != m_reso_vHKL.size()-1)
 					ostrRes << ", ";
 			}
 			ostrRes << "</p>\n";
+			//ostrRes << "<p><b>Resolution Scalar</b>: " << res.reso_s << "</p>\n";
+		}
 
-			ostrRes << "<p><b>Resolution Scalar</b>: " << res.reso_s << "</p>\n";
 
+		ostrRes << "</body></html>";
 
-			if(m_bHasUB)
-			{
-				ostrRes << "<p><b>Resolution Matrix (h, k, l, E) in rlu, meV:</b>\n\n";
-				ostrRes << "<blockquote><table border=\"0\" width=\"75%\">\n";
-				for(std::size_t i=0; i<m_resoHKL.size1(); ++i)
-				{
-					ostrRes << "<tr>\n";
-					for(std::size_t j=0; j<m_resoHKL.size2(); ++j)
-					{
-						t_real_reso dVal = m_resoHKL(i,j);
-						tl::set_eps_0(dVal, g_dEps);
-						ostrRes << "<td>" << std::setw(g_iPrec*2) << dVal << "</td>";
-					}
-					ostrRes << "</tr>\n";
-
-					if(i!=m_resoHKL.size1()-1)
-						ostrRes << "\n";
-				}
-				ostrRes << "</table></blockquote></p>\n";
+		editResults->setHtml(QString::fromUtf8(ostrRes.str().c_str()));
+		labelStatus->setText("Calculation successful.");
 
-				ostrRes << "<p><b>Resolution Vector in rlu, meV:</b> ";
-				for(std::size_t iVec=0; iVec<m_reso_vHKL.size(); ++iVec)
-				{
-					ostrRes << m_reso_vHKL[iVec];
-					if(iVec != m_reso_vHKL.size()-1)
-						ostrRes << ", ";
-				}
-				ostrRes << "</p>\n";
-				//ostrRes << "<p><b>Resolution Scalar</b>: " << res.reso_s << "</p>\n";
-			}
 
+		// the first live MC neutrons, the others follow in chunks
+		m_vecMC_direct = calc.mcFirst.vecDirect;
+		m_vecMC_HKL = calc.mcFirst.vecHKL;
 
-			ostrRes << "</body></html>";
+		EmitResults();
+	}
+	else
+	{
+		QString strErr = "Error: ";
+		strErr += res.strErr.c_str();
+		labelStatus->setText(QString("<font color='red'>") + strErr + QString("</font>"));
+	}
+}
 
-			editResults->setHtml(QString::fromUtf8(ostrRes.str().c_str()));
-			labelStatus->setText("Calculation successful.");
 
+/**
+ * requests the next chunk of live mc neutrons;
+ * the chunks grow geometrically, so the ellipse dialogs are only updated a few times
+ */
+void ResoDlg::SubmitMCChunk()
+{
+	if(!m_pCalcRes)
+		return;
 
+	const std::size_t iNumMC = m_pCalcRes->input.iNumMC;
+	const std::size_t iFirst = m_vecMC_direct.size();
+	if(iFirst >= iNumMC)
+		return;
+	const std::size_t iNum = std::min(iNumMC - iFirst, std::max(iFirst, s_iMCFirstChunk));
 
-			// generate live MC neutrons
-			const std::size_t iNumMC = spinMCNeutronsLive->value();
-			if(iNumMC)
-			{
-				McNeutronOpts<t_mat> opts;
-				opts.bCenter = 0;
-				opts.matU = m_matU;
-				opts.matB = m_matB;
-				opts.matUB = m_matUB;
-				opts.matUinv = m_matUinv;
-				opts.matBinv = m_matBinv;
-				opts.matUBinv = m_matUBinv;
-
-				t_mat* pMats[] = {&opts.matU, &opts.matB, &opts.matUB,
-					&opts.matUinv, &opts.matBinv, &opts.matUBinv};
-
-				for(t_mat *pMat : pMats)
-				{
-					pMat->resize(4,4,1);
+	std::shared_ptr<const ResoCalcResult> pCalc = m_pCalcRes;
+	m_pMCWorker->Submit([pCalc, iFirst, iNum](const std::atomic<bool>& bCancel)
+		-> std::shared_ptr<const ResoMCChunk>
+	{
+		if(bCancel.load())
+			return nullptr;
+		return std::make_shared<ResoMCChunk>(calc_mc_chunk(*pCalc, iFirst, iNum));
+	});
+}
 
-					for(int i0=0; i0<3; ++i0)
-						(*pMat)(i0,3) = (*pMat)(3,i0) = 0.;
-					(*pMat)(3,3) = 1.;
-				}
 
-				opts.dAngleQVec0 = m_dAngleQVec0;
+void ResoDlg::MCChunkCalculated(qulonglong iJob)
+{
+	std::shared_ptr<const ResoMCChunk> pChunk = m_pMCWorker->TakeResult(iJob);
+	if(!pChunk || pChunk->iFirst != m_vecMC_direct.size())
+		return;
 
-				if(m_bHasUB)
-				{
-					// rlu system
-					opts.coords = McNeutronCoords::RLU;
-					if(m_vecMC_HKL.size() != iNumMC)
-						m_vecMC_HKL.resize(iNumMC);
-					mc_neutrons<t_vec>(m_ell4d, iNumMC, opts, m_vecMC_HKL.begin());
-				}
-				else
-					m_vecMC_HKL.clear();
-
-				// Qpara, Qperp system
-				opts.coords = McNeutronCoords::DIRECT;
-				if(m_vecMC_direct.size() != iNumMC)
-					m_vecMC_direct.resize(iNumMC);
-				mc_neutrons<t_vec>(m_ell4d, iNumMC, opts, m_vecMC_direct.begin());
-			}
-			else
-			{
-				m_vecMC_direct.clear();
-				m_vecMC_HKL.clear();
-			}
+	m_vecMC_direct.insert(m_vecMC_direct.end(), pChunk->vecDirect.begin(), pChunk->vecDirect.end());
+	m_vecMC_HKL.insert(m_vecMC_HKL.end(), pChunk->vecHKL.begin(), pChunk->vecHKL.end());
 
-			EmitResults();
-		}
-		else
-		{
-			QString strErr = "Error: ";
-			strErr += res.strErr.c_str();
-			labelStatus->setText(QString("<font color='red'>") + strErr + QString("</font>"));
-		}
-	}
-	catch(const std::exception& ex)
-	{
-		tl::log_err("Cannot calculate resolution: ", ex.what(), ".");
-	}
+	EmitResults();
+	SubmitMCChunk();
 }
 
 
@@ -1176,22 +1354,41 @@ void ResoDlg::AlgoChanged()
 
 
 /**
- * quick hack to scan a variable
+ * quick hack to scan a variable,
+ * the results are calculated in the worker thread and printed in ResultsCalculated
  */
 void ResoDlg::DebugOutput()
 {
-	std::ostream &ostr = std::cout;
+	m_vecDebugScan = tl::linspace<t_real_reso, t_real_reso, std::vector>(1., 500., 128);
+	m_iDebugScan = 0;
+	DebugOutputStep();
+}
 
-	for(t_real_reso val : tl::linspace<t_real_reso, t_real_reso, std::vector>(1., 500., 128))
-	{
-		spinMonoCurvH->setValue(val);
-		//spinMonoCurvV->setValue(val);
-		//spinAnaCurvH->setValue(val);
-		//spinAnaCurvV->setValue(val);
 
-		//Calc();
-		ostr << val << "\t" << m_res.dR0 << "\t" << m_res.dResVol << std::endl;
+/**
+ * sets the current value of the variable scan and starts its calculation
+ */
+void ResoDlg::DebugOutputStep()
+{
+	if(m_iDebugScan >= m_vecDebugScan.size())
+	{
+		m_vecDebugScan.clear();
+		m_iDebugScan = 0;
+		return;
 	}
+
+	const t_real_reso val = m_vecDebugScan[m_iDebugScan];
+
+	// always calculate, even if the value does not change
+	bool bOldDontCalc = m_bDontCalc;
+	m_bDontCalc = 1;
+	spinMonoCurvH->setValue(val);
+	//spinMonoCurvV->setValue(val);
+	//spinAnaCurvH->setValue(val);
+	//spinAnaCurvV->setValue(val);
+	m_bDontCalc = bOldDontCalc;
+
+	Calc();
 }
 
 
@@ -25,6 +25,7 @@
 #include "eck.h"
 #include "viol.h"
 #include "simple.h"
+#include "mc.h"
 #include "tlibs/math/linalg.h"
 #include "tlibs/file/prop.h"
 #ifndef NO_3D
@@ -34,6 +35,7 @@
 #include "dialogs/RealParamDlg.h"
 #include "dialogs/EllipseDlg.h"
 #include "dialogs/TOFDlg.h"
+#include "libs/worker.h"
 
 
 // parameters that are not already in RealParams or RecipParams
@@ -54,6 +56,53 @@ struct SampleParams
 };
 
 
+/**
+ * snapshot of the dialog's parameters for the calculation in the worker thread
+ */
+struct ResoCalcInput
+{
+	ResoAlgo algo = ResoAlgo::UNKNOWN;
+	EckParams tas;
+	ViolParams tof;
+	SimpleResoParams simple;
+
+	bool bHasUB = 0;
+	t_real_reso dAngleQVec0 = 0.;
+	ublas::matrix<t_real_reso> matUB, matUBinv, matUrlu, matUinvrlu;
+
+	// live mc neutrons
+	std::size_t iNumMC = 0;
+	McNeutronOpts<ublas::matrix<t_real_reso>> mcopts;
+	McRandStream rngMC;
+};
+
+/**
+ * a part of the live mc neutrons, in direct and in rlu coordinates
+ */
+struct ResoMCChunk
+{
+	std::size_t iFirst = 0;
+	std::vector<ublas::vector<t_real_reso>> vecDirect, vecHKL;
+};
+
+struct ResoCalcResult
+{
+	ResoCalcInput input;
+
+	ResoResults res;
+	t_real_reso dVanadiumFWHM_Q = 0., dVanadiumFWHM_E = 0.;
+
+	ublas::matrix<t_real_reso> resoHKL, resoOrient;
+	ublas::vector<t_real_reso> reso_vHKL, reso_vOrient;
+	ublas::vector<t_real_reso> Q_avgHKL, Q_avgOrient;
+
+	Ellipsoid4d<t_real_reso> ell4d;
+
+	// the first mc neutrons are calculated together with the resolution
+	ResoMCChunk mcFirst;
+};
+
+
 class ResoDlg : public QDialog, Ui::ResoDlg
 {Q_OBJECT
 private:
@@ -62,6 +111,11 @@ private:
 	std::shared_ptr<ReflCurve<t_real_reso>> load_cache_refl(const std::string& strFile);
 
 	void DebugOutput();
+	void DebugOutputStep();
+
+	// values of the variable scan in DebugOutput, the next one is set when the results arrive
+	std::vector<t_real_reso> m_vecDebugScan;
+	std::size_t m_iDebugScan = 0;
 
 protected:
 	std::vector<QDoubleSpinBox*> m_vecSpinBoxes;
@@ -123,6 +177,11 @@ protected:
 
 	std::unique_ptr<TOFDlg> m_pTOFDlg;
 
+	// only the latest parameters are calculated, the live mc neutrons follow in chunks
+	std::unique_ptr<CoalescingWorker<ResoCalcResult>> m_pCalcWorker;
+	std::unique_ptr<CoalescingWorker<ResoMCChunk>> m_pMCWorker;
+	std::shared_ptr<const ResoCalcResult> m_pCalcRes;
+
 
 	ResoAlgo GetSelectedAlgo() const;
 	void SetSelectedAlgo(ResoAlgo algo);
@@ -155,9 +214,14 @@ protected slots:
 
 	void RefreshQEPos();
 
+	void ResultsCalculated(qulonglong iJob);
+	void MCChunkCalculated(qulonglong iJob);
+
 protected:
 	void setupAlgos();
 	void RefreshSimCmd();
+	void ShowResults(const ResoCalcResult& calc);
+	void SubmitMCChunk();
 
 public slots:
 	void ResoParamsChanged(const ResoParams& params);
@@ -177,6 +241,10 @@ public:
 
 signals:
 	void ResoResultsSig(const EllipseDlgParams& params);
+
+	// emitted from the worker threads
+	void CalcDone(qulonglong iJob);
+	void MCChunkDone(qulonglong iJob);
 };
 
 #endif
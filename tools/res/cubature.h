@@ -0,0 +1,263 @@
+/**
+ * sparse-grid gauss-hermite cubature over the resolution ellipsoid
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __RES_CUBATURE_H__
+#define __RES_CUBATURE_H__
+
+#include <vector>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+
+#include "mc.h"
+
+
+/**
+ * gauss-hermite rule with n nodes for the standard normal distribution,
+ * i.e. for the weight function exp(-x^2/2)/sqrt(2pi), the weights sum to 1
+ * (newton iteration on the normalised hermite polynomials, see Numerical Recipes, ch. 4.5)
+ */
+template<class t_real = double>
+void gauss_hermite_1d(std::size_t n, std::vector<t_real>& vecX, std::vector<t_real>& vecW)
+{
+	vecX.resize(n);
+	vecW.resize(n);
+
+	const t_real dEps = 1e-14;
+	const t_real dPiM4 = std::pow(tl::get_pi<t_real>(), t_real(-0.25));
+
+	// roots of the physicists' hermite polynomial
+	std::vector<t_real> vecRoots(n);
+
+	t_real z = 0., pp = 0.;
+	for(std::size_t i=0; i<(n+1)/2; ++i)
+	{
+		// initial guesses for the largest roots
+		if(i == 0)
+			z = std::sqrt(t_real(2*n+1)) - t_real(1.85575)*std::pow(t_real(2*n+1), t_real(-0.16667));
+		else if(i == 1)
+			z -= t_real(1.14)*std::pow(t_real(n), t_real(0.426))/z;
+		else if(i == 2)
+			z = t_real(1.86)*z - t_real(0.86)*vecRoots[0];
+		else if(i == 3)
+			z = t_real(1.91)*z - t_real(0.91)*vecRoots[1];
+		else
+			z = t_real(2)*z - vecRoots[i-2];
+
+		for(int iIter=0; iIter<100; ++iIter)
+		{
+			t_real p1 = dPiM4, p2 = 0.;
+			for(std::size_t j=0; j<n; ++j)
+			{
+				const t_real p3 = p2;
+				p2 = p1;
+				p1 = z*std::sqrt(t_real(2)/t_real(j+1))*p2 - std::sqrt(t_real(j)/t_real(j+1))*p3;
+			}
+			pp = std::sqrt(t_real(2*n))*p2;
+
+			const t_real z1 = z;
+			z = z1 - p1/pp;
+			if(std::abs(z-z1) <= dEps)
+				break;
+		}
+
+		vecRoots[i] = z;
+
+		// physicists' to probabilists' hermite rule
+		vecX[i] = z * std::sqrt(t_real(2));
+		vecX[n-1-i] = -vecX[i];
+		vecW[i] = vecW[n-1-i] = t_real(2)/(pp*pp) / std::sqrt(tl::get_pi<t_real>());
+	}
+}
+
+
+/**
+ * nodes (in units of the standard deviations) and weights of a 4d cubature rule
+ */
+template<class t_real = double>
+struct Cubature4d
+{
+	std::vector<t_real> z[4];
+	std::vector<t_real> w;
+
+	std::size_t size() const { return w.size(); }
+};
+
+
+/**
+ * smolyak sparse grid of 1d gauss-hermite rules with 2i-1 nodes,
+ * level 1 is the centre, level 2 has 9 nodes, level 3 has 49, ...
+ */
+template<class t_real = double>
+Cubature4d<t_real> sparse_gauss_hermite_4d(unsigned int iLevel)
+{
+	constexpr int DIM = 4;
+	const int q = int(iLevel) + DIM - 1;
+
+	std::vector<std::vector<t_real>> vecX1d(iLevel+1), vecW1d(iLevel+1);
+	for(unsigned int i=1; i<=iLevel; ++i)
+		gauss_hermite_1d<t_real>(2*i-1, vecX1d[i], vecW1d[i]);
+
+	// the same 1d rules are used everywhere, so coinciding nodes are bitwise equal
+	std::map<std::array<t_real, DIM>, t_real> mapNodes;
+
+	int idx[DIM];
+	std::fill(idx, idx+DIM, 1);
+	while(1)
+	{
+		int iSum = 0;
+		for(int i=0; i<DIM; ++i)
+			iSum += idx[i];
+
+		if(iSum >= q-DIM+1 && iSum <= q)
+		{
+			// combination coefficient (-1)^(q-|i|) * binomial(DIM-1, q-|i|)
+			const int k = q - iSum;
+			int iBinom = 1;
+			for(int j=0; j<k; ++j)
+				iBinom = iBinom * (DIM-1-j) / (j+1);
+			const t_real dCoeff = t_real((k % 2) ? -iBinom : iBinom);
+
+			// tensor product of the 1d rules
+			int pt[DIM] = { 0, 0, 0, 0 };
+			while(1)
+			{
+				std::array<t_real, DIM> node;
+				t_real dW = dCoeff;
+				for(int i=0; i<DIM; ++i)
+				{
+					node[i] = vecX1d[idx[i]][pt[i]];
+					dW *= vecW1d[idx[i]][pt[i]];
+				}
+				mapNodes[node] += dW;
+
+				int iDim = 0;
+				for(; iDim<DIM; ++iDim)
+				{
+					if(++pt[iDim] < 2*idx[iDim]-1)
+						break;
+					pt[iDim] = 0;
+				}
+				if(iDim == DIM)
+					break;
+			}
+		}
+
+		// next multi-index, the ones outside the range are skipped above
+		int iDim = 0;
+		for(; iDim<DIM; ++iDim)
+		{
+			if(++idx[iDim] <= int(iLevel))
+				break;
+			idx[iDim] = 1;
+		}
+		if(iDim == DIM)
+			break;
+	}
+
+	Cubature4d<t_real> cub;
+	for(const auto& pair : mapNodes)
+	{
+		if(pair.second == t_real(0))
+			continue;
+		for(int i=0; i<DIM; ++i)
+			cub.z[i].push_back(pair.first[i]);
+		cub.w.push_back(pair.second);
+	}
+	return cub;
+}
+
+
+/**
+ * the rules only depend on the level, they are calculated once
+ */
+template<class t_real = double>
+std::shared_ptr<const Cubature4d<t_real>> get_sparse_gauss_hermite_4d(unsigned int iLevel)
+{
+	static std::mutex mtx;
+	static std::map<unsigned int, std::shared_ptr<const Cubature4d<t_real>>> mapRules;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto iter = mapRules.find(iLevel);
+	if(iter != mapRules.end())
+		return iter->second;
+
+	std::shared_ptr<const Cubature4d<t_real>> pRule =
+		std::make_shared<Cubature4d<t_real>>(sparse_gauss_hermite_4d<t_real>(iLevel));
+	mapRules.emplace(iLevel, pRule);
+	return pRule;
+}
+
+
+/**
+ * outcome of comparing two successive cubature levels
+ */
+enum class CubatureCheck
+{
+	CONVERGED,	// the levels agree
+	REFINE,		// try the next level
+	FAILED,		// the cubature cannot be trusted, use mc neutrons
+};
+
+
+/**
+ * compares the results dS = sum(w*S) of two successive cubature levels,
+ * dSAbs = sum(|w*S|) of each level is the scale for deciding if a result is zero;
+ * if both levels are (close to) zero, the nodes have most likely missed a sharp S(q,w),
+ * so the agreement of the levels says nothing about the integral
+ */
+template<class t_real = double>
+CubatureCheck cubature_check_levels(t_real dSLevel, t_real dSAbsLevel,
+	t_real dSLast, t_real dSAbsLast, t_real dTol)
+{
+	const bool bZero = std::abs(dSLevel) <= dTol*dSAbsLevel;
+	const bool bZeroLast = std::abs(dSLast) <= dTol*dSAbsLast;
+	if(bZero && bZeroLast)
+		return CubatureCheck::FAILED;
+
+	if(std::abs(dSLevel - dSLast) <= dTol*std::abs(dSLevel))
+	{
+		// the negative weights of the sparse grid can give unphysical values
+		return dSLevel < t_real(0) ? CubatureCheck::FAILED : CubatureCheck::CONVERGED;
+	}
+
+	return CubatureCheck::REFINE;
+}
+
+
+/**
+ * cubature nodes transformed like mc neutrons, written into a buffer starting at iOffs,
+ * the weights are scaled by dWeightScale
+ */
+template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>>
+void cubature_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
+	const Cubature4d<typename t_vec::value_type>& cub, const McNeutronOpts<t_mat>& opts,
+	McNeutrons<typename t_vec::value_type>& neutrons, std::size_t iOffs=0,
+	typename t_vec::value_type dWeightScale=1)
+{
+	using t_real = typename t_vec::value_type;
+	const McNeutronTrafo<t_real> trafo = mc_neutron_trafo<t_mat, t_real>(ell4d, opts);
+
+	t_real* pOut[4] = { neutrons.h.data() + iOffs, neutrons.k.data() + iOffs,
+		neutrons.l.data() + iOffs, neutrons.E.data() + iOffs };
+
+	for(std::size_t iNode=0; iNode<cub.size(); ++iNode)
+	{
+		for(int i=0; i<4; ++i)
+		{
+			pOut[i][iNode] = trafo.offs[i]
+				+ trafo.mat[i][0]*cub.z[0][iNode] + trafo.mat[i][1]*cub.z[1][iNode]
+				+ trafo.mat[i][2]*cub.z[2][iNode] + trafo.mat[i][3]*cub.z[3][iNode];
+		}
+		neutrons.w[iOffs + iNode] = cub.w[iNode] * dWeightScale;
+	}
+}
+
+
+#endif
@@ -13,6 +13,11 @@
 #include <ostream>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <atomic>
 
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
@@ -20,6 +25,8 @@ namespace ublas = boost::numeric::ublas;
 
 #include "tlibs/math/math.h"
 #include "tlibs/math/rand.h"
+#include "tlibs/math/linalg.h"
+#include "ellipse.h"
 
 
 enum class McNeutronCoords
@@ -29,6 +36,12 @@ enum class McNeutronCoords
 	RLU = 2
 };
 
+enum class McNeutronSampling
+{
+	PSEUDO = 0,		// pseudo-random numbers
+	SOBOL = 1		// scrambled sobol sequence (quasi-random)
+};
+
 template<class t_mat = ublas::matrix<double>>
 struct McNeutronOpts
 {
@@ -40,16 +53,553 @@ struct McNeutronOpts
 	real_type dAngleQVec0;
 
 	bool bCenter;
+	McNeutronSampling sampling = McNeutronSampling::PSEUDO;
+};
+
+
+
+/**
+ * contiguous structure-of-arrays buffer of mc neutrons
+ * (coordinates depend on McNeutronOpts::coords, for RLU they are h, k, l, E);
+ * the weights are only set for cubature nodes, mc neutrons have equal weights
+ */
+template<class t_real = double>
+struct McNeutrons
+{
+	std::vector<t_real> h, k, l, E;
+	std::vector<t_real> w;
+
+	bool HasWeights() const { return !w.empty(); }
+
+	std::size_t size() const { return E.size(); }
+
+	void resize(std::size_t iNum)
+	{
+		h.resize(iNum); k.resize(iNum);
+		l.resize(iNum); E.resize(iNum);
+	}
+
+	void clear()
+	{
+		h.clear(); k.clear();
+		l.clear(); E.clear();
+		w.clear();
+	}
 };
 
 
 
+// number of neutrons generated per block in the batched kernel
+#define MC_NEUTR_BLOCK 256
+
+
+/**
+ * single 4x4 affine trafo from the (unit-variance) principal axis system
+ * of the ellipsoid to the requested output coordinates
+ */
+template<class t_real = double>
+struct McNeutronTrafo
+{
+	t_real mat[4][4];
+	t_real offs[4];
+};
+
+
 /**
  * Ellipsoid E in Q||... coord. system in 1/A
  *
  * matQVec0: trafo from Q||... to orient1, orient2 system in 1/A
  * Uinv * matQVec0: trafo from Q||... system to lab 1/A system
  * Binv * Uinv * matQVec0: trafo from Q||... system to crystal rlu system
+ *
+ * the sigmas, the ellipsoid rotation, its offset and the coordinate trafo
+ * are folded into a single affine matrix
+ */
+template<class t_mat = ublas::matrix<double>, class t_real = typename t_mat::value_type>
+McNeutronTrafo<t_real> mc_neutron_trafo(const Ellipsoid4d<t_real>& ell4d,
+	const McNeutronOpts<t_mat>& opts)
+{
+	using t_vec = ublas::vector<t_real>;
+
+	t_mat matCoord = ublas::identity_matrix<t_real>(4);
+	if(opts.coords == McNeutronCoords::ANGS || opts.coords == McNeutronCoords::RLU)
+	{
+		//tl::log_debug("Qvec0 = ", opts.dAngleQVec0/M_PI*180.);
+		t_mat matQVec0 = tl::rotation_matrix_2d(-opts.dAngleQVec0);
+		tl::resize_unity(matQVec0, 4);
+
+		if(opts.coords == McNeutronCoords::ANGS)
+			matCoord = matQVec0;
+		else
+			matCoord = ublas::prod(opts.matUBinv, matQVec0);
+	}
+
+	//tl::log_debug("rot: ", ell4d.rot);
+	const t_mat matTot = ublas::prod(matCoord, ell4d.rot);
+
+	t_vec vecTrans = ublas::zero_vector<t_real>(4);
+	if(!opts.bCenter)
+	{
+		vecTrans = ublas::prod(matCoord,
+			tl::make_vec<t_vec>({ell4d.x_offs, ell4d.y_offs, ell4d.z_offs, ell4d.w_offs}));
+	}
+
+	const t_real dSigma[4] =
+	{
+		ell4d.x_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.y_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.z_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.w_hwhm*tl::get_HWHM2SIGMA<t_real>()
+	};
+
+	McNeutronTrafo<t_real> trafo;
+	for(int i=0; i<4; ++i)
+	{
+		for(int j=0; j<4; ++j)
+			trafo.mat[i][j] = matTot(i,j) * dSigma[j];
+		trafo.offs[i] = vecTrans[i];
+	}
+
+	return trafo;
+}
+
+
+/**
+ * gaussian distribution of the energy for a given (h, k, l) inside the ellipsoid:
+ * E|Q ~ N(dE0 + dSlope.(Q - dQ0), dSigma^2), with the covariance matrix S = M M^T
+ * of the trafo: dSlope = S_QQ^(-1) S_QE, dSigma^2 = S_EE - S_EQ S_QQ^(-1) S_QE
+ */
+template<class t_real = double>
+struct McCondE
+{
+	t_real dQ0[3];
+	t_real dE0;
+	t_real dSlope[3];
+	t_real dSigma;
+
+	t_real Mean(t_real h, t_real k, t_real l) const
+	{
+		return dE0 + dSlope[0]*(h-dQ0[0]) + dSlope[1]*(k-dQ0[1]) + dSlope[2]*(l-dQ0[2]);
+	}
+};
+
+
+/**
+ * conditional energy distribution of a neutron trafo, false if the Q part is degenerate
+ */
+template<class t_real = double>
+bool mc_cond_E(const McNeutronTrafo<t_real>& trafo, McCondE<t_real>& cond)
+{
+	t_real cov[4][4];
+	for(int i=0; i<4; ++i)
+		for(int j=0; j<4; ++j)
+			cov[i][j] = trafo.mat[i][0]*trafo.mat[j][0] + trafo.mat[i][1]*trafo.mat[j][1]
+				+ trafo.mat[i][2]*trafo.mat[j][2] + trafo.mat[i][3]*trafo.mat[j][3];
+
+	// inverse of the 3x3 Q block using cofactors
+	t_real inv[3][3];
+	for(int i=0; i<3; ++i)
+		for(int j=0; j<3; ++j)
+		{
+			const int i1 = (j+1)%3, i2 = (j+2)%3;
+			const int j1 = (i+1)%3, j2 = (i+2)%3;
+			inv[i][j] = cov[i1][j1]*cov[i2][j2] - cov[i1][j2]*cov[i2][j1];
+		}
+
+	const t_real dDet = cov[0][0]*inv[0][0] + cov[0][1]*inv[1][0] + cov[0][2]*inv[2][0];
+	if(std::abs(dDet) <= std::numeric_limits<t_real>::min())
+		return false;
+
+	t_real dVar = cov[3][3];
+	for(int i=0; i<3; ++i)
+	{
+		cond.dSlope[i] = (inv[i][0]*cov[0][3] + inv[i][1]*cov[1][3] + inv[i][2]*cov[2][3]) / dDet;
+		dVar -= cond.dSlope[i]*cov[i][3];
+		cond.dQ0[i] = trafo.offs[i];
+	}
+	cond.dE0 = trafo.offs[3];
+
+	if(!(dVar > t_real(0)))
+		return false;
+	cond.dSigma = std::sqrt(dVar);
+	return true;
+}
+
+
+/**
+ * marginal distribution of Q of a neutron trafo, the energy is integrated out of
+ * the precision matrix (see ellipsoid_gauss_int); the resulting trafo only uses
+ * the first three normal deviates and maps them to Q and to the conditional mean
+ * energy m(Q), dSigE is the conditional energy width; false if degenerate
+ */
+template<class t_real = double>
+bool mc_marginal_Q(const McNeutronTrafo<t_real>& trafo, McNeutronTrafo<t_real>& trafoQ, t_real& dSigE)
+{
+	using t_mat = ublas::matrix<t_real>;
+
+	t_mat cov(4, 4), prec;
+	for(int i=0; i<4; ++i)
+		for(int j=0; j<4; ++j)
+			cov(i,j) = trafo.mat[i][0]*trafo.mat[j][0] + trafo.mat[i][1]*trafo.mat[j][1]
+				+ trafo.mat[i][2]*trafo.mat[j][2] + trafo.mat[i][3]*trafo.mat[j][3];
+
+	if(!tl::inverse(cov, prec) || !(prec(3,3) > t_real(0)))
+		return false;
+	const t_mat precQ = ellipsoid_gauss_int<t_real>(prec, 3);
+
+	// cholesky decomposition precQ = L L^T
+	t_real L[3][3] = { {0.,0.,0.}, {0.,0.,0.}, {0.,0.,0.} };
+	for(int i=0; i<3; ++i)
+	{
+		for(int j=0; j<=i; ++j)
+		{
+			t_real d = precQ(i,j);
+			for(int k=0; k<j; ++k)
+				d -= L[i][k]*L[j][k];
+
+			if(i == j)
+			{
+				if(!(d > t_real(0)))
+					return false;
+				L[i][i] = std::sqrt(d);
+			}
+			else
+			{
+				L[i][j] = d / L[j][j];
+			}
+		}
+	}
+
+	// inverse of the lower triangular L
+	t_real Linv[3][3] = { {0.,0.,0.}, {0.,0.,0.}, {0.,0.,0.} };
+	for(int i=0; i<3; ++i)
+	{
+		Linv[i][i] = t_real(1) / L[i][i];
+		for(int j=0; j<i; ++j)
+		{
+			t_real d = 0.;
+			for(int k=j; k<i; ++k)
+				d -= L[i][k]*Linv[k][j];
+			Linv[i][j] = d / L[i][i];
+		}
+	}
+
+	// Q = Q0 + L^(-T) z has the covariance precQ^(-1)
+	for(int i=0; i<3; ++i)
+	{
+		for(int j=0; j<3; ++j)
+			trafoQ.mat[i][j] = Linv[j][i];
+		trafoQ.mat[i][3] = 0.;
+		trafoQ.offs[i] = trafo.offs[i];
+	}
+
+	// m(Q) = E0 - prec_EQ (Q - Q0) / prec_EE
+	for(int j=0; j<3; ++j)
+	{
+		t_real d = 0.;
+		for(int i=0; i<3; ++i)
+			d -= prec(3,i) / prec(3,3) * trafoQ.mat[i][j];
+		trafoQ.mat[3][j] = d;
+	}
+	trafoQ.mat[3][3] = 0.;
+	trafoQ.offs[3] = trafo.offs[3];
+
+	dSigE = t_real(1) / std::sqrt(prec(3,3));
+	return true;
+}
+
+
+/**
+ * counter-based random stream: the i-th number of a stream is a hash of
+ * (key, i), i.e. the splitmix64 sequence with a jump-ahead to position i;
+ * sub-streams are keyed by a seed and a path of ids, e.g. (seed, scan point,
+ * sample position), so results do not depend on the order of evaluation
+ */
+struct McRandStream
+{
+	std::uint64_t iKey = 0;
+
+	McRandStream() = default;
+	explicit McRandStream(std::uint64_t iSeed) : iKey(mix(iSeed)) {}
+
+	static std::uint64_t mix(std::uint64_t x)
+	{
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	McRandStream Sub(std::uint64_t iId) const
+	{
+		McRandStream rng;
+		rng.iKey = mix(iKey ^ mix(iId + 0x9e3779b97f4a7c15ull));
+		return rng;
+	}
+
+	// independent stream for every call, derived from the global seed and a call counter
+	static McRandStream Fresh()
+	{
+		static std::atomic<std::uint64_t> s_iCalls{0};
+		return McRandStream(tl::get_rand_seed()).Sub(s_iCalls++);
+	}
+
+	// sub-stream keyed by the bit pattern of a real value, e.g. a scan coordinate
+	template<class t_real>
+	McRandStream SubReal(t_real dId) const
+	{
+		double d = double(dId);
+		if(d == 0.) d = 0.;	// same stream for -0 and +0
+		std::uint64_t iId = 0;
+		std::memcpy(&iId, &d, sizeof(d));
+		return Sub(iId);
+	}
+
+	std::uint64_t operator()(std::uint64_t iCtr) const
+	{
+		return mix(iKey + (iCtr+1)*0x9e3779b97f4a7c15ull);
+	}
+
+	// uniform in (0, 1]
+	template<class t_real = double>
+	t_real Uniform(std::uint64_t iCtr) const
+	{
+		return t_real(((*this)(iCtr) >> 11) + 1) * t_real(1./9007199254740992.);
+	}
+
+	// standard normal deviate (box-muller using the counters 2*iCtr and 2*iCtr+1)
+	template<class t_real = double>
+	t_real Norm(std::uint64_t iCtr) const
+	{
+		const t_real dR = std::sqrt(t_real(-2) * std::log(Uniform<t_real>(2*iCtr)));
+		return dR * std::cos(t_real(2) * tl::get_pi<t_real>() * Uniform<t_real>(2*iCtr+1));
+	}
+};
+
+
+/**
+ * fills a block with standard normal deviates (box-muller)
+ */
+template<class t_real = double>
+void mc_rand_norm_block(t_real* pOut, std::size_t iNum)
+{
+	const std::size_t iNumPairs = (iNum+1) / 2;
+	t_real dU1[MC_NEUTR_BLOCK/2], dU2[MC_NEUTR_BLOCK/2];
+
+	for(std::size_t iPair=0; iPair<iNumPairs; ++iPair)
+	{
+		dU1[iPair] = t_real(1) - tl::rand_real<t_real>(t_real(0), t_real(1));	// in (0, 1]
+		dU2[iPair] = tl::rand_real<t_real>(t_real(0), t_real(1));
+	}
+
+	for(std::size_t iPair=0; iPair<iNumPairs; ++iPair)
+	{
+		const t_real dR = std::sqrt(t_real(-2) * std::log(dU1[iPair]));
+		const t_real dPhi = t_real(2) * tl::get_pi<t_real>() * dU2[iPair];
+
+		pOut[2*iPair] = dR * std::cos(dPhi);
+		if(2*iPair+1 < iNum)
+			pOut[2*iPair+1] = dR * std::sin(dPhi);
+	}
+}
+
+
+/**
+ * fills the four coordinate blocks of the neutrons [iFirst, iFirst+iNum) of a stream;
+ * every neutron only depends on its own index, so the split into threads does not matter
+ */
+template<class t_real = double>
+void mc_rand_norm_block(const McRandStream& rng, std::size_t iFirst, std::size_t iNum,
+	t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		const std::uint64_t iCtr = 4*std::uint64_t(iFirst + iCur);
+
+		for(int iPair=0; iPair<2; ++iPair)
+		{
+			const t_real dR = std::sqrt(t_real(-2) * std::log(rng.Uniform<t_real>(iCtr + 2*iPair)));
+			const t_real dPhi = t_real(2) * tl::get_pi<t_real>() * rng.Uniform<t_real>(iCtr + 2*iPair + 1);
+
+			pOut[2*iPair][iCur] = dR * std::cos(dPhi);
+			pOut[2*iPair+1][iCur] = dR * std::sin(dPhi);
+		}
+	}
+}
+
+
+/**
+ * four-dimensional sobol sequence, the i-th point is the xor of the direction numbers
+ * of the set bits of i, so every point can be generated independently;
+ * direction numbers from Joe and Kuo, primitive polynomials x+1, x^2+x+1, x^3+x+1
+ */
+class McSobol4
+{
+protected:
+	std::uint32_t m_v[4][32];
+
+	McSobol4()
+	{
+		const unsigned int iDeg[4] = { 0, 1, 2, 3 };
+		const unsigned int iCoeff[4] = { 0, 0, 1, 1 };
+		const std::uint32_t iInit[4][3] = { {0,0,0}, {1,0,0}, {1,3,0}, {1,3,1} };
+
+		for(int iDim=0; iDim<4; ++iDim)
+		{
+			const unsigned int s = iDeg[iDim];
+			for(unsigned int j=0; j<32; ++j)
+			{
+				if(iDim == 0)
+					m_v[iDim][j] = std::uint32_t(1) << (31-j);
+				else if(j < s)
+					m_v[iDim][j] = iInit[iDim][j] << (31-j);
+				else
+				{
+					std::uint32_t v = m_v[iDim][j-s] ^ (m_v[iDim][j-s] >> s);
+					for(unsigned int k=1; k<s; ++k)
+						if((iCoeff[iDim] >> (s-1-k)) & 1)
+							v ^= m_v[iDim][j-k];
+					m_v[iDim][j] = v;
+				}
+			}
+		}
+	}
+
+public:
+	static const McSobol4& get()
+	{
+		static const McSobol4 sobol;
+		return sobol;
+	}
+
+	std::uint32_t operator()(std::uint64_t iIdx, int iDim) const
+	{
+		std::uint32_t x = 0;
+		for(unsigned int j=0; iIdx && j<32; ++j, iIdx >>= 1)
+			if(iIdx & 1)
+				x ^= m_v[iDim][j];
+		return x;
+	}
+};
+
+
+/**
+ * inverse of the standard normal cdf (Acklam's rational approximation, rel. error < 1.2e-9)
+ */
+template<class t_real = double>
+t_real mc_inv_norm(t_real p)
+{
+	static const t_real a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+		1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+	static const t_real b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+		6.680131188771972e+01, -1.328068155288572e+01 };
+	static const t_real c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+		-2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+	static const t_real d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+		3.754408661907416e+00 };
+	const t_real pLow = 0.02425;
+
+	if(p < pLow)
+	{
+		const t_real q = std::sqrt(t_real(-2)*std::log(p));
+		return (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+			((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+t_real(1));
+	}
+	else if(p > t_real(1)-pLow)
+	{
+		const t_real q = std::sqrt(t_real(-2)*std::log(t_real(1)-p));
+		return -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+			((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+t_real(1));
+	}
+
+	const t_real q = p - t_real(0.5);
+	const t_real r = q*q;
+	return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q /
+		(((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+t_real(1));
+}
+
+
+/**
+ * fills the four coordinate blocks of the neutrons [iFirst, iFirst+iNum) with
+ * normal deviates from the sobol sequence; the stream provides a random digital shift
+ * per dimension, which keeps the low discrepancy but gives an unbiased estimate
+ */
+template<class t_real = double>
+void mc_qrand_norm_block(const McRandStream& rng, std::size_t iFirst, std::size_t iNum,
+	t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	const McSobol4& sobol = McSobol4::get();
+	const t_real dScale = t_real(1./4294967296.);
+
+	for(int iDim=0; iDim<4; ++iDim)
+	{
+		const std::uint32_t iShift = std::uint32_t(rng(iDim) >> 32);
+
+		for(std::size_t iCur=0; iCur<iNum; ++iCur)
+		{
+			// centre of the 2^-32 cell, in (0, 1)
+			const std::uint32_t x = sobol(iFirst + iCur, iDim) ^ iShift;
+			pOut[iDim][iCur] = mc_inv_norm<t_real>((t_real(x) + t_real(0.5)) * dScale);
+		}
+	}
+}
+
+
+/**
+ * batched mc neutron kernel writing into four coordinate arrays;
+ * if a random stream is given, the neutrons are its numbers [iFirst, iFirst+iNum),
+ * otherwise the global generator is used
+ */
+template<class t_real = double>
+void mc_neutrons_kernel(const McNeutronTrafo<t_real>& trafo, std::size_t iNum,
+	t_real *pX0, t_real *pX1, t_real *pX2, t_real *pX3,
+	const McRandStream* pRng = nullptr, std::size_t iFirst = 0,
+	McNeutronSampling sampling = McNeutronSampling::PSEUDO)
+{
+	t_real* pOut[4] = { pX0, pX1, pX2, pX3 };
+	t_real dZ[4][MC_NEUTR_BLOCK];
+
+	// the sobol points need a shift that is the same for all parts of the sequence
+	const McRandStream rngDefault;
+	if(sampling == McNeutronSampling::SOBOL && !pRng)
+		pRng = &rngDefault;
+
+	for(std::size_t iStart=0; iStart<iNum; iStart+=MC_NEUTR_BLOCK)
+	{
+		const std::size_t iBlock = std::min<std::size_t>(MC_NEUTR_BLOCK, iNum-iStart);
+
+		if(sampling == McNeutronSampling::SOBOL)
+		{
+			mc_qrand_norm_block<t_real>(*pRng, iFirst+iStart, iBlock, dZ);
+		}
+		else if(pRng)
+		{
+			mc_rand_norm_block<t_real>(*pRng, iFirst+iStart, iBlock, dZ);
+		}
+		else
+		{
+			for(int iDim=0; iDim<4; ++iDim)
+				mc_rand_norm_block<t_real>(dZ[iDim], iBlock);
+		}
+
+		for(int i=0; i<4; ++i)
+		{
+			const t_real m0 = trafo.mat[i][0], m1 = trafo.mat[i][1];
+			const t_real m2 = trafo.mat[i][2], m3 = trafo.mat[i][3];
+			const t_real offs = trafo.offs[i];
+			t_real *pDst = pOut[i] + iStart;
+
+			for(std::size_t iCur=0; iCur<iBlock; ++iCur)
+			{
+				pDst[iCur] = offs + m0*dZ[0][iCur] + m1*dZ[1][iCur]
+					+ m2*dZ[2][iCur] + m3*dZ[3][iCur];
+			}
+		}
+	}
+}
+
+
+/**
+ * mc neutrons written to a container of vectors
  */
 template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>,
 	class t_iter = typename std::vector<t_vec>::iterator>
@@ -58,39 +608,40 @@ void mc_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
 {
 	using t_real = typename t_vec::value_type;
 
-	t_vec vecTrans = tl::make_vec<t_vec>({ell4d.x_offs, ell4d.y_offs, ell4d.z_offs, ell4d.w_offs});
-	const t_mat& rot = ell4d.rot;
-	//if(vecResult.size() != iNum)
-	//	vecResult.resize(iNum);
-
-	//tl::log_debug("rot: ", rot);
-	//tl::log_debug("Qvec0 = ", opts.dAngleQVec0/M_PI*180.);
-	t_mat matQVec0 = tl::rotation_matrix_2d(-opts.dAngleQVec0);
-	tl::resize_unity(matQVec0, 4);
+	// quasi-random sampling needs a random stream, a new one is used for every call
+	const McRandStream rng = McRandStream::Fresh();
 
-	t_mat matUBinvQVec0 = ublas::prod(opts.matUBinv, matQVec0);
+	McNeutrons<t_real> neutrons;
+	neutrons.resize(iNum);
+	mc_neutrons_kernel<t_real>(mc_neutron_trafo<t_mat, t_real>(ell4d, opts), iNum,
+		neutrons.h.data(), neutrons.k.data(), neutrons.l.data(), neutrons.E.data(),
+		opts.sampling == McNeutronSampling::SOBOL ? &rng : nullptr, 0, opts.sampling);
 
 	for(std::size_t iCur=0; iCur<iNum; ++iCur)
 	{
-		t_vec vecMC = tl::make_vec<t_vec, std::vector>(
-			tl::rand_norm_nd<t_real, std::vector>
-				({0.,0.,0.,0.},
-				{ ell4d.x_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.y_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.z_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.w_hwhm*tl::get_HWHM2SIGMA<t_real>() }));
+		iterResult[iCur] = tl::make_vec<t_vec>({ neutrons.h[iCur], neutrons.k[iCur],
+			neutrons.l[iCur], neutrons.E[iCur] });
+	}
+}
 
-		vecMC = ublas::prod(rot, vecMC);
-		if(!opts.bCenter)
-			vecMC += vecTrans;
 
-		if(opts.coords == McNeutronCoords::ANGS)
-			vecMC = ublas::prod(matQVec0, vecMC);
-		else if(opts.coords == McNeutronCoords::RLU)
-			vecMC = ublas::prod(matUBinvQVec0, vecMC);
+/**
+ * mc neutrons written directly into a structure-of-arrays buffer,
+ * starting at index iOffs, the buffer has to be large enough;
+ * with a random stream, the neutrons are its numbers starting at iFirst
+ * (quasi-random sampling needs a stream to be unbiased and reproducible)
+ */
+template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>>
+void mc_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
+	std::size_t iNum, const McNeutronOpts<t_mat>& opts,
+	McNeutrons<typename t_vec::value_type>& neutrons, std::size_t iOffs=0,
+	const McRandStream* pRng = nullptr, std::size_t iFirst = 0)
+{
+	using t_real = typename t_vec::value_type;
 
-		iterResult[iCur] = std::move(vecMC);
-	}
+	mc_neutrons_kernel<t_real>(mc_neutron_trafo<t_mat, t_real>(ell4d, opts), iNum,
+		neutrons.h.data() + iOffs, neutrons.k.data() + iOffs,
+		neutrons.l.data() + iOffs, neutrons.E.data() + iOffs, pRng, iFirst, opts.sampling);
 }
 
 #endif
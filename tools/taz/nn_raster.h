@@ -0,0 +1,428 @@
+/**
+ * tiled, multi-threaded raster of the nearest lattice nodes (e.g. for brillouin zone images)
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __TAZ_NN_RASTER_H__
+#define __TAZ_NN_RASTER_H__
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "tlibs/math/linalg.h"
+#include "tlibs/math/math.h"
+#include "tlibs/math/kd.h"
+#include "tlibs/phys/lattice.h"
+#include "tlibs/helper/thread.h"
+#include "tlibs/log/log.h"
+
+#ifdef USE_GIL
+	#include <png.h>
+#endif
+
+
+/**
+ * colours a pixel by the hkl of its nearest lattice node and
+ * marks the nodes themselves (the direct beam darker, all others brighter)
+ */
+template<class t_real = double>
+void nn_raster_colour(const t_real* pHKL, t_real dDist, int iMaxPeaks, unsigned char* pRGB)
+{
+	const bool bIsDirectBeam = tl::float_equal<t_real>(pHKL[0], 0.) &&
+		tl::float_equal<t_real>(pHKL[1], 0.) && tl::float_equal<t_real>(pHKL[2], 0.);
+	const int iBraggAmp = int(tl::gauss_model<t_real>(dDist, 0., 0.01, 255., 0.));
+
+	for(int i=0; i<3; ++i)
+	{
+		int iCol = int((pHKL[i]+iMaxPeaks) * 255 / (iMaxPeaks*2));
+		iCol += bIsDirectBeam ? -iBraggAmp : iBraggAmp;
+		pRGB[i] = (unsigned char)tl::clamp(iCol, 0, 255);
+	}
+}
+
+
+/**
+ * renders the nearest nodes of a lattice kd tree on a plane;
+ * the image is calculated in bands of tiles which are distributed over the threads,
+ * every finished band is handed row by row to a sink, so only one band is in memory;
+ * the pixels of a tile are traversed in a serpentine order and the nearest node of a pixel
+ * is found by a local search starting at the nearest node of the previous pixel,
+ * the kd tree is only queried when the search cannot prove its result
+ */
+template<class t_real = double>
+class NearestNodeRaster
+{
+	public:
+		using t_vec = ublas::vector<t_real>;
+
+		// gets the rgb values of a finished image row
+		using t_rowsink = std::function<bool(const unsigned char* pRGB)>;
+
+		struct Node
+		{
+			t_real dPos[3];
+			t_real dHKL[3];
+		};
+
+	protected:
+		struct Offset
+		{
+			t_real dPos[3];
+			int iHKL[3];
+			t_real dLenSq;
+		};
+
+		const tl::Kd<t_real>& m_kd;
+		int m_iMaxPeaks = 0;
+
+		// neighbour offsets to all nodes within m_dRad, sorted by length
+		std::vector<Offset> m_vecOffs;
+		t_real m_dRad = 0.;
+
+		unsigned m_iTileW = 128, m_iTileH = 64;
+		mutable std::atomic<std::size_t> m_iNumKdQueries{0};
+
+	protected:
+		static t_real dist_sq(const t_real* pA, const t_real* pB)
+		{
+			const t_real dX=pA[0]-pB[0], dY=pA[1]-pB[1], dZ=pA[2]-pB[2];
+			return dX*dX + dY*dY + dZ*dZ;
+		}
+
+		void NearestFromKd(const t_real* pQ, Node& node) const
+		{
+			++m_iNumKdQueries;
+
+			const std::vector<t_real>& vecNearest =
+				m_kd.GetNearestNode(std::vector<t_real>{pQ[0], pQ[1], pQ[2]});
+			for(int i=0; i<3; ++i)
+			{
+				node.dPos[i] = vecNearest[i];
+				node.dHKL[i] = vecNearest[i+3];
+			}
+		}
+
+		/**
+		 * all lattice nodes within the distance 2*|q-c| of the candidate c are checked,
+		 * if none is nearer, c is the nearest node;
+		 * differences of nodes are again nodes (also for the centred lattices),
+		 * so the offsets found around the origin are valid for every candidate
+		 */
+		void Nearest(const t_real* pQ, Node& node, bool bHasCandidate) const
+		{
+			if(!bHasCandidate)
+			{
+				NearestFromKd(pQ, node);
+				return;
+			}
+
+			const t_real dRadSq = m_dRad*m_dRad;
+			for(int iIter=0; iIter<64; ++iIter)
+			{
+				const t_real dDistSq = dist_sq(pQ, node.dPos);
+				if(4.*dDistSq > dRadSq)
+					break;
+
+				const Offset* pNearer = nullptr;
+				for(const Offset& offs : m_vecOffs)
+				{
+					if(offs.dLenSq > 4.*dDistSq)
+						break;
+
+					bool bInLattice = 1;
+					for(int i=0; i<3; ++i)
+					{
+						if(std::abs(int(std::round(node.dHKL[i])) + offs.iHKL[i]) > m_iMaxPeaks)
+						{
+							bInLattice = 0;
+							break;
+						}
+					}
+					if(!bInLattice)
+						continue;
+
+					const t_real dPos[3] = { node.dPos[0]+offs.dPos[0],
+						node.dPos[1]+offs.dPos[1], node.dPos[2]+offs.dPos[2] };
+					if(dist_sq(pQ, dPos) < dDistSq)
+					{
+						pNearer = &offs;
+						break;
+					}
+				}
+
+				if(!pNearer)
+					return;
+
+				// move to the nearer node and check again
+				for(int i=0; i<3; ++i)
+				{
+					node.dPos[i] += pNearer->dPos[i];
+					node.dHKL[i] += t_real(pNearer->iHKL[i]);
+				}
+			}
+
+			NearestFromKd(pQ, node);
+		}
+
+		/**
+		 * calculates the rgb values of the tile's pixels in the band's buffer
+		 */
+		void RenderTile(unsigned iW, unsigned iX0, unsigned iX1, unsigned iY0, unsigned iY1,
+			const t_real* pOrig, const t_real* pDirX, const t_real* pDirY,
+			unsigned char* pBand) const
+		{
+			Node node;
+			bool bHasCandidate = 0;
+
+			for(unsigned iY=iY0; iY<iY1; ++iY)
+			{
+				unsigned char* pRow = pBand + std::size_t(iY-iY0)*iW*3;
+				const bool bReverse = ((iY-iY0) % 2) != 0;
+
+				for(unsigned _iX=iX0; _iX<iX1; ++_iX)
+				{
+					const unsigned iX = bReverse ? iX1-1-(_iX-iX0) : _iX;
+
+					t_real dQ[3];
+					for(int i=0; i<3; ++i)
+						dQ[i] = pOrig[i] + t_real(iX)*pDirX[i] + t_real(iY)*pDirY[i];
+
+					Nearest(dQ, node, bHasCandidate);
+					bHasCandidate = 1;
+
+					nn_raster_colour<t_real>(node.dHKL, std::sqrt(dist_sq(dQ, node.dPos)),
+						m_iMaxPeaks, pRow + std::size_t(iX)*3);
+				}
+			}
+		}
+
+	public:
+		/**
+		 * @param kd lattice nodes as (x, y, z, h, k, l), it has to stay valid while rendering
+		 * @param latt lattice of the nodes
+		 * @param iMaxPeaks the kd tree has all (allowed) nodes with |h|, |k|, |l| <= iMaxPeaks
+		 */
+		NearestNodeRaster(const tl::Kd<t_real>& kd, const tl::Lattice<t_real>& latt, int iMaxPeaks)
+			: m_kd(kd), m_iMaxPeaks(iMaxPeaks)
+		{
+			if(!m_kd.GetRootNode())
+				return;
+
+			const t_vec vecBase[3] = { latt.GetPos(1.,0.,0.), latt.GetPos(0.,1.,0.), latt.GetPos(0.,0.,1.) };
+
+			// dual vectors: |h_i| <= |p|*|dual_i| for a node p = h_i*base_i
+			t_real dDualLen[3];
+			const t_real dVol = std::abs(ublas::inner_prod(vecBase[0], tl::cross_3(vecBase[1], vecBase[2])));
+			if(tl::float_equal<t_real>(dVol, 0.))
+				return;
+			for(int i=0; i<3; ++i)
+				dDualLen[i] = ublas::norm_2(tl::cross_3(vecBase[(i+1)%3], vecBase[(i+2)%3])) / dVol;
+
+			// half the sum of the base vectors bounds the covering radius of the primitive lattice,
+			// the offsets also have to stay within the nodes available in the kd tree
+			m_dRad = ublas::norm_2(vecBase[0]) + ublas::norm_2(vecBase[1]) + ublas::norm_2(vecBase[2]);
+			for(int i=0; i<3; ++i)
+				m_dRad = std::min(m_dRad, t_real(m_iMaxPeaks)/dDualLen[i]);
+
+			int iMax[3];
+			for(int i=0; i<3; ++i)
+				iMax[i] = std::min(m_iMaxPeaks, int(std::ceil(m_dRad*dDualLen[i])));
+
+			for(int ih=-iMax[0]; ih<=iMax[0]; ++ih)
+			for(int ik=-iMax[1]; ik<=iMax[1]; ++ik)
+			for(int il=-iMax[2]; il<=iMax[2]; ++il)
+			{
+				if(ih==0 && ik==0 && il==0)
+					continue;
+
+				const t_vec vecPos = t_real(ih)*vecBase[0] + t_real(ik)*vecBase[1] + t_real(il)*vecBase[2];
+				const t_real dLenSq = ublas::inner_prod(vecPos, vecPos);
+				if(dLenSq > m_dRad*m_dRad)
+					continue;
+
+				// only use the offsets to nodes which are in the kd tree (e.g. allowed reflections)
+				const std::vector<t_real>& vecNearest =
+					m_kd.GetNearestNode(std::vector<t_real>{vecPos[0], vecPos[1], vecPos[2]});
+				if(int(std::round(vecNearest[3]))!=ih || int(std::round(vecNearest[4]))!=ik
+					|| int(std::round(vecNearest[5]))!=il)
+					continue;
+
+				Offset offs;
+				offs.dPos[0] = vecNearest[0]; offs.dPos[1] = vecNearest[1]; offs.dPos[2] = vecNearest[2];
+				offs.iHKL[0] = ih; offs.iHKL[1] = ik; offs.iHKL[2] = il;
+				offs.dLenSq = dLenSq;
+				m_vecOffs.push_back(offs);
+			}
+
+			std::sort(m_vecOffs.begin(), m_vecOffs.end(),
+				[](const Offset& offs1, const Offset& offs2) -> bool
+				{ return offs1.dLenSq < offs2.dLenSq; });
+		}
+
+		bool IsOk() const { return m_kd.GetRootNode() != nullptr; }
+		void SetTileSize(unsigned iW, unsigned iH) { m_iTileW = std::max(iW, 1u); m_iTileH = std::max(iH, 1u); }
+		std::size_t GetNumKdQueries() const { return m_iNumKdQueries.load(); }
+
+		/**
+		 * nearest node of a single position
+		 */
+		Node GetNearest(const t_vec& vecQ) const
+		{
+			const t_real dQ[3] = { vecQ[0], vecQ[1], vecQ[2] };
+			Node node;
+			NearestFromKd(dQ, node);
+			return node;
+		}
+
+		/**
+		 * renders an image of iW x iH pixels, pixel (x, y) is at the lattice position
+		 * vecOrig + x*vecDirX + y*vecDirY; the rows are passed to the sink from top to bottom
+		 * @return false if the sink failed or nothing could be rendered
+		 */
+		bool Render(unsigned iW, unsigned iH, const t_vec& vecOrig,
+			const t_vec& vecDirX, const t_vec& vecDirY, const t_rowsink& sink,
+			unsigned iNumThreads) const
+		{
+			if(!IsOk() || !iW || !iH)
+				return false;
+
+			const t_real dOrig[3] = { vecOrig[0], vecOrig[1], vecOrig[2] };
+			const t_real dDirX[3] = { vecDirX[0], vecDirX[1], vecDirX[2] };
+			const t_real dDirY[3] = { vecDirY[0], vecDirY[1], vecDirY[2] };
+
+			const unsigned iTilesX = (iW + m_iTileW-1) / m_iTileW;
+			iNumThreads = std::max(1u, std::min(iNumThreads, iTilesX));
+
+			std::vector<unsigned char> vecBand(std::size_t(iW)*m_iTileH*3);
+			m_iNumKdQueries = 0;
+
+			for(unsigned iY0=0; iY0<iH; iY0+=m_iTileH)
+			{
+				const unsigned iY1 = std::min(iY0+m_iTileH, iH);
+
+				// the threads take the tiles of the band one after the other
+				std::atomic<unsigned> iNextTile{0};
+				auto render_tiles = [&]() -> void
+				{
+					for(unsigned iTile=iNextTile++; iTile<iTilesX; iTile=iNextTile++)
+					{
+						const unsigned iX0 = iTile*m_iTileW;
+						const unsigned iX1 = std::min(iX0+m_iTileW, iW);
+						RenderTile(iW, iX0, iX1, iY0, iY1, dOrig, dDirX, dDirY, vecBand.data());
+					}
+				};
+
+				if(iNumThreads > 1)
+				{
+					tl::ThreadPool<void()> tp(iNumThreads);
+					for(unsigned iThread=0; iThread<iNumThreads; ++iThread)
+						tp.AddTask(render_tiles);
+					tp.StartTasks();
+					for(auto& fut : tp.GetFutures())
+						fut.get();
+				}
+				else
+				{
+					render_tiles();
+				}
+
+				for(unsigned iY=iY0; iY<iY1; ++iY)
+				{
+					if(!sink(vecBand.data() + std::size_t(iY-iY0)*iW*3))
+						return false;
+				}
+			}
+
+			tl::log_debug("Nearest node raster: ", GetNumKdQueries(), " kd queries for ",
+				std::size_t(iW)*iH, " pixels.");
+			return true;
+		}
+};
+
+
+
+#ifdef USE_GIL
+
+/**
+ * writes a png file row by row
+ */
+class PngRowWriter
+{
+	protected:
+		std::FILE *m_pFile = nullptr;
+		png_structp m_pPng = nullptr;
+		png_infop m_pInfo = nullptr;
+		bool m_bOk = 0;
+
+	public:
+		PngRowWriter(const char* pcFile, unsigned iW, unsigned iH)
+		{
+			m_pFile = std::fopen(pcFile, "wb");
+			if(!m_pFile)
+				return;
+
+			m_pPng = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+			if(m_pPng)
+				m_pInfo = png_create_info_struct(m_pPng);
+			if(!m_pPng || !m_pInfo)
+				return;
+
+			if(setjmp(png_jmpbuf(m_pPng)))
+				return;
+
+			png_init_io(m_pPng, m_pFile);
+			png_set_IHDR(m_pPng, m_pInfo, iW, iH, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+				PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+			png_write_info(m_pPng, m_pInfo);
+			m_bOk = 1;
+		}
+
+		~PngRowWriter()
+		{
+			if(m_pPng)
+				png_destroy_write_struct(&m_pPng, m_pInfo ? &m_pInfo : nullptr);
+			if(m_pFile)
+				std::fclose(m_pFile);
+		}
+
+		PngRowWriter(const PngRowWriter&) = delete;
+		const PngRowWriter& operator=(const PngRowWriter&) = delete;
+
+		bool IsOk() const { return m_bOk; }
+
+		bool WriteRow(const unsigned char* pRGB)
+		{
+			if(!m_bOk) return false;
+
+			if(setjmp(png_jmpbuf(m_pPng)))
+				return m_bOk = 0;
+
+			png_write_row(m_pPng, const_cast<png_bytep>(pRGB));
+			return true;
+		}
+
+		/**
+		 * finishes the file, all rows have to be written before;
+		 * an unfinished file is left truncated
+		 */
+		bool Close()
+		{
+			if(!m_bOk) return false;
+			m_bOk = 0;
+
+			if(setjmp(png_jmpbuf(m_pPng)))
+				return false;
+
+			png_write_end(m_pPng, nullptr);
+			return std::fflush(m_pFile) == 0;
+		}
+};
+
+#endif
+
+#endif
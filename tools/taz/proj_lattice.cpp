@@ -116,22 +116,32 @@ static void to_proj(T x, T y, T z, T& xg, T& yg, bool bGnom=1)
 		std::tie(xg, yg) = tl::stereographic_proj(phi_crys, theta_crys, T(1));
 }
 
-void ProjLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon, bool bIsRecip)
+/**
+ * calculates the projected lattice points,
+ * this does not access the gui and can run in a background thread
+ * @return nullptr if cancelled
+ */
+std::shared_ptr<const ProjLatticeData> ProjLattice::CalcPeaksData(
+	const xtl::LatticeCommon<t_real>& latticecommon, bool bIsRecip,
+	int iMaxPeaks, LatticeProj proj, t_real dScaleFactor, const std::atomic<bool>* pbCancel)
 {
-	ClearPeaks();
+	std::shared_ptr<ProjLatticeData> pPeaks = std::make_shared<ProjLatticeData>();
+	std::vector<ProjLatticeData::Point>& vecPoints = pPeaks->vecPoints;
 
+	const tl::Lattice<t_real>* pLattice = nullptr;
 	const tl::Lattice<t_real>* pLatticeOther = nullptr;
+	t_mat matPlane_inv;
 	if(bIsRecip)
 	{
-		m_lattice = latticecommon.recip;
+		pLattice = &latticecommon.recip;
 		pLatticeOther = &latticecommon.lattice;
-		m_matPlane_inv = latticecommon.matPlane_inv;
+		matPlane_inv = latticecommon.matPlane_inv;
 	}
 	else
 	{
-		m_lattice = latticecommon.lattice;
+		pLattice = &latticecommon.lattice;
 		pLatticeOther = &latticecommon.recip;
-		// m_matPlane_inv = ! TODO !
+		matPlane_inv = latticecommon.matPlaneReal_inv;
 	}
 
 
@@ -140,33 +150,36 @@ void ProjLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon, boo
 	dLattConst = std::min(dLattConst, pLatticeOther->GetC());
 	dLattConst = 2.*tl::get_pi<t_real>() / dLattConst;
 
-	if(m_proj == LatticeProj::PERSPECTIVE)
+	if(proj == LatticeProj::PERSPECTIVE)
 		matPersp = tl::perspective_matrix<t_mat>(tl::d2r(t_real(5)),
 			t_real(1), t_real(0.01), t_real(100));
 
-	const std::string strAA = tl::get_spec_char_utf8("AA");
 	bool bModifiedRadii = 0;
 
-	for(int ih=-m_iMaxPeaks; ih<=m_iMaxPeaks; ++ih)
-		for(int ik=-m_iMaxPeaks; ik<=m_iMaxPeaks; ++ik)
-			for(int il=-m_iMaxPeaks; il<=m_iMaxPeaks; ++il)
+	for(int ih=-iMaxPeaks; ih<=iMaxPeaks; ++ih)
+	{
+		if(pbCancel && pbCancel->load())
+			return nullptr;
+
+		for(int ik=-iMaxPeaks; ik<=iMaxPeaks; ++ik)
+			for(int il=-iMaxPeaks; il<=iMaxPeaks; ++il)
 			{
 				if(bIsRecip && latticecommon.pSpaceGroup &&
 					!latticecommon.pSpaceGroup->HasReflection(ih, ik, il))
 					continue;
 
 				const t_real h = t_real(ih), k = t_real(ik), l = t_real(il);
-				t_vec vecPeak = m_lattice.GetPos(h,k,l);
+				t_vec vecPeak = pLattice->GetPos(h,k,l);
 
-				t_vec vecCoord = ublas::prod(m_matPlane_inv, vecPeak);
+				t_vec vecCoord = ublas::prod(matPlane_inv, vecPeak);
 				t_real dX = vecCoord[0], dY = vecCoord[1];
-				switch(m_proj)
+				switch(proj)
 				{
 					case LatticeProj::PARALLEL:
 						break;
 					case LatticeProj::PERSPECTIVE:
 						vecCoord.resize(4,1);
-						vecCoord[2] += dLattConst*m_iMaxPeaks*4.75;
+						vecCoord[2] += dLattConst*iMaxPeaks*4.75;
 						vecCoord[3] = 1.;
 						vecCoord = ublas::prod(matPersp, vecCoord);
 						vecCoord /= vecCoord[3];
@@ -181,32 +194,30 @@ void ProjLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon, boo
 						break;
 				}
 
-				dX *=m_dScaleFactor; dY = -dY*m_dScaleFactor;
+				dX *= dScaleFactor; dY = -dY*dScaleFactor;
 				if(tl::is_nan_or_inf(dX) || tl::is_nan_or_inf(dY))
 					continue;
 
-				auto iterPeak = std::find_if(m_vecPeaks.begin(), m_vecPeaks.end(),
-					[dX, dY](const ProjLatticePoint* pPeak) -> bool
+				auto iterPeak = std::find_if(vecPoints.begin(), vecPoints.end(),
+					[dX, dY](const ProjLatticeData::Point& pt) -> bool
 					{
-						return tl::float_equal<t_real>(pPeak->x(), dX, g_dEpsGfx) &&
-							tl::float_equal<t_real>(pPeak->y(), dY, g_dEpsGfx);
+						return tl::float_equal<t_real>(pt.dX, dX, g_dEpsGfx) &&
+							tl::float_equal<t_real>(pt.dY, dY, g_dEpsGfx);
 					});
 
-				ProjLatticePoint *pPeak = nullptr;
-				if(iterPeak == m_vecPeaks.end())
+				ProjLatticeData::Point *pPeak = nullptr;
+				if(iterPeak == vecPoints.end())
 				{
-					pPeak = new ProjLatticePoint();
-					if(ih==0 && ik==0 && il==0)
-						pPeak->SetColor(Qt::green);
-					pPeak->setPos(dX, dY);
-					pPeak->setData(PROJ_LATTICE_NODE_TYPE_KEY, NODE_PROJ_LATTICE);
-
-					m_vecPeaks.push_back(pPeak);
-					m_scene.addItem(pPeak);
+					ProjLatticeData::Point pt;
+					pt.bOrigin = (ih==0 && ik==0 && il==0);
+					pt.dX = dX; pt.dY = dY;
+
+					vecPoints.emplace_back(std::move(pt));
+					pPeak = &vecPoints.back();
 				}
 				else
 				{
-					pPeak = *iterPeak;
+					pPeak = &*iterPeak;
 				}
 
 				if(bIsRecip && latticecommon.CanCalcStructFact())
@@ -215,54 +226,100 @@ void ProjLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon, boo
 					std::tie(std::ignore, dF, std::ignore) =
 						latticecommon.GetStructFact(vecPeak);
 
-					pPeak->AddRadius(dF);
+					pPeak->dRadius += dF;
 					bModifiedRadii = 1;
 				}
 				else
 				{
-					pPeak->SetRadius(DEF_PEAK_SIZE);
+					pPeak->dRadius = DEF_PEAK_SIZE;
 				}
 
 				std::ostringstream ostrTip;
 				ostrTip.precision(g_iPrecGfx);
 
 				ostrTip << "(" << ih << " " << ik << " " << il << ")";
-				pPeak->AddTooltip(QString::fromUtf8(ostrTip.str().c_str(), ostrTip.str().length()));
+				if(pPeak->strTip.length())
+					pPeak->strTip += ", ";
+				pPeak->strTip += ostrTip.str();
 			}
+	}
 
 
-	t_real dMinRad = std::numeric_limits<t_real>::max(), dMaxRad = -1.;
-
 	if(bModifiedRadii)
 	{
-		for(ProjLatticePoint* pPeak : m_vecPeaks)
+		t_real dMinRad = std::numeric_limits<t_real>::max(), dMaxRad = -1.;
+		for(const ProjLatticeData::Point& pt : vecPoints)
 		{
-			dMinRad = std::min(dMinRad, pPeak->GetRadius());
-			dMaxRad = std::max(dMaxRad, pPeak->GetRadius());
+			dMinRad = std::min(dMinRad, pt.dRadius);
+			dMaxRad = std::max(dMaxRad, pt.dRadius);
 		}
-	}
 
-	for(ProjLatticePoint* pPeak : m_vecPeaks)
-	{
-		if(bModifiedRadii)
+		for(ProjLatticeData::Point& pt : vecPoints)
 		{
 			if(!tl::float_equal(dMinRad, dMaxRad, g_dEpsGfx))
 			{
-				t_real dRadScale = (pPeak->GetRadius()-dMinRad) / (dMaxRad-dMinRad);
-				pPeak->SetRadius(tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dRadScale));
+				t_real dRadScale = (pt.dRadius-dMinRad) / (dMaxRad-dMinRad);
+				pt.dRadius = tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dRadScale);
 			}
 			else
 			{
-				pPeak->SetRadius(DEF_PEAK_SIZE);
+				pt.dRadius = DEF_PEAK_SIZE;
 			}
 		}
+	}
+
+	return pPeaks;
+}
+
 
-		pPeak->SetTooltip();
+/**
+ * shows the projected lattice calculated by CalcPeaksData
+ */
+void ProjLattice::SetPeaks(const xtl::LatticeCommon<t_real>& latticecommon, bool bIsRecip,
+	const std::shared_ptr<const ProjLatticeData>& pPeaks)
+{
+	ClearPeaks();
+
+	if(bIsRecip)
+	{
+		m_lattice = latticecommon.recip;
+		m_matPlane_inv = latticecommon.matPlane_inv;
+	}
+	else
+	{
+		m_lattice = latticecommon.lattice;
+		m_matPlane_inv = latticecommon.matPlaneReal_inv;
+	}
+
+	if(pPeaks)
+	{
+		m_vecPeaks.reserve(pPeaks->vecPoints.size());
+		for(const ProjLatticeData::Point& pt : pPeaks->vecPoints)
+		{
+			ProjLatticePoint *pPeak = new ProjLatticePoint();
+			if(pt.bOrigin)
+				pPeak->SetColor(Qt::green);
+			pPeak->setPos(pt.dX, pt.dY);
+			pPeak->setData(PROJ_LATTICE_NODE_TYPE_KEY, NODE_PROJ_LATTICE);
+			pPeak->SetRadius(pt.dRadius);
+			pPeak->AddTooltip(QString::fromUtf8(pt.strTip.c_str(), pt.strTip.length()));
+			pPeak->SetTooltip();
+
+			m_vecPeaks.push_back(pPeak);
+			m_scene.addItem(pPeak);
+		}
 	}
 
 	this->update();
 }
 
+
+void ProjLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon, bool bIsRecip)
+{
+	SetPeaks(latticecommon, bIsRecip, CalcPeaksData(latticecommon, bIsRecip,
+		m_iMaxPeaks, m_proj, m_dScaleFactor));
+}
+
 void ProjLattice::ClearPeaks()
 {
 	for(ProjLatticePoint*& pPeak : m_vecPeaks)
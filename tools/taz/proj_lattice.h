@@ -20,6 +20,9 @@
 
 #include "tasoptions.h"
 
+#include <memory>
+#include <atomic>
+
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QGraphicsItem>
@@ -69,6 +72,23 @@ class ProjLatticePoint : public QGraphicsItem
 };
 
 
+/**
+ * lattice projection calculated independently of the gui (see ProjLattice::CalcPeaksData)
+ */
+struct ProjLatticeData
+{
+	struct Point
+	{
+		t_real_glob dX = 0., dY = 0.;	// position in scene coordinates
+		t_real_glob dRadius = 0.;
+		bool bOrigin = 0;
+		std::string strTip;
+	};
+
+	std::vector<Point> vecPoints;
+};
+
+
 class ProjLatticeScene;
 class ProjLattice : public QGraphicsItem
 {
@@ -101,12 +121,20 @@ class ProjLattice : public QGraphicsItem
 		const ublas::matrix<t_real_glob>& GetPlane() const { return m_matPlane; }
 
 		void SetProjection(LatticeProj proj) { m_proj = proj; }
+		LatticeProj GetProjection() const { return m_proj; }
 
 	public:
 		bool HasPeaks() const { return m_vecPeaks.size()!=0 && m_lattice.IsInited(); }
 		void ClearPeaks();
 		void CalcPeaks(const xtl::LatticeCommon<t_real_glob>& recipcommon, bool bIsRecip=1);
 
+		static std::shared_ptr<const ProjLatticeData> CalcPeaksData(
+			const xtl::LatticeCommon<t_real_glob>& recipcommon, bool bIsRecip,
+			int iMaxPeaks, LatticeProj proj, t_real_glob dScaleFactor,
+			const std::atomic<bool>* pbCancel=nullptr);
+		void SetPeaks(const xtl::LatticeCommon<t_real_glob>& recipcommon, bool bIsRecip,
+			const std::shared_ptr<const ProjLatticeData>& pPeaks);
+
 		void SetMaxPeaks(int iMax) { m_iMaxPeaks = iMax; }
 		unsigned int GetMaxPeaks() const { return m_iMaxPeaks; }
 		void SetZoom(t_real_glob dZoom);
@@ -12,6 +12,7 @@
 #include "tlibs/log/log.h"
 #include "libs/globals.h"
 #include "real_lattice.h"
+#include "nn_raster.h"
 
 #include <QToolTip>
 #include <iostream>
@@ -208,90 +209,51 @@ void RealLattice::paint(QPainter *pPainter, const QStyleOptionGraphicsItem*, QWi
 
 
 /**
- * calculate real space representation
+ * calculates the real lattice points and the wigner-seitz cell,
+ * this does not access the gui and can run in a background thread
+ * @return nullptr if cancelled
  */
-void RealLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon)
+std::shared_ptr<const RealLatticeData> RealLattice::CalcPeaksData(
+	const xtl::LatticeCommon<t_real>& latticecommon,
+	int iMaxPeaks, t_real dPlaneDistTolerance, const std::atomic<bool>* pbCancel)
 {
-	ClearPeaks();
-	m_kdLattice.Unload();
-	m_lattice = latticecommon.lattice;
-	m_matPlane = latticecommon.matPlaneReal;
-	m_matPlane_inv = latticecommon.matPlaneReal_inv;
+	std::shared_ptr<RealLatticeData> pPeaks = std::make_shared<RealLatticeData>();
+	const tl::Lattice<t_real>& lattice = latticecommon.lattice;
+	const t_mat& matPlane_inv = latticecommon.matPlaneReal_inv;
 
-	m_ws.SetEpsilon(g_dEps);
-	m_ws.SetMaxNN(g_iMaxNN);
-	m_ws3.SetEpsilon(g_dEps);
-	m_ws3.SetMaxNN(g_iMaxNN);
+	tl::Brillouin2D<t_real>& ws = pPeaks->ws;
+	tl::Brillouin3D<t_real>& ws3 = pPeaks->ws3;
+	ws.SetEpsilon(g_dEps);
+	ws.SetMaxNN(g_iMaxNN);
+	ws3.SetEpsilon(g_dEps);
+	ws3.SetMaxNN(g_iMaxNN);
 
 	// central peak for WS cell calculation
 	ublas::vector<int> veciCent = tl::make_vec({0.,0.,0.});
 
 	static const std::string strAA = tl::get_spec_char_utf8("AA");
 
-	// --------------------------------------------------------------------
-	// atom positions in unit cell
-	std::vector<QColor> colors = {QColor(127,0,0), QColor(0,127,0), QColor(0,0,127),
-		QColor(127,127,0), QColor(0,127,127), QColor(127,0,127)};
+	std::list<std::vector<t_real>> lstPeaksForKd;
 
-	for(std::size_t iAtom=0; iAtom<latticecommon.vecAllAtoms.size(); ++iAtom)
+	for(int ih=-iMaxPeaks; ih<=iMaxPeaks; ++ih)
 	{
-		const std::string& strElem = latticecommon.vecAllNames[iAtom];
-		const t_vec& vecThisAtom = latticecommon.vecAllAtoms[iAtom];
-		const t_vec& vecThisAtomFrac = latticecommon.vecAllAtomsFrac[iAtom];
-		std::size_t iCurAtomType = latticecommon.vecAllAtomTypes[iAtom];
-
-		LatticeAtom *pAtom = new LatticeAtom();
-		m_vecAtoms.push_back(pAtom);
+		if(pbCancel && pbCancel->load())
+			return nullptr;
 
-		pAtom->m_strElem = strElem;
-		pAtom->m_vecPos = std::move(vecThisAtom);
-		pAtom->m_vecProj = latticecommon.planeReal.GetDroppedPerp(pAtom->m_vecPos/*, &pAtom->m_dProjDist*/);
-		pAtom->m_dProjDist = latticecommon.planeReal.GetDist(pAtom->m_vecPos);
-
-		t_vec vecCoord = ublas::prod(m_matPlane_inv, pAtom->m_vecProj);
-		t_real dX = vecCoord[0], dY = -vecCoord[1];
-
-		pAtom->setPos(dX * m_dScaleFactor, dY * m_dScaleFactor);
-		pAtom->setData(REAL_LATTICE_NODE_TYPE_KEY, NODE_REAL_LATTICE_ATOM);
-
-		std::ostringstream ostrTip;
-		ostrTip.precision(g_iPrecGfx);
-		ostrTip << pAtom->m_strElem;
-		ostrTip << "\n("
-			<< vecThisAtomFrac[0] << ", "
-			<< vecThisAtomFrac[1] << ", "
-			<< vecThisAtomFrac[2] << ") frac";
-		ostrTip << "\n("
-			<< vecThisAtom[0] << ", "
-			<< vecThisAtom[1] << ", "
-			<< vecThisAtom[2] << ") " << strAA;
-		ostrTip << "\nDistance to Plane: " << pAtom->m_dProjDist << " " << strAA;
-		pAtom->setToolTip(QString::fromUtf8(ostrTip.str().c_str(), ostrTip.str().length()));
-		pAtom->SetColor(colors[iCurAtomType % colors.size()]);
-
-		m_scene.addItem(pAtom);
-	}
-	// --------------------------------------------------------------------
-
-
-
-	std::list<std::vector<t_real>> lstPeaksForKd;
-
-	for(int ih=-m_iMaxPeaks; ih<=m_iMaxPeaks; ++ih)
-		for(int ik=-m_iMaxPeaks; ik<=m_iMaxPeaks; ++ik)
-			for(int il=-m_iMaxPeaks; il<=m_iMaxPeaks; ++il)
+		for(int ik=-iMaxPeaks; ik<=iMaxPeaks; ++ik)
+			for(int il=-iMaxPeaks; il<=iMaxPeaks; ++il)
 			{
 				const t_real h = t_real(ih), k = t_real(ik), l = t_real(il);
 				const t_vec vecPeakHKL = tl::make_vec<t_vec>({h,k,l});
-				t_vec vecPeak = m_lattice.GetPos(h,k,l);
+				t_vec vecPeak = lattice.GetPos(h,k,l);
 
 				// 3d unit cell
 				if(g_b3dBZ)
 				{
 					if(ih==veciCent[0] && ik==veciCent[1] && il==veciCent[2])
-						m_ws3.SetCentralReflex(vecPeak, &vecPeakHKL);
+						ws3.SetCentralReflex(vecPeak, &vecPeakHKL);
 					else if(std::abs(ih-veciCent[0]) <= 2 && std::abs(ik-veciCent[1]) <= 2 && std::abs(il-veciCent[2]) <= 2)
-						m_ws3.AddReflex(vecPeak, &vecPeakHKL);
+						ws3.AddReflex(vecPeak, &vecPeakHKL);
 				}
 
 				// add peak in A and in fractional units
@@ -300,22 +262,20 @@ void RealLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon)
 				t_real dDist = 0.;
 				t_vec vecDropped = latticecommon.planeReal.GetDroppedPerp(vecPeak, &dDist);
 
-				if(tl::float_equal<t_real>(dDist, 0., m_dPlaneDistTolerance))
+				if(tl::float_equal<t_real>(dDist, 0., dPlaneDistTolerance))
 				{
-					t_vec vecCoord = ublas::prod(m_matPlane_inv, vecDropped);
+					t_vec vecCoord = ublas::prod(matPlane_inv, vecDropped);
 					t_real dX = vecCoord[0], dY = -vecCoord[1];
 
-					LatticePoint *pPeak = new LatticePoint();
-					if(ih==0 && ik==0 && il==0)
-						pPeak->SetColor(Qt::darkGreen);
-					pPeak->setPos(dX * m_dScaleFactor, dY * m_dScaleFactor);
-					pPeak->setData(REAL_LATTICE_NODE_TYPE_KEY, NODE_REAL_LATTICE);
+					RealLatticeData::Point pt;
+					pt.h = ih; pt.k = ik; pt.l = il;
+					pt.dX = dX; pt.dY = dY;
 
 					std::ostringstream ostrTip;
 					ostrTip.precision(g_iPrecGfx);
 
 					ostrTip << "(" << ih << " " << ik << " " << il << ")";
-					pPeak->SetLabel(ostrTip.str().c_str());
+					pt.strLabel = ostrTip.str();
 
 					tl::set_eps_0(vecPeak, g_dEps);
 					ostrTip << " frac\n";
@@ -324,10 +284,9 @@ void RealLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon)
 							<< vecPeak[1] << ", "
 							<< vecPeak[2] << ") " << strAA;
 					//ostrTip << "\ndistance to plane: " << dDist << " " << strAA;
-					pPeak->setToolTip(QString::fromUtf8(ostrTip.str().c_str(), ostrTip.str().length()));
+					pt.strTip = ostrTip.str();
 
-					m_vecPeaks.push_back(pPeak);
-					m_scene.addItem(pPeak);
+					pPeaks->vecPoints.emplace_back(std::move(pt));
 
 
 					// 2d unit cell
@@ -337,54 +296,157 @@ void RealLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon)
 						{
 							t_vec vecCentral = tl::make_vec({dX, dY});
 							//log_debug("Central ", ih, ik, il, ": ", vecCentral);
-							m_ws.SetCentralReflex(vecCentral, &vecPeakHKL);
+							ws.SetCentralReflex(vecCentral, &vecPeakHKL);
 						}
 						// TODO: check if 2 next neighbours is sufficient for all space groups
 						else if(std::abs(ih-veciCent[0])<=2 && std::abs(ik-veciCent[1])<=2
 							&& std::abs(il-veciCent[2])<=2)
 						{
 							t_vec vecN = tl::make_vec({dX, dY});
-							m_ws.AddReflex(vecN, &vecPeakHKL);
+							ws.AddReflex(vecN, &vecPeakHKL);
 						}
 					}
 				}
 			}
+	}
 
 	if(g_b3dBZ)
 	{
-		m_ws3.CalcBZ(get_max_threads());
+		ws3.CalcBZ(get_max_threads());
 
 		// ----------------------------------------------------------------
 		// calculate intersection with real plane
-		tl::Plane<t_real> planeBZ3 = tl::Plane<t_real>(m_ws3.GetCentralReflex(),
+		tl::Plane<t_real> planeBZ3 = tl::Plane<t_real>(ws3.GetCentralReflex(),
 			latticecommon.planeReal.GetNorm());
 
-		std::tie(std::ignore, m_vecWS3VertsUnproj) = m_ws3.GetIntersection(planeBZ3);
+		std::tie(std::ignore, pPeaks->vecWS3VertsUnproj) = ws3.GetIntersection(planeBZ3);
 
-		for(const t_vec& _vecWS3Vert : m_vecWS3VertsUnproj)
+		for(const t_vec& _vecWS3Vert : pPeaks->vecWS3VertsUnproj)
 		{
-			t_vec vecWS3Vert = ublas::prod(latticecommon.matPlaneReal_inv, _vecWS3Vert - m_ws3.GetCentralReflex());
+			t_vec vecWS3Vert = ublas::prod(matPlane_inv, _vecWS3Vert - ws3.GetCentralReflex());
 			vecWS3Vert.resize(2, true);
 			vecWS3Vert[1] = -vecWS3Vert[1];
 
-			m_vecWS3Verts.push_back(vecWS3Vert);
+			pPeaks->vecWS3Verts.push_back(vecWS3Vert);
 		}
 		// ----------------------------------------------------------------
 
 	}
 	else
 	{
-		m_ws.CalcBZ();
+		ws.CalcBZ();
 	}
 
-	//for(LatticePoint* pPeak : m_vecPeaks)
-	//	pPeak->SetBZ(&m_ws);
+	if(pbCancel && pbCancel->load())
+		return nullptr;
+
+	std::shared_ptr<tl::Kd<t_real>> pKd = std::make_shared<tl::Kd<t_real>>();
+	pKd->Load(lstPeaksForKd, 3);
+	pPeaks->pKd = pKd;
+
+	return pPeaks;
+}
 
-	m_kdLattice.Load(lstPeaksForKd, 3);
+
+/**
+ * shows the real lattice calculated by CalcPeaksData and the atoms in the unit cell
+ */
+void RealLattice::SetPeaks(const xtl::LatticeCommon<t_real>& latticecommon,
+	const std::shared_ptr<const RealLatticeData>& pPeaks)
+{
+	ClearPeaks();
+	m_pKdLattice = std::make_shared<tl::Kd<t_real>>();
+	m_lattice = latticecommon.lattice;
+	m_matPlane = latticecommon.matPlaneReal;
+	m_matPlane_inv = latticecommon.matPlaneReal_inv;
+
+	static const std::string strAA = tl::get_spec_char_utf8("AA");
+
+	// --------------------------------------------------------------------
+	// atom positions in unit cell
+	std::vector<QColor> colors = {QColor(127,0,0), QColor(0,127,0), QColor(0,0,127),
+		QColor(127,127,0), QColor(0,127,127), QColor(127,0,127)};
+
+	for(std::size_t iAtom=0; iAtom<latticecommon.vecAllAtoms.size(); ++iAtom)
+	{
+		const std::string& strElem = latticecommon.vecAllNames[iAtom];
+		const t_vec& vecThisAtom = latticecommon.vecAllAtoms[iAtom];
+		const t_vec& vecThisAtomFrac = latticecommon.vecAllAtomsFrac[iAtom];
+		std::size_t iCurAtomType = latticecommon.vecAllAtomTypes[iAtom];
+
+		LatticeAtom *pAtom = new LatticeAtom();
+		m_vecAtoms.push_back(pAtom);
+
+		pAtom->m_strElem = strElem;
+		pAtom->m_vecPos = std::move(vecThisAtom);
+		pAtom->m_vecProj = latticecommon.planeReal.GetDroppedPerp(pAtom->m_vecPos/*, &pAtom->m_dProjDist*/);
+		pAtom->m_dProjDist = latticecommon.planeReal.GetDist(pAtom->m_vecPos);
+
+		t_vec vecCoord = ublas::prod(m_matPlane_inv, pAtom->m_vecProj);
+		t_real dX = vecCoord[0], dY = -vecCoord[1];
+
+		pAtom->setPos(dX * m_dScaleFactor, dY * m_dScaleFactor);
+		pAtom->setData(REAL_LATTICE_NODE_TYPE_KEY, NODE_REAL_LATTICE_ATOM);
+
+		std::ostringstream ostrTip;
+		ostrTip.precision(g_iPrecGfx);
+		ostrTip << pAtom->m_strElem;
+		ostrTip << "\n("
+			<< vecThisAtomFrac[0] << ", "
+			<< vecThisAtomFrac[1] << ", "
+			<< vecThisAtomFrac[2] << ") frac";
+		ostrTip << "\n("
+			<< vecThisAtom[0] << ", "
+			<< vecThisAtom[1] << ", "
+			<< vecThisAtom[2] << ") " << strAA;
+		ostrTip << "\nDistance to Plane: " << pAtom->m_dProjDist << " " << strAA;
+		pAtom->setToolTip(QString::fromUtf8(ostrTip.str().c_str(), ostrTip.str().length()));
+		pAtom->SetColor(colors[iCurAtomType % colors.size()]);
+
+		m_scene.addItem(pAtom);
+	}
+	// --------------------------------------------------------------------
+
+
+	if(pPeaks)
+	{
+		m_ws = pPeaks->ws;
+		m_ws3 = pPeaks->ws3;
+		m_vecWS3VertsUnproj = pPeaks->vecWS3VertsUnproj;
+		m_vecWS3Verts = pPeaks->vecWS3Verts;
+		if(pPeaks->pKd)
+			m_pKdLattice = pPeaks->pKd;
+
+		m_vecPeaks.reserve(pPeaks->vecPoints.size());
+		for(const RealLatticeData::Point& pt : pPeaks->vecPoints)
+		{
+			LatticePoint *pPeak = new LatticePoint();
+			if(pt.h==0 && pt.k==0 && pt.l==0)
+				pPeak->SetColor(Qt::darkGreen);
+			pPeak->setPos(pt.dX * m_dScaleFactor, pt.dY * m_dScaleFactor);
+			pPeak->setData(REAL_LATTICE_NODE_TYPE_KEY, NODE_REAL_LATTICE);
+
+			pPeak->SetLabel(pt.strLabel.c_str());
+			pPeak->setToolTip(QString::fromUtf8(pt.strTip.c_str(), pt.strTip.length()));
+
+			m_vecPeaks.push_back(pPeak);
+			m_scene.addItem(pPeak);
+		}
+	}
 
 	this->update();
 }
 
+
+/**
+ * calculate real space representation
+ */
+void RealLattice::CalcPeaks(const xtl::LatticeCommon<t_real>& latticecommon)
+{
+	SetPeaks(latticecommon, CalcPeaksData(latticecommon,
+		m_iMaxPeaks, m_dPlaneDistTolerance));
+}
+
 t_vec RealLattice::GetHKLFromPlanePos(t_real x, t_real y) const
 {
 	if(!HasPeaks())
@@ -455,74 +517,39 @@ void LatticeScene::mousePressEvent(QGraphicsSceneMouseEvent *pEvt)
 
 #ifdef USE_GIL
 
-#include "tlibs/gfx/gil.h"
-namespace gil = boost::gil;
-
-bool LatticeScene::ExportWSAccurate(const char* pcFile) const
+bool LatticeScene::ExportWSAccurate(const char* pcFile, unsigned iW, unsigned iH) const
 {
-	if(!m_pLatt) return false;
+	if(!m_pLatt || !m_pLatt->HasPeaks()) return false;
+	if(!iW || !iH) return false;
 
-	const int iW = 720;
-	const int iH = 720;
+	const NearestNodeRaster<t_real> raster(m_pLatt->GetKdLattice(),
+		m_pLatt->GetRealLattice(), int(m_pLatt->GetMaxPeaks()));
+	if(!raster.IsOk()) return false;
 
-	gil::rgb8_view_t view;
-	std::vector<gil::rgb8_pixel_t> vecPix;
-	tl::create_imgview(iW, iH, vecPix, view);
-
-	const int iMaxPeaks = m_pLatt->GetMaxPeaks();
+	// the image covers the same part of the scene for all sizes
+	const t_real dStep = t_real(720) / t_real(std::max(iW, iH));
 	int iXMid = sceneRect().left() + (sceneRect().right()-sceneRect().left())/2;
 	int iYMid = sceneRect().top() + (sceneRect().bottom()-sceneRect().top())/2;
 
-	int _iY=0;
-	for(int iY=iYMid-iH/2; iY<iYMid+iH/2; ++iY, ++_iY)
-	{
-		auto iterRow = view.row_begin(_iY);
+	// the lattice positions are linear in the scene positions, see GetHKLFromPlanePos
+	const t_vec vecX = tl::get_column(m_pLatt->GetPlane(), 0) / m_pLatt->GetScaleFactor();
+	const t_vec vecY = tl::get_column(m_pLatt->GetPlane(), 1) / m_pLatt->GetScaleFactor();
+	const t_vec vecOrig = (t_real(iXMid) - t_real(iW/2)*dStep) * vecX
+		- (t_real(iYMid) - t_real(iH/2)*dStep) * vecY;
 
-		int _iX=0;
-		t_real dY = iY;
-		for(int iX=iXMid-iW/2; iX<iXMid+iW/2; ++iX, ++_iX)
-		{
-			t_real dX = iX;
-			t_vec vecHKL = m_pLatt->GetHKLFromPlanePos(dX, -dY);
-			if(vecHKL.size()!=3) return false;
-			vecHKL /= m_pLatt->GetScaleFactor();
-
-			const std::vector<t_real>* pvecNearest = nullptr;
-			const tl::Kd<t_real>& kd = m_pLatt->GetKdLattice();
-			t_vec vecHKLA = m_pLatt->GetRealLattice().GetPos(vecHKL[0], vecHKL[1], vecHKL[2]);
-
-			if(kd.GetRootNode())
-			{
-				std::vector<t_real> stdvecHKL{vecHKLA[0], vecHKLA[1], vecHKLA[2]};
-				pvecNearest = &kd.GetNearestNode(stdvecHKL);
-			}
-
-			if(!pvecNearest) return false;
-			t_real dDist = ublas::norm_2(tl::make_vec({(*pvecNearest)[0], (*pvecNearest)[1], (*pvecNearest)[2]}) - vecHKLA);
-
-			bool bIsDirectBeam = 0;
-			if(tl::float_equal<t_real>((*pvecNearest)[3], 0.) && tl::float_equal<t_real>((*pvecNearest)[4], 0.) && tl::float_equal<t_real>((*pvecNearest)[5], 0.))
-				bIsDirectBeam = 1;
-
-			int iR = ((*pvecNearest)[3]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			int iG = ((*pvecNearest)[4]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			int iB = ((*pvecNearest)[5]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			t_real dBraggAmp = tl::gauss_model<t_real>(dDist, 0., 0.01, 255., 0.);
-			iR += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-			iG += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-			iB += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-
-			iR = tl::clamp(iR, 0, 255);
-			iG = tl::clamp(iG, 0, 255);
-			iB = tl::clamp(iB, 0, 255);
-
-			iterRow[_iX] = gil::rgb8_pixel_t((unsigned char)iR, (unsigned char)iG, (unsigned char)iB);
-		}
-
-		//tl::log_info("BZ export: Line ", _iY+1, " of ", iH);
+	// the rows are written as soon as their band is finished
+	PngRowWriter png(pcFile, iW, iH);
+	bool bOk = png.IsOk();
+	if(bOk)
+	{
+		bOk = raster.Render(iW, iH, vecOrig, dStep*vecX, -dStep*vecY,
+			[&png](const unsigned char* pRGB) -> bool { return png.WriteRow(pRGB); },
+			get_max_threads());
+		if(bOk)
+			bOk = png.Close();
 	}
 
-	if(!tl::save_view(pcFile, &view))
+	if(!bOk)
 	{
 		tl::log_err("Cannot write image \"", pcFile, "\".");
 		return false;
@@ -532,7 +559,7 @@ bool LatticeScene::ExportWSAccurate(const char* pcFile) const
 }
 
 #else
-bool LatticeScene::ExportWSAccurate(const char* pcFile) const { return 0; }
+bool LatticeScene::ExportWSAccurate(const char*, unsigned, unsigned) const { return 0; }
 #endif
 
 
@@ -22,6 +22,9 @@
 #include "tasoptions.h"
 #include "dialogs/AtomsDlg.h"
 
+#include <memory>
+#include <atomic>
+
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QGraphicsItem>
@@ -76,6 +79,29 @@ class LatticeAtom : public QGraphicsItem
 };
 
 
+/**
+ * real lattice calculated independently of the gui (see RealLattice::CalcPeaksData)
+ */
+struct RealLatticeData
+{
+	struct Point
+	{
+		int h = 0, k = 0, l = 0;
+		t_real_glob dX = 0., dY = 0.;	// position in the view plane in A
+		std::string strLabel, strTip;
+	};
+
+	// lattice points in the view plane
+	std::vector<Point> vecPoints;
+
+	std::shared_ptr<const tl::Kd<t_real_glob>> pKd;
+
+	tl::Brillouin2D<t_real_glob> ws;
+	tl::Brillouin3D<t_real_glob> ws3;
+	std::vector<ublas::vector<t_real_glob>> vecWS3VertsUnproj, vecWS3Verts;
+};
+
+
 class LatticeScene;
 class RealLattice : public QGraphicsItem
 {
@@ -93,7 +119,7 @@ class RealLattice : public QGraphicsItem
 		std::vector<LatticePoint*> m_vecPeaks;
 		std::vector<LatticeAtom*> m_vecAtoms;
 
-		tl::Kd<t_real_glob> m_kdLattice;
+		std::shared_ptr<const tl::Kd<t_real_glob>> m_pKdLattice = std::make_shared<tl::Kd<t_real_glob>>();
 
 		bool m_bShowWS = 1;
 		tl::Brillouin2D<t_real_glob> m_ws;	// "Wigner-Seitz cell"
@@ -119,7 +145,15 @@ class RealLattice : public QGraphicsItem
 		void ClearPeaks();
 		void CalcPeaks(const xtl::LatticeCommon<t_real_glob>& latticecommon);
 
+		static std::shared_ptr<const RealLatticeData> CalcPeaksData(
+			const xtl::LatticeCommon<t_real_glob>& latticecommon,
+			int iMaxPeaks, t_real_glob dPlaneDistTolerance,
+			const std::atomic<bool>* pbCancel=nullptr);
+		void SetPeaks(const xtl::LatticeCommon<t_real_glob>& latticecommon,
+			const std::shared_ptr<const RealLatticeData>& pPeaks);
+
 		void SetPlaneDistTolerance(t_real_glob dTol) { m_dPlaneDistTolerance = dTol; }
+		t_real_glob GetPlaneDistTolerance() const { return m_dPlaneDistTolerance; }
 		void SetMaxPeaks(int iMax) { m_iMaxPeaks = iMax; }
 		unsigned int GetMaxPeaks() const { return m_iMaxPeaks; }
 		void SetZoom(t_real_glob dZoom);
@@ -129,7 +163,7 @@ class RealLattice : public QGraphicsItem
 		const tl::Brillouin3D<t_real_glob>& GetWS3D() const { return m_ws3; }
 		const std::vector<ublas::vector<t_real_glob>>& GetWS3DPlaneVerts() const { return m_vecWS3VertsUnproj; }
 
-		const tl::Kd<t_real_glob>& GetKdLattice() const { return m_kdLattice; }
+		const tl::Kd<t_real_glob>& GetKdLattice() const { return *m_pKdLattice; }
 
 	public:
 		t_real_glob GetScaleFactor() const { return m_dScaleFactor; }
@@ -154,7 +188,7 @@ class LatticeScene : public QGraphicsScene
 		const RealLattice* GetLattice() const { return m_pLatt; }
 		RealLattice* GetLattice() { return m_pLatt; }
 
-		bool ExportWSAccurate(const char* pcFile) const;
+		bool ExportWSAccurate(const char* pcFile, unsigned iW=720, unsigned iH=720) const;
 
 	public slots:
 		void scaleChanged(t_real_glob dTotalScale);
@@ -9,13 +9,17 @@
 #include "tlibs/phys/neutrons.h"
 #include "tlibs/string/spec_char.h"
 #include "tlibs/log/log.h"
+#include "tlibs/helper/thread.h"
 #include "scattering_triangle.h"
+#include "nn_raster.h"
 
 #include <QToolTip>
 #include <iostream>
 #include <sstream>
 #include <cmath>
 #include <tuple>
+#include <mutex>
+#include <algorithm>
 
 
 // symbol drawing sizes
@@ -971,27 +975,223 @@ static inline std::string print_complex(const std::complex<T>& c)
 }
 
 
-void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon, bool bIsPowder)
+// ----------------------------------------------------------------------------
+// table of bragg peaks
+
+/**
+ * flat table of the generally allowed bragg peaks in the (2N+1)^3 hkl cube,
+ * which only depends on the crystal and not on the scattering plane
+ */
+struct RecipPeakTable
 {
-	ClearPeaks();
-	m_vecPowderLines.clear();
-	m_vecPowderLineWidths.clear();
-	m_kdLattice.Unload();
+	// the crystal this table was calculated for
+	int iMaxPeaks = 0;
+	t_real dA = 0., dB = 0., dC = 0., dAlpha = 0., dBeta = 0., dGamma = 0.;
+	const xtl::SpaceGroup<t_real>* pSpaceGroup = nullptr;
+	std::vector<t_vec> vecAllAtoms;
+	std::vector<std::complex<t_real>> vecScatlens;
 
-	m_lattice = recipcommon.lattice;
-	m_recip = recipcommon.recip;
-	m_plane = recipcommon.plane;
-	m_matPlane = recipcommon.matPlane;
-	m_matPlaneRlu = recipcommon.matPlaneRLU;
-	m_matPlane_inv = recipcommon.matPlane_inv;
+	// columns
+	std::vector<int> vecH, vecK, vecL;
+	std::vector<t_real> vecQx, vecQy, vecQz;		// in 1/A
+	std::vector<std::complex<t_real>> vecF;			// in fm
+	std::vector<t_real> vecFsq;						// < 0: no structure factor
+	std::vector<char> vecAllowed;					// not structurally forbidden
+
+	std::size_t size() const { return vecH.size(); }
+
+	void reserve(std::size_t iSize)
+	{
+		vecH.reserve(iSize); vecK.reserve(iSize); vecL.reserve(iSize);
+		vecQx.reserve(iSize); vecQy.reserve(iSize); vecQz.reserve(iSize);
+		vecF.reserve(iSize); vecFsq.reserve(iSize); vecAllowed.reserve(iSize);
+	}
+
+	void append(const RecipPeakTable& tab)
+	{
+		vecH.insert(vecH.end(), tab.vecH.begin(), tab.vecH.end());
+		vecK.insert(vecK.end(), tab.vecK.begin(), tab.vecK.end());
+		vecL.insert(vecL.end(), tab.vecL.begin(), tab.vecL.end());
+		vecQx.insert(vecQx.end(), tab.vecQx.begin(), tab.vecQx.end());
+		vecQy.insert(vecQy.end(), tab.vecQy.begin(), tab.vecQy.end());
+		vecQz.insert(vecQz.end(), tab.vecQz.begin(), tab.vecQz.end());
+		vecF.insert(vecF.end(), tab.vecF.begin(), tab.vecF.end());
+		vecFsq.insert(vecFsq.end(), tab.vecFsq.begin(), tab.vecFsq.end());
+		vecAllowed.insert(vecAllowed.end(), tab.vecAllowed.begin(), tab.vecAllowed.end());
+	}
+
+	bool IsFor(const xtl::LatticeCommon<t_real>& recipcommon, int iMax) const
+	{
+		const tl::Lattice<t_real>& recip = recipcommon.recip;
+		if(iMax != iMaxPeaks || recipcommon.pSpaceGroup != pSpaceGroup)
+			return false;
+		if(recip.GetA() != dA || recip.GetB() != dB || recip.GetC() != dC ||
+			recip.GetAlpha() != dAlpha || recip.GetBeta() != dBeta || recip.GetGamma() != dGamma)
+			return false;
+		if(recipcommon.vecScatlens != vecScatlens ||
+			recipcommon.vecAllAtoms.size() != vecAllAtoms.size())
+			return false;
+
+		for(std::size_t iAtom=0; iAtom<vecAllAtoms.size(); ++iAtom)
+		{
+			const t_vec& vec1 = vecAllAtoms[iAtom];
+			const t_vec& vec2 = recipcommon.vecAllAtoms[iAtom];
+			if(vec1.size() != vec2.size() || !std::equal(vec1.begin(), vec1.end(), vec2.begin()))
+				return false;
+		}
+
+		return true;
+	}
+};
+
+
+/**
+ * calculates the peak table in parallel, one task per h slab
+ * @return nullptr if cancelled
+ */
+static std::shared_ptr<const RecipPeakTable> calc_recip_peak_table(
+	const xtl::LatticeCommon<t_real>& recipcommon, int iMaxPeaks,
+	const std::atomic<bool>* pbCancel)
+{
+	const tl::Lattice<t_real>& recip = recipcommon.recip;
+
+	std::shared_ptr<RecipPeakTable> pTab = std::make_shared<RecipPeakTable>();
+	pTab->iMaxPeaks = iMaxPeaks;
+	pTab->dA = recip.GetA(); pTab->dB = recip.GetB(); pTab->dC = recip.GetC();
+	pTab->dAlpha = recip.GetAlpha(); pTab->dBeta = recip.GetBeta(); pTab->dGamma = recip.GetGamma();
+	pTab->pSpaceGroup = recipcommon.pSpaceGroup;
+	pTab->vecAllAtoms = recipcommon.vecAllAtoms;
+	pTab->vecScatlens = recipcommon.vecScatlens;
+
+	const int iNumSlabs = 2*iMaxPeaks + 1;
+	std::vector<RecipPeakTable> vecSlabs(iNumSlabs);
+	const bool bStructFact = recipcommon.CanCalcStructFact();
+
+	auto calc_slab = [&recipcommon, &recip, &vecSlabs, iMaxPeaks, bStructFact, pbCancel](int ih)
+	{
+		if(pbCancel && pbCancel->load())
+			return;
+
+		RecipPeakTable& tab = vecSlabs[ih + iMaxPeaks];
+		tab.reserve((2*iMaxPeaks + 1) * (2*iMaxPeaks + 1));
+
+		for(int ik=-iMaxPeaks; ik<=iMaxPeaks; ++ik)
+			for(int il=-iMaxPeaks; il<=iMaxPeaks; ++il)
+			{
+				bool bHasRefl = 1;
+				if(recipcommon.pSpaceGroup)
+				{
+					if(!recipcommon.pSpaceGroup->HasGenReflection(ih, ik, il))
+						continue;
+					bHasRefl = recipcommon.pSpaceGroup->HasReflection(ih, ik, il);
+				}
+
+				const t_vec vecPeak = recip.GetPos(t_real(ih), t_real(ik), t_real(il));
+
+				std::complex<t_real> cF(-1., -1.);
+				t_real dF = -1., dFsq = -1.;
+				if(bHasRefl && bStructFact)
+				{
+					std::tie(cF, dF, dFsq) = recipcommon.GetStructFact(vecPeak);
+					tl::set_eps_0(dFsq, g_dEpsGfx);
+				}
+
+				tab.vecH.push_back(ih); tab.vecK.push_back(ik); tab.vecL.push_back(il);
+				tab.vecQx.push_back(vecPeak[0]); tab.vecQy.push_back(vecPeak[1]); tab.vecQz.push_back(vecPeak[2]);
+				tab.vecF.push_back(cF);
+				tab.vecFsq.push_back(dFsq);
+				tab.vecAllowed.push_back(bHasRefl);
+			}
+	};
+
+	const unsigned int iNumThreads = std::max<unsigned int>(1,
+		std::min<unsigned int>(get_max_threads(), iNumSlabs));
+	tl::ThreadPool<void()> tp(iNumThreads);
+	for(unsigned int iThread=0; iThread<iNumThreads; ++iThread)
+	{
+		tp.AddTask([iThread, iNumThreads, iNumSlabs, iMaxPeaks, &calc_slab]()
+		{
+			for(int iSlab=int(iThread); iSlab<iNumSlabs; iSlab+=int(iNumThreads))
+				calc_slab(iSlab - iMaxPeaks);
+		});
+	}
+
+	tp.StartTasks();
+	for(auto& fut : tp.GetFutures())
+		fut.get();
+
+	if(pbCancel && pbCancel->load())
+		return nullptr;
+
+	std::size_t iSize = 0;
+	for(const RecipPeakTable& tab : vecSlabs)
+		iSize += tab.size();
+	pTab->reserve(iSize);
+
+	// same order as iterating over h, k, l
+	for(const RecipPeakTable& tab : vecSlabs)
+		pTab->append(tab);
+
+	return pTab;
+}
+
+
+/**
+ * gets the peak table for the given crystal, the last one is cached,
+ * so that changing only the scattering plane does not recalculate the structure factors
+ * @return nullptr if cancelled
+ */
+static std::shared_ptr<const RecipPeakTable> get_recip_peak_table(
+	const xtl::LatticeCommon<t_real>& recipcommon, int iMaxPeaks,
+	const std::atomic<bool>* pbCancel)
+{
+	static std::mutex mtxCache;
+	static std::shared_ptr<const RecipPeakTable> pCachedTab;
+
+	{
+		std::lock_guard<std::mutex> lock(mtxCache);
+		if(pCachedTab && pCachedTab->IsFor(recipcommon, iMaxPeaks))
+			return pCachedTab;
+	}
+
+	std::shared_ptr<const RecipPeakTable> pTab =
+		calc_recip_peak_table(recipcommon, iMaxPeaks, pbCancel);
+
+	if(pTab)
+	{
+		std::lock_guard<std::mutex> lock(mtxCache);
+		pCachedTab = pTab;
+	}
+
+	return pTab;
+}
+
+// ----------------------------------------------------------------------------
+
+
+/**
+ * calculates the reciprocal lattice peaks, the brillouin zones and the powder lines,
+ * this does not access the gui and can run in a background thread
+ * @return nullptr if cancelled
+ */
+std::shared_ptr<const RecipPeaksData> ScatteringTriangle::CalcPeaksData(
+	const xtl::LatticeCommon<t_real>& recipcommon, bool bIsPowder,
+	int _iMaxPeaks, t_real dPlaneDistTolerance, const std::atomic<bool>* pbCancel)
+{
+	std::shared_ptr<RecipPeaksData> pPeaks = std::make_shared<RecipPeaksData>();
+	const tl::Lattice<t_real>& recip = recipcommon.recip;
+	const tl::Plane<t_real>& plane = recipcommon.plane;
+	const t_mat& matPlane_inv = recipcommon.matPlane_inv;
 
 	tl::Powder<int, t_real_glob> powder;
-	powder.SetRecipLattice(&m_recip);
+	powder.SetRecipLattice(&recip);
 
-	m_bz.SetEpsilon(g_dEps);
-	m_bz.SetMaxNN(g_iMaxNN);
-	m_bz3.SetEpsilon(g_dEps);
-	m_bz3.SetMaxNN(g_iMaxNN);
+	tl::Brillouin2D<t_real>& bz = pPeaks->bz;
+	tl::Brillouin3D<t_real>& bz3 = pPeaks->bz3;
+	bz.SetEpsilon(g_dEps);
+	bz.SetMaxNN(g_iMaxNN);
+	bz3.SetEpsilon(g_dEps);
+	bz3.SetMaxNN(g_iMaxNN);
 
 	// -------------------------------------------------------------------------
 	// central peak for BZ calculation
@@ -1030,166 +1230,186 @@ void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon
 		tl::get_spec_char_utf8("sup1");
 	static const std::string strSup2 = tl::get_spec_char_utf8("sup2");
 
-	static const QColor colPeakAllowed = Qt::red;
-	static const QColor colPeakForbidden(0xaa, 0xaa, 0xaa);
-	static const QColor colPeakOrigin = Qt::darkGreen;
-
 	std::list<std::vector<t_real>> lstPeaksForKd;
 	t_real dMinF = std::numeric_limits<t_real>::max(), dMaxF = -1.;
 
 	const int iMaxNN = g_iMaxNN <= 4 ? 2 : g_iMaxNN-2;	// TODO
-	// iterate over all bragg peaks
-	const int iMaxPeaks = bIsPowder ? m_iMaxPeaks/2 : m_iMaxPeaks;
-	for(int ih=-iMaxPeaks; ih<=iMaxPeaks; ++ih)
-		for(int ik=-iMaxPeaks; ik<=iMaxPeaks; ++ik)
-			for(int il=-iMaxPeaks; il<=iMaxPeaks; ++il)
-			{
-				const t_real h=t_real(ih); const t_real k=t_real(ik); const t_real l=t_real(il);
-				const t_vec vecPeakHKL = tl::make_vec<t_vec>({h,k,l});
+	// table of all bragg peaks, reused if only the scattering plane has changed
+	const int iMaxPeaks = bIsPowder ? _iMaxPeaks/2 : _iMaxPeaks;
+	std::shared_ptr<const RecipPeakTable> pTab =
+		get_recip_peak_table(recipcommon, iMaxPeaks, pbCancel);
+	if(!pTab)
+		return nullptr;
+	const RecipPeakTable& tab = *pTab;
+	const std::size_t iNumPeaks = tab.size();
 
-				bool bHasRefl = 1;
-				bool bHasGenRefl = 1;
+	// -------------------------------------------------------------------------
+	// project the peaks onto the scattering plane in parallel
+	std::vector<char> vecInPlane(iNumPeaks);
+	std::vector<t_real> vecX(iNumPeaks), vecY(iNumPeaks);
+	{
+		const std::size_t iMinPerThread = 1024;
+		const unsigned int iNumThreads = std::max<unsigned int>(1, std::min<std::size_t>(
+			get_max_threads(), iNumPeaks / iMinPerThread));
+		const std::size_t iNumPerThread = iNumPeaks / iNumThreads;
 
-				if(recipcommon.pSpaceGroup)
+		tl::ThreadPool<void()> tp(iNumThreads);
+		for(unsigned int iThread=0; iThread<iNumThreads; ++iThread)
+		{
+			const std::size_t iStart = iThread*iNumPerThread;
+			const std::size_t iEnd = iThread==iNumThreads-1 ? iNumPeaks : iStart+iNumPerThread;
+
+			tp.AddTask([iStart, iEnd, &tab, &plane, &matPlane_inv, dPlaneDistTolerance,
+				&vecInPlane, &vecX, &vecY]()
+			{
+				for(std::size_t iPeak=iStart; iPeak<iEnd; ++iPeak)
 				{
-					bHasRefl = recipcommon.pSpaceGroup->HasReflection(ih, ik, il);
-					bHasGenRefl = recipcommon.pSpaceGroup->HasGenReflection(ih, ik, il);
+					const t_vec vecPeak = tl::make_vec<t_vec>(
+						{ tab.vecQx[iPeak], tab.vecQy[iPeak], tab.vecQz[iPeak] });
+
+					t_real dDist = 0.;
+					t_vec vecDropped = plane.GetDroppedPerp(vecPeak, &dDist);
+					vecInPlane[iPeak] = tl::float_equal<t_real>(dDist, 0., dPlaneDistTolerance);
+
+					t_vec vecCoord = ublas::prod(matPlane_inv, vecDropped);
+					vecX[iPeak] = vecCoord[0];
+					vecY[iPeak] = -vecCoord[1];
 				}
+			});
+		}
+
+		tp.StartTasks();
+		for(auto& fut : tp.GetFutures())
+			fut.get();
+	}
+	// -------------------------------------------------------------------------
 
-				if(!bHasGenRefl)
-					continue;
+	if(pbCancel && pbCancel->load())
+		return nullptr;
 
-				t_vec vecPeak = m_recip.GetPos(h,k,l);
-				//t_vec vecPeak = matB * tl::make_vec({h,k,l});
-				//const t_real dG = ublas::norm_2(vecPeak);
+	for(std::size_t iPeak=0; iPeak<iNumPeaks; ++iPeak)
+	{
+		const int ih = tab.vecH[iPeak], ik = tab.vecK[iPeak], il = tab.vecL[iPeak];
+		const t_real h=t_real(ih); const t_real k=t_real(ik); const t_real l=t_real(il);
+		const t_vec vecPeakHKL = tl::make_vec<t_vec>({h,k,l});
 
+		// only generally allowed reflections are in the table
+		const bool bHasRefl = tab.vecAllowed[iPeak];
+		const bool bHasGenRefl = 1;
 
-				// add peak in 1/A and rlu units (only 1/A vectors are used for kd calculation)
-				lstPeaksForKd.push_back(std::vector<t_real>
-					{ vecPeak[0],vecPeak[1],vecPeak[2], h,k,l/*, dF*/ });
+		t_vec vecPeak = tl::make_vec<t_vec>({ tab.vecQx[iPeak], tab.vecQy[iPeak], tab.vecQz[iPeak] });
 
-				// add peaks for 3d calculation of 1st BZ
-				if(g_b3dBZ && bHasGenRefl)
-				{
-					if(ih==veciCent[0] && ik==veciCent[1] && il==veciCent[2])
-						m_bz3.SetCentralReflex(vecPeak, &vecPeakHKL);
-					else if(std::abs(ih-veciCent[0]) <= iMaxNN &&
-						std::abs(ik-veciCent[1]) <= iMaxNN &&
-						std::abs(il-veciCent[2]) <= iMaxNN)
-						m_bz3.AddReflex(vecPeak, &vecPeakHKL);
-				}
 
-				t_real dDist = 0.;
-				t_vec vecDropped = m_plane.GetDroppedPerp(vecPeak, &dDist);
-				bool bInPlane = tl::float_equal<t_real>(dDist, 0., m_dPlaneDistTolerance);
+		// add peak in 1/A and rlu units (only 1/A vectors are used for kd calculation)
+		lstPeaksForKd.push_back(std::vector<t_real>
+			{ vecPeak[0],vecPeak[1],vecPeak[2], h,k,l/*, dF*/ });
 
-				// --------------------------------------------------------------------
-				// structure factors
-				std::complex<t_real> cF(-1., -1.);
-				t_real dF = -1., dFsq = -1.;
+		// add peaks for 3d calculation of 1st BZ
+		if(g_b3dBZ && bHasGenRefl)
+		{
+			if(ih==veciCent[0] && ik==veciCent[1] && il==veciCent[2])
+				bz3.SetCentralReflex(vecPeak, &vecPeakHKL);
+			else if(std::abs(ih-veciCent[0]) <= iMaxNN &&
+				std::abs(ik-veciCent[1]) <= iMaxNN &&
+				std::abs(il-veciCent[2]) <= iMaxNN)
+				bz3.AddReflex(vecPeak, &vecPeakHKL);
+		}
 
-				if(bHasRefl && recipcommon.CanCalcStructFact() && (bInPlane || bIsPowder))
-				{
-					std::tie(cF, dF, dFsq) =
-						recipcommon.GetStructFact(vecPeak);
+		const bool bInPlane = vecInPlane[iPeak];
 
-					//dFsq *= tl::lorentz_factor(dAngle);
-					tl::set_eps_0(dFsq, g_dEpsGfx);
+		// --------------------------------------------------------------------
+		// structure factors
+		std::complex<t_real> cF(-1., -1.);
+		t_real dF = -1., dFsq = -1.;
+
+		if(tab.vecFsq[iPeak] >= 0. && (bInPlane || bIsPowder))
+		{
+			cF = tab.vecF[iPeak];
+			dFsq = tab.vecFsq[iPeak];
+			dF = std::sqrt(dFsq);
 
-					tl::set_eps_0(dF, g_dEpsGfx);
-					dMinF = std::min(dF, dMinF);
-					dMaxF = std::max(dF, dMaxF);
+			tl::set_eps_0(dF, g_dEpsGfx);
+			dMinF = std::min(dF, dMinF);
+			dMaxF = std::max(dF, dMaxF);
+		}
+		// --------------------------------------------------------------------
+
+		const t_real dX = vecX[iPeak];
+		const t_real dY = vecY[iPeak];
+
+		// in scattering plane?
+		if(bInPlane)
+		{
+			// (000), i.e. direct beam, also needed for powder
+			if(!bIsPowder || (ih==0 && ik==0 && il==0))
+			{
+				RecipPeaksData::Peak peak;
+				peak.h = ih; peak.k = ik; peak.l = il;
+				peak.dX = dX; peak.dY = dY;
+				peak.dF = dF;
+				peak.bAllowed = bHasRefl;
+
+				std::ostringstream ostrLabel, ostrTip;
+				ostrLabel.precision(g_iPrecGfx);
+				ostrTip.precision(g_iPrec);
+
+				ostrLabel << "(" << ih << " " << ik << " " << il << ")";
+				ostrTip << "G = (" << ih << " " << ik << " " << il << ") rlu";
+
+				tl::set_eps_0(vecPeak, g_dEps);
+				ostrTip << "\nG = (" << vecPeak[0] << ", "
+					<< vecPeak[1] << ", "
+					<< vecPeak[2] << ") " << strAA;
+
+				if(dFsq > -1.)
+				{
+					if(g_bShowFsq)
+						ostrLabel << "\nS = " << dFsq;
+					else
+						ostrLabel << "\nF = " << dF;
+
+					ostrTip << "\nF = " << print_complex<t_real>(cF) << " fm";
+					ostrTip << "\nS = " << dFsq << " fm" << strSup2;
+				}
+				else if(!bHasRefl)
+				{
+					ostrTip << "\nStructurally forbidden reflection.";
 				}
-				// --------------------------------------------------------------------
 
-				t_vec vecCoord = ublas::prod(m_matPlane_inv, vecDropped);
-				t_real dX = vecCoord[0];
-				t_real dY = -vecCoord[1];
+				//ostrTip << "\ndistance to plane: " << dDist << " " << strAA;
+				peak.strLabel = ostrLabel.str();
+				peak.strTip = ostrTip.str();
+				pPeaks->vecPeaks.emplace_back(std::move(peak));
 
-				// in scattering plane?
-				if(bInPlane)
+
+				// add peaks for 2d approximation of 1st BZ
+				if(!g_b3dBZ && bHasGenRefl)
 				{
-					// (000), i.e. direct beam, also needed for powder
-					if(!bIsPowder || (ih==0 && ik==0 && il==0))
+					t_vec vecN = tl::make_vec({dX, dY});
+					if(ih==veciCent[0] && ik==veciCent[1] && il==veciCent[2])
+					{
+						bz.SetCentralReflex(vecN, &vecPeakHKL);
+					}
+					else if(std::abs(ih-veciCent[0])<=2 && std::abs(ik-veciCent[1])<=2
+						&& std::abs(il-veciCent[2])<=2)
 					{
-						if(bHasRefl || m_bShowAllPeaks)
-						{
-							RecipPeak *pPeak = new RecipPeak();
-							if(ih==0 && ik==0 && il==0)
-								pPeak->SetColor(bHasRefl ? colPeakOrigin : colPeakForbidden);
-							else
-								pPeak->SetColor(bHasRefl ? colPeakAllowed : colPeakForbidden);
-							
-							pPeak->setPos(dX * m_dScaleFactor, dY * m_dScaleFactor);
-							if(dF >= 0.) pPeak->SetRadius(dF);
-							pPeak->setData(TRIANGLE_NODE_TYPE_KEY, NODE_BRAGG);
-
-							std::ostringstream ostrLabel, ostrTip;
-							ostrLabel.precision(g_iPrecGfx);
-							ostrTip.precision(g_iPrec);
-
-							ostrLabel << "(" << ih << " " << ik << " " << il << ")";
-							ostrTip << "G = (" << ih << " " << ik << " " << il << ") rlu";
-
-							tl::set_eps_0(vecPeak, g_dEps);
-							ostrTip << "\nG = (" << vecPeak[0] << ", "
-								<< vecPeak[1] << ", "
-								<< vecPeak[2] << ") " << strAA;
-
-							if(dFsq > -1.)
-							{
-								if(g_bShowFsq)
-									ostrLabel << "\nS = " << dFsq;
-								else
-									ostrLabel << "\nF = " << dF;
-
-								ostrTip << "\nF = " << print_complex<t_real>(cF) << " fm";
-								ostrTip << "\nS = " << dFsq << " fm" << strSup2;
-							}
-							else if(!bHasRefl)
-							{
-								pPeak->SetPeakAllowed(0);
-								ostrTip << "\nStructurally forbidden reflection.";
-							}
-							
-
-							pPeak->SetLabel(ostrLabel.str().c_str());
-
-							//ostrTip << "\ndistance to plane: " << dDist << " " << strAA;
-							pPeak->setToolTip(QString::fromUtf8(ostrTip.str().c_str(), ostrTip.str().length()));
-
-							m_vecPeaks.push_back(pPeak);
-							m_scene.addItem(pPeak);
-						}
-
-
-						// add peaks for 2d approximation of 1st BZ
-						if(!g_b3dBZ && bHasGenRefl)
-						{
-							t_vec vecN = tl::make_vec({dX, dY});
-							if(ih==veciCent[0] && ik==veciCent[1] && il==veciCent[2])
-							{
-								m_bz.SetCentralReflex(vecN, &vecPeakHKL);
-							}
-							else if(std::abs(ih-veciCent[0])<=2 && std::abs(ik-veciCent[1])<=2
-								&& std::abs(il-veciCent[2])<=2)
-							{
-								m_bz.AddReflex(vecN, &vecPeakHKL);
-							}
-						}
+						bz.AddReflex(vecN, &vecPeakHKL);
 					}
 				}
-
-				if(bIsPowder)
-					powder.AddPeak(ih, ik, il, dF);
 			}
+		}
+
+		if(bIsPowder)
+			powder.AddPeak(ih, ik, il, dF);
+	}
 
 	// single crystal
+	std::shared_ptr<tl::Kd<t_real>> pKd = std::make_shared<tl::Kd<t_real>>();
 	if(!bIsPowder)
 	{
 		if(g_b3dBZ)
 		{
-			m_bz3.CalcBZ(get_max_threads());
+			bz3.CalcBZ(get_max_threads());
 
 			// ----------------------------------------------------------------
 			// calculate points of high symmetry
@@ -1205,70 +1425,61 @@ void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon
 
 			for(const t_vec& vecSymmDir : vecSymmDirs)
 			{
-				const t_vec vecSymmDirInvA = m_recip.GetPos(vecSymmDir[0], vecSymmDir[1], vecSymmDir[2]);
-				tl::Line<t_real> lineSymmDir(m_bz3.GetCentralReflex(), vecSymmDirInvA);
-				std::vector<t_vec> vecSymmIntersects = m_bz3.GetIntersection(lineSymmDir);
+				const t_vec vecSymmDirInvA = recip.GetPos(vecSymmDir[0], vecSymmDir[1], vecSymmDir[2]);
+				tl::Line<t_real> lineSymmDir(bz3.GetCentralReflex(), vecSymmDirInvA);
+				std::vector<t_vec> vecSymmIntersects = bz3.GetIntersection(lineSymmDir);
 				for(t_vec& vecSymmIntersect : vecSymmIntersects)
-					m_vecBZ3SymmPts.emplace_back(std::move(vecSymmIntersect));
+					pPeaks->vecBZ3SymmPts.emplace_back(std::move(vecSymmIntersect));
 			}
 			// ----------------------------------------------------------------
 
 			// ----------------------------------------------------------------
 			// calculate intersection with scattering plane
-			tl::Plane<t_real> planeBZ3 = tl::Plane<t_real>(m_bz3.GetCentralReflex(),
-				m_plane.GetNorm());
+			tl::Plane<t_real> planeBZ3 = tl::Plane<t_real>(bz3.GetCentralReflex(),
+				plane.GetNorm());
 
-			std::tie(std::ignore, m_vecBZ3VertsUnproj) = m_bz3.GetIntersection(planeBZ3);
+			std::tie(std::ignore, pPeaks->vecBZ3VertsUnproj) = bz3.GetIntersection(planeBZ3);
 
-			for(const t_vec& _vecBZ3Vert : m_vecBZ3VertsUnproj)
+			for(const t_vec& _vecBZ3Vert : pPeaks->vecBZ3VertsUnproj)
 			{
-				t_vec vecBZ3Vert = ublas::prod(m_matPlane_inv, _vecBZ3Vert - m_bz3.GetCentralReflex());
+				t_vec vecBZ3Vert = ublas::prod(matPlane_inv, _vecBZ3Vert - bz3.GetCentralReflex());
 				vecBZ3Vert.resize(2, true);
 				vecBZ3Vert[1] = -vecBZ3Vert[1];
 
-				m_vecBZ3Verts.push_back(vecBZ3Vert);
+				pPeaks->vecBZ3Verts.push_back(vecBZ3Vert);
 			}
 			// ----------------------------------------------------------------
 		}
 		else
 		{
-			m_bz.CalcBZ();
+			bz.CalcBZ();
 		}
 
-		m_kdLattice.Load(lstPeaksForKd, 3);
+		if(pbCancel && pbCancel->load())
+			return nullptr;
+		pKd->Load(lstPeaksForKd, 3);
 	}
+	pPeaks->pKd = pKd;
 
-	// single crystal peaks
 	if(dMaxF >= 0.)
 	{
-		bool bValidStructFacts = !tl::float_equal(dMinF, dMaxF, g_dEpsGfx);
-		for(RecipPeak *pPeak : m_vecPeaks)
-		{
-			if(bValidStructFacts)
-			{
-				t_real dFScale = (pPeak->GetRadius()-dMinF) / (dMaxF-dMinF);
-				pPeak->SetRadius(tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dFScale));
-			}
-			else
-			{
-				pPeak->SetRadius(DEF_PEAK_SIZE);
-			}
-		}
+		pPeaks->dMinF = dMinF;
+		pPeaks->dMaxF = dMaxF;
 	}
 
 	// powder lines
 	if(bIsPowder)
 	{
 		using t_line = typename decltype(powder)::t_peak;
-		m_vecPowderLines = powder.GetUniquePeaksSumF();
-		m_vecPowderLineWidths.reserve(m_vecPowderLines.size());
+		pPeaks->vecPowderLines = powder.GetUniquePeaksSumF();
+		pPeaks->vecPowderLineWidths.reserve(pPeaks->vecPowderLines.size());
 
 		t_real dMinFLine = 0.;
 		t_real dMaxFLine = 0.;
 
 		if(dMaxF >= 0.)
 		{
-			auto minmaxiters = std::minmax_element(m_vecPowderLines.begin(), m_vecPowderLines.end(),
+			auto minmaxiters = std::minmax_element(pPeaks->vecPowderLines.begin(), pPeaks->vecPowderLines.end(),
 				[](const t_line& line1, const t_line& line2) -> bool
 				{
 					return std::get<4>(line1) < std::get<4>(line2);
@@ -1278,17 +1489,98 @@ void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon
 		}
 
 		bool bValidStructFacts = !tl::float_equal(dMinFLine, dMaxFLine, g_dEpsGfx);
-		for(t_line& line : m_vecPowderLines)
+		for(const t_line& line : pPeaks->vecPowderLines)
 		{
 			if(bValidStructFacts)
 			{
 				t_real dFScale = (std::get<4>(line)-dMinFLine) / (dMaxFLine-dMinFLine);
-				m_vecPowderLineWidths.push_back(tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dFScale));
+				pPeaks->vecPowderLineWidths.push_back(tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dFScale));
+			}
+			else
+			{
+				pPeaks->vecPowderLineWidths.push_back(1.);
 			}
+		}
+	}
+
+	return pPeaks;
+}
+
+
+/**
+ * shows the reciprocal lattice calculated by CalcPeaksData
+ */
+void ScatteringTriangle::SetPeaks(const xtl::LatticeCommon<t_real>& recipcommon,
+	const std::shared_ptr<const RecipPeaksData>& pPeaks)
+{
+	ClearPeaks();
+	m_vecPowderLines.clear();
+	m_vecPowderLineWidths.clear();
+	m_pKdLattice = std::make_shared<tl::Kd<t_real>>();
+
+	m_lattice = recipcommon.lattice;
+	m_recip = recipcommon.recip;
+	m_plane = recipcommon.plane;
+	m_matPlane = recipcommon.matPlane;
+	m_matPlaneRlu = recipcommon.matPlaneRLU;
+	m_matPlane_inv = recipcommon.matPlane_inv;
+
+	if(pPeaks)
+	{
+		m_bz = pPeaks->bz;
+		m_bz3 = pPeaks->bz3;
+		m_vecBZ3VertsUnproj = pPeaks->vecBZ3VertsUnproj;
+		m_vecBZ3Verts = pPeaks->vecBZ3Verts;
+		m_vecBZ3SymmPts = pPeaks->vecBZ3SymmPts;
+		if(pPeaks->pKd)
+			m_pKdLattice = pPeaks->pKd;
+
+		m_vecPowderLines = pPeaks->vecPowderLines;
+		m_vecPowderLineWidths = pPeaks->vecPowderLineWidths;
+
+		static const QColor colPeakAllowed = Qt::red;
+		static const QColor colPeakForbidden(0xaa, 0xaa, 0xaa);
+		static const QColor colPeakOrigin = Qt::darkGreen;
+
+		const t_real dMinF = pPeaks->dMinF, dMaxF = pPeaks->dMaxF;
+		const bool bValidStructFacts = !tl::float_equal(dMinF, dMaxF, g_dEpsGfx);
+
+		m_vecPeaks.reserve(pPeaks->vecPeaks.size());
+		for(const RecipPeaksData::Peak& peak : pPeaks->vecPeaks)
+		{
+			if(!peak.bAllowed && !m_bShowAllPeaks)
+				continue;
+
+			RecipPeak *pPeak = new RecipPeak();
+			if(peak.h==0 && peak.k==0 && peak.l==0)
+				pPeak->SetColor(peak.bAllowed ? colPeakOrigin : colPeakForbidden);
 			else
+				pPeak->SetColor(peak.bAllowed ? colPeakAllowed : colPeakForbidden);
+
+			pPeak->setPos(peak.dX * m_dScaleFactor, peak.dY * m_dScaleFactor);
+			pPeak->setData(TRIANGLE_NODE_TYPE_KEY, NODE_BRAGG);
+			pPeak->SetPeakAllowed(peak.bAllowed);
+
+			// single crystal peaks
+			if(dMaxF >= 0.)
 			{
-				m_vecPowderLineWidths.push_back(1.);
+				if(bValidStructFacts)
+				{
+					t_real dRad = peak.dF >= 0. ? peak.dF : pPeak->GetRadius();
+					t_real dFScale = (dRad-dMinF) / (dMaxF-dMinF);
+					pPeak->SetRadius(tl::lerp(MIN_PEAK_SIZE, MAX_PEAK_SIZE, dFScale));
+				}
+				else
+				{
+					pPeak->SetRadius(DEF_PEAK_SIZE);
+				}
 			}
+
+			pPeak->SetLabel(peak.strLabel.c_str());
+			pPeak->setToolTip(QString::fromUtf8(peak.strTip.c_str(), peak.strTip.length()));
+
+			m_vecPeaks.push_back(pPeak);
+			m_scene.addItem(pPeak);
 		}
 	}
 
@@ -1297,6 +1589,13 @@ void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon
 }
 
 
+void ScatteringTriangle::CalcPeaks(const xtl::LatticeCommon<t_real>& recipcommon, bool bIsPowder)
+{
+	SetPeaks(recipcommon, CalcPeaksData(recipcommon, bIsPowder,
+		m_iMaxPeaks, m_dPlaneDistTolerance));
+}
+
+
 t_vec ScatteringTriangle::GetHKLFromPlanePos(t_real x, t_real y) const
 {
 	if(!HasPeaks())
@@ -1842,74 +2141,39 @@ void ScatteringTriangleScene::setSnapq(bool bSnap)
 
 #ifdef USE_GIL
 
-#include "tlibs/gfx/gil.h"
-namespace gil = boost::gil;
-
-bool ScatteringTriangleScene::ExportBZAccurate(const char* pcFile) const
+bool ScatteringTriangleScene::ExportBZAccurate(const char* pcFile, unsigned iW, unsigned iH) const
 {
-	if(!m_pTri) return false;
-
-	const int iW = 720;
-	const int iH = 720;
+	if(!m_pTri || !m_pTri->HasPeaks()) return false;
+	if(!iW || !iH) return false;
 
-	gil::rgb8_view_t view;
-	std::vector<gil::rgb8_pixel_t> vecPix;
-	tl::create_imgview(iW, iH, vecPix, view);
+	const NearestNodeRaster<t_real> raster(m_pTri->GetKdLattice(),
+		m_pTri->GetRecipLattice(), int(m_pTri->GetMaxPeaks()));
+	if(!raster.IsOk()) return false;
 
-	const int iMaxPeaks = m_pTri->GetMaxPeaks();
+	// the image covers the same part of the scene for all sizes
+	const t_real dStep = t_real(720) / t_real(std::max(iW, iH));
 	int iXMid = sceneRect().left() + (sceneRect().right()-sceneRect().left())/2;
 	int iYMid = sceneRect().top() + (sceneRect().bottom()-sceneRect().top())/2;
 
-	int _iY=0;
-	for(int iY=iYMid-iH/2; iY<iYMid+iH/2; ++iY, ++_iY)
-	{
-		auto iterRow = view.row_begin(_iY);
+	// the lattice positions are linear in the scene positions, see GetHKLFromPlanePos
+	const t_vec vecX = tl::get_column(m_pTri->GetPlane(), 0) / m_pTri->GetScaleFactor();
+	const t_vec vecY = tl::get_column(m_pTri->GetPlane(), 1) / m_pTri->GetScaleFactor();
+	const t_vec vecOrig = (t_real(iXMid) - t_real(iW/2)*dStep) * vecX
+		- (t_real(iYMid) - t_real(iH/2)*dStep) * vecY;
 
-		int _iX=0;
-		t_real dY = iY;
-		for(int iX=iXMid-iW/2; iX<iXMid+iW/2; ++iX, ++_iX)
-		{
-			t_real dX = iX;
-			t_vec vecHKL = m_pTri->GetHKLFromPlanePos(dX, -dY);
-			if(vecHKL.size()!=3) return false;
-			vecHKL /= m_pTri->GetScaleFactor();
-
-			const std::vector<t_real>* pvecNearest = nullptr;
-			const tl::Kd<t_real>& kd = m_pTri->GetKdLattice();
-			t_vec vecHKLinvA = m_pTri->GetRecipLattice().GetPos(vecHKL[0], vecHKL[1], vecHKL[2]);
-
-			if(kd.GetRootNode())
-			{
-				std::vector<t_real> stdvecHKL{vecHKLinvA[0], vecHKLinvA[1], vecHKLinvA[2]};
-				pvecNearest = &kd.GetNearestNode(stdvecHKL);
-			}
-
-			if(!pvecNearest) return false;
-			t_real dDist = ublas::norm_2(tl::make_vec({(*pvecNearest)[0], (*pvecNearest)[1], (*pvecNearest)[2]}) - vecHKLinvA);
-
-			bool bIsDirectBeam = 0;
-			if(tl::float_equal<t_real>((*pvecNearest)[3], 0.) && tl::float_equal<t_real>((*pvecNearest)[4], 0.) && tl::float_equal<t_real>((*pvecNearest)[5], 0.))
-				bIsDirectBeam = 1;
-
-			int iR = ((*pvecNearest)[3]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			int iG = ((*pvecNearest)[4]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			int iB = ((*pvecNearest)[5]+iMaxPeaks) * 255 / (iMaxPeaks*2);
-			t_real dBraggAmp = tl::gauss_model<t_real>(dDist, 0., 0.01, 255., 0.);
-			iR += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-			iG += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-			iB += bIsDirectBeam ? -(unsigned int)dBraggAmp : (unsigned int)dBraggAmp;
-
-			iR = tl::clamp(iR, 0, 255);
-			iG = tl::clamp(iG, 0, 255);
-			iB = tl::clamp(iB, 0, 255);
-
-			/*view(_iX, _iY) =*/ iterRow[_iX] = gil::rgb8_pixel_t((unsigned char)iR, (unsigned char)iG, (unsigned char)iB);
-		}
-
-		//tl::log_info("BZ export: Line ", _iY+1, " of ", iH);
+	// the rows are written as soon as their band is finished
+	PngRowWriter png(pcFile, iW, iH);
+	bool bOk = png.IsOk();
+	if(bOk)
+	{
+		bOk = raster.Render(iW, iH, vecOrig, dStep*vecX, -dStep*vecY,
+			[&png](const unsigned char* pRGB) -> bool { return png.WriteRow(pRGB); },
+			get_max_threads());
+		if(bOk)
+			bOk = png.Close();
 	}
 
-	if(!tl::save_view(pcFile, &view))
+	if(!bOk)
 	{
 		tl::log_err("Cannot write image \"", pcFile, "\".");
 		return false;
@@ -1919,7 +2183,7 @@ bool ScatteringTriangleScene::ExportBZAccurate(const char* pcFile) const
 }
 
 #else
-bool ScatteringTriangleScene::ExportBZAccurate(const char* pcFile) const { return 0; }
+bool ScatteringTriangleScene::ExportBZAccurate(const char*, unsigned, unsigned) const { return 0; }
 #endif
 
 
@@ -9,6 +9,7 @@
 #define __TAZ_SCATT_TRIAG_H__
 
 #include <memory>
+#include <atomic>
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QGraphicsItem>
@@ -104,6 +105,38 @@ class RecipPeak : public QGraphicsItem
 };
 
 
+/**
+ * reciprocal lattice calculated independently of the gui (see ScatteringTriangle::CalcPeaksData)
+ */
+struct RecipPeaksData
+{
+	using t_powderline = typename tl::Powder<int,t_real_glob>::t_peak;
+
+	struct Peak
+	{
+		int h = 0, k = 0, l = 0;
+		t_real_glob dX = 0., dY = 0.;	// position in the scattering plane in 1/A
+		t_real_glob dF = -1.;			// < 0: no structure factor
+		bool bAllowed = 1;				// not structurally forbidden
+		std::string strLabel, strTip;
+	};
+
+	// peaks in the scattering plane
+	std::vector<Peak> vecPeaks;
+	t_real_glob dMinF = -1., dMaxF = -1.;
+
+	std::shared_ptr<const tl::Kd<t_real_glob>> pKd;
+
+	tl::Brillouin2D<t_real_glob> bz;
+	tl::Brillouin3D<t_real_glob> bz3;
+	std::vector<ublas::vector<t_real_glob>> vecBZ3VertsUnproj, vecBZ3Verts;
+	std::vector<ublas::vector<t_real_glob>> vecBZ3SymmPts;
+
+	std::vector<t_powderline> vecPowderLines;
+	std::vector<t_real_glob> vecPowderLineWidths;
+};
+
+
 class ScatteringTriangleScene;
 class ScatteringTriangle : public QGraphicsItem
 {
@@ -130,7 +163,7 @@ class ScatteringTriangle : public QGraphicsItem
 
 		std::vector<t_powderline> m_vecPowderLines;
 		std::vector<t_real_glob> m_vecPowderLineWidths;
-		tl::Kd<t_real_glob> m_kdLattice;
+		std::shared_ptr<const tl::Kd<t_real_glob>> m_pKdLattice = std::make_shared<tl::Kd<t_real_glob>>();
 
 		bool m_bShowBZ = 1;
 		tl::Brillouin2D<t_real_glob> m_bz;
@@ -183,7 +216,15 @@ class ScatteringTriangle : public QGraphicsItem
 		void ClearPeaks();
 		void CalcPeaks(const xtl::LatticeCommon<t_real_glob>& recipcommon, bool bIsPowder=0);
 
+		static std::shared_ptr<const RecipPeaksData> CalcPeaksData(
+			const xtl::LatticeCommon<t_real_glob>& recipcommon, bool bIsPowder,
+			int iMaxPeaks, t_real_glob dPlaneDistTolerance,
+			const std::atomic<bool>* pbCancel=nullptr);
+		void SetPeaks(const xtl::LatticeCommon<t_real_glob>& recipcommon,
+			const std::shared_ptr<const RecipPeaksData>& pPeaks);
+
 		void SetPlaneDistTolerance(t_real_glob dTol) { m_dPlaneDistTolerance = dTol; }
+		t_real_glob GetPlaneDistTolerance() const { return m_dPlaneDistTolerance; }
 		void SetMaxPeaks(int iMax) { m_iMaxPeaks = iMax; }
 		unsigned int GetMaxPeaks() const { return m_iMaxPeaks; }
 		void SetZoom(t_real_glob dZoom);
@@ -196,7 +237,7 @@ class ScatteringTriangle : public QGraphicsItem
 		void SetEwaldSphereVisible(EwaldSphere iEw);
 
 		const std::vector<t_powderline>& GetPowder() const { return m_vecPowderLines; }
-		const tl::Kd<t_real_glob>& GetKdLattice() const { return m_kdLattice; }
+		const tl::Kd<t_real_glob>& GetKdLattice() const { return *m_pKdLattice; }
 
 		const tl::Brillouin3D<t_real_glob>& GetBZ3D() const { return m_bz3; }
 		const std::vector<ublas::vector<t_real_glob>>& GetBZ3DPlaneVerts() const { return m_vecBZ3VertsUnproj; }
@@ -272,7 +313,7 @@ class ScatteringTriangleScene : public QGraphicsScene
 
 		void CheckForSpurions();
 
-		bool ExportBZAccurate(const char* pcFile) const;
+		bool ExportBZAccurate(const char* pcFile, unsigned iW=720, unsigned iH=720) const;
 
 	public slots:
 		void tasChanged(const TriangleOptions& opts);
@@ -36,6 +36,7 @@ namespace fs = boost::filesystem;
 using t_real = t_real_glob;
 const std::string TazDlg::s_strTitle = "Takin";
 const t_real_glob TazDlg::s_dPlaneDistTolerance = std::cbrt(tl::get_epsilon<t_real_glob>());
+const int TazDlg::s_iCalcPeaksDelay = 150;	// ms
 
 //#define NO_HELP_ASSISTANT
 
@@ -260,15 +261,30 @@ TazDlg::TazDlg(QWidget* pParent, const std::string& strLogFile)
 	for(QLineEdit* pEdit : m_vecEdits_monoana)
 		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(UpdateDs()));
 
+	// lattice calculations run in the background, typing in the edits only restarts the timers
+	m_pCalcPeaksWorker.reset(new CoalescingWorker<CrystalCalc>([this](std::size_t iJob)
+	{
+		emit CalcPeaksDone(qulonglong(iJob));
+	}));
+	QObject::connect(this, SIGNAL(CalcPeaksDone(qulonglong)),
+		this, SLOT(PeaksCalculated(qulonglong)), Qt::QueuedConnection);
+
+	m_timerCalcPeaks.setSingleShot(1);
+	m_timerCalcPeaks.setInterval(s_iCalcPeaksDelay);
+	m_timerCalcPeaksRecip.setSingleShot(1);
+	m_timerCalcPeaksRecip.setInterval(s_iCalcPeaksDelay);
+	QObject::connect(&m_timerCalcPeaks, SIGNAL(timeout()), this, SLOT(CalcPeaks()));
+	QObject::connect(&m_timerCalcPeaksRecip, SIGNAL(timeout()), this, SLOT(CalcPeaksRecip()));
+
 	for(QLineEdit* pEdit : m_vecEdits_real)
 	{
 		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CheckCrystalType()));
-		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaks()));
+		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaksDeferred()));
 	}
 
 	for(QLineEdit* pEdit : m_vecEdits_plane)
 	{
-		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaks()));
+		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaksDeferred()));
 	}
 
 	//for(QDoubleSpinBox* pSpin : m_vecSpinBoxesSample)
@@ -277,7 +293,7 @@ TazDlg::TazDlg(QWidget* pParent, const std::string& strLogFile)
 	for(QLineEdit* pEdit : m_vecEdits_recip)
 	{
 		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CheckCrystalType()));
-		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaksRecip()));
+		QObject::connect(pEdit, SIGNAL(textEdited(const QString&)), this, SLOT(CalcPeaksRecipDeferred()));
 	}
 
 	QObject::connect(checkSenseM, SIGNAL(stateChanged(int)), this, SLOT(UpdateMonoSense()));
@@ -905,7 +921,7 @@ TazDlg::TazDlg(QWidget* pParent, const std::string& strLogFile)
 
 	m_bReady = 1;
 	UpdateDs();
-	CalcPeaks();
+	CalcPeaks(0);
 
 
 	m_sceneRecip.GetTriangle()->SetqVisible(bSmallqVisible);
@@ -924,6 +940,10 @@ TazDlg::TazDlg(QWidget* pParent, const std::string& strLogFile)
 TazDlg::~TazDlg()
 {
 	//log_debug("In ", __func__, ".");
+	m_timerCalcPeaks.stop();
+	m_timerCalcPeaksRecip.stop();
+	if(m_pCalcPeaksWorker) m_pCalcPeaksWorker->Stop();
+
 	Disconnect();
 	DeleteDialogs();
 
@@ -22,9 +22,11 @@
 #include <QSettings>
 #include <QVariant>
 #include <QSignalMapper>
+#include <QTimer>
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "ui/ui_taz.h"
 #include "scattering_triangle.h"
@@ -69,9 +71,31 @@
 #include "libs/spacegroups/latticehelper.h"
 #include "libs/globals.h"
 #include "libs/globals_qt.h"
+#include "libs/worker.h"
 #include "tlibs/phys/lattice.h"
 
 
+/**
+ * lattice calculations which are done in the background (see TazDlg::CalcPeaks)
+ */
+struct CrystalCalc
+{
+	// latticecommon refers to this copy of the atoms
+	std::vector<xtl::AtomPos<t_real_glob>> vecAtoms;
+	xtl::LatticeCommon<t_real_glob> latticecommon;
+	bool bOk = 0;
+	bool bPowder = 0;
+
+	std::shared_ptr<const RecipPeaksData> pRecip;
+	std::shared_ptr<const ProjLatticeData> pProj;
+	std::shared_ptr<const RealLatticeData> pReal;
+
+	CrystalCalc() = default;
+	CrystalCalc(const CrystalCalc&) = delete;
+	const CrystalCalc& operator=(const CrystalCalc&) = delete;
+};
+
+
 class TazDlg : public QMainWindow, Ui::TazDlg
 { Q_OBJECT
 	private:
@@ -109,6 +133,7 @@ class TazDlg : public QMainWindow, Ui::TazDlg
 
 	protected:
 		static const t_real_glob s_dPlaneDistTolerance;
+		static const int s_iCalcPeaksDelay;
 
 		bool m_bReady = false;
 		QSettings m_settings;
@@ -129,6 +154,11 @@ class TazDlg : public QMainWindow, Ui::TazDlg
 		QMenu *m_pMenuRecentImport = nullptr;
 		QMenu *m_pMenuRecentImportCIF = nullptr;
 
+		// background lattice calculations
+		std::unique_ptr<CoalescingWorker<CrystalCalc>> m_pCalcPeaksWorker;
+		std::shared_ptr<const CrystalCalc> m_pCrystalCalc;
+		QTimer m_timerCalcPeaks, m_timerCalcPeaksRecip;
+
 		// reciprocal lattice
 		xtl::LatticeCommon<t_real_glob> m_latticecommon;
 		ScatteringTriangleView *m_pviewRecip = nullptr;
@@ -223,9 +253,14 @@ class TazDlg : public QMainWindow, Ui::TazDlg
 		void ExportSceneSVG(QGraphicsScene& scene);
 		void emitSampleParams();
 
+		void SetCrystalCalc(const std::shared_ptr<const CrystalCalc>& pCalc);
+
 	protected slots:
-		void CalcPeaks();
+		void CalcPeaks(bool bAsync=1);
 		void CalcPeaksRecip();
+		void CalcPeaksDeferred();
+		void CalcPeaksRecipDeferred();
+		void PeaksCalculated(qulonglong iJob);
 		void UpdateDs();
 
 		void SetCrystalType();
@@ -341,6 +376,7 @@ class TazDlg : public QMainWindow, Ui::TazDlg
 	signals:
 		void ResoParamsChanged(const ResoParams& resoparams);
 		void SampleParamsChanged(const SampleParams& parms);
+		void CalcPeaksDone(qulonglong iJob);
 };
 
 #endif
@@ -89,6 +89,7 @@ void TazDlg::CheckCrystalType()
 
 void TazDlg::CalcPeaksRecip()
 {
+	m_timerCalcPeaksRecip.stop();
 	if(!m_bReady) return;
 
 	try
@@ -121,10 +122,152 @@ void TazDlg::CalcPeaksRecip()
 	}
 }
 
-void TazDlg::CalcPeaks()
+/**
+ * parameters of the lattice calculations in the background
+ */
+struct CrystalCalcParams
+{
+	tl::Lattice<t_real> lattice, recip;
+	tl::Plane<t_real> planeRLU, planeRealFrac;
+	const xtl::SpaceGroup<t_real>* pSpaceGroup = nullptr;
+	std::vector<xtl::AtomPos<t_real>> vecAtoms;
+	bool bPowder = 0;
+
+	int iMaxPeaksRecip = 0, iMaxPeaksProj = 0, iMaxPeaksReal = 0;
+	t_real dPlaneDistTolRecip = 0., dPlaneDistTolReal = 0.;
+	LatticeProj projProj = LatticeProj::STEREOGRAPHIC;
+	t_real dScaleProj = 1.;
+};
+
+
+/**
+ * lattice calculations which don't need the gui
+ * @return nullptr if cancelled
+ */
+static std::shared_ptr<const CrystalCalc> calc_crystal(const CrystalCalcParams& params,
+	const std::atomic<bool>* pbCancel=nullptr)
+{
+	std::shared_ptr<CrystalCalc> pCalc = std::make_shared<CrystalCalc>();
+	pCalc->vecAtoms = params.vecAtoms;
+	pCalc->bPowder = params.bPowder;
+
+	pCalc->bOk = pCalc->latticecommon.Calc(params.lattice, params.recip,
+		params.planeRLU, params.planeRealFrac, params.pSpaceGroup, &pCalc->vecAtoms);
+	if(!pCalc->bOk)
+		return pCalc;
+
+	const xtl::LatticeCommon<t_real>& latticecommon = pCalc->latticecommon;
+
+	pCalc->pRecip = ScatteringTriangle::CalcPeaksData(latticecommon, params.bPowder,
+		params.iMaxPeaksRecip, params.dPlaneDistTolRecip, pbCancel);
+	if(!pCalc->pRecip)
+		return nullptr;
+
+	pCalc->pProj = ProjLattice::CalcPeaksData(latticecommon, true,
+		params.iMaxPeaksProj, params.projProj, params.dScaleProj, pbCancel);
+	if(!pCalc->pProj)
+		return nullptr;
+
+	pCalc->pReal = RealLattice::CalcPeaksData(latticecommon,
+		params.iMaxPeaksReal, params.dPlaneDistTolReal, pbCancel);
+	if(!pCalc->pReal)
+		return nullptr;
+
+	return pCalc;
+}
+
+
+/**
+ * restarts the timer for the lattice calculation, so that it only runs after the last keystroke
+ */
+void TazDlg::CalcPeaksDeferred()
+{
+	m_timerCalcPeaks.start();
+}
+
+void TazDlg::CalcPeaksRecipDeferred()
+{
+	m_timerCalcPeaksRecip.start();
+}
+
+
+/**
+ * the worker has finished a lattice calculation
+ */
+void TazDlg::PeaksCalculated(qulonglong iJob)
+{
+	if(!m_pCalcPeaksWorker)
+		return;
+
+	// nullptr if superseded by a newer calculation
+	std::shared_ptr<const CrystalCalc> pCalc = m_pCalcPeaksWorker->TakeResult(std::size_t(iJob));
+	if(pCalc)
+		SetCrystalCalc(pCalc);
+}
+
+
+/**
+ * shows the results of a lattice calculation
+ */
+void TazDlg::SetCrystalCalc(const std::shared_ptr<const CrystalCalc>& pCalc)
+{
+	try
+	{
+		// also keeps the atoms referenced by m_latticecommon
+		m_pCrystalCalc = pCalc;
+		m_latticecommon = pCalc->latticecommon;
+
+		if(pCalc->bOk)
+		{
+			m_sceneRecip.GetTriangle()->SetPeaks(m_latticecommon, pCalc->pRecip);
+			if(m_sceneRecip.getSnapq())
+				m_sceneRecip.GetTriangle()->SnapToNearestPeak(m_sceneRecip.GetTriangle()->GetNodeGq());
+			m_sceneRecip.emitUpdate();
+
+			m_sceneProjRecip.GetLattice()->SetPeaks(m_latticecommon, true, pCalc->pProj);
+			m_sceneRealLattice.GetLattice()->SetPeaks(m_latticecommon, pCalc->pReal);
+
+#ifndef NO_3D
+			if(m_pRecip3d)
+				m_pRecip3d->CalcPeaks(m_latticecommon);
+			if(m_pReal3d)
+				m_pReal3d->CalcPeaks(m_sceneRealLattice.GetLattice()->GetWS3D(),
+					m_latticecommon);
+			if(m_pBZ3d)
+				m_pBZ3d->RenderBZ(m_sceneRecip.GetTriangle()->GetBZ3D(),
+					m_latticecommon,
+					&m_sceneRecip.GetTriangle()->GetBZ3DPlaneVerts(),
+					&m_sceneRecip.GetTriangle()->GetBZ3DSymmVerts());
+#endif
+		}
+		else
+		{
+			tl::log_err("Lattice calculations failed.");
+		}
+
+		m_dlgRealParam.CrystalChanged(m_latticecommon);
+	}
+	catch(const std::exception& ex)
+	{
+		m_sceneRecip.GetTriangle()->ClearPeaks();
+		tl::log_err(ex.what());
+	}
+}
+
+
+/**
+ * updates the crystal edits and starts the lattice calculation,
+ * which runs in the background if bAsync is set
+ */
+void TazDlg::CalcPeaks(bool bAsync)
 {
+	// a direct call supersedes the deferred one
+	m_timerCalcPeaks.stop();
+
 	if(!m_bReady || !m_sceneRecip.GetTriangle() || !m_sceneRealLattice.GetLattice())
 		return;
+	if(!m_pCalcPeaksWorker)
+		bAsync = 0;
 
 	try
 	{
@@ -295,36 +438,38 @@ void TazDlg::CalcPeaks()
 		editCrystalSystem->setText(strCryTy.c_str());
 
 
-		m_latticecommon = xtl::LatticeCommon<t_real_glob>();
-		if(m_latticecommon.Calc(lattice, recip, planeRLU, planeRealFrac, pSpaceGroup, &m_vecAtoms))
+		CrystalCalcParams params;
+		params.lattice = lattice;
+		params.recip = recip;
+		params.planeRLU = planeRLU;
+		params.planeRealFrac = planeRealFrac;
+		params.pSpaceGroup = pSpaceGroup;
+		params.vecAtoms = m_vecAtoms;
+		params.bPowder = bPowder;
+
+		params.iMaxPeaksRecip = m_sceneRecip.GetTriangle()->GetMaxPeaks();
+		params.dPlaneDistTolRecip = m_sceneRecip.GetTriangle()->GetPlaneDistTolerance();
+		params.iMaxPeaksProj = m_sceneProjRecip.GetLattice()->GetMaxPeaks();
+		params.projProj = m_sceneProjRecip.GetLattice()->GetProjection();
+		params.dScaleProj = m_sceneProjRecip.GetLattice()->GetScaleFactor();
+		params.iMaxPeaksReal = m_sceneRealLattice.GetLattice()->GetMaxPeaks();
+		params.dPlaneDistTolReal = m_sceneRealLattice.GetLattice()->GetPlaneDistTolerance();
+
+		if(bAsync)
 		{
-			m_sceneRecip.GetTriangle()->CalcPeaks(m_latticecommon, bPowder);
-			if(m_sceneRecip.getSnapq())
-				m_sceneRecip.GetTriangle()->SnapToNearestPeak(m_sceneRecip.GetTriangle()->GetNodeGq());
-			m_sceneRecip.emitUpdate();
-
-			m_sceneProjRecip.GetLattice()->CalcPeaks(m_latticecommon, true);
-			m_sceneRealLattice.GetLattice()->CalcPeaks(m_latticecommon);
-
-#ifndef NO_3D
-			if(m_pRecip3d)
-				m_pRecip3d->CalcPeaks(m_latticecommon);
-			if(m_pReal3d)
-				m_pReal3d->CalcPeaks(m_sceneRealLattice.GetLattice()->GetWS3D(),
-					m_latticecommon);
-			if(m_pBZ3d)
-				m_pBZ3d->RenderBZ(m_sceneRecip.GetTriangle()->GetBZ3D(),
-					m_latticecommon,
-					&m_sceneRecip.GetTriangle()->GetBZ3DPlaneVerts(),
-					&m_sceneRecip.GetTriangle()->GetBZ3DSymmVerts());
-#endif
+			// drops the results of all earlier requests
+			m_pCalcPeaksWorker->Submit([params](const std::atomic<bool>& bCancel)
+				-> std::shared_ptr<const CrystalCalc>
+			{
+				return calc_crystal(params, &bCancel);
+			});
 		}
 		else
 		{
-			tl::log_err("Lattice calculations failed.");
+			if(m_pCalcPeaksWorker)
+				m_pCalcPeaksWorker->Cancel();
+			SetCrystalCalc(calc_crystal(params));
 		}
-
-		m_dlgRealParam.CrystalChanged(m_latticecommon);
 	}
 	catch(const std::exception& ex)
 	{
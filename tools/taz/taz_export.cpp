@@ -15,6 +15,7 @@
 
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QtSvg/QSvgGenerator>
 
 
@@ -240,8 +241,15 @@ void TazDlg::ExportBZImage()
 	if(!strFile.endsWith(".png", Qt::CaseInsensitive))
 		strFile += ".png";
 
+	// the same part of the plane is rendered for every image size
+	bool bSizeOk = 0;
+	int iSize = QInputDialog::getInt(this, "Image Size", "Width and height of the image in pixels:",
+		m_settings.value("main/bz_image_size", 720).toInt(), 16, 16384, 1, &bSizeOk);
+	if(!bSizeOk)
+		return;
+	m_settings.setValue("main/bz_image_size", iSize);
 
-	bool bOk = m_sceneRecip.ExportBZAccurate(strFile.toStdString().c_str());
+	bool bOk = m_sceneRecip.ExportBZAccurate(strFile.toStdString().c_str(), unsigned(iSize), unsigned(iSize));
 	if(!bOk)
 		QMessageBox::critical(this, "Error", "Could not export image.");
 
@@ -266,7 +274,15 @@ void TazDlg::ExportWSImage()
 	if(!strFile.endsWith(".png", Qt::CaseInsensitive))
 		strFile += ".png";
 
-	bool bOk = m_sceneRealLattice.ExportWSAccurate(strFile.toStdString().c_str());
+	// the same part of the plane is rendered for every image size
+	bool bSizeOk = 0;
+	int iSize = QInputDialog::getInt(this, "Image Size", "Width and height of the image in pixels:",
+		m_settings.value("main/ws_image_size", 720).toInt(), 16, 16384, 1, &bSizeOk);
+	if(!bSizeOk)
+		return;
+	m_settings.setValue("main/ws_image_size", iSize);
+
+	bool bOk = m_sceneRealLattice.ExportWSAccurate(strFile.toStdString().c_str(), unsigned(iSize), unsigned(iSize));
 	if(!bOk)
 		QMessageBox::critical(this, "Error", "Could not export image.");
 
@@ -407,7 +407,7 @@ bool TazDlg::Load(const char* pcFile)
 	m_sceneRecip.GetTriangle()->SetReady(true);
 	m_sceneRecip.SetEmitChanges(true);
 
-	CalcPeaks();
+	CalcPeaks(0);
 	m_sceneRecip.emitUpdate();
 
 	if(m_pReso)
@@ -783,7 +783,7 @@ bool TazDlg::Import(const char* pcFile)
 		recent.SaveList();
 		recent.FillMenu(m_pMenuRecentImport, m_pMapperRecentImport);
 
-		CalcPeaks();
+		CalcPeaks(0);
 
 		if(iScanNum && m_pGotoDlg)
 		{
@@ -1006,7 +1006,7 @@ bool TazDlg::ImportCIF(const char* pcFile)
 		recent.SaveList();
 		recent.FillMenu(m_pMenuRecentImportCIF, m_pMapperRecentImportCIF);
 
-		CalcPeaks();
+		CalcPeaks(0);
 	}
 	catch(const std::exception& ex)
 	{
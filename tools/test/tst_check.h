@@ -0,0 +1,30 @@
+/**
+ * checks shared by the self-checking tests
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ */
+
+#ifndef __TST_CHECK_H__
+#define __TST_CHECK_H__
+
+#include <iostream>
+
+
+static int g_iErrs = 0;
+
+static inline void check(bool bOk, const char* pcWhat)
+{
+	std::cout << (bOk ? "OK:   " : "FAIL: ") << pcWhat << std::endl;
+	if(!bOk) ++g_iErrs;
+}
+
+/**
+ * prints the overall result, returns the exit code of the test
+ */
+static inline int check_result()
+{
+	std::cout << (g_iErrs ? "FAILED" : "PASSED") << std::endl;
+	return g_iErrs ? -1 : 0;
+}
+
+#endif
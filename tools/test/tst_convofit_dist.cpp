@@ -0,0 +1,130 @@
+/**
+ * distributed convofit: coordinator and several workers on localhost,
+ * including a lost and a hung worker, a silent client and a client with a wrong token
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../.. -o tst_convofit_dist tst_convofit_dist.cpp ../convofit/convofit_dist.cpp ../../tlibs/log/log.cpp -lboost_filesystem -lboost_system -lpthread
+ */
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "../convofit/convofit_dist.h"
+#include "tst_check.h"
+
+namespace asio = boost::asio;
+namespace fs = boost::filesystem;
+using asio::ip::tcp;
+
+
+/**
+ * dummy job: writes <job>.out, the first job takes longer than the coordinator's timeout
+ */
+static bool run_job(const std::string& strJob, std::vector<std::string>& vecOutFiles)
+{
+	static std::atomic<int> s_iCalls{0};
+	const int iDelayMs = (s_iCalls++ == 0) ? 2500 : 200;
+	std::this_thread::sleep_for(std::chrono::milliseconds(iDelayMs));
+
+	const std::string strOut = strJob + ".out";
+	std::ofstream(strOut) << "result of " << strJob << "\n";
+	vecOutFiles.push_back(strOut);
+	return true;
+}
+
+
+/**
+ * connects to the coordinator and returns the first command it sends,
+ * then keeps the connection open for iHoldMs without answering
+ */
+static std::string raw_client(const std::string& strPort, const std::string& strHello, unsigned int iHoldMs)
+{
+	tcp::iostream stream("127.0.0.1", strPort);
+	if(strHello != "")
+		stream << strHello << "\n" << std::flush;
+
+	std::string strCmd;
+	stream >> strCmd;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(iHoldMs));
+	return strCmd;
+}
+
+
+int main()
+{
+	const std::size_t iNumJobs = 8;
+	const std::string strPort = std::to_string(20000 + getpid() % 20000);
+
+	const fs::path pathDir = fs::temp_directory_path() / fs::unique_path("tst_convofit_dist_%%%%%%");
+	fs::create_directories(pathDir);
+
+	std::vector<std::string> vecJobs;
+	for(std::size_t iJob=0; iJob<iNumJobs; ++iJob)
+	{
+		vecJobs.push_back((pathDir / ("job" + std::to_string(iJob))).string());
+		std::ofstream(vecJobs.back()) << "; dummy job\n";
+	}
+
+	ConvofitDistOpts opts;
+	opts.strToken = "secret";
+	opts.iMaxRetries = 2;
+	opts.iTimeoutMs = 1000;
+	opts.iHeartbeatMs = 200;
+
+	std::size_t iNumFailed = iNumJobs;
+	std::thread thCoord([&]() { iNumFailed = run_coordinator(vecJobs, std::stoi(strPort), opts); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	// a worker which gets a job and is lost, the job has to be re-queued
+	check(raw_client(strPort, "HELLO secret lost", 0) == "JOB", "lost worker gets a job");
+
+	// a worker which gets a job and does not answer anymore, the job has to be re-queued after the timeout
+	std::string strHung;
+	std::thread thHung([&]() { strHung = raw_client(strPort, "HELLO secret hung", 3*opts.iTimeoutMs); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+	// clients which must not get a job
+	std::string strWrongToken, strSilent;
+	std::thread thWrongToken([&]() { strWrongToken = raw_client(strPort, "HELLO wrong intruder", 0); });
+	std::thread thSilent([&]() { strSilent = raw_client(strPort, "", 0); });
+
+	std::vector<std::thread> vecWorkers;
+	std::atomic<int> iWorkersOk{0};
+	for(int iWorker=0; iWorker<3; ++iWorker)
+		vecWorkers.emplace_back([&]()
+		{
+			if(run_worker("127.0.0.1", strPort, run_job, opts))
+				++iWorkersOk;
+		});
+
+	thHung.join();
+	thWrongToken.join();
+	thSilent.join();
+	for(std::thread& th : vecWorkers)
+		th.join();
+	thCoord.join();
+
+	check(strHung == "JOB", "hung worker gets a job");
+	check(strWrongToken == "", "client with wrong token rejected");
+	check(strSilent == "", "silent client dropped");
+	check(iWorkersOk == 3, "workers finished");
+	check(iNumFailed == 0, "all jobs successful");
+
+	std::size_t iNumResults = 0;
+	for(const std::string& strJob : vecJobs)
+		if(fs::exists(strJob + ".out"))
+			++iNumResults;
+	check(iNumResults == iNumJobs, "all result files written");
+
+	fs::remove_all(pathDir);
+
+	return check_result();
+}
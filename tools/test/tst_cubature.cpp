@@ -0,0 +1,142 @@
+/**
+ * accuracy of the sparse-grid gauss-hermite cubature compared to mc sampling,
+ * a smooth function has to converge to the mc reference, a sharp one has to be rejected
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -o tst_cubature tst_cubature.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lpthread
+ */
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include "../res/cubature.h"
+#include "tst_check.h"
+
+using t_real = double;
+
+
+// same settings as the defaults in TASReso
+#define CUB_MAX_LEVEL	5
+#define CUB_TOL		1e-3
+
+// number of mc samples for the reference values
+#define MC_REF_SAMPLES	(1<<20)
+
+
+// smooth test function: gaussian in the first dimension times a cosine in the fourth
+static t_real func_smooth(const t_real *z)
+{
+	return std::exp(-t_real(0.5)*(z[0]-0.3)*(z[0]-0.3)) * std::cos(t_real(0.5)*z[3]);
+}
+
+// sharp test function: normalised gaussian of width 1e-3 in the first dimension,
+// lying between the cubature nodes; its expectation value is the normal pdf at 0.37
+static t_real func_sharp(const t_real *z)
+{
+	const t_real dSig = 1e-3;
+	return std::exp(-t_real(0.5)*(z[0]-0.37)*(z[0]-0.37)/(dSig*dSig)) / (dSig*std::sqrt(2.*M_PI));
+}
+
+
+/**
+ * cubature with rising levels as in convo_cubature
+ */
+static CubatureCheck cubature(t_real (*pFunc)(const t_real*), t_real& dS)
+{
+	t_real dSLast = 0., dSAbsLast = 0.;
+
+	for(unsigned int iLevel=2; iLevel<=CUB_MAX_LEVEL; ++iLevel)
+	{
+		const Cubature4d<t_real> cub = sparse_gauss_hermite_4d<t_real>(iLevel);
+
+		t_real dSLevel = 0., dSAbsLevel = 0.;
+		for(std::size_t iNode=0; iNode<cub.size(); ++iNode)
+		{
+			const t_real z[4] = { cub.z[0][iNode], cub.z[1][iNode], cub.z[2][iNode], cub.z[3][iNode] };
+			dSLevel += cub.w[iNode] * pFunc(z);
+			dSAbsLevel += std::abs(cub.w[iNode] * pFunc(z));
+		}
+
+		const CubatureCheck check = (iLevel > 2)
+			? cubature_check_levels<t_real>(dSLevel, dSAbsLevel, dSLast, dSAbsLast, CUB_TOL)
+			: CubatureCheck::REFINE;
+
+		std::cout << "level " << iLevel << ", " << cub.size() << " nodes: " << dSLevel << std::endl;
+		if(check != CubatureCheck::REFINE)
+		{
+			dS = dSLevel;
+			return check;
+		}
+
+		dSLast = dSLevel;
+		dSAbsLast = dSAbsLevel;
+	}
+
+	return CubatureCheck::REFINE;
+}
+
+
+/**
+ * mc reference value and its standard error
+ */
+static t_real mc(t_real (*pFunc)(const t_real*), t_real& dErr)
+{
+	McRandStream rng(1234);
+	t_real dZ[4][MC_NEUTR_BLOCK];
+	t_real dSum = 0., dSum2 = 0.;
+
+	for(std::size_t iStart=0; iStart<MC_REF_SAMPLES; iStart+=MC_NEUTR_BLOCK)
+	{
+		const std::size_t iBlock = std::min<std::size_t>(MC_NEUTR_BLOCK, MC_REF_SAMPLES-iStart);
+		mc_rand_norm_block<t_real>(rng, iStart, iBlock, dZ);
+		for(std::size_t i=0; i<iBlock; ++i)
+		{
+			const t_real z[4] = { dZ[0][i], dZ[1][i], dZ[2][i], dZ[3][i] };
+			const t_real dVal = pFunc(z);
+			dSum += dVal;
+			dSum2 += dVal*dVal;
+		}
+	}
+
+	const t_real dN = t_real(MC_REF_SAMPLES);
+	const t_real dMean = dSum / dN;
+	dErr = std::sqrt(std::max(t_real(0), dSum2/dN - dMean*dMean) / dN);
+	return dMean;
+}
+
+
+int main()
+{
+	// smooth function
+	{
+		const t_real dExact = std::sqrt(0.5) * std::exp(-0.09/4.) * std::exp(-0.125);
+
+		t_real dErrMC = 0.;
+		const t_real dMC = mc(func_smooth, dErrMC);
+		std::cout << "smooth: exact " << dExact << ", mc " << dMC << " +- " << dErrMC << std::endl;
+		check(std::abs(dMC - dExact) <= 4.*dErrMC, "smooth: mc reference");
+
+		t_real dCub = 0.;
+		check(cubature(func_smooth, dCub) == CubatureCheck::CONVERGED, "smooth: cubature converged");
+		check(std::abs(dCub - dMC) <= 4.*dErrMC + CUB_TOL*std::abs(dMC), "smooth: cubature agrees with mc");
+	}
+
+	// sharp function, the nodes miss the peak
+	{
+		const t_real dExact = std::exp(-0.5*0.37*0.37) / std::sqrt(2.*M_PI);
+
+		t_real dErrMC = 0.;
+		const t_real dMC = mc(func_sharp, dErrMC);
+		std::cout << "sharp: exact " << dExact << ", mc " << dMC << " +- " << dErrMC << std::endl;
+		check(std::abs(dMC - dExact) <= 4.*dErrMC, "sharp: mc reference");
+
+		t_real dCub = 0.;
+		const CubatureCheck cubcheck = cubature(func_sharp, dCub);
+		check(cubcheck != CubatureCheck::CONVERGED || std::abs(dCub - dMC) <= 4.*dErrMC,
+			"sharp: cubature does not converge to a wrong value");
+		check(cubcheck == CubatureCheck::FAILED, "sharp: cubature rejected");
+	}
+
+	return check_result();
+}
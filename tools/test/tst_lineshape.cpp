@@ -0,0 +1,53 @@
+/**
+ * energy average of the dho line shape over a gaussian compared to a numerical integration
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -o tst_lineshape tst_lineshape.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lpthread
+ */
+
+#include <iostream>
+#include <cmath>
+#include "../monteconvo/lineshape.h"
+
+using t_real = double;
+
+
+// midpoint rule over +-20 sigma and +-400 meV for the lorentzian tails
+static t_real dho_gauss_num(t_real dE, t_real dSig, t_real dE0, t_real dHWHM, t_real dT)
+{
+	const t_real dStep = t_real(1e-3) * std::min(dSig, dHWHM);
+	t_real dSum = 0.;
+
+	for(t_real dECur=dE-t_real(400); dECur<dE+t_real(400); dECur+=dStep)
+	{
+		const t_real dX = dECur + t_real(0.5)*dStep;
+		const t_real dGauss = std::exp(-t_real(0.5)*(dX-dE)*(dX-dE)/(dSig*dSig))
+			/ (std::sqrt(t_real(2)*tl::get_pi<t_real>()) * dSig);
+		dSum += dGauss * tl::DHO_model<t_real>(dX, dT, dE0, dHWHM, t_real(1), t_real(0)) * dStep;
+	}
+
+	return dSum;
+}
+
+
+int main()
+{
+	const t_real dSig = 0.3, dE0 = 3.;
+
+	for(t_real dT : { 2., 20., 300. })
+	for(t_real dHWHM : { 0.02, 0.4 })
+	for(t_real dE : { -3., 0., 1.5, 2.8, 3. })
+	{
+		t_real dS = 0.;
+		if(!dho_gauss_E<t_real>(dE, dSig, dE0, dHWHM, dT, t_real(1), dS))
+			continue;
+		const t_real dSNum = dho_gauss_num(dE, dSig, dE0, dHWHM, dT);
+
+		std::cout << "T = " << dT << " K, HWHM = " << dHWHM << " meV, E = " << dE << " meV: "
+			<< "S = " << dS << ", numerical: " << dSNum << ", "
+			<< "relative error: " << std::abs(dS-dSNum)/dSNum << "." << std::endl;
+	}
+
+	return 0;
+}
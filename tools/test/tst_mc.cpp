@@ -0,0 +1,123 @@
+/**
+ * benchmark of the mc neutron generation
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++14 -O2 -march=native -I../../ -I../.. -o tst_mc tst_mc.cpp ../monteconvo/TASReso.cpp ../res/cn.cpp ../res/pop.cpp ../res/eck.cpp ../res/viol.cpp ../res/r0.cpp ../res/simple.cpp ../res/refl_curve.cpp ../../libs/globals.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lboost_system -lboost_filesystem -lboost_iostreams -lpthread
+ */
+
+#include <iostream>
+#include <vector>
+#include "../monteconvo/TASReso.h"
+#include "tlibs/time/stopwatch.h"
+#include "tlibs/math/rand.h"
+
+using t_real = t_real_reso;
+using t_vec = ublas::vector<t_real>;
+using t_mat = ublas::matrix<t_real>;
+
+
+// previous implementation: one rand_norm_nd and up to three dynamic products per neutron
+static void mc_neutrons_ref(const Ellipsoid4d<t_real>& ell4d, std::size_t iNum,
+	const McNeutronOpts<t_mat>& opts, std::vector<t_vec>& vecResult)
+{
+	t_vec vecTrans = tl::make_vec<t_vec>({ell4d.x_offs, ell4d.y_offs, ell4d.z_offs, ell4d.w_offs});
+	t_mat matQVec0 = tl::rotation_matrix_2d(-opts.dAngleQVec0);
+	tl::resize_unity(matQVec0, 4);
+	t_mat matUBinvQVec0 = ublas::prod(opts.matUBinv, matQVec0);
+
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		t_vec vecMC = tl::make_vec<t_vec, std::vector>(
+			tl::rand_norm_nd<t_real, std::vector>({0.,0.,0.,0.},
+				{ ell4d.x_hwhm*tl::get_HWHM2SIGMA<t_real>(), ell4d.y_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+				ell4d.z_hwhm*tl::get_HWHM2SIGMA<t_real>(), ell4d.w_hwhm*tl::get_HWHM2SIGMA<t_real>() }));
+
+		vecMC = ublas::prod(ell4d.rot, vecMC);
+		vecMC += vecTrans;
+		vecMC = ublas::prod(matUBinvQVec0, vecMC);
+		vecResult[iCur] = std::move(vecMC);
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <reso file> <crystal file> [neutrons]" << std::endl;
+		return -1;
+	}
+
+	const std::size_t iNum = argc > 3 ? std::stoul(argv[3]) : 1000000;
+	tl::init_rand();
+
+	TASReso reso;
+	if(!reso.LoadRes(argv[1]) || !reso.LoadLattice(argv[2]))
+		return -1;
+
+	const std::pair<ResoAlgo, const char*> algos[] =
+	{
+		{ ResoAlgo::CN, "CN" },
+		{ ResoAlgo::POP, "Pop" },
+		{ ResoAlgo::ECK, "Eck" },
+	};
+
+	for(const auto& algo : algos)
+	{
+		reso.SetAlgo(algo.first);
+		if(!reso.SetHKLE(1., 0., 0., 0.))
+			continue;
+
+		const ResoResults& res = reso.GetResoResults();
+		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(res.reso, res.reso_v, res.reso_s, res.Q_avg);
+
+		std::vector<t_vec> vecRef(iNum);
+		tl::Stopwatch<t_real> watchRef;
+		watchRef.start();
+		mc_neutrons_ref(ell4d, iNum, reso.GetMCOpts(), vecRef);
+		watchRef.stop();
+
+		McNeutrons<t_real> neutrons;
+		neutrons.resize(iNum);
+		tl::Stopwatch<t_real> watchNew;
+		watchNew.start();
+		mc_neutrons<t_vec>(ell4d, iNum, reso.GetMCOpts(), neutrons);
+		watchNew.stop();
+
+		// random stream, generated in one piece and split into uneven parts
+		const McRandStream rng = McRandStream(1234).Sub(0);
+		McNeutrons<t_real> neutronsStream, neutronsSplit;
+		neutronsStream.resize(iNum);
+		neutronsSplit.resize(iNum);
+		tl::Stopwatch<t_real> watchStream;
+		watchStream.start();
+		mc_neutrons<t_vec>(ell4d, iNum, reso.GetMCOpts(), neutronsStream, 0, &rng, 0);
+		watchStream.stop();
+
+		for(std::size_t iFirst=0, iPart=1; iFirst<iNum; iFirst+=iPart, iPart=iPart*3+7)
+		{
+			const std::size_t iLen = std::min(iPart, iNum-iFirst);
+			mc_neutrons<t_vec>(ell4d, iLen, reso.GetMCOpts(), neutronsSplit, iFirst, &rng, iFirst);
+		}
+		const bool bSame = (neutronsStream.h == neutronsSplit.h && neutronsStream.k == neutronsSplit.k
+			&& neutronsStream.l == neutronsSplit.l && neutronsStream.E == neutronsSplit.E);
+
+		// quasi-random neutrons
+		McNeutronOpts<t_mat> optsSobol = reso.GetMCOpts();
+		optsSobol.sampling = McNeutronSampling::SOBOL;
+		tl::Stopwatch<t_real> watchSobol;
+		watchSobol.start();
+		mc_neutrons<t_vec>(ell4d, iNum, optsSobol, neutronsSplit, 0, &rng, 0);
+		watchSobol.stop();
+
+		std::cout << algo.second << ": "
+			<< t_real(iNum)/watchRef.GetDur() << " neutrons/s (before), "
+			<< t_real(iNum)/watchNew.GetDur() << " neutrons/s (after), "
+			<< t_real(iNum)/watchStream.GetDur() << " neutrons/s (stream), "
+			<< t_real(iNum)/watchSobol.GetDur() << " neutrons/s (sobol), "
+			<< "split stream " << (bSame ? "identical" : "DIFFERENT") << "." << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * tiled nearest node raster compared to the kd tree queries of every pixel
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -o tst_nnraster tst_nnraster.cpp ../../tlibs/log/log.cpp -lpthread
+ */
+
+#include <iostream>
+#include <list>
+#include <cmath>
+#include "../taz/nn_raster.h"
+
+using t_real = double;
+using t_vec = ublas::vector<t_real>;
+
+
+int main()
+{
+	const int iMaxPeaks = 5;
+	const unsigned iW = 400, iH = 300;
+
+	for(bool bCentred : {0, 1})
+	{
+		tl::Lattice<t_real> latt(4.1, 5.3, 6.2, tl::d2r(90.), tl::d2r(103.), tl::d2r(90.));
+
+		std::list<std::vector<t_real>> lstNodes;
+		for(int ih=-iMaxPeaks; ih<=iMaxPeaks; ++ih)
+			for(int ik=-iMaxPeaks; ik<=iMaxPeaks; ++ik)
+				for(int il=-iMaxPeaks; il<=iMaxPeaks; ++il)
+				{
+					if(bCentred && (ih+ik+il)%2)
+						continue;
+
+					t_vec vecPos = latt.GetPos(ih, ik, il);
+					lstNodes.push_back(std::vector<t_real>{vecPos[0], vecPos[1], vecPos[2], t_real(ih), t_real(ik), t_real(il)});
+				}
+
+		tl::Kd<t_real> kd;
+		kd.Load(lstNodes, 3);
+
+		NearestNodeRaster<t_real> raster(kd, latt, iMaxPeaks);
+		raster.SetTileSize(50, 16);
+
+		const t_vec vecOrig = tl::make_vec<t_vec>({-12., -10., 1.});
+		const t_vec vecDirX = tl::make_vec<t_vec>({0.06, 0.01, 0.002});
+		const t_vec vecDirY = tl::make_vec<t_vec>({0.005, 0.07, -0.003});
+
+		unsigned iRow = 0;
+		std::size_t iMismatches = 0, iTies = 0;
+		auto check_row = [&](const unsigned char* pRGB) -> bool
+		{
+			for(unsigned iX=0; iX<iW; ++iX)
+			{
+				t_vec vecQ = vecOrig + t_real(iX)*vecDirX + t_real(iRow)*vecDirY;
+				const std::vector<t_real>& vecNearest = kd.GetNearestNode(std::vector<t_real>{vecQ[0], vecQ[1], vecQ[2]});
+				t_real dDist = ublas::norm_2(tl::make_vec<t_vec>({vecNearest[0], vecNearest[1], vecNearest[2]}) - vecQ);
+
+				unsigned char rgb[3];
+				nn_raster_colour<t_real>(vecNearest.data()+3, dDist, iMaxPeaks, rgb);
+				if(rgb[0]==pRGB[iX*3] && rgb[1]==pRGB[iX*3+1] && rgb[2]==pRGB[iX*3+2])
+					continue;
+
+				// equidistant nodes can be chosen differently
+				std::size_t iNumNearest = 0;
+				for(const std::vector<t_real>& vecNode : lstNodes)
+				{
+					t_real dNodeDist = ublas::norm_2(tl::make_vec<t_vec>({vecNode[0], vecNode[1], vecNode[2]}) - vecQ);
+					if(std::abs(dNodeDist - dDist) < 1e-8)
+						++iNumNearest;
+				}
+				if(iNumNearest > 1)
+					++iTies;
+				else
+					++iMismatches;
+			}
+
+			++iRow;
+			return true;
+		};
+
+		bool bOk = raster.Render(iW, iH, vecOrig, vecDirX, vecDirY, check_row, 4);
+
+		std::cout << (bCentred ? "centred" : "primitive") << ": ok = " << bOk
+			<< ", rows = " << iRow << ", mismatches = " << iMismatches << ", ties = " << iTies
+			<< ", kd queries = " << raster.GetNumKdQueries() << " of " << iW*iH << std::endl;
+	}
+
+	return 0;
+}
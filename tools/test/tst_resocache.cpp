@@ -0,0 +1,228 @@
+/**
+ * resolution cache compared to the exact calculation of a smooth model resolution
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../.. -o tst_resocache tst_resocache.cpp ../../tlibs/log/log.cpp -lboost_system -lpthread
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <cstdio>
+#include "../monteconvo/reso_cache.h"
+#include "tst_check.h"
+
+using t_real = t_real_reso;
+
+
+static std::size_t g_iNumCalc = 0;
+
+// model resolution with a kinematic limit at E = 10 - Q
+static ResoResults calc(t_real dQ, t_real dE)
+{
+	++g_iNumCalc;
+
+	ResoResults res;
+	res.bOk = (dE < t_real(10) - dQ);
+
+	res.reso = ublas::zero_matrix<t_real>(4, 4);
+	res.reso(0,0) = 100. + 20.*dQ*dQ + dE;
+	res.reso(1,1) = 300. / (1. + 0.1*dQ);
+	res.reso(2,2) = 500.;
+	res.reso(3,3) = 2. / (1. + 0.05*dE*dE);
+	res.reso(0,3) = res.reso(3,0) = 5.*std::sin(dQ) * std::cos(0.3*dE);
+
+	res.reso_v = ublas::zero_vector<t_real>(4);
+	res.reso_s = 0.;
+
+	res.Q_avg = ublas::zero_vector<t_real>(4);
+	res.Q_avg[0] = dQ;
+	res.Q_avg[3] = dE;
+
+	res.dR0 = std::exp(-0.1*dE) * (1. + dQ);
+	res.dResVol = 1.;
+	for(int i=0; i<4; ++i)
+		res.dBraggFWHMs[i] = 0.;
+	return res;
+}
+
+
+static t_real max_rel_dev(const ResoResults& res0, const ResoResults& res1)
+{
+	t_real dMax = 0., dDev = 0.;
+	for(std::size_t i=0; i<4; ++i)
+		for(std::size_t j=0; j<4; ++j)
+		{
+			dMax = std::max(dMax, std::abs(res1.reso(i,j)));
+			dDev = std::max(dDev, std::abs(res0.reso(i,j) - res1.reso(i,j)));
+		}
+
+	return std::max(dDev / dMax, std::abs(res0.dR0/res1.dR0 - 1.));
+}
+
+
+/**
+ * evaluates the points, returns the number of model calls
+ */
+static std::size_t run_points(ResoCache& cache, std::uint64_t iHash,
+	const std::vector<std::pair<t_real, t_real>>& vecPts, t_real& dMaxDev, std::size_t& iErrs)
+{
+	g_iNumCalc = 0;
+	dMaxDev = 0.;
+	iErrs = 0;
+
+	for(const auto& pt : vecPts)
+	{
+		ResoResults res = cache.Get(iHash, pt.first, pt.second, calc);
+		ResoResults resExact = calc(pt.first, pt.second);
+		--g_iNumCalc;
+
+		if(res.bOk != resExact.bOk)
+			++iErrs;
+		else if(res.bOk)
+			dMaxDev = std::max(dMaxDev, max_rel_dev(res, resExact));
+	}
+
+	return g_iNumCalc;
+}
+
+
+int main()
+{
+	const t_real dTol = 1e-3;
+	const std::string strDir = "/tmp";
+	const t_real dTolCoarse = 1e-2;
+	const std::uint64_t iHash = 0x1234, iHashMerge = 0x5678, iHashCorrupt = 0x9abc;
+
+	// only used for the file names
+	ResoCache cacheFiles, cacheFilesCoarse;
+	cacheFiles.SetTolerance(dTol);
+	cacheFiles.SetDir(strDir);
+	cacheFilesCoarse.SetTolerance(dTolCoarse);
+	cacheFilesCoarse.SetDir(strDir);
+
+	for(std::uint64_t iCurHash : { iHash, iHashMerge, iHashCorrupt })
+		std::remove(cacheFiles.GetFileName(iCurHash).c_str());
+	std::remove(cacheFilesCoarse.GetFileName(iHash).c_str());
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<t_real> distQ(0.5, 5.), distE(-3., 8.);
+	std::vector<std::pair<t_real, t_real>> vecPts;
+	for(int i=0; i<20000; ++i)
+		vecPts.push_back(std::make_pair(distQ(rng), distE(rng)));
+
+	std::size_t iNumCalcLoaded = 0;
+	for(int iRun=0; iRun<2; ++iRun)
+	{
+		ResoCache cache;
+		cache.SetTolerance(dTol);
+		cache.SetDir(strDir);
+
+		t_real dMaxDev = 0.;
+		std::size_t iErrs = 0;
+		const std::size_t iNumCalc = run_points(cache, iHash, vecPts, dMaxDev, iErrs);
+
+		std::cout << "run " << iRun << ": max deviation = " << dMaxDev << " (tolerance " << dTol << ")"
+			<< ", validity errors = " << iErrs
+			<< ", interpolated = " << cache.GetNumInterpolated()
+			<< ", exact = " << cache.GetNumExact()
+			<< ", model calls = " << iNumCalc << " for " << vecPts.size() << " points" << std::endl;
+		check(iErrs == 0, "validity");
+
+		// the second run loads the saved map
+		if(iRun == 0)
+			check(cache.Save(), "save");
+		else
+			iNumCalcLoaded = iNumCalc;
+	}
+
+
+	// a job with another tolerance in the same directory does not overwrite the map
+	{
+		check(cacheFiles.GetFileName(iHash) != cacheFilesCoarse.GetFileName(iHash), "file names differ by tolerance");
+
+		ResoCache cacheCoarse;
+		cacheCoarse.SetTolerance(dTolCoarse);
+		cacheCoarse.SetDir(strDir);
+
+		t_real dMaxDev = 0.;
+		std::size_t iErrs = 0;
+		run_points(cacheCoarse, iHash, vecPts, dMaxDev, iErrs);
+		check(cacheCoarse.Save(), "save coarse cache");
+
+		ResoCache cache;
+		cache.SetTolerance(dTol);
+		cache.SetDir(strDir);
+		const std::size_t iNumCalc = run_points(cache, iHash, vecPts, dMaxDev, iErrs);
+		std::cout << "after coarse job: model calls = " << iNumCalc << ", before: " << iNumCalcLoaded << std::endl;
+		check(iNumCalc == iNumCalcLoaded, "map kept next to coarse map");
+	}
+
+
+	// two caches, e.g. of concurrent jobs, which save different parts of a map
+	{
+		// the caches see different Q ranges
+		std::vector<std::pair<t_real, t_real>> vecPts0, vecPts1;
+		for(const auto& pt : vecPts)
+			(pt.first < 2.75 ? vecPts0 : vecPts1).push_back(pt);
+
+		ResoCache cache0, cache1;
+		for(ResoCache* pCache : { &cache0, &cache1 })
+		{
+			pCache->SetTolerance(dTol);
+			pCache->SetDir(strDir);
+		}
+
+		t_real dMaxDev = 0.;
+		std::size_t iErrs = 0;
+		run_points(cache0, iHashMerge, vecPts0, dMaxDev, iErrs);
+		run_points(cache1, iHashMerge, vecPts1, dMaxDev, iErrs);
+		check(cache0.Save() && cache1.Save(), "save concurrent caches");
+
+		ResoCache cacheMerged;
+		cacheMerged.SetTolerance(dTol);
+		cacheMerged.SetDir(strDir);
+		const std::size_t iNumCalc = run_points(cacheMerged, iHashMerge, vecPts, dMaxDev, iErrs);
+		std::cout << "merged: model calls = " << iNumCalc << ", with the full map: " << iNumCalcLoaded << std::endl;
+		check(iErrs == 0, "merged map validity");
+		check(iNumCalc <= iNumCalcLoaded + iNumCalcLoaded/10, "merged map has both parts");
+	}
+
+
+	// corrupt maps are ignored
+	{
+		const char* pcCorrupt[] =
+		{
+			"grid 0.1 0.5 4 0.001\ncell 0 1 1 7\n",				// invalid cell state
+			"grid 0.1 0.5 4 0.001\ncell 9 1 1 1\n",				// invalid level
+			"grid 0.1 0.5 4 0.001\ncell 0 1 1 1\n",				// interpolated cell without nodes
+			"grid 0.1 0.5 4 0.001\nnode 0 0 1 1 1 0 0 0 0 0 100000000 100000000\n",	// huge matrix
+		};
+
+		for(const char* pcFile : pcCorrupt)
+		{
+			std::ofstream(cacheFiles.GetFileName(iHashCorrupt)) << pcFile;
+
+			ResoCache cache;
+			cache.SetTolerance(dTol);
+			cache.SetDir(strDir);
+
+			ResoResults res = cache.Get(iHashCorrupt, 0.15, 0.75, calc);
+			check(res.bOk && max_rel_dev(res, calc(0.15, 0.75)) == 0., "corrupt map ignored");
+		}
+	}
+
+	std::vector<std::string> vecFiles = { cacheFilesCoarse.GetFileName(iHash) };
+	for(std::uint64_t iCurHash : { iHash, iHashMerge, iHashCorrupt })
+		vecFiles.push_back(cacheFiles.GetFileName(iCurHash));
+	for(const std::string& strFile : vecFiles)
+	{
+		std::remove(strFile.c_str());
+		std::remove((strFile + ".lock").c_str());
+	}
+
+	return check_result();
+}
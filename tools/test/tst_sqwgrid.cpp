@@ -0,0 +1,63 @@
+/**
+ * tabulates a model on a coarse grid and compares the interpolated dispersion
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -o tst_sqwgrid tst_sqwgrid.cpp ../monteconvo/sqw.cpp ../monteconvo/sqw_grid.cpp ../monteconvo/sqwbase.cpp ../../tlibs/log/log.cpp ../../tlibs/string/eval.cpp ../../tlibs/math/rand.cpp -lboost_iostreams -lboost_filesystem -lboost_system -lpthread
+ */
+
+#include <iostream>
+#include "../monteconvo/sqw.h"
+#include "../monteconvo/sqw_grid.h"
+#include "tlibs/math/rand.h"
+
+using t_real = t_real_reso;
+
+
+int main()
+{
+	tl::init_rand();
+
+	SqwMagnon magnon("");
+	magnon.SetVarIfAvail("G", "1 1 0");
+	magnon.SetVarIfAvail("D", "10");
+
+	const t_real dMin[] = { 0.8, 0.8, -0.2 };
+	const t_real dMax[] = { 1.2, 1.2, 0.2 };
+
+	for(t_real dStep : { 0.005, 0.01, 0.02, 0.04 })
+	{
+		const t_real dSteps[] = { dStep, dStep, dStep };
+		if(!save_sqw_grid("tst_sqwgrid.bin", magnon, dMin, dMax, dSteps, 2, 1, 1, 16))
+		{
+			std::cerr << "Cannot create grid." << std::endl;
+			return -1;
+		}
+
+		for(bool bInterp : { false, true })
+		{
+			SqwGrid grid("tst_sqwgrid.bin");
+			grid.SetVarIfAvail("interpolate", bInterp ? "1" : "0");
+
+			t_real dMaxDiff = 0.;
+			for(std::size_t i=0; i<10000; ++i)
+			{
+				t_real h = tl::rand_real<t_real>(dMin[0], dMax[0]);
+				t_real k = tl::rand_real<t_real>(dMin[1], dMax[1]);
+				t_real l = tl::rand_real<t_real>(dMin[2], dMax[2]);
+
+				std::vector<t_real> vecE0, vecW0, vecE1, vecW1;
+				std::tie(vecE0, vecW0) = magnon.disp(h, k, l);
+				std::tie(vecE1, vecW1) = grid.disp(h, k, l);
+
+				for(std::size_t iBranch=0; iBranch<std::min(vecE0.size(), vecE1.size()); ++iBranch)
+					dMaxDiff = std::max(dMaxDiff, std::abs(vecE0[iBranch] - vecE1[iBranch]));
+			}
+
+			std::cout << "step " << dStep << ", " << (bInterp ? "interpolated" : "nearest node")
+				<< ": max. energy deviation " << dMaxDiff << " meV." << std::endl;
+		}
+	}
+
+	return 0;
+}
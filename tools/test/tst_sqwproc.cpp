@@ -0,0 +1,74 @@
+/**
+ * benchmark of the S(q,w) process transport: per-point messages vs. shared ring buffer
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -I../monteconvo -o tst_sqwproc tst_sqwproc.cpp ../monteconvo/sqw.cpp ../monteconvo/sqwbase.cpp ../../tlibs/log/log.cpp ../../tlibs/string/eval.cpp ../../tlibs/math/rand.cpp -lboost_filesystem -lboost_system -lpthread -lrt
+ */
+
+#include <iostream>
+#include <vector>
+#include "../monteconvo/sqw.h"
+#include "../monteconvo/sqw_proc.h"
+#include "../monteconvo/sqw_proc_impl.h"
+#include "tlibs/time/stopwatch.h"
+#include "tlibs/math/rand.h"
+
+using t_real = t_real_reso;
+
+
+int main(int argc, char** argv)
+{
+	tl::init_rand();
+
+	std::size_t iNumChildren = 1;
+	if(argc > 1)
+		iNumChildren = tl::str_to_var<std::size_t>(std::string(argv[1]));
+
+	SqwProc<SqwMagnon> sqw("", iNumChildren);
+	if(!sqw.IsOk())
+	{
+		std::cerr << "Cannot create S(q,w) processes." << std::endl;
+		return -1;
+	}
+	sqw.SetVarIfAvail("G", "1 1 0");
+	sqw.SetVarIfAvail("D", "10");
+
+	for(std::size_t iNum : { std::size_t(1000), std::size_t(10000), std::size_t(100000) })
+	{
+		std::vector<t_real> vecH(iNum), vecK(iNum), vecL(iNum), vecE(iNum);
+		std::vector<t_real> vecSMsg(iNum), vecSRing(iNum);
+		for(std::size_t i=0; i<iNum; ++i)
+		{
+			vecH[i] = tl::rand_real<t_real>(0.9, 1.1);
+			vecK[i] = tl::rand_real<t_real>(0.9, 1.1);
+			vecL[i] = tl::rand_real<t_real>(-0.1, 0.1);
+			vecE[i] = tl::rand_real<t_real>(-2., 2.);
+		}
+
+		// one message pair per point
+		tl::Stopwatch<t_real> watchMsg;
+		watchMsg.start();
+		for(std::size_t i=0; i<iNum; ++i)
+			vecSMsg[i] = sqw(vecH[i], vecK[i], vecL[i], vecE[i]);
+		watchMsg.stop();
+
+		// one message per batch, chunks in the ring buffer
+		tl::Stopwatch<t_real> watchRing;
+		watchRing.start();
+		sqw.sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecSRing.data(), iNum);
+		watchRing.stop();
+
+		t_real dMaxDiff = 0.;
+		for(std::size_t i=0; i<iNum; ++i)
+			dMaxDiff = std::max(dMaxDiff, std::abs(vecSMsg[i] - vecSRing[i]));
+
+		std::cout << iNum << " points: "
+			<< t_real(iNum)/watchMsg.GetDur() << " points/s (message queue), "
+			<< t_real(iNum)/watchRing.GetDur() << " points/s (ring buffer), "
+			<< "max. difference: " << dMaxDiff << "." << std::endl;
+	}
+
+	sqw.LogChildStats();
+	return 0;
+}
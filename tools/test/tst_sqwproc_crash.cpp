@@ -0,0 +1,128 @@
+/**
+ * S(q,w) process pool: a child crashing in the middle of a batch must not block the parent
+ * @author Tobias Weber <tobias.weber@tum.de>
+ * @license GPLv2
+ *
+ * g++ -std=c++11 -O2 -I../../ -I../.. -I../monteconvo -o tst_sqwproc_crash tst_sqwproc_crash.cpp ../monteconvo/sqw.cpp ../monteconvo/sqwbase.cpp ../../tlibs/log/log.cpp ../../tlibs/string/eval.cpp ../../tlibs/math/rand.cpp -lboost_filesystem -lboost_system -lpthread -lrt
+ */
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <signal.h>
+#include <unistd.h>
+#include "../monteconvo/sqw.h"
+#include "../monteconvo/sqw_proc.h"
+#include "../monteconvo/sqw_proc_impl.h"
+#include "tst_check.h"
+
+using t_real = t_real_reso;
+
+
+// energy at which the model kills its own process
+#define CRASH_E -123.
+
+
+/**
+ * S = h + offs, crashes at E = CRASH_E
+ */
+class SqwCrash : public SqwBase
+{
+protected:
+	t_real m_dOffs = 0.;
+
+public:
+	SqwCrash(const char*) { m_bOk = 1; }
+
+	virtual t_real operator()(t_real dh, t_real dk, t_real dl, t_real dE) const override
+	{
+		if(dE == t_real(CRASH_E))
+			kill(getpid(), SIGKILL);
+		return dh + m_dOffs;
+	}
+
+	virtual std::vector<SqwBase::t_var> GetVars() const override
+	{
+		return std::vector<SqwBase::t_var>{
+			SqwBase::t_var{"offs", "real", tl::var_to_str(m_dOffs)} };
+	}
+
+	virtual void SetVars(const std::vector<SqwBase::t_var>& vecVars) override
+	{
+		for(const SqwBase::t_var& var : vecVars)
+			if(std::get<0>(var) == "offs")
+				m_dOffs = tl::str_to_var<t_real>(std::get<2>(var));
+	}
+
+	virtual SqwBase* shallow_copy() const override { return new SqwCrash(*this); }
+};
+
+
+// checks S = h + dOffs in [iStart, iEnd)
+static bool check_range(const std::vector<t_real>& vecH, const std::vector<t_real>& vecS,
+	std::size_t iStart, std::size_t iEnd, t_real dOffs)
+{
+	for(std::size_t i=iStart; i<iEnd; ++i)
+		if(std::abs(vecS[i] - (vecH[i] + dOffs)) > 1e-9)
+			return false;
+	return true;
+}
+
+
+int main()
+{
+	// a hang is a failure
+	alarm(120);
+
+	const std::size_t iNumChildren = 3;
+	SqwProc<SqwCrash> sqw("", iNumChildren);
+	check(sqw.IsOk(), "pool started");
+
+	// one shard of two chunks per child
+	const std::size_t iNum = iNumChildren * 2 * SQW_BATCH_SIZE;
+	std::vector<t_real> vecH(iNum), vecK(iNum, 0.), vecL(iNum, 0.), vecE(iNum, 0.), vecS(iNum, -1.);
+	for(std::size_t i=0; i<iNum; ++i)
+		vecH[i] = t_real(i);
+
+	sqw.sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecS.data(), iNum);
+	check(check_range(vecH, vecS, 0, iNum, 0.), "batch before crash");
+
+	// crash the child of the middle shard in its second chunk
+	const std::size_t iShardLen = 2*SQW_BATCH_SIZE;
+	const std::size_t iCrash = iShardLen + SQW_BATCH_SIZE;
+	vecE[iCrash] = CRASH_E;
+	sqw.sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecS.data(), iNum);
+	vecE[iCrash] = 0.;
+
+	check(check_range(vecH, vecS, 0, iCrash, 0.), "shards before crashed chunk");
+	check(check_range(vecH, vecS, 2*iShardLen, iNum, 0.), "shard after crashed one");
+	check(std::all_of(vecS.begin()+iCrash, vecS.begin()+2*iShardLen,
+		[](t_real d) -> bool { return d == 0.; }), "crashed chunk is zeroed");
+	check(sqw.GetNumAliveChildren() == iNumChildren-1, "crashed child removed from pool");
+
+	// the remaining children keep working
+	sqw.SetVars(std::vector<SqwBase::t_var>{ SqwBase::t_var{"offs", "real", "1"} });
+	check(sqw.IsOk(), "IsOk after crash");
+	check(sqw.GetVars().size() == 1, "GetVars after crash");
+	check(std::abs(sqw(5., 0., 0., 0.) - 6.) < 1e-9, "single point after crash");
+
+	sqw.sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecS.data(), iNum);
+	check(check_range(vecH, vecS, 0, iNum, 1.), "batch after crash");
+
+	// crash all remaining children, every call has to return
+	for(std::size_t iChild=0; iChild<iNumChildren-1; ++iChild)
+		check(sqw(1., 0., 0., CRASH_E) == 0., "single point crash");
+	check(sqw.GetNumAliveChildren() == 0, "all children removed from pool");
+
+	sqw.SetVars(std::vector<SqwBase::t_var>{ SqwBase::t_var{"offs", "real", "2"} });
+	check(!sqw.IsOk(), "IsOk without children");
+	check(sqw.GetVars().size() == 0, "GetVars without children");
+	check(std::get<0>(sqw.disp(1., 0., 0.)).size() == 0, "disp without children");
+
+	sqw.sqw_batch(vecH.data(), vecK.data(), vecL.data(), vecE.data(), vecS.data(), iNum);
+	check(std::all_of(vecS.begin(), vecS.end(),
+		[](t_real d) -> bool { return d == 0.; }), "batch without children");
+
+	return check_result();
+}